@@ -0,0 +1,44 @@
+# CMAKE generated file: DO NOT EDIT!
+# Generated by CMake Version 3.25
+cmake_policy(SET CMP0009 NEW)
+
+# iqdb_SRC at src/CMakeLists.txt:3 (file)
+file(GLOB NEW_GLOB LIST_DIRECTORIES true "/root/repo/src/*.cpp")
+set(OLD_GLOB
+  "/root/repo/src/bucket_arena.cpp"
+  "/root/repo/src/change_log.cpp"
+  "/root/repo/src/coordinator.cpp"
+  "/root/repo/src/cursor_cache.cpp"
+  "/root/repo/src/debug.cpp"
+  "/root/repo/src/duplicates.cpp"
+  "/root/repo/src/exact_index.cpp"
+  "/root/repo/src/follower.cpp"
+  "/root/repo/src/haar.cpp"
+  "/root/repo/src/haar_signature.cpp"
+  "/root/repo/src/http_server.cpp"
+  "/root/repo/src/imgdb.cpp"
+  "/root/repo/src/iqdb.cpp"
+  "/root/repo/src/kernels.cpp"
+  "/root/repo/src/knn_graph.cpp"
+  "/root/repo/src/lsh_index.cpp"
+  "/root/repo/src/metrics.cpp"
+  "/root/repo/src/query_batcher.cpp"
+  "/root/repo/src/query_cache.cpp"
+  "/root/repo/src/reorder.cpp"
+  "/root/repo/src/server.cpp"
+  "/root/repo/src/sqlite_db.cpp"
+  "/root/repo/src/thread_pool.cpp"
+  )
+if(NOT "${NEW_GLOB}" STREQUAL "${OLD_GLOB}")
+  message("-- GLOB mismatch!")
+  file(TOUCH_NOCREATE "/root/repo/_gate_debug/CMakeFiles/cmake.verify_globs")
+endif()
+
+# iqdb_SRC at src/CMakeLists.txt:3 (file)
+file(GLOB NEW_GLOB LIST_DIRECTORIES true "/root/repo/src/*.h")
+set(OLD_GLOB
+  )
+if(NOT "${NEW_GLOB}" STREQUAL "${OLD_GLOB}")
+  message("-- GLOB mismatch!")
+  file(TOUCH_NOCREATE "/root/repo/_gate_debug/CMakeFiles/cmake.verify_globs")
+endif()
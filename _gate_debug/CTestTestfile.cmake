@@ -0,0 +1,13 @@
+# CMake generated Testfile for 
+# Source directory: /root/repo
+# Build directory: /root/repo/_gate_debug
+# 
+# This file includes the relevant testing commands required for 
+# testing this directory and lists subdirectories to be tested as well.
+subdirs("_deps/httplib-build")
+subdirs("_deps/json-build")
+subdirs("_deps/catch2-build")
+subdirs("_deps/fmt-build")
+subdirs("src")
+subdirs("bench")
+subdirs("test")
@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/Catch2WithMain.dir/main.cpp.o"
+  "CMakeFiles/Catch2WithMain.dir/main.cpp.o.d"
+  "libCatch2WithMain.a"
+  "libCatch2WithMain.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang CXX)
+  include(CMakeFiles/Catch2WithMain.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/iqdb-bench.dir/iqdb-bench.cpp.o"
+  "CMakeFiles/iqdb-bench.dir/iqdb-bench.cpp.o.d"
+  "iqdb-bench"
+  "iqdb-bench.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang CXX)
+  include(CMakeFiles/iqdb-bench.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/iqdb-loadgen.dir/iqdb-loadgen.cpp.o"
+  "CMakeFiles/iqdb-loadgen.dir/iqdb-loadgen.cpp.o.d"
+  "iqdb-loadgen"
+  "iqdb-loadgen.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang CXX)
+  include(CMakeFiles/iqdb-loadgen.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/iqdb-microbench.dir/iqdb-microbench.cpp.o"
+  "CMakeFiles/iqdb-microbench.dir/iqdb-microbench.cpp.o.d"
+  "iqdb-microbench"
+  "iqdb-microbench.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang CXX)
+  include(CMakeFiles/iqdb-microbench.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
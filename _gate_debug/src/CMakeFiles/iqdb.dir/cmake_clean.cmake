@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/iqdb.dir/iqdb.cpp.o"
+  "CMakeFiles/iqdb.dir/iqdb.cpp.o.d"
+  "iqdb"
+  "iqdb.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang CXX)
+  include(CMakeFiles/iqdb.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
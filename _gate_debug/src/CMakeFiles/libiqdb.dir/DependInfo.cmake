@@ -0,0 +1,40 @@
+
+# Consider dependencies only in project.
+set(CMAKE_DEPENDS_IN_PROJECT_ONLY OFF)
+
+# The set of languages for which implicit dependencies are needed:
+set(CMAKE_DEPENDS_LANGUAGES
+  )
+
+# The set of dependency files which are needed:
+set(CMAKE_DEPENDS_DEPENDENCY_FILES
+  "/root/repo/src/bucket_arena.cpp" "src/CMakeFiles/libiqdb.dir/bucket_arena.cpp.o" "gcc" "src/CMakeFiles/libiqdb.dir/bucket_arena.cpp.o.d"
+  "/root/repo/src/change_log.cpp" "src/CMakeFiles/libiqdb.dir/change_log.cpp.o" "gcc" "src/CMakeFiles/libiqdb.dir/change_log.cpp.o.d"
+  "/root/repo/src/coordinator.cpp" "src/CMakeFiles/libiqdb.dir/coordinator.cpp.o" "gcc" "src/CMakeFiles/libiqdb.dir/coordinator.cpp.o.d"
+  "/root/repo/src/cursor_cache.cpp" "src/CMakeFiles/libiqdb.dir/cursor_cache.cpp.o" "gcc" "src/CMakeFiles/libiqdb.dir/cursor_cache.cpp.o.d"
+  "/root/repo/src/debug.cpp" "src/CMakeFiles/libiqdb.dir/debug.cpp.o" "gcc" "src/CMakeFiles/libiqdb.dir/debug.cpp.o.d"
+  "/root/repo/src/duplicates.cpp" "src/CMakeFiles/libiqdb.dir/duplicates.cpp.o" "gcc" "src/CMakeFiles/libiqdb.dir/duplicates.cpp.o.d"
+  "/root/repo/src/exact_index.cpp" "src/CMakeFiles/libiqdb.dir/exact_index.cpp.o" "gcc" "src/CMakeFiles/libiqdb.dir/exact_index.cpp.o.d"
+  "/root/repo/src/follower.cpp" "src/CMakeFiles/libiqdb.dir/follower.cpp.o" "gcc" "src/CMakeFiles/libiqdb.dir/follower.cpp.o.d"
+  "/root/repo/src/haar.cpp" "src/CMakeFiles/libiqdb.dir/haar.cpp.o" "gcc" "src/CMakeFiles/libiqdb.dir/haar.cpp.o.d"
+  "/root/repo/src/haar_signature.cpp" "src/CMakeFiles/libiqdb.dir/haar_signature.cpp.o" "gcc" "src/CMakeFiles/libiqdb.dir/haar_signature.cpp.o.d"
+  "/root/repo/src/http_server.cpp" "src/CMakeFiles/libiqdb.dir/http_server.cpp.o" "gcc" "src/CMakeFiles/libiqdb.dir/http_server.cpp.o.d"
+  "/root/repo/src/imgdb.cpp" "src/CMakeFiles/libiqdb.dir/imgdb.cpp.o" "gcc" "src/CMakeFiles/libiqdb.dir/imgdb.cpp.o.d"
+  "/root/repo/src/kernels.cpp" "src/CMakeFiles/libiqdb.dir/kernels.cpp.o" "gcc" "src/CMakeFiles/libiqdb.dir/kernels.cpp.o.d"
+  "/root/repo/src/knn_graph.cpp" "src/CMakeFiles/libiqdb.dir/knn_graph.cpp.o" "gcc" "src/CMakeFiles/libiqdb.dir/knn_graph.cpp.o.d"
+  "/root/repo/src/lsh_index.cpp" "src/CMakeFiles/libiqdb.dir/lsh_index.cpp.o" "gcc" "src/CMakeFiles/libiqdb.dir/lsh_index.cpp.o.d"
+  "/root/repo/src/metrics.cpp" "src/CMakeFiles/libiqdb.dir/metrics.cpp.o" "gcc" "src/CMakeFiles/libiqdb.dir/metrics.cpp.o.d"
+  "/root/repo/src/query_batcher.cpp" "src/CMakeFiles/libiqdb.dir/query_batcher.cpp.o" "gcc" "src/CMakeFiles/libiqdb.dir/query_batcher.cpp.o.d"
+  "/root/repo/src/query_cache.cpp" "src/CMakeFiles/libiqdb.dir/query_cache.cpp.o" "gcc" "src/CMakeFiles/libiqdb.dir/query_cache.cpp.o.d"
+  "/root/repo/src/reorder.cpp" "src/CMakeFiles/libiqdb.dir/reorder.cpp.o" "gcc" "src/CMakeFiles/libiqdb.dir/reorder.cpp.o.d"
+  "/root/repo/src/server.cpp" "src/CMakeFiles/libiqdb.dir/server.cpp.o" "gcc" "src/CMakeFiles/libiqdb.dir/server.cpp.o.d"
+  "/root/repo/src/sqlite_db.cpp" "src/CMakeFiles/libiqdb.dir/sqlite_db.cpp.o" "gcc" "src/CMakeFiles/libiqdb.dir/sqlite_db.cpp.o.d"
+  "/root/repo/src/thread_pool.cpp" "src/CMakeFiles/libiqdb.dir/thread_pool.cpp.o" "gcc" "src/CMakeFiles/libiqdb.dir/thread_pool.cpp.o.d"
+  )
+
+# Targets to which this target links.
+set(CMAKE_TARGET_LINKED_INFO_FILES
+  )
+
+# Fortran module output directory.
+set(CMAKE_Fortran_TARGET_MODULE_DIR "")
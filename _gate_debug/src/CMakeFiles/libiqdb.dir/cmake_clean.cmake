@@ -0,0 +1,53 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/libiqdb.dir/bucket_arena.cpp.o"
+  "CMakeFiles/libiqdb.dir/bucket_arena.cpp.o.d"
+  "CMakeFiles/libiqdb.dir/change_log.cpp.o"
+  "CMakeFiles/libiqdb.dir/change_log.cpp.o.d"
+  "CMakeFiles/libiqdb.dir/coordinator.cpp.o"
+  "CMakeFiles/libiqdb.dir/coordinator.cpp.o.d"
+  "CMakeFiles/libiqdb.dir/cursor_cache.cpp.o"
+  "CMakeFiles/libiqdb.dir/cursor_cache.cpp.o.d"
+  "CMakeFiles/libiqdb.dir/debug.cpp.o"
+  "CMakeFiles/libiqdb.dir/debug.cpp.o.d"
+  "CMakeFiles/libiqdb.dir/duplicates.cpp.o"
+  "CMakeFiles/libiqdb.dir/duplicates.cpp.o.d"
+  "CMakeFiles/libiqdb.dir/exact_index.cpp.o"
+  "CMakeFiles/libiqdb.dir/exact_index.cpp.o.d"
+  "CMakeFiles/libiqdb.dir/follower.cpp.o"
+  "CMakeFiles/libiqdb.dir/follower.cpp.o.d"
+  "CMakeFiles/libiqdb.dir/haar.cpp.o"
+  "CMakeFiles/libiqdb.dir/haar.cpp.o.d"
+  "CMakeFiles/libiqdb.dir/haar_signature.cpp.o"
+  "CMakeFiles/libiqdb.dir/haar_signature.cpp.o.d"
+  "CMakeFiles/libiqdb.dir/http_server.cpp.o"
+  "CMakeFiles/libiqdb.dir/http_server.cpp.o.d"
+  "CMakeFiles/libiqdb.dir/imgdb.cpp.o"
+  "CMakeFiles/libiqdb.dir/imgdb.cpp.o.d"
+  "CMakeFiles/libiqdb.dir/kernels.cpp.o"
+  "CMakeFiles/libiqdb.dir/kernels.cpp.o.d"
+  "CMakeFiles/libiqdb.dir/knn_graph.cpp.o"
+  "CMakeFiles/libiqdb.dir/knn_graph.cpp.o.d"
+  "CMakeFiles/libiqdb.dir/lsh_index.cpp.o"
+  "CMakeFiles/libiqdb.dir/lsh_index.cpp.o.d"
+  "CMakeFiles/libiqdb.dir/metrics.cpp.o"
+  "CMakeFiles/libiqdb.dir/metrics.cpp.o.d"
+  "CMakeFiles/libiqdb.dir/query_batcher.cpp.o"
+  "CMakeFiles/libiqdb.dir/query_batcher.cpp.o.d"
+  "CMakeFiles/libiqdb.dir/query_cache.cpp.o"
+  "CMakeFiles/libiqdb.dir/query_cache.cpp.o.d"
+  "CMakeFiles/libiqdb.dir/reorder.cpp.o"
+  "CMakeFiles/libiqdb.dir/reorder.cpp.o.d"
+  "CMakeFiles/libiqdb.dir/server.cpp.o"
+  "CMakeFiles/libiqdb.dir/server.cpp.o.d"
+  "CMakeFiles/libiqdb.dir/sqlite_db.cpp.o"
+  "CMakeFiles/libiqdb.dir/sqlite_db.cpp.o.d"
+  "CMakeFiles/libiqdb.dir/thread_pool.cpp.o"
+  "CMakeFiles/libiqdb.dir/thread_pool.cpp.o.d"
+  "libiqdb.a"
+  "libiqdb.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang CXX)
+  include(CMakeFiles/libiqdb.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
@@ -0,0 +1,47 @@
+
+# Consider dependencies only in project.
+set(CMAKE_DEPENDS_IN_PROJECT_ONLY OFF)
+
+# The set of languages for which implicit dependencies are needed:
+set(CMAKE_DEPENDS_LANGUAGES
+  )
+
+# The set of dependency files which are needed:
+set(CMAKE_DEPENDS_DEPENDENCY_FILES
+  "/root/repo/test/test-bucket-arena.cpp" "test/CMakeFiles/iqdb-test.dir/test-bucket-arena.cpp.o" "gcc" "test/CMakeFiles/iqdb-test.dir/test-bucket-arena.cpp.o.d"
+  "/root/repo/test/test-change-log.cpp" "test/CMakeFiles/iqdb-test.dir/test-change-log.cpp.o" "gcc" "test/CMakeFiles/iqdb-test.dir/test-change-log.cpp.o.d"
+  "/root/repo/test/test-channels.cpp" "test/CMakeFiles/iqdb-test.dir/test-channels.cpp.o" "gcc" "test/CMakeFiles/iqdb-test.dir/test-channels.cpp.o.d"
+  "/root/repo/test/test-collections.cpp" "test/CMakeFiles/iqdb-test.dir/test-collections.cpp.o" "gcc" "test/CMakeFiles/iqdb-test.dir/test-collections.cpp.o.d"
+  "/root/repo/test/test-coordinator.cpp" "test/CMakeFiles/iqdb-test.dir/test-coordinator.cpp.o" "gcc" "test/CMakeFiles/iqdb-test.dir/test-coordinator.cpp.o.d"
+  "/root/repo/test/test-cursor-cache.cpp" "test/CMakeFiles/iqdb-test.dir/test-cursor-cache.cpp.o" "gcc" "test/CMakeFiles/iqdb-test.dir/test-cursor-cache.cpp.o.d"
+  "/root/repo/test/test-duplicates.cpp" "test/CMakeFiles/iqdb-test.dir/test-duplicates.cpp.o" "gcc" "test/CMakeFiles/iqdb-test.dir/test-duplicates.cpp.o.d"
+  "/root/repo/test/test-exact-index.cpp" "test/CMakeFiles/iqdb-test.dir/test-exact-index.cpp.o" "gcc" "test/CMakeFiles/iqdb-test.dir/test-exact-index.cpp.o.d"
+  "/root/repo/test/test-follower.cpp" "test/CMakeFiles/iqdb-test.dir/test-follower.cpp.o" "gcc" "test/CMakeFiles/iqdb-test.dir/test-follower.cpp.o.d"
+  "/root/repo/test/test-haar.cpp" "test/CMakeFiles/iqdb-test.dir/test-haar.cpp.o" "gcc" "test/CMakeFiles/iqdb-test.dir/test-haar.cpp.o.d"
+  "/root/repo/test/test-http-server.cpp" "test/CMakeFiles/iqdb-test.dir/test-http-server.cpp.o" "gcc" "test/CMakeFiles/iqdb-test.dir/test-http-server.cpp.o.d"
+  "/root/repo/test/test-kernels.cpp" "test/CMakeFiles/iqdb-test.dir/test-kernels.cpp.o" "gcc" "test/CMakeFiles/iqdb-test.dir/test-kernels.cpp.o.d"
+  "/root/repo/test/test-knn-graph.cpp" "test/CMakeFiles/iqdb-test.dir/test-knn-graph.cpp.o" "gcc" "test/CMakeFiles/iqdb-test.dir/test-knn-graph.cpp.o.d"
+  "/root/repo/test/test-logging.cpp" "test/CMakeFiles/iqdb-test.dir/test-logging.cpp.o" "gcc" "test/CMakeFiles/iqdb-test.dir/test-logging.cpp.o.d"
+  "/root/repo/test/test-lsh-index.cpp" "test/CMakeFiles/iqdb-test.dir/test-lsh-index.cpp.o" "gcc" "test/CMakeFiles/iqdb-test.dir/test-lsh-index.cpp.o.d"
+  "/root/repo/test/test-metrics.cpp" "test/CMakeFiles/iqdb-test.dir/test-metrics.cpp.o" "gcc" "test/CMakeFiles/iqdb-test.dir/test-metrics.cpp.o.d"
+  "/root/repo/test/test-profile.cpp" "test/CMakeFiles/iqdb-test.dir/test-profile.cpp.o" "gcc" "test/CMakeFiles/iqdb-test.dir/test-profile.cpp.o.d"
+  "/root/repo/test/test-query-batch.cpp" "test/CMakeFiles/iqdb-test.dir/test-query-batch.cpp.o" "gcc" "test/CMakeFiles/iqdb-test.dir/test-query-batch.cpp.o.d"
+  "/root/repo/test/test-query-batcher.cpp" "test/CMakeFiles/iqdb-test.dir/test-query-batcher.cpp.o" "gcc" "test/CMakeFiles/iqdb-test.dir/test-query-batcher.cpp.o.d"
+  "/root/repo/test/test-query-cache.cpp" "test/CMakeFiles/iqdb-test.dir/test-query-cache.cpp.o" "gcc" "test/CMakeFiles/iqdb-test.dir/test-query-cache.cpp.o.d"
+  "/root/repo/test/test-query-threshold.cpp" "test/CMakeFiles/iqdb-test.dir/test-query-threshold.cpp.o" "gcc" "test/CMakeFiles/iqdb-test.dir/test-query-threshold.cpp.o.d"
+  "/root/repo/test/test-reorder.cpp" "test/CMakeFiles/iqdb-test.dir/test-reorder.cpp.o" "gcc" "test/CMakeFiles/iqdb-test.dir/test-reorder.cpp.o.d"
+  "/root/repo/test/test-report.cpp" "test/CMakeFiles/iqdb-test.dir/test-report.cpp.o" "gcc" "test/CMakeFiles/iqdb-test.dir/test-report.cpp.o.d"
+  "/root/repo/test/test-similar.cpp" "test/CMakeFiles/iqdb-test.dir/test-similar.cpp.o" "gcc" "test/CMakeFiles/iqdb-test.dir/test-similar.cpp.o.d"
+  "/root/repo/test/test-sqlite-db.cpp" "test/CMakeFiles/iqdb-test.dir/test-sqlite-db.cpp.o" "gcc" "test/CMakeFiles/iqdb-test.dir/test-sqlite-db.cpp.o.d"
+  "/root/repo/test/test-synthetic.cpp" "test/CMakeFiles/iqdb-test.dir/test-synthetic.cpp.o" "gcc" "test/CMakeFiles/iqdb-test.dir/test-synthetic.cpp.o.d"
+  "/root/repo/test/test-thread-pool.cpp" "test/CMakeFiles/iqdb-test.dir/test-thread-pool.cpp.o" "gcc" "test/CMakeFiles/iqdb-test.dir/test-thread-pool.cpp.o.d"
+  )
+
+# Targets to which this target links.
+set(CMAKE_TARGET_LINKED_INFO_FILES
+  "/root/repo/_gate_debug/src/CMakeFiles/libiqdb.dir/DependInfo.cmake"
+  "/root/repo/_gate_debug/_deps/catch2-build/CMakeFiles/Catch2WithMain.dir/DependInfo.cmake"
+  )
+
+# Fortran module output directory.
+set(CMAKE_Fortran_TARGET_MODULE_DIR "")
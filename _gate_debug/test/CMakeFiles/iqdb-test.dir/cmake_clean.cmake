@@ -0,0 +1,64 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/iqdb-test.dir/test-bucket-arena.cpp.o"
+  "CMakeFiles/iqdb-test.dir/test-bucket-arena.cpp.o.d"
+  "CMakeFiles/iqdb-test.dir/test-change-log.cpp.o"
+  "CMakeFiles/iqdb-test.dir/test-change-log.cpp.o.d"
+  "CMakeFiles/iqdb-test.dir/test-channels.cpp.o"
+  "CMakeFiles/iqdb-test.dir/test-channels.cpp.o.d"
+  "CMakeFiles/iqdb-test.dir/test-collections.cpp.o"
+  "CMakeFiles/iqdb-test.dir/test-collections.cpp.o.d"
+  "CMakeFiles/iqdb-test.dir/test-coordinator.cpp.o"
+  "CMakeFiles/iqdb-test.dir/test-coordinator.cpp.o.d"
+  "CMakeFiles/iqdb-test.dir/test-cursor-cache.cpp.o"
+  "CMakeFiles/iqdb-test.dir/test-cursor-cache.cpp.o.d"
+  "CMakeFiles/iqdb-test.dir/test-duplicates.cpp.o"
+  "CMakeFiles/iqdb-test.dir/test-duplicates.cpp.o.d"
+  "CMakeFiles/iqdb-test.dir/test-exact-index.cpp.o"
+  "CMakeFiles/iqdb-test.dir/test-exact-index.cpp.o.d"
+  "CMakeFiles/iqdb-test.dir/test-follower.cpp.o"
+  "CMakeFiles/iqdb-test.dir/test-follower.cpp.o.d"
+  "CMakeFiles/iqdb-test.dir/test-haar.cpp.o"
+  "CMakeFiles/iqdb-test.dir/test-haar.cpp.o.d"
+  "CMakeFiles/iqdb-test.dir/test-http-server.cpp.o"
+  "CMakeFiles/iqdb-test.dir/test-http-server.cpp.o.d"
+  "CMakeFiles/iqdb-test.dir/test-kernels.cpp.o"
+  "CMakeFiles/iqdb-test.dir/test-kernels.cpp.o.d"
+  "CMakeFiles/iqdb-test.dir/test-knn-graph.cpp.o"
+  "CMakeFiles/iqdb-test.dir/test-knn-graph.cpp.o.d"
+  "CMakeFiles/iqdb-test.dir/test-logging.cpp.o"
+  "CMakeFiles/iqdb-test.dir/test-logging.cpp.o.d"
+  "CMakeFiles/iqdb-test.dir/test-lsh-index.cpp.o"
+  "CMakeFiles/iqdb-test.dir/test-lsh-index.cpp.o.d"
+  "CMakeFiles/iqdb-test.dir/test-metrics.cpp.o"
+  "CMakeFiles/iqdb-test.dir/test-metrics.cpp.o.d"
+  "CMakeFiles/iqdb-test.dir/test-profile.cpp.o"
+  "CMakeFiles/iqdb-test.dir/test-profile.cpp.o.d"
+  "CMakeFiles/iqdb-test.dir/test-query-batch.cpp.o"
+  "CMakeFiles/iqdb-test.dir/test-query-batch.cpp.o.d"
+  "CMakeFiles/iqdb-test.dir/test-query-batcher.cpp.o"
+  "CMakeFiles/iqdb-test.dir/test-query-batcher.cpp.o.d"
+  "CMakeFiles/iqdb-test.dir/test-query-cache.cpp.o"
+  "CMakeFiles/iqdb-test.dir/test-query-cache.cpp.o.d"
+  "CMakeFiles/iqdb-test.dir/test-query-threshold.cpp.o"
+  "CMakeFiles/iqdb-test.dir/test-query-threshold.cpp.o.d"
+  "CMakeFiles/iqdb-test.dir/test-reorder.cpp.o"
+  "CMakeFiles/iqdb-test.dir/test-reorder.cpp.o.d"
+  "CMakeFiles/iqdb-test.dir/test-report.cpp.o"
+  "CMakeFiles/iqdb-test.dir/test-report.cpp.o.d"
+  "CMakeFiles/iqdb-test.dir/test-similar.cpp.o"
+  "CMakeFiles/iqdb-test.dir/test-similar.cpp.o.d"
+  "CMakeFiles/iqdb-test.dir/test-sqlite-db.cpp.o"
+  "CMakeFiles/iqdb-test.dir/test-sqlite-db.cpp.o.d"
+  "CMakeFiles/iqdb-test.dir/test-synthetic.cpp.o"
+  "CMakeFiles/iqdb-test.dir/test-synthetic.cpp.o.d"
+  "CMakeFiles/iqdb-test.dir/test-thread-pool.cpp.o"
+  "CMakeFiles/iqdb-test.dir/test-thread-pool.cpp.o.d"
+  "iqdb-test"
+  "iqdb-test.pdb"
+  "iqdb-test_tests-b12d07c.cmake"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang CXX)
+  include(CMakeFiles/iqdb-test.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
@@ -0,0 +1,5 @@
+if(EXISTS "/root/repo/_gate_debug/test/iqdb-test_tests-b12d07c.cmake")
+  include("/root/repo/_gate_debug/test/iqdb-test_tests-b12d07c.cmake")
+else()
+  add_test(iqdb-test_NOT_BUILT-b12d07c iqdb-test_NOT_BUILT-b12d07c)
+endif()
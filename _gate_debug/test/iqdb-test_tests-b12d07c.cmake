@@ -0,0 +1,181 @@
+add_test( [==[Size classes round capacities up by at most 25%]==] /root/repo/_gate_debug/test/iqdb-test [==[Size classes round capacities up by at most 25%]==]  )
+set_tests_properties( [==[Size classes round capacities up by at most 25%]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Buckets keep their ids sorted as they change]==] /root/repo/_gate_debug/test/iqdb-test [==[Buckets keep their ids sorted as they change]==]  )
+set_tests_properties( [==[Buckets keep their ids sorted as they change]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Buckets can grow into large blocks of their own]==] /root/repo/_gate_debug/test/iqdb-test [==[Buckets can grow into large blocks of their own]==]  )
+set_tests_properties( [==[Buckets can grow into large blocks of their own]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Compacting the arena keeps every id and frees the gaps]==] /root/repo/_gate_debug/test/iqdb-test [==[Compacting the arena keeps every id and frees the gaps]==]  )
+set_tests_properties( [==[Compacting the arena keeps every id and frees the gaps]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[The change log returns the changes after a sequence number]==] /root/repo/_gate_debug/test/iqdb-test [==[The change log returns the changes after a sequence number]==]  )
+set_tests_properties( [==[The change log returns the changes after a sequence number]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[The change log tells a reader that has fallen behind or is ahead]==] /root/repo/_gate_debug/test/iqdb-test [==[The change log tells a reader that has fallen behind or is ahead]==]  )
+set_tests_properties( [==[The change log tells a reader that has fallen behind or is ahead]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Waiting readers are woken by the next change]==] /root/repo/_gate_debug/test/iqdb-test [==[Waiting readers are woken by the next change]==]  )
+set_tests_properties( [==[Waiting readers are woken by the next change]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Waiting readers are woken at their deadline or by wakeAll]==] /root/repo/_gate_debug/test/iqdb-test [==[Waiting readers are woken at their deadline or by wakeAll]==]  )
+set_tests_properties( [==[Waiting readers are woken at their deadline or by wakeAll]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Coefficient weights come from the weight table by bin]==] /root/repo/_gate_debug/test/iqdb-test [==[Coefficient weights come from the weight table by bin]==]  )
+set_tests_properties( [==[Coefficient weights come from the weight table by bin]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Grayscale images are only in their Y buckets]==] /root/repo/_gate_debug/test/iqdb-test [==[Grayscale images are only in their Y buckets]==]  )
+set_tests_properties( [==[Grayscale images are only in their Y buckets]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Grayscale and color queries score images like the formula]==] /root/repo/_gate_debug/test/iqdb-test [==[Grayscale and color queries score images like the formula]==]  )
+set_tests_properties( [==[Grayscale and color queries score images like the formula]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Filters match post id ranges and lists]==] /root/repo/_gate_debug/test/iqdb-test [==[Filters match post id ranges and lists]==]  )
+set_tests_properties( [==[Filters match post id ranges and lists]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Filtered queries return the matches that pass the filter]==] /root/repo/_gate_debug/test/iqdb-test [==[Filtered queries return the matches that pass the filter]==]  )
+set_tests_properties( [==[Filtered queries return the matches that pass the filter]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Collections in the same file are kept apart]==] /root/repo/_gate_debug/test/iqdb-test [==[Collections in the same file are kept apart]==]  )
+set_tests_properties( [==[Collections in the same file are kept apart]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Collections have routes of their own]==] /root/repo/_gate_debug/test/iqdb-test [==[Collections have routes of their own]==]  )
+set_tests_properties( [==[Collections have routes of their own]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[The coordinator returns the best of every shard's matches]==] /root/repo/_gate_debug/test/iqdb-test [==[The coordinator returns the best of every shard's matches]==]  )
+set_tests_properties( [==[The coordinator returns the best of every shard's matches]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[The coordinator finds duplicates on other shards]==] /root/repo/_gate_debug/test/iqdb-test [==[The coordinator finds duplicates on other shards]==]  )
+set_tests_properties( [==[The coordinator finds duplicates on other shards]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Cursors return pages of their results]==] /root/repo/_gate_debug/test/iqdb-test [==[Cursors return pages of their results]==]  )
+set_tests_properties( [==[Cursors return pages of their results]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Cursors are dropped when they expire or don't fit]==] /root/repo/_gate_debug/test/iqdb-test [==[Cursors are dropped when they expire or don't fit]==]  )
+set_tests_properties( [==[Cursors are dropped when they expire or don't fit]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Queries with a cursor can be paged through]==] /root/repo/_gate_debug/test/iqdb-test [==[Queries with a cursor can be paged through]==]  )
+set_tests_properties( [==[Queries with a cursor can be paged through]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Cursors can be turned off, and aren't supported by the coordinator]==] /root/repo/_gate_debug/test/iqdb-test [==[Cursors can be turned off\, and aren't supported by the coordinator]==]  )
+set_tests_properties( [==[Cursors can be turned off, and aren't supported by the coordinator]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Duplicate pairs match a query with every image]==] /root/repo/_gate_debug/test/iqdb-test [==[Duplicate pairs match a query with every image]==]  )
+set_tests_properties( [==[Duplicate pairs match a query with every image]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Duplicate options are parsed from flags]==] /root/repo/_gate_debug/test/iqdb-test [==[Duplicate options are parsed from flags]==]  )
+set_tests_properties( [==[Duplicate options are parsed from flags]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Duplicates are written out as clusters]==] /root/repo/_gate_debug/test/iqdb-test [==[Duplicates are written out as clusters]==]  )
+set_tests_properties( [==[Duplicates are written out as clusters]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Signatures are the same image if only their luminance's last bits differ]==] /root/repo/_gate_debug/test/iqdb-test [==[Signatures are the same image if only their luminance's last bits differ]==]  )
+set_tests_properties( [==[Signatures are the same image if only their luminance's last bits differ]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[The exact index finds every post with a signature]==] /root/repo/_gate_debug/test/iqdb-test [==[The exact index finds every post with a signature]==]  )
+set_tests_properties( [==[The exact index finds every post with a signature]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[IQDB finds exact duplicates and keeps them up to date]==] /root/repo/_gate_debug/test/iqdb-test [==[IQDB finds exact duplicates and keeps them up to date]==]  )
+set_tests_properties( [==[IQDB finds exact duplicates and keeps them up to date]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Uploads with dedupe are refused if the image is already there]==] /root/repo/_gate_debug/test/iqdb-test [==[Uploads with dedupe are refused if the image is already there]==]  )
+set_tests_properties( [==[Uploads with dedupe are refused if the image is already there]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[A follower loads a snapshot, then replays the leader's changes]==] /root/repo/_gate_debug/test/iqdb-test [==[A follower loads a snapshot\, then replays the leader's changes]==]  )
+set_tests_properties( [==[A follower loads a snapshot, then replays the leader's changes]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Gray pixels have no chrominance]==] /root/repo/_gate_debug/test/iqdb-test [==[Gray pixels have no chrominance]==]  )
+set_tests_properties( [==[Gray pixels have no chrominance]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[The Haar transform of a flat image is only its DC coefficient]==] /root/repo/_gate_debug/test/iqdb-test [==[The Haar transform of a flat image is only its DC coefficient]==]  )
+set_tests_properties( [==[The Haar transform of a flat image is only its DC coefficient]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[get_m_largests finds the largest coefficients and their signs]==] /root/repo/_gate_debug/test/iqdb-test [==[get_m_largests finds the largest coefficients and their signs]==]  )
+set_tests_properties( [==[get_m_largests finds the largest coefficients and their signs]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[The stages add up to from_channels]==] /root/repo/_gate_debug/test/iqdb-test [==[The stages add up to from_channels]==]  )
+set_tests_properties( [==[The stages add up to from_channels]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Signatures round-trip through their hash]==] /root/repo/_gate_debug/test/iqdb-test [==[Signatures round-trip through their hash]==]  )
+set_tests_properties( [==[Signatures round-trip through their hash]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Keep-alive connections are reused until the client asks to close]==] /root/repo/_gate_debug/test/iqdb-test [==[Keep-alive connections are reused until the client asks to close]==]  )
+set_tests_properties( [==[Keep-alive connections are reused until the client asks to close]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Pipelined requests are answered in order]==] /root/repo/_gate_debug/test/iqdb-test [==[Pipelined requests are answered in order]==]  )
+set_tests_properties( [==[Pipelined requests are answered in order]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[A client that expects 100 Continue gets it before sending the body]==] /root/repo/_gate_debug/test/iqdb-test [==[A client that expects 100 Continue gets it before sending the body]==]  )
+set_tests_properties( [==[A client that expects 100 Continue gets it before sending the body]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Chunked request bodies are refused with a 501]==] /root/repo/_gate_debug/test/iqdb-test [==[Chunked request bodies are refused with a 501]==]  )
+set_tests_properties( [==[Chunked request bodies are refused with a 501]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[A half-closed connection is answered before it's closed]==] /root/repo/_gate_debug/test/iqdb-test [==[A half-closed connection is answered before it's closed]==]  )
+set_tests_properties( [==[A half-closed connection is answered before it's closed]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Idle connections are closed after the keep-alive timeout]==] /root/repo/_gate_debug/test/iqdb-test [==[Idle connections are closed after the keep-alive timeout]==]  )
+set_tests_properties( [==[Idle connections are closed after the keep-alive timeout]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Clients that stop sending their request are closed after the read timeout]==] /root/repo/_gate_debug/test/iqdb-test [==[Clients that stop sending their request are closed after the read timeout]==]  )
+set_tests_properties( [==[Clients that stop sending their request are closed after the read timeout]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Unix socket clients are reported as such]==] /root/repo/_gate_debug/test/iqdb-test [==[Unix socket clients are reported as such]==]  )
+set_tests_properties( [==[Unix socket clients are reported as such]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Streamed responses don't hold the thread while the client is behind]==] /root/repo/_gate_debug/test/iqdb-test [==[Streamed responses don't hold the thread while the client is behind]==]  )
+set_tests_properties( [==[Streamed responses don't hold the thread while the client is behind]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Every ISA scores images exactly like the scalar kernels]==] /root/repo/_gate_debug/test/iqdb-test [==[Every ISA scores images exactly like the scalar kernels]==]  )
+set_tests_properties( [==[Every ISA scores images exactly like the scalar kernels]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Every ISA finds the same scores as the scalar kernels]==] /root/repo/_gate_debug/test/iqdb-test [==[Every ISA finds the same scores as the scalar kernels]==]  )
+set_tests_properties( [==[Every ISA finds the same scores as the scalar kernels]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Every ISA transforms channels exactly like the scalar kernels]==] /root/repo/_gate_debug/test/iqdb-test [==[Every ISA transforms channels exactly like the scalar kernels]==]  )
+set_tests_properties( [==[Every ISA transforms channels exactly like the scalar kernels]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Neighbour lists keep the best k entries]==] /root/repo/_gate_debug/test/iqdb-test [==[Neighbour lists keep the best k entries]==]  )
+set_tests_properties( [==[Neighbour lists keep the best k entries]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Saved graphs are only loaded for the same k and database]==] /root/repo/_gate_debug/test/iqdb-test [==[Saved graphs are only loaded for the same k and database]==]  )
+set_tests_properties( [==[Saved graphs are only loaded for the same k and database]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Similar posts from the graph match a full scan]==] /root/repo/_gate_debug/test/iqdb-test [==[Similar posts from the graph match a full scan]==]  )
+set_tests_properties( [==[Similar posts from the graph match a full scan]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[The graph is saved with the database and dropped when it changes]==] /root/repo/_gate_debug/test/iqdb-test [==[The graph is saved with the database and dropped when it changes]==]  )
+set_tests_properties( [==[The graph is saved with the database and dropped when it changes]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[LSH tables find near-duplicates]==] /root/repo/_gate_debug/test/iqdb-test [==[LSH tables find near-duplicates]==]  )
+set_tests_properties( [==[LSH tables find near-duplicates]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Approximate queries score candidates like an exact query]==] /root/repo/_gate_debug/test/iqdb-test [==[Approximate queries score candidates like an exact query]==]  )
+set_tests_properties( [==[Approximate queries score candidates like an exact query]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Queries can ask for probes over HTTP]==] /root/repo/_gate_debug/test/iqdb-test [==[Queries can ask for probes over HTTP]==]  )
+set_tests_properties( [==[Queries can ask for probes over HTTP]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Messages below the log level aren't formatted]==] /root/repo/_gate_debug/test/iqdb-test [==[Messages below the log level aren't formatted]==]  )
+set_tests_properties( [==[Messages below the log level aren't formatted]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[The log writer writes every message in order]==] /root/repo/_gate_debug/test/iqdb-test [==[The log writer writes every message in order]==]  )
+set_tests_properties( [==[The log writer writes every message in order]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Histograms count samples in cumulative buckets]==] /root/repo/_gate_debug/test/iqdb-test [==[Histograms count samples in cumulative buckets]==]  )
+set_tests_properties( [==[Histograms count samples in cumulative buckets]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Samples and headers are rendered with their labels]==] /root/repo/_gate_debug/test/iqdb-test [==[Samples and headers are rendered with their labels]==]  )
+set_tests_properties( [==[Samples and headers are rendered with their labels]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[The server's metrics count its queries and images]==] /root/repo/_gate_debug/test/iqdb-test [==[The server's metrics count its queries and images]==]  )
+set_tests_properties( [==[The server's metrics count its queries and images]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[A profile lists every bucket a query visits]==] /root/repo/_gate_debug/test/iqdb-test [==[A profile lists every bucket a query visits]==]  )
+set_tests_properties( [==[A profile lists every bucket a query visits]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[POST /query returns the profile next to the matches]==] /root/repo/_gate_debug/test/iqdb-test [==[POST /query returns the profile next to the matches]==]  )
+set_tests_properties( [==[POST /query returns the profile next to the matches]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Batched queries return the same results as single queries]==] /root/repo/_gate_debug/test/iqdb-test [==[Batched queries return the same results as single queries]==]  )
+set_tests_properties( [==[Batched queries return the same results as single queries]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Batched queries use and fill the query cache]==] /root/repo/_gate_debug/test/iqdb-test [==[Batched queries use and fill the query cache]==]  )
+set_tests_properties( [==[Batched queries use and fill the query cache]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Queries that arrive within the window run as one batch]==] /root/repo/_gate_debug/test/iqdb-test [==[Queries that arrive within the window run as one batch]==]  )
+set_tests_properties( [==[Queries that arrive within the window run as one batch]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[A full batch runs without waiting for the window]==] /root/repo/_gate_debug/test/iqdb-test [==[A full batch runs without waiting for the window]==]  )
+set_tests_properties( [==[A full batch runs without waiting for the window]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Shutting down runs the queued queries]==] /root/repo/_gate_debug/test/iqdb-test [==[Shutting down runs the queued queries]==]  )
+set_tests_properties( [==[Shutting down runs the queued queries]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Queries submitted after shutdown fail instead of waiting forever]==] /root/repo/_gate_debug/test/iqdb-test [==[Queries submitted after shutdown fail instead of waiting forever]==]  )
+set_tests_properties( [==[Queries submitted after shutdown fail instead of waiting forever]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Cached queries match uncached queries after adds and removes]==] /root/repo/_gate_debug/test/iqdb-test [==[Cached queries match uncached queries after adds and removes]==]  )
+set_tests_properties( [==[Cached queries match uncached queries after adds and removes]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[A removed post isn't returned from the cache]==] /root/repo/_gate_debug/test/iqdb-test [==[A removed post isn't returned from the cache]==]  )
+set_tests_properties( [==[A removed post isn't returned from the cache]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[An added or replaced post shows up in cached results]==] /root/repo/_gate_debug/test/iqdb-test [==[An added or replaced post shows up in cached results]==]  )
+set_tests_properties( [==[An added or replaced post shows up in cached results]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Threshold queries return every image a full scan scores above the threshold]==] /root/repo/_gate_debug/test/iqdb-test [==[Threshold queries return every image a full scan scores above the threshold]==]  )
+set_tests_properties( [==[Threshold queries return every image a full scan scores above the threshold]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Threshold queries apply the filter]==] /root/repo/_gate_debug/test/iqdb-test [==[Threshold queries apply the filter]==]  )
+set_tests_properties( [==[Threshold queries apply the filter]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Reordering closes the gaps without changing query results]==] /root/repo/_gate_debug/test/iqdb-test [==[Reordering closes the gaps without changing query results]==]  )
+set_tests_properties( [==[Reordering closes the gaps without changing query results]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Percentiles are taken from the sorted samples]==] /root/repo/_gate_debug/test/iqdb-test [==[Percentiles are taken from the sorted samples]==]  )
+set_tests_properties( [==[Percentiles are taken from the sorted samples]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Percentiles of a few samples stay in range]==] /root/repo/_gate_debug/test/iqdb-test [==[Percentiles of a few samples stay in range]==]  )
+set_tests_properties( [==[Percentiles of a few samples stay in range]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Similar posts are the post's matches, without the post]==] /root/repo/_gate_debug/test/iqdb-test [==[Similar posts are the post's matches\, without the post]==]  )
+set_tests_properties( [==[Similar posts are the post's matches, without the post]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Similar posts can be asked for one post or many]==] /root/repo/_gate_debug/test/iqdb-test [==[Similar posts can be asked for one post or many]==]  )
+set_tests_properties( [==[Similar posts can be asked for one post or many]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Replacing an image keeps its id]==] /root/repo/_gate_debug/test/iqdb-test [==[Replacing an image keeps its id]==]  )
+set_tests_properties( [==[Replacing an image keeps its id]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Renumbering gives every image its new id]==] /root/repo/_gate_debug/test/iqdb-test [==[Renumbering gives every image its new id]==]  )
+set_tests_properties( [==[Renumbering gives every image its new id]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Renumbering changes nothing if an image isn't given an id]==] /root/repo/_gate_debug/test/iqdb-test [==[Renumbering changes nothing if an image isn't given an id]==]  )
+set_tests_properties( [==[Renumbering changes nothing if an image isn't given an id]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[A replaced image is swapped out of the index]==] /root/repo/_gate_debug/test/iqdb-test [==[A replaced image is swapped out of the index]==]  )
+set_tests_properties( [==[A replaced image is swapped out of the index]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Synthetic images depend only on the seed and their number]==] /root/repo/_gate_debug/test/iqdb-test [==[Synthetic images depend only on the seed and their number]==]  )
+set_tests_properties( [==[Synthetic images depend only on the seed and their number]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Synthetic images are valid and look like real ones]==] /root/repo/_gate_debug/test/iqdb-test [==[Synthetic images are valid and look like real ones]==]  )
+set_tests_properties( [==[Synthetic images are valid and look like real ones]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Synthetic corpora have near-duplicates to find]==] /root/repo/_gate_debug/test/iqdb-test [==[Synthetic corpora have near-duplicates to find]==]  )
+set_tests_properties( [==[Synthetic corpora have near-duplicates to find]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Corpora fitted to a sample use the sample's coefficients]==] /root/repo/_gate_debug/test/iqdb-test [==[Corpora fitted to a sample use the sample's coefficients]==]  )
+set_tests_properties( [==[Corpora fitted to a sample use the sample's coefficients]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[A worker pool runs every queued task before it shuts down]==] /root/repo/_gate_debug/test/iqdb-test [==[A worker pool runs every queued task before it shuts down]==]  )
+set_tests_properties( [==[A worker pool runs every queued task before it shuts down]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[A worker pool rejects tasks when its queue is full]==] /root/repo/_gate_debug/test/iqdb-test [==[A worker pool rejects tasks when its queue is full]==]  )
+set_tests_properties( [==[A worker pool rejects tasks when its queue is full]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[CPU lists are parsed into CPU numbers]==] /root/repo/_gate_debug/test/iqdb-test [==[CPU lists are parsed into CPU numbers]==]  )
+set_tests_properties( [==[CPU lists are parsed into CPU numbers]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[Queries past their deadline are abandoned]==] /root/repo/_gate_debug/test/iqdb-test [==[Queries past their deadline are abandoned]==]  )
+set_tests_properties( [==[Queries past their deadline are abandoned]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[The server turns queries away when the query queue is full]==] /root/repo/_gate_debug/test/iqdb-test [==[The server turns queries away when the query queue is full]==]  )
+set_tests_properties( [==[The server turns queries away when the query queue is full]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+add_test( [==[The server limits how many matches a query returns]==] /root/repo/_gate_debug/test/iqdb-test [==[The server limits how many matches a query returns]==]  )
+set_tests_properties( [==[The server limits how many matches a query returns]==] PROPERTIES WORKING_DIRECTORY /root/repo/_gate_debug/test)
+set( iqdb-test_TESTS [==[Size classes round capacities up by at most 25%]==] [==[Buckets keep their ids sorted as they change]==] [==[Buckets can grow into large blocks of their own]==] [==[Compacting the arena keeps every id and frees the gaps]==] [==[The change log returns the changes after a sequence number]==] [==[The change log tells a reader that has fallen behind or is ahead]==] [==[Waiting readers are woken by the next change]==] [==[Waiting readers are woken at their deadline or by wakeAll]==] [==[Coefficient weights come from the weight table by bin]==] [==[Grayscale images are only in their Y buckets]==] [==[Grayscale and color queries score images like the formula]==] [==[Filters match post id ranges and lists]==] [==[Filtered queries return the matches that pass the filter]==] [==[Collections in the same file are kept apart]==] [==[Collections have routes of their own]==] [==[The coordinator returns the best of every shard's matches]==] [==[The coordinator finds duplicates on other shards]==] [==[Cursors return pages of their results]==] [==[Cursors are dropped when they expire or don't fit]==] [==[Queries with a cursor can be paged through]==] [==[Cursors can be turned off, and aren't supported by the coordinator]==] [==[Duplicate pairs match a query with every image]==] [==[Duplicate options are parsed from flags]==] [==[Duplicates are written out as clusters]==] [==[Signatures are the same image if only their luminance's last bits differ]==] [==[The exact index finds every post with a signature]==] [==[IQDB finds exact duplicates and keeps them up to date]==] [==[Uploads with dedupe are refused if the image is already there]==] [==[A follower loads a snapshot, then replays the leader's changes]==] [==[Gray pixels have no chrominance]==] [==[The Haar transform of a flat image is only its DC coefficient]==] [==[get_m_largests finds the largest coefficients and their signs]==] [==[The stages add up to from_channels]==] [==[Signatures round-trip through their hash]==] [==[Keep-alive connections are reused until the client asks to close]==] [==[Pipelined requests are answered in order]==] [==[A client that expects 100 Continue gets it before sending the body]==] [==[Chunked request bodies are refused with a 501]==] [==[A half-closed connection is answered before it's closed]==] [==[Idle connections are closed after the keep-alive timeout]==] [==[Clients that stop sending their request are closed after the read timeout]==] [==[Unix socket clients are reported as such]==] [==[Streamed responses don't hold the thread while the client is behind]==] [==[Every ISA scores images exactly like the scalar kernels]==] [==[Every ISA finds the same scores as the scalar kernels]==] [==[Every ISA transforms channels exactly like the scalar kernels]==] [==[Neighbour lists keep the best k entries]==] [==[Saved graphs are only loaded for the same k and database]==] [==[Similar posts from the graph match a full scan]==] [==[The graph is saved with the database and dropped when it changes]==] [==[LSH tables find near-duplicates]==] [==[Approximate queries score candidates like an exact query]==] [==[Queries can ask for probes over HTTP]==] [==[Messages below the log level aren't formatted]==] [==[The log writer writes every message in order]==] [==[Histograms count samples in cumulative buckets]==] [==[Samples and headers are rendered with their labels]==] [==[The server's metrics count its queries and images]==] [==[A profile lists every bucket a query visits]==] [==[POST /query returns the profile next to the matches]==] [==[Batched queries return the same results as single queries]==] [==[Batched queries use and fill the query cache]==] [==[Queries that arrive within the window run as one batch]==] [==[A full batch runs without waiting for the window]==] [==[Shutting down runs the queued queries]==] [==[Queries submitted after shutdown fail instead of waiting forever]==] [==[Cached queries match uncached queries after adds and removes]==] [==[A removed post isn't returned from the cache]==] [==[An added or replaced post shows up in cached results]==] [==[Threshold queries return every image a full scan scores above the threshold]==] [==[Threshold queries apply the filter]==] [==[Reordering closes the gaps without changing query results]==] [==[Percentiles are taken from the sorted samples]==] [==[Percentiles of a few samples stay in range]==] [==[Similar posts are the post's matches, without the post]==] [==[Similar posts can be asked for one post or many]==] [==[Replacing an image keeps its id]==] [==[Renumbering gives every image its new id]==] [==[Renumbering changes nothing if an image isn't given an id]==] [==[A replaced image is swapped out of the index]==] [==[Synthetic images depend only on the seed and their number]==] [==[Synthetic images are valid and look like real ones]==] [==[Synthetic corpora have near-duplicates to find]==] [==[Corpora fitted to a sample use the sample's coefficients]==] [==[A worker pool runs every queued task before it shuts down]==] [==[A worker pool rejects tasks when its queue is full]==] [==[CPU lists are parsed into CPU numbers]==] [==[Queries past their deadline are abandoned]==] [==[The server turns queries away when the query queue is full]==] [==[The server limits how many matches a query returns]==])
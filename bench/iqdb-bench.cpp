@@ -0,0 +1,366 @@
+/*
+ * iqdb-bench - scale benchmark for the in-memory index.
+ *
+ * Builds an IQDB from a synthetic corpus of signatures, then measures load
+ * time, memory per image, single-query latency, concurrent query throughput,
+ * and add/remove throughput. Then it builds the approximate (LSH) index and
+ * measures recall@limit against the exact results for each number of probes.
+ * Results are printed to stdout as JSON.
+ *
+ * Usage: iqdb-bench [--images=N] [--queries=N] [--limit=N] [--threads=N]
+ *                   [--duration=SECONDS] [--writes=N] [--seed=N]
+ *                   [--duplicates=RATE] [--sample=DBFILE]
+ *                   [--lsh-tables=N] [--probes=LIST]
+ */
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include <iqdb/debug.h>
+#include <iqdb/imgdb.h>
+#include <iqdb/lsh_index.h>
+#include <iqdb/metrics.h>
+#include <iqdb/sqlite_db.h>
+
+#include "report.h"
+#include "synthetic.h"
+
+using namespace iqdb;
+using namespace iqdb::bench;
+using nlohmann::json;
+
+struct BenchOptions {
+  size_t images = 100000;
+  size_t queries = 1000;
+  size_t limit = 10;
+  size_t threads = std::max(1u, std::thread::hardware_concurrency());
+  double duration = 5;
+  size_t writes = 1000;
+  uint64_t seed = 1;
+  double duplicates = 0.05;
+  std::string sample;
+  size_t lsh_tables = 16;
+  std::vector<size_t> probes = { 1, 2, 4, 8, 16 };
+};
+
+// Parse a comma-separated list of numbers.
+static std::vector<size_t> parse_list(const std::string& value) {
+  std::vector<size_t> list;
+  size_t start = 0;
+
+  while (start < value.size()) {
+    const size_t end = std::min(value.find(',', start), value.size());
+    list.push_back(std::stoul(value.substr(start, end - start)));
+    start = end + 1;
+  }
+
+  return list;
+}
+
+static BenchOptions parse_options(int argc, char** argv) {
+  BenchOptions options;
+
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    const auto eq = arg.find('=');
+    const std::string name = arg.substr(0, eq);
+    const std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+
+    if (name == "--images") options.images = std::stoul(value);
+    else if (name == "--queries") options.queries = std::stoul(value);
+    else if (name == "--limit") options.limit = std::stoul(value);
+    else if (name == "--threads") options.threads = std::stoul(value);
+    else if (name == "--duration") options.duration = std::stod(value);
+    else if (name == "--writes") options.writes = std::stoul(value);
+    else if (name == "--seed") options.seed = std::stoull(value);
+    else if (name == "--duplicates") options.duplicates = std::stod(value);
+    else if (name == "--sample") options.sample = value;
+    else if (name == "--lsh-tables") options.lsh_tables = std::stoul(value);
+    else if (name == "--probes") options.probes = parse_list(value);
+    else throw param_error("Unknown option (option=" + arg + ")");
+  }
+
+  return options;
+}
+
+// Generate signatures [first, last) of the corpus in parallel.
+static std::vector<HaarSignature> generate(const SyntheticCorpus& corpus, size_t first, size_t last, size_t threads) {
+  std::vector<HaarSignature> signatures(last - first);
+  std::vector<std::thread> workers;
+
+  for (size_t t = 0; t < threads; t++) {
+    workers.emplace_back([&, t] {
+      for (size_t i = t; i < signatures.size(); i += threads) {
+        signatures[i] = corpus.image(first + i);
+      }
+    });
+  }
+
+  for (auto& worker : workers) {
+    worker.join();
+  }
+
+  return signatures;
+}
+
+// Run `func` with logging turned down, so that per-image log messages from
+// addImage and removeImage don't dominate the timings.
+template <typename F>
+static void quiet(F func) {
+  const int level = debug_level;
+  debug_level = std::max(level, 3);
+  func();
+  debug_level = level;
+}
+
+// Counts data TLB misses of this thread with perf_event_open. Unavailable if
+// the kernel doesn't allow it (see /proc/sys/kernel/perf_event_paranoid) or
+// the CPU doesn't count TLB misses.
+class TlbMissCounter {
+public:
+  TlbMissCounter() {
+    perf_event_attr attr = {};
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    fd_ = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+  }
+
+  ~TlbMissCounter() {
+    if (fd_ >= 0) close(fd_);
+  }
+
+  bool available() const { return fd_ >= 0; }
+  void start() { if (fd_ >= 0) ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0); }
+  void stop() { if (fd_ >= 0) ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0); }
+
+  uint64_t count() const {
+    uint64_t value = 0;
+    return fd_ >= 0 && read(fd_, &value, sizeof(value)) == sizeof(value) ? value : 0;
+  }
+
+private:
+  int fd_;
+};
+
+static std::vector<HaarSignature> load_sample(const std::string& filename, size_t max) {
+  std::vector<HaarSignature> sample;
+  SqliteDB db(filename);
+
+  db.eachImage([&](const Image& image) {
+    if (sample.size() < max) {
+      sample.push_back(image.haar());
+    }
+  });
+
+  INFO("Loaded {} sample signatures from {}.\n", sample.size(), filename);
+  return sample;
+}
+
+int main(int argc, char** argv) {
+  start_log_writer();
+
+  try {
+    const BenchOptions options = parse_options(argc, argv);
+    json result = {
+      { "images", options.images },
+      { "seed", options.seed },
+      { "threads", options.threads },
+      { "limit", options.limit },
+    };
+
+    const SyntheticCorpus corpus = options.sample.empty()
+      ? SyntheticCorpus(options.seed, options.duplicates)
+      : SyntheticCorpus(options.seed, load_sample(options.sample, 100000), options.duplicates);
+
+    // Build the index in batches, so that the whole corpus is never in memory
+    // at once. Generation time is excluded from the load time.
+    IQDB db;
+    const size_t rss_before = resident_memory();
+    const size_t batch_size = 1000000;
+    double load_seconds = 0;
+
+    for (size_t first = 0; first < options.images; first += batch_size) {
+      const size_t last = std::min(options.images, first + batch_size);
+      const auto batch = generate(corpus, first, last, options.threads);
+
+      const auto start = Clock::now();
+      quiet([&] {
+        for (size_t i = 0; i < batch.size(); i++) {
+          db.addImage(static_cast<postId>(first + i + 1), batch[i]);
+        }
+      });
+      load_seconds += seconds_since(start);
+
+      INFO("Loaded {}/{} images...\n", last, options.images);
+    }
+
+    const auto compact_start = Clock::now();
+    db.compactMemory();
+    load_seconds += seconds_since(compact_start);
+
+    const MemoryUsage memory = db.memoryUsage();
+    const double images = static_cast<double>(std::max<size_t>(options.images, 1));
+    result["load"] = {
+      { "seconds", load_seconds },
+      { "images_per_second", images / load_seconds },
+    };
+    result["bytes_per_image"] = {
+      { "buckets", static_cast<double>(memory.buckets) / images },
+      { "m_info", static_cast<double>(memory.m_info) / images },
+      { "rss", static_cast<double>(resident_memory() - rss_before) / images },
+    };
+    result["bucket_arena"] = {
+      { "mapped", memory.bucket_arena.mapped },
+      { "committed", memory.bucket_arena.committed },
+      { "allocated", memory.bucket_arena.allocated },
+      { "free", memory.bucket_arena.free },
+      { "used", memory.bucket_arena.used },
+      { "hugetlb", memory.bucket_arena.hugetlb },
+      { "anon_huge_pages", anon_huge_pages() },
+      { "fragmentation", memory.bucket_arena.fragmentation() },
+    };
+
+    // Queries are near-duplicates of images in the corpus, like real lookups.
+    SplitMix64 rng(options.seed + 1);
+    std::vector<HaarSignature> queries;
+    for (size_t i = 0; i < options.queries; i++) {
+      queries.push_back(corpus.variant(corpus.image(rng.below(options.images)), rng, static_cast<int>(rng.below(4))));
+    }
+
+    // Single-query latency. The results are kept to measure the recall of
+    // approximate queries against.
+    std::vector<double> latencies;
+    std::vector<sim_vector> exact_results;
+    TlbMissCounter tlb_misses;
+    tlb_misses.start();
+    for (const auto& query : queries) {
+      const auto start = Clock::now();
+      exact_results.push_back(db.queryFromSignature(query, options.limit));
+      latencies.push_back(seconds_since(start) * 1000);
+    }
+    tlb_misses.stop();
+    result["query_latency_ms"] = percentiles(latencies);
+    result["dtlb_misses_per_query"] = tlb_misses.available() && !queries.empty()
+      ? json(static_cast<double>(tlb_misses.count()) / static_cast<double>(queries.size()))
+      : json(nullptr);
+
+    // Concurrent throughput: every thread queries as fast as it can.
+    std::atomic<size_t> completed = 0;
+    std::atomic<bool> stop = false;
+    std::vector<std::thread> workers;
+    const auto start = Clock::now();
+
+    for (size_t t = 0; t < options.threads; t++) {
+      workers.emplace_back([&, t] {
+        for (size_t i = t; !stop; i++) {
+          db.queryFromSignature(queries[i % queries.size()], options.limit);
+          completed++;
+        }
+      });
+    }
+
+    std::this_thread::sleep_for(std::chrono::duration<double>(options.duration));
+    stop = true;
+    for (auto& worker : workers) {
+      worker.join();
+    }
+
+    result["concurrent"] = {
+      { "threads", options.threads },
+      { "qps", static_cast<double>(completed) / seconds_since(start) },
+    };
+
+    // Write throughput: add new images, then remove them again.
+    const auto writes = generate(corpus, options.images, options.images + options.writes, options.threads);
+
+    auto write_start = Clock::now();
+    quiet([&] {
+      for (size_t i = 0; i < writes.size(); i++) {
+        db.addImage(static_cast<postId>(options.images + i + 1), writes[i]);
+      }
+    });
+    const double add_seconds = seconds_since(write_start);
+
+    write_start = Clock::now();
+    quiet([&] {
+      for (size_t i = 0; i < writes.size(); i++) {
+        db.removeImage(static_cast<postId>(options.images + i + 1));
+      }
+    });
+    const double remove_seconds = seconds_since(write_start);
+
+    result["writes"] = {
+      { "count", writes.size() },
+      { "adds_per_second", static_cast<double>(writes.size()) / add_seconds },
+      { "removes_per_second", static_cast<double>(writes.size()) / remove_seconds },
+    };
+
+    // Approximate queries: recall@limit against the exact results, and latency,
+    // for each number of probes.
+    if (options.lsh_tables > 0) {
+      const auto build_start = Clock::now();
+      quiet([&] { db.enableLshIndex(options.lsh_tables); });
+      const double build_seconds = seconds_since(build_start);
+
+      json probes = json::array();
+      for (size_t count : options.probes) {
+        QueryOptions query_options;
+        query_options.probes = count;
+
+        std::vector<double> approx_latencies;
+        size_t found = 0, expected = 0, candidates = 0, found_best = 0;
+
+        for (size_t i = 0; i < queries.size(); i++) {
+          const auto query_start = Clock::now();
+          const sim_vector results = db.queryFromSignature(queries[i], options.limit, query_options);
+          approx_latencies.push_back(seconds_since(query_start) * 1000);
+
+          candidates += db.lshIndex()->candidates(queries[i], count).size();
+          found_best += !exact_results[i].empty() && !results.empty() && results[0].id == exact_results[i][0].id;
+          for (const auto& match : exact_results[i]) {
+            expected++;
+            found += std::any_of(results.begin(), results.end(), [&](const auto& other) { return other.id == match.id; });
+          }
+        }
+
+        probes += {
+          { "probes", count },
+          { "recall", expected ? static_cast<double>(found) / static_cast<double>(expected) : 1.0 },
+          { "recall_at_1", static_cast<double>(found_best) / static_cast<double>(std::max<size_t>(queries.size(), 1)) },
+          { "candidates_per_query", static_cast<double>(candidates) / static_cast<double>(std::max<size_t>(queries.size(), 1)) },
+          { "latency_ms", percentiles(approx_latencies) },
+        };
+      }
+
+      result["approximate"] = {
+        { "tables", options.lsh_tables },
+        { "build_seconds", build_seconds },
+        { "bytes_per_image", static_cast<double>(db.memoryUsage().lsh_index) / images },
+        { "probes", probes },
+      };
+    }
+
+    printf("%s\n", result.dump(2).c_str());
+  } catch (const std::exception& e) {
+    ERROR("Error: {}\n", e.what());
+    return 1;
+  }
+
+  return 0;
+}
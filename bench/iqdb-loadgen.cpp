@@ -0,0 +1,348 @@
+/*
+ * iqdb-loadgen - open-loop HTTP load generator for `iqdb http`.
+ *
+ * Sends a mix of `POST /query`, `POST /images/:id`, `DELETE /images/:id` and
+ * `GET /status` requests to a running server at a fixed rate, or replays the
+ * requests in an access log written by the server (`[info] addr "METHOD path
+ * version" status size` lines). Results are printed to stdout as JSON.
+ *
+ * The load is open-loop: request `i` is due at `start + i / rate` no matter
+ * how long earlier requests took, and its latency is measured from when it was
+ * due rather than from when it was actually sent. A slow server therefore
+ * shows up as high latency instead of as a lower request rate (coordinated
+ * omission). If every connection is busy when a request is due, the time it
+ * spends waiting for one counts against it too.
+ *
+ * Queries use synthetic signature hashes. Added images are made from the raw
+ * 128x128 RGB dumps in --corpus (see iqdb-microbench), with noise added so
+ * that each add has a different signature.
+ *
+ * Usage: iqdb-loadgen [--host=HOST] [--port=PORT] [--rate=N] [--duration=SECONDS]
+ *                     [--connections=N] [--mix=query:90,add:5,remove:4,status:1]
+ *                     [--ids=N] [--limit=N] [--seed=N] [--corpus=DIR]
+ *                     [--replay=LOGFILE]
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <httplib.h>
+#include <nlohmann/json.hpp>
+
+#include <iqdb/debug.h>
+#include <iqdb/imgdb.h>
+
+#include "report.h"
+#include "synthetic.h"
+
+using namespace iqdb;
+using namespace iqdb::bench;
+using nlohmann::json;
+
+enum RequestKind { QUERY, ADD, REMOVE, STATUS, OTHER, REQUEST_KINDS };
+static const char* const request_kind_names[REQUEST_KINDS] = { "query", "add", "remove", "status", "other" };
+
+struct LoadgenOptions {
+  std::string host = "127.0.0.1";
+  int port = 8000;
+  double rate = 100;
+  double duration = 10;
+  size_t connections = 16;
+  double mix[REQUEST_KINDS] = { 90, 5, 4, 1, 0 };
+  uint64_t ids = 100000;
+  int limit = 10;
+  uint64_t seed = 1;
+  std::string corpus = "files";
+  std::string replay;
+};
+
+// Parse a mix like `query:90,add:5`. Kinds that aren't mentioned get 0.
+static void parse_mix(LoadgenOptions& options, const std::string& value) {
+  std::fill(std::begin(options.mix), std::end(options.mix), 0);
+
+  std::stringstream stream(value);
+  std::string item;
+  while (std::getline(stream, item, ',')) {
+    const auto colon = item.find(':');
+    const std::string kind = item.substr(0, colon);
+    const auto it = std::find_if(std::begin(request_kind_names), std::end(request_kind_names), [&](const char* name) { return kind == name; });
+
+    if (colon == std::string::npos || it == std::end(request_kind_names) || it == std::begin(request_kind_names) + OTHER) {
+      throw param_error("Invalid mix (mix=" + value + ")");
+    }
+
+    options.mix[it - std::begin(request_kind_names)] = std::stod(item.substr(colon + 1));
+  }
+}
+
+static LoadgenOptions parse_options(int argc, char** argv) {
+  LoadgenOptions options;
+
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    const auto eq = arg.find('=');
+    const std::string name = arg.substr(0, eq);
+    const std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+
+    if (name == "--host") options.host = value;
+    else if (name == "--port") options.port = std::stoi(value);
+    else if (name == "--rate") options.rate = std::stod(value);
+    else if (name == "--duration") options.duration = std::stod(value);
+    else if (name == "--connections") options.connections = std::max(1ul, std::stoul(value));
+    else if (name == "--mix") parse_mix(options, value);
+    else if (name == "--ids") options.ids = std::max(1ull, std::stoull(value));
+    else if (name == "--limit") options.limit = std::stoi(value);
+    else if (name == "--seed") options.seed = std::stoull(value);
+    else if (name == "--corpus") options.corpus = value;
+    else if (name == "--replay") options.replay = value;
+    else throw param_error("Unknown option (option=" + arg + ")");
+  }
+
+  if (options.rate <= 0) {
+    throw param_error("--rate must be positive");
+  }
+
+  if (std::all_of(std::begin(options.mix), std::end(options.mix), [](double weight) { return weight <= 0; })) {
+    throw param_error("--mix must include at least one request type");
+  }
+
+  return options;
+}
+
+struct Request {
+  RequestKind kind;
+  std::string method;
+  std::string path;
+  const std::string* body = nullptr; // Points into a BodyPool.
+};
+
+// Request bodies, shared between requests so that long runs don't need a
+// copy of a 200KB image body per add.
+class BodyPool {
+public:
+  BodyPool(const LoadgenOptions& options) : options_(options), rng_(options.seed), corpus_(options.seed) {}
+
+  // A `POST /query` body with the hash of a synthetic signature.
+  const std::string* query() {
+    if (queries_.size() < max_queries) {
+      const json body = { { "hash", corpus_.image(queries_.size()).to_string() }, { "limit", options_.limit } };
+      queries_.push_back(body.dump());
+      return &queries_.back();
+    }
+
+    return &queries_[rng_.below(queries_.size())];
+  }
+
+  // A `POST /images/:id` body made from one of the corpus images.
+  const std::string* add() {
+    if (images_.empty()) {
+      load_images();
+    }
+
+    if (adds_.size() < max_adds) {
+      const auto& pixels = images_[adds_.size() % images_.size()];
+      std::vector<int> r, g, b;
+
+      for (size_t i = 0; i < NUM_PIXELS_SQUARED; i++) {
+        r.push_back(noisy(pixels[3 * i]));
+        g.push_back(noisy(pixels[3 * i + 1]));
+        b.push_back(noisy(pixels[3 * i + 2]));
+      }
+
+      const json body = { { "channels", { { "r", r }, { "g", g }, { "b", b } } } };
+      adds_.push_back(body.dump());
+      return &adds_.back();
+    }
+
+    return &adds_[rng_.below(adds_.size())];
+  }
+
+private:
+  static constexpr size_t max_queries = 10000;
+  static constexpr size_t max_adds = 64;
+
+  int noisy(unsigned char value) {
+    return std::clamp(static_cast<int>(value) + static_cast<int>(rng_.below(9)) - 4, 0, 255);
+  }
+
+  void load_images() {
+    for (const auto& entry : std::filesystem::directory_iterator(options_.corpus)) {
+      if (entry.path().extension() != ".rgb") {
+        continue;
+      }
+
+      std::ifstream file(entry.path(), std::ios::binary);
+      std::vector<unsigned char> pixels(std::istreambuf_iterator<char>(file), {});
+      if (pixels.size() == 3 * NUM_PIXELS_SQUARED) {
+        images_.push_back(std::move(pixels));
+      }
+    }
+
+    if (images_.empty()) {
+      throw param_error("No 128x128 .rgb channel dumps found for adds (corpus=" + options_.corpus + ")");
+    }
+  }
+
+  const LoadgenOptions& options_;
+  SplitMix64 rng_;
+  SyntheticCorpus corpus_;
+  std::vector<std::vector<unsigned char>> images_;
+  std::deque<std::string> queries_; // Deques, so that pointers to bodies stay valid.
+  std::deque<std::string> adds_;
+};
+
+// Generate `rate * duration` requests with the configured mix.
+static std::vector<Request> generate_plan(const LoadgenOptions& options, BodyPool& bodies) {
+  std::vector<double> weights(std::begin(options.mix), std::end(options.mix));
+  const AliasTable mix(weights);
+  SplitMix64 rng(options.seed);
+
+  const size_t count = static_cast<size_t>(options.rate * options.duration);
+  std::vector<Request> plan;
+
+  for (size_t i = 0; i < count; i++) {
+    const auto kind = static_cast<RequestKind>(mix.sample(rng));
+    const std::string id = std::to_string(1 + rng.below(options.ids));
+
+    switch (kind) {
+      case QUERY: plan.push_back({ kind, "POST", "/query", bodies.query() }); break;
+      case ADD: plan.push_back({ kind, "POST", "/images/" + id, bodies.add() }); break;
+      case REMOVE: plan.push_back({ kind, "DELETE", "/images/" + id }); break;
+      default: plan.push_back({ kind, "GET", "/status" }); break;
+    }
+  }
+
+  return plan;
+}
+
+// Read the requests in a server log, in order. Bodies aren't logged, so
+// queries and adds get synthetic bodies.
+static std::vector<Request> load_replay(const LoadgenOptions& options, BodyPool& bodies) {
+  std::ifstream file(options.replay);
+  if (!file) {
+    throw param_error("Couldn't open log (file=" + options.replay + ")");
+  }
+
+  static const std::regex request_line(R"re("([A-Z]+) (\S+) HTTP/[0-9.]+" \d+ \d+)re");
+  static const std::regex images_path(R"(/images/\d+)");
+  std::vector<Request> plan;
+  std::string line;
+  std::smatch match;
+
+  while (std::getline(file, line)) {
+    if (!std::regex_search(line, match, request_line)) {
+      continue;
+    }
+
+    const std::string method = match[1], path = match[2];
+
+    if (method == "POST" && path == "/query") {
+      plan.push_back({ QUERY, method, path, bodies.query() });
+    } else if (method == "POST" && std::regex_match(path, images_path)) {
+      plan.push_back({ ADD, method, path, bodies.add() });
+    } else if (method == "DELETE" && std::regex_match(path, images_path)) {
+      plan.push_back({ REMOVE, method, path });
+    } else if (method == "GET") {
+      plan.push_back({ path == "/status" ? STATUS : OTHER, method, path });
+    }
+  }
+
+  INFO("Replaying {} requests from {}.\n", plan.size(), options.replay);
+  return plan;
+}
+
+struct Sample {
+  RequestKind kind;
+  int status; // 0 if the request failed without a response.
+  double latency_ms;
+};
+
+int main(int argc, char** argv) {
+  start_log_writer();
+
+  try {
+    const LoadgenOptions options = parse_options(argc, argv);
+    BodyPool bodies(options);
+    const auto plan = options.replay.empty() ? generate_plan(options, bodies) : load_replay(options, bodies);
+
+    const auto interval = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1 / options.rate));
+    const auto start = Clock::now() + std::chrono::milliseconds(100); // Give the connections time to start.
+
+    std::atomic<size_t> next = 0;
+    std::vector<std::vector<Sample>> samples(options.connections);
+    std::vector<std::thread> connections;
+
+    for (size_t c = 0; c < options.connections; c++) {
+      connections.emplace_back([&, c] {
+        httplib::Client client(options.host, options.port);
+        client.set_keep_alive(true);
+
+        for (size_t i = next++; i < plan.size(); i = next++) {
+          const Request& request = plan[i];
+          const auto due = start + static_cast<Clock::rep>(i) * interval;
+          std::this_thread::sleep_until(due);
+
+          httplib::Result result = request.method == "POST" ? client.Post(request.path, *request.body, "application/json")
+                                 : request.method == "DELETE" ? client.Delete(request.path)
+                                 : client.Get(request.path);
+
+          const double latency = std::chrono::duration<double, std::milli>(Clock::now() - due).count();
+          samples[c].push_back({ request.kind, result ? result->status : 0, latency });
+        }
+      });
+    }
+
+    for (auto& connection : connections) {
+      connection.join();
+    }
+
+    const double elapsed = seconds_since(start);
+    std::vector<double> latencies[REQUEST_KINDS], all;
+    std::map<std::string, size_t> statuses[REQUEST_KINDS];
+
+    for (const auto& connection_samples : samples) {
+      for (const auto& sample : connection_samples) {
+        latencies[sample.kind].push_back(sample.latency_ms);
+        statuses[sample.kind][sample.status ? std::to_string(sample.status) : "error"]++;
+        all.push_back(sample.latency_ms);
+      }
+    }
+
+    json result = {
+      { "target", options.host + ":" + std::to_string(options.port) },
+      { "requests", plan.size() },
+      { "rate", options.rate },
+      { "achieved_rate", static_cast<double>(plan.size()) / elapsed },
+      { "connections", options.connections },
+      { "latency_ms", percentiles(all) },
+    };
+
+    for (int kind = 0; kind < REQUEST_KINDS; kind++) {
+      if (!latencies[kind].empty()) {
+        result[request_kind_names[kind]] = {
+          { "count", latencies[kind].size() },
+          { "statuses", statuses[kind] },
+          { "latency_ms", percentiles(latencies[kind]) },
+        };
+      }
+    }
+
+    printf("%s\n", result.dump(2).c_str());
+  } catch (const std::exception& e) {
+    ERROR("Error: {}\n", e.what());
+    return 1;
+  }
+
+  return 0;
+}
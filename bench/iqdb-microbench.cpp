@@ -0,0 +1,292 @@
+/*
+ * iqdb-microbench - per-stage benchmarks for the signature pipeline.
+ *
+ * Times each stage of turning an image's channels into a HaarSignature
+ * (transformChar, RGB_2_YIQ, haar2D, get_m_largests, the coefficient sorts in
+ * HaarSignature::from_channels, and from_channels end to end), plus the
+ * to_string and from_hash codecs. Results are printed to stdout as JSON.
+ *
+ * The corpus is a directory of raw 128x128 RGB dumps (`*.rgb` files of
+ * 128*128*3 interleaved bytes). The repository's own corpus in files/ starts
+ * with a dump of files/1.jpg. More can be made with ImageMagick:
+ *
+ *   convert image.jpg -resize '128x128!' -depth 8 rgb:image.rgb
+ *
+ * Each stage is timed per image on one thread, then per core with --threads
+ * threads running at once. With --baseline, results are compared against the
+ * JSON output of an earlier run.
+ *
+ * Usage: iqdb-microbench [--corpus=DIR] [--threads=N] [--time=SECONDS]
+ *                        [--baseline=FILE]
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include <iqdb/debug.h>
+#include <iqdb/haar.h>
+#include <iqdb/haar_signature.h>
+#include <iqdb/imgdb.h>
+#include <iqdb/metrics.h>
+
+using namespace iqdb;
+using nlohmann::json;
+
+struct MicrobenchOptions {
+  std::string corpus = "files";
+  size_t threads = std::max(1u, std::thread::hardware_concurrency());
+  double time = 0.5;
+  std::string baseline;
+};
+
+static MicrobenchOptions parse_options(int argc, char** argv) {
+  MicrobenchOptions options;
+
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    const auto eq = arg.find('=');
+    const std::string name = arg.substr(0, eq);
+    const std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+
+    if (name == "--corpus") options.corpus = value;
+    else if (name == "--threads") options.threads = std::max(1ul, std::stoul(value));
+    else if (name == "--time") options.time = std::stod(value);
+    else if (name == "--baseline") options.baseline = value;
+    else throw param_error("Unknown option (option=" + arg + ")");
+  }
+
+  return options;
+}
+
+// One image of the corpus, with the input of every stage precomputed.
+struct CorpusImage {
+  std::string name;
+  std::vector<unsigned char> r, g, b;     // The raw channels.
+  std::vector<Unit> rgb[3];               // Input of RGB_2_YIQ.
+  std::vector<Unit> yiq[3];               // Input of haar2D.
+  std::vector<Unit> haar[3];              // Input of get_m_largests.
+  signature_t unsorted;                   // Input of the sorts.
+  HaarSignature signature;                // Input of to_string.
+  std::string hash;                       // Input of from_hash.
+};
+
+static std::vector<CorpusImage> load_corpus(const std::string& dir) {
+  std::vector<std::filesystem::path> paths;
+  for (const auto& entry : std::filesystem::directory_iterator(dir)) {
+    if (entry.path().extension() == ".rgb") {
+      paths.push_back(entry.path());
+    }
+  }
+
+  if (paths.empty()) {
+    throw param_error("No .rgb channel dumps found (corpus=" + dir + ")");
+  }
+
+  std::sort(paths.begin(), paths.end());
+  std::vector<CorpusImage> corpus;
+
+  for (const auto& path : paths) {
+    std::ifstream file(path, std::ios::binary);
+    const std::vector<unsigned char> pixels(std::istreambuf_iterator<char>(file), {});
+    if (pixels.size() != 3 * NUM_PIXELS_SQUARED) {
+      throw param_error("Channel dump isn't 128x128 RGB (file=" + path.string() + ")");
+    }
+
+    CorpusImage image;
+    image.name = path.filename().string();
+    for (size_t i = 0; i < NUM_PIXELS_SQUARED; i++) {
+      image.r.push_back(pixels[3 * i]);
+      image.g.push_back(pixels[3 * i + 1]);
+      image.b.push_back(pixels[3 * i + 2]);
+    }
+
+    image.rgb[0].assign(image.r.begin(), image.r.end());
+    image.rgb[1].assign(image.g.begin(), image.g.end());
+    image.rgb[2].assign(image.b.begin(), image.b.end());
+
+    for (int c = 0; c < 3; c++) image.yiq[c] = image.rgb[c];
+    RGB_2_YIQ(image.yiq[0].data(), image.yiq[1].data(), image.yiq[2].data());
+
+    for (int c = 0; c < 3; c++) image.haar[c].resize(NUM_PIXELS_SQUARED);
+    transformChar(image.r.data(), image.g.data(), image.b.data(), image.haar[0].data(), image.haar[1].data(), image.haar[2].data());
+
+    double avgl[3];
+    calcHaar(image.haar[0].data(), image.haar[1].data(), image.haar[2].data(), image.unsorted[0], image.unsorted[1], image.unsorted[2], avgl);
+
+    image.signature = HaarSignature::from_channels(image.r, image.g, image.b);
+    image.hash = image.signature.to_string();
+    corpus.push_back(std::move(image));
+  }
+
+  return corpus;
+}
+
+// Per-thread scratch space. Stages that work in place copy their input here
+// first, outside of the timed region.
+struct Scratch {
+  std::vector<Unit> units[3] = {
+    std::vector<Unit>(NUM_PIXELS_SQUARED),
+    std::vector<Unit>(NUM_PIXELS_SQUARED),
+    std::vector<Unit>(NUM_PIXELS_SQUARED),
+  };
+  signature_t sig;
+  HaarSignature signature;
+  std::string hash;
+};
+
+struct Stage {
+  std::string name;
+  std::function<void(Scratch&, const CorpusImage&)> setup; // Untimed.
+  std::function<void(Scratch&, const CorpusImage&)> run;   // Timed.
+};
+
+static std::vector<Stage> stages() {
+  auto none = [](Scratch&, const CorpusImage&) {};
+
+  return {
+    { "transformChar", none, [](Scratch& s, const CorpusImage& image) {
+      transformChar(const_cast<unsigned char*>(image.r.data()), const_cast<unsigned char*>(image.g.data()), const_cast<unsigned char*>(image.b.data()),
+                    s.units[0].data(), s.units[1].data(), s.units[2].data());
+    }},
+    { "RGB_2_YIQ", [](Scratch& s, const CorpusImage& image) {
+      for (int c = 0; c < 3; c++) std::copy(image.rgb[c].begin(), image.rgb[c].end(), s.units[c].begin());
+    }, [](Scratch& s, const CorpusImage&) {
+      RGB_2_YIQ(s.units[0].data(), s.units[1].data(), s.units[2].data());
+    }},
+    { "haar2D", [](Scratch& s, const CorpusImage& image) {
+      for (int c = 0; c < 3; c++) std::copy(image.yiq[c].begin(), image.yiq[c].end(), s.units[c].begin());
+    }, [](Scratch& s, const CorpusImage&) {
+      for (int c = 0; c < 3; c++) haar2D(s.units[c].data());
+    }},
+    { "get_m_largests", none, [](Scratch& s, const CorpusImage& image) {
+      for (int c = 0; c < 3; c++) get_m_largests(const_cast<Unit*>(image.haar[c].data()), s.sig[c]);
+    }},
+    { "sort", [](Scratch& s, const CorpusImage& image) {
+      std::copy(&image.unsorted[0][0], &image.unsorted[0][0] + 3 * NUM_COEFS, &s.sig[0][0]);
+    }, [](Scratch& s, const CorpusImage&) {
+      for (int c = 0; c < 3; c++) std::sort(&s.sig[c][0], &s.sig[c][NUM_COEFS]);
+    }},
+    { "from_channels", none, [](Scratch& s, const CorpusImage& image) {
+      s.signature = HaarSignature::from_channels(image.r, image.g, image.b);
+    }},
+    { "to_string", none, [](Scratch& s, const CorpusImage& image) {
+      s.hash = image.signature.to_string();
+    }},
+    { "from_hash", none, [](Scratch& s, const CorpusImage& image) {
+      s.signature = HaarSignature::from_hash(image.hash);
+    }},
+  };
+}
+
+// Run a stage over the corpus for `seconds` on each of `threads` threads at
+// once, and return the median time of one call in nanoseconds. Each call is
+// timed individually, so that the setup of in-place stages isn't counted.
+static double measure(const Stage& stage, const std::vector<CorpusImage>& corpus, size_t threads, double seconds) {
+  std::vector<std::vector<double>> samples(threads);
+  std::vector<std::thread> workers;
+  std::atomic<size_t> ready = 0;
+
+  for (size_t t = 0; t < threads; t++) {
+    workers.emplace_back([&, t] {
+      Scratch scratch;
+
+      ready++;
+      while (ready < threads) std::this_thread::yield();
+
+      const auto end = Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+      for (size_t i = t; Clock::now() < end; i++) {
+        const CorpusImage& image = corpus[i % corpus.size()];
+        stage.setup(scratch, image);
+
+        const auto start = Clock::now();
+        stage.run(scratch, image);
+        samples[t].push_back(std::chrono::duration<double, std::nano>(Clock::now() - start).count());
+      }
+    });
+  }
+
+  for (auto& worker : workers) {
+    worker.join();
+  }
+
+  std::vector<double> all;
+  for (const auto& thread_samples : samples) {
+    all.insert(all.end(), thread_samples.begin(), thread_samples.end());
+  }
+
+  std::nth_element(all.begin(), all.begin() + all.size() / 2, all.end());
+  return all[all.size() / 2];
+}
+
+static json load_baseline(const std::string& filename) {
+  std::ifstream file(filename);
+  if (!file) {
+    throw param_error("Couldn't open baseline (file=" + filename + ")");
+  }
+
+  return json::parse(file);
+}
+
+int main(int argc, char** argv) {
+  start_log_writer();
+
+  try {
+    const MicrobenchOptions options = parse_options(argc, argv);
+    const auto corpus = load_corpus(options.corpus);
+    const json baseline = options.baseline.empty() ? json::object() : load_baseline(options.baseline);
+
+    json images = json::array();
+    for (const auto& image : corpus) {
+      images.push_back(image.name);
+    }
+
+    json result = {
+      { "corpus", images },
+      { "threads", options.threads },
+      { "stages", json::object() },
+    };
+
+    for (const auto& stage : stages()) {
+      const double single = measure(stage, corpus, 1, options.time);
+      const double parallel = measure(stage, corpus, options.threads, options.time);
+
+      json data = {
+        { "ns_per_image", single },
+        { "per_core", {
+          { "ns_per_image", parallel },
+          { "images_per_second", 1e9 / parallel },
+        }},
+      };
+
+      if (baseline.contains("stages") && baseline["stages"].contains(stage.name)) {
+        const double before = baseline["stages"][stage.name]["ns_per_image"];
+        const double before_parallel = baseline["stages"][stage.name]["per_core"]["ns_per_image"];
+        data["baseline"] = {
+          { "ns_per_image", before },
+          { "speedup", before / single },
+          { "per_core_speedup", before_parallel / parallel },
+        };
+      }
+
+      INFO("{}: {:.0f} ns/image, {:.0f} ns/image per core with {} threads\n", stage.name, single, parallel, options.threads);
+      result["stages"][stage.name] = data;
+    }
+
+    printf("%s\n", result.dump(2).c_str());
+  } catch (const std::exception& e) {
+    ERROR("Error: {}\n", e.what());
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,44 @@
+#ifndef IQDB_BENCH_REPORT_H
+#define IQDB_BENCH_REPORT_H
+
+// Helpers for reporting benchmark results as JSON.
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include <iqdb/metrics.h>
+
+namespace iqdb::bench {
+
+inline double seconds_since(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Latency percentiles in milliseconds.
+inline nlohmann::json percentiles(std::vector<double> samples) {
+  if (samples.empty()) {
+    return nlohmann::json::object();
+  }
+
+  std::sort(samples.begin(), samples.end());
+  auto at = [&](double p) { return samples[std::min(samples.size() - 1, static_cast<size_t>(p * static_cast<double>(samples.size())))]; };
+
+  double total = 0;
+  for (double sample : samples) total += sample;
+
+  return {
+    { "mean", total / static_cast<double>(samples.size()) },
+    { "p50", at(0.50) },
+    { "p90", at(0.90) },
+    { "p99", at(0.99) },
+    { "p999", at(0.999) },
+    { "max", samples.back() },
+  };
+}
+
+}
+
+#endif
@@ -0,0 +1,227 @@
+#ifndef IQDB_BENCH_SYNTHETIC_H
+#define IQDB_BENCH_SYNTHETIC_H
+
+// Deterministic synthetic HaarSignature corpora for benchmarks.
+//
+// By default, coefficients are drawn from a built-in model of real
+// signatures: the largest Haar coefficients of a photo or drawing are
+// concentrated in the coarse levels of the transform (small row and column
+// indexes), more so in the I and Q chroma channels than in Y, and about 15% of
+// images are grayscale. For a closer match to a particular collection, the
+// model can instead be fitted to a sample of real signatures, in which case
+// coefficients and luminance values are drawn from the sample's empirical
+// distribution.
+//
+// Image `n` of a corpus depends only on the seed and `n`, so corpora can be
+// generated in parallel and regenerated exactly.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <iqdb/haar.h>
+#include <iqdb/haar_signature.h>
+
+namespace iqdb::bench {
+
+// https://prng.di.unimi.it/splitmix64.c
+class SplitMix64 {
+public:
+  explicit SplitMix64(uint64_t seed) : state_(seed) {}
+
+  uint64_t next() noexcept {
+    uint64_t z = (state_ += 0x9e3779b97f4a7c15);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+  }
+
+  // A uniform double in [0, 1).
+  double uniform() noexcept { return static_cast<double>(next() >> 11) * 0x1.0p-53; }
+
+  // A uniform integer in [0, n).
+  uint64_t below(uint64_t n) noexcept { return next() % n; }
+
+  // A normally distributed double (Box-Muller).
+  double normal(double mean, double stddev) noexcept {
+    const double u1 = std::max(uniform(), 1e-300);
+    const double u2 = uniform();
+    const double pi = 3.14159265358979323846;
+    return mean + stddev * std::sqrt(-2 * std::log(u1)) * std::cos(2 * pi * u2);
+  }
+
+private:
+  uint64_t state_;
+};
+
+// Samples from a discrete distribution in O(1) (Vose's alias method).
+class AliasTable {
+public:
+  AliasTable() = default;
+
+  explicit AliasTable(const std::vector<double>& weights) : prob_(weights.size()), alias_(weights.size()) {
+    const size_t n = weights.size();
+    double total = 0;
+    for (double w : weights) total += w;
+
+    std::vector<double> scaled(n);
+    std::vector<uint32_t> small, large;
+    for (size_t i = 0; i < n; i++) {
+      scaled[i] = weights[i] * static_cast<double>(n) / total;
+      (scaled[i] < 1 ? small : large).push_back(static_cast<uint32_t>(i));
+    }
+
+    while (!small.empty() && !large.empty()) {
+      const uint32_t s = small.back(), l = large.back();
+      small.pop_back();
+      prob_[s] = scaled[s];
+      alias_[s] = l;
+      scaled[l] -= 1 - scaled[s];
+      if (scaled[l] < 1) {
+        large.pop_back();
+        small.push_back(l);
+      }
+    }
+
+    for (uint32_t i : large) prob_[i] = 1;
+    for (uint32_t i : small) prob_[i] = 1;
+  }
+
+  uint32_t sample(SplitMix64& rng) const noexcept {
+    const uint32_t i = static_cast<uint32_t>(rng.below(prob_.size()));
+    return rng.uniform() < prob_[i] ? i : alias_[i];
+  }
+
+private:
+  std::vector<double> prob_;
+  std::vector<uint32_t> alias_;
+};
+
+class SyntheticCorpus {
+public:
+  // Use the built-in model of real signatures.
+  explicit SyntheticCorpus(uint64_t seed, double duplicate_rate = 0.05) : seed_(seed), duplicate_rate_(duplicate_rate) {
+    for (int c = 0; c < 3; c++) {
+      // Relative weight of each Haar level: level L holds the coefficients
+      // with max(row, col) in [2^L, 2^(L+1)). Chroma is smoother than luma, so
+      // its large coefficients sit in coarser levels.
+      static const double luma[7] = { 0.10, 0.17, 0.22, 0.22, 0.16, 0.09, 0.04 };
+      static const double chroma[7] = { 0.20, 0.26, 0.24, 0.16, 0.09, 0.04, 0.01 };
+      const double* levels = c == 0 ? luma : chroma;
+
+      std::vector<double> weights(2 * NUM_PIXELS_SQUARED, 0);
+      for (int i = 1; i < NUM_PIXELS_SQUARED; i++) {
+        const int level = static_cast<int>(std::log2(std::max(i / NUM_PIXELS, i % NUM_PIXELS)));
+        const int level_size = 3 << (2 * level); // (2^(L+1))^2 - (2^L)^2
+        weights[2 * i] = weights[2 * i + 1] = levels[level] / level_size;
+      }
+
+      coefs_[c] = AliasTable(weights);
+    }
+  }
+
+  // Fit the model to a sample of real signatures.
+  SyntheticCorpus(uint64_t seed, const std::vector<HaarSignature>& sample, double duplicate_rate = 0.05)
+    : seed_(seed), duplicate_rate_(duplicate_rate), sample_(sample) {
+    for (int c = 0; c < 3; c++) {
+      std::vector<double> weights(2 * NUM_PIXELS_SQUARED, 1e-9);
+      for (const auto& signature : sample) {
+        for (int16_t coef : signature.sig[c]) {
+          weights[2 * std::abs(coef) + (coef < 0)] += 1;
+        }
+      }
+
+      weights[0] = weights[1] = 0; // The DC coefficient is never in a signature.
+      coefs_[c] = AliasTable(weights);
+    }
+  }
+
+  // The signature of image `n`. Some images are near-duplicates of an earlier
+  // image, so that queries have real matches to find.
+  HaarSignature image(uint64_t n) const {
+    SplitMix64 rng(seed_ ^ (n * 0xd1b54a32d192ed03));
+
+    if (n > 0 && rng.uniform() < duplicate_rate_) {
+      return variant(image(rng.below(n)), rng, 1 + static_cast<int>(rng.below(8)));
+    }
+
+    HaarSignature signature;
+    randomLuminance(signature, rng);
+
+    for (int c = 0; c < 3; c++) {
+      for (int i = 0; i < NUM_COEFS; i++) {
+        signature.sig[c][i] = randomCoef(c, rng, signature.sig[c], i);
+      }
+
+      std::sort(&signature.sig[c][0], &signature.sig[c][NUM_COEFS]);
+    }
+
+    return signature;
+  }
+
+  // A near-duplicate of `base`: the luminance is jittered slightly and
+  // `changes` coefficients in each channel are replaced.
+  HaarSignature variant(const HaarSignature& base, SplitMix64& rng, int changes) const {
+    HaarSignature signature = base;
+
+    for (int c = 0; c < 3; c++) {
+      signature.avglf[c] += rng.normal(0, 0.002);
+
+      for (int k = 0; k < changes; k++) {
+        const int i = static_cast<int>(rng.below(NUM_COEFS));
+        signature.sig[c][i] = 0;
+        signature.sig[c][i] = randomCoef(c, rng, signature.sig[c], NUM_COEFS);
+      }
+
+      std::sort(&signature.sig[c][0], &signature.sig[c][NUM_COEFS]);
+    }
+
+    if (base.is_grayscale()) {
+      signature.avglf[1] = signature.avglf[2] = 0;
+    }
+
+    return signature;
+  }
+
+private:
+  void randomLuminance(HaarSignature& signature, SplitMix64& rng) const {
+    if (!sample_.empty()) {
+      const auto& other = sample_[rng.below(sample_.size())];
+      for (int c = 0; c < 3; c++) {
+        signature.avglf[c] = other.avglf[c] + (other.is_grayscale() && c > 0 ? 0 : rng.normal(0, 0.01));
+      }
+      return;
+    }
+
+    signature.avglf[0] = std::clamp(rng.normal(0.55, 0.2), 0.01, 1.0);
+    if (rng.uniform() < 0.15) {
+      signature.avglf[1] = signature.avglf[2] = 0;
+    } else {
+      signature.avglf[1] = rng.normal(0, 0.04);
+      signature.avglf[2] = rng.normal(0, 0.03);
+    }
+  }
+
+  // A random signed coefficient index that isn't already in `sig[0..count)`.
+  int16_t randomCoef(int c, SplitMix64& rng, const int16_t* sig, int count) const {
+    while (true) {
+      const uint32_t k = coefs_[c].sample(rng);
+      const int index = static_cast<int>(k / 2);
+      const int16_t coef = static_cast<int16_t>(k % 2 ? -index : index);
+
+      if (std::none_of(sig, sig + count, [&](int16_t other) { return std::abs(other) == index; })) {
+        return coef;
+      }
+    }
+  }
+
+  uint64_t seed_;
+  double duplicate_rate_;
+  std::vector<HaarSignature> sample_;
+  AliasTable coefs_[3];
+};
+
+}
+
+#endif
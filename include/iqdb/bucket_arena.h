@@ -0,0 +1,135 @@
+#ifndef IQDB_BUCKET_ARENA_H
+#define IQDB_BUCKET_ARENA_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace iqdb {
+
+class Bucket;
+
+// Memory usage of a BucketArena, in bytes.
+struct BucketArenaStats {
+  size_t mapped = 0;    // Address space mapped from the OS, including untouched slab space.
+  size_t committed = 0; // Mapped space that has been handed out at least once.
+  size_t allocated = 0; // Space in live blocks.
+  size_t free = 0;      // Space in blocks on the free lists.
+  size_t used = 0;      // Space holding ids (filled in by bucket_set).
+  size_t hugetlb = 0;   // Mapped space backed by explicit (MAP_HUGETLB) huge pages.
+
+  // The fraction of committed memory that doesn't hold ids.
+  double fragmentation() const noexcept { return committed ? 1 - static_cast<double>(used) / static_cast<double>(committed) : 0; }
+};
+
+// Allocates the id arrays of the buckets in a bucket_set.
+//
+// Small blocks are carved out of 64MB slabs, in size classes spaced at most
+// 25% apart, and freed blocks go on a free list per size class for reuse.
+// Growing buckets leave a trail of freed blocks behind, so after a bulk load
+// the arena should be compacted.
+// Blocks of 1MB or more get a mapping of their own. Slabs and large blocks are
+// 2MB-aligned and backed by huge pages: explicit huge pages (MAP_HUGETLB) if
+// any are reserved, otherwise transparent huge pages. This keeps bucket data
+// in a few hundred huge pages instead of hundreds of thousands of 4K heap
+// pages, which cuts TLB misses when scanning buckets.
+//
+// Not thread-safe. Callers must hold the same lock as for changing buckets.
+class BucketArena {
+public:
+  BucketArena() = default;
+  ~BucketArena();
+  BucketArena(const BucketArena&) = delete;
+  BucketArena& operator=(const BucketArena&) = delete;
+
+  // Allocate a block with room for at least `capacity` ids. Returns the
+  // block's actual capacity in `capacity`.
+  uint32_t* allocate(uint32_t& capacity);
+
+  // Grow a block to hold at least `capacity` ids, keeping its first `size` ids.
+  uint32_t* reallocate(uint32_t* block, uint32_t old_capacity, uint32_t size, uint32_t& capacity);
+
+  void deallocate(uint32_t* block, uint32_t capacity) noexcept;
+
+  // Free all memory. Every block becomes invalid.
+  void clear() noexcept;
+
+  // Move the blocks of `buckets`, which must be every bucket with a block in
+  // this arena, into new slabs with no gaps between them, shrinking each block
+  // to the smallest size class that fits. Afterwards the free lists are empty.
+  // Old slabs are unmapped as soon as they've been emptied, so this needs at
+  // most a couple of slabs of extra memory.
+  void compact(std::vector<Bucket*> buckets);
+
+  BucketArenaStats stats() const noexcept;
+
+  // The capacity of the size class that `capacity` ids round up to.
+  static uint32_t roundCapacity(uint32_t capacity) noexcept;
+
+private:
+  static constexpr size_t slab_bytes = 64 << 20;
+  static constexpr size_t large_block_bytes = 1 << 20;
+  static constexpr size_t huge_page_bytes = 2 << 20;
+  static constexpr size_t num_classes = 64; // Enough for every class below large_block_bytes.
+
+  struct Mapping {
+    void* address;
+    size_t bytes;
+    bool hugetlb;
+  };
+
+  static size_t sizeClass(uint32_t capacity) noexcept;
+  static bool isLarge(uint32_t capacity) noexcept { return capacity * sizeof(uint32_t) >= large_block_bytes; }
+
+  // The capacity of a large block for at least `capacity` ids, rounded up to a
+  // whole number of huge pages.
+  static uint32_t largeCapacity(uint32_t capacity) noexcept;
+
+  // Map `bytes` (a multiple of the huge page size) of huge-page-aligned memory.
+  static Mapping map(size_t bytes);
+
+  std::vector<Mapping> slabs_;
+  std::unordered_map<uint32_t*, Mapping> large_blocks_;
+  size_t slab_used_ = 0; // Bytes handed out from the newest slab.
+  std::array<void*, num_classes> free_lists_ = {};
+  size_t free_ = 0;
+  size_t allocated_ = 0;
+  size_t committed_ = 0; // Bytes handed out from slabs, excluding large blocks.
+};
+
+// A bucket's sorted array of image ids. Only the owner of the bucket's arena
+// can change it.
+class Bucket {
+public:
+  using value_type = uint32_t;
+
+  const uint32_t* begin() const noexcept { return data_; }
+  const uint32_t* end() const noexcept { return data_ + size_; }
+  size_t size() const noexcept { return size_; }
+  size_t capacity() const noexcept { return capacity_; }
+  bool empty() const noexcept { return size_ == 0; }
+  uint32_t operator[](size_t i) const noexcept { return data_[i]; }
+
+  // Add `id`, keeping the ids sorted.
+  void insert(BucketArena& arena, uint32_t id);
+
+  // Remove every occurrence of `id`. The block is freed if the bucket becomes
+  // empty.
+  void erase(BucketArena& arena, uint32_t id) noexcept;
+
+  // Forget the block without freeing it, for when the whole arena is cleared.
+  void reset() noexcept { data_ = nullptr; size_ = capacity_ = 0; }
+
+private:
+  friend class BucketArena;
+
+  uint32_t* data_ = nullptr;
+  uint32_t size_ = 0;
+  uint32_t capacity_ = 0;
+};
+
+}
+
+#endif
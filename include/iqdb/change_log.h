@@ -0,0 +1,84 @@
+#ifndef IQDB_CHANGE_LOG_H
+#define IQDB_CHANGE_LOG_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <iqdb/haar_signature.h>
+#include <iqdb/metrics.h>
+#include <iqdb/types.h>
+
+namespace iqdb {
+
+// The most recent adds and removes made to an index, numbered in the order
+// they were made, so that followers can replay them. Only the last `capacity`
+// changes are kept; a follower that falls further behind than that has to
+// start over from a snapshot. Sequence numbers start over when the server
+// restarts, so each log has a random epoch to tell runs apart. Thread-safe.
+class ChangeLog {
+public:
+  enum class Type { add, remove };
+
+  struct Change {
+    uint64_t seq;
+    Type type;
+    postId post_id;
+    HaarSignature signature; // The new signature of an added image.
+  };
+
+  explicit ChangeLog(size_t capacity);
+  ~ChangeLog();
+
+  // Record a change and wake up any waiting readers. Returns its sequence number.
+  uint64_t append(Type type, postId post_id, const HaarSignature& signature = {});
+
+  // Up to `limit` changes after `since`, in order. Returns nullopt if changes
+  // after `since` have already been dropped.
+  std::optional<std::vector<Change>> since(uint64_t since, size_t limit);
+
+  // Wait for a change after `since` without holding a thread. Returns true if
+  // `func` will be called, once there's a change or `deadline` has passed,
+  // from the thread that appends the change or from the log's timer thread.
+  // Returns false without calling `func` if there's nothing to wait for:
+  // there are already changes after `since`, or `since` is ahead of the log.
+  bool waitAsync(uint64_t since, Clock::time_point deadline, std::function<void()> func);
+
+  // Call every waiting function now, e.g. when the server is stopping.
+  void wakeAll();
+
+  // The sequence number of the last change, or 0 if there haven't been any.
+  uint64_t lastSeq() const;
+
+  const std::string& epoch() const noexcept { return epoch_; }
+
+private:
+  using Waiters = std::multimap<Clock::time_point, std::function<void()>>;
+
+  // Call the waiting functions whose deadline has passed, until the log is destroyed.
+  void expireWaiters();
+
+  const size_t capacity_;
+  const std::string epoch_;
+
+  mutable std::mutex mutex_;
+  std::deque<Change> changes_;
+  uint64_t last_seq_ = 0;
+
+  Waiters waiters_; // By deadline, soonest first.
+  std::condition_variable waiters_changed_;
+  bool stopping_ = false;
+  std::thread timer_;
+};
+
+}
+
+#endif
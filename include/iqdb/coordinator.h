@@ -0,0 +1,34 @@
+#ifndef IQDB_COORDINATOR_H
+#define IQDB_COORDINATOR_H
+
+#include <string>
+#include <vector>
+
+#include <iqdb/server.h>
+#include <iqdb/types.h>
+
+namespace iqdb {
+
+// Settings for `iqdb coordinator`, set with `--name=value` command line flags.
+struct CoordinatorOptions {
+  std::vector<std::string> shards; // The shard servers, as host:port. Their order decides which shard owns which post.
+  int shard_timeout = 5000;        // How long to wait for a shard, in milliseconds, unless a query has its own `timeout`.
+  size_t max_limit = 1000;         // The largest `limit` a query may ask for.
+  size_t max_batch = 1000;         // The most post ids a batch similarity query may ask for.
+  size_t http_threads = 64;        // Threads for handling requests.
+};
+
+// Set an option from a `--name=value` command line flag.
+void parse_option(CoordinatorOptions& options, const std::string& flag);
+
+// The index of the shard that owns a post.
+size_t shard_for(postId post_id, size_t shards);
+
+// Run an HTTP server with the same API as `iqdb http`, which splits the posts
+// between several `iqdb http` servers. Writes go to the shard that owns the
+// post, and queries go to every shard and their results are merged.
+void coordinator(const std::string host, const int port, const CoordinatorOptions& options, StartedCallback on_started = nullptr);
+
+}
+
+#endif
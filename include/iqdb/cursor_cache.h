@@ -0,0 +1,72 @@
+#ifndef IQDB_CURSOR_CACHE_H
+#define IQDB_CURSOR_CACHE_H
+
+#include <chrono>
+#include <cstddef>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <string>
+#include <unordered_map>
+
+#include <iqdb/imgdb.h>
+#include <iqdb/metrics.h>
+
+namespace iqdb {
+
+// A page of a cursor's results.
+struct CursorPage {
+  sim_vector matches; // Up to `limit` results from `offset` on, best match first.
+  size_t total;       // The number of results behind the cursor.
+};
+
+// Ranked query results kept for a while after the query, so that a client can
+// page through them with a cursor instead of running the query again with a
+// bigger limit. A cursor expires `ttl` after it was last read, and the least
+// recently read cursors are dropped early to keep the results under
+// `max_bytes`. Safe to use from concurrent requests.
+class CursorCache {
+public:
+  CursorCache(size_t max_bytes, std::chrono::seconds ttl);
+
+  // Keep `results` for the collection `scope`, and return the new cursor's
+  // token, or nothing if the results are too big for the budget.
+  std::optional<std::string> put(const std::string& scope, sim_vector results);
+
+  // Return up to `limit` results from `offset` on, if the cursor exists and
+  // was made for the collection `scope`.
+  std::optional<CursorPage> get(const std::string& token, const std::string& scope, size_t offset, size_t limit);
+
+  size_t size();
+  size_t bytes();
+  size_t maxBytes() const noexcept { return max_bytes_; }
+
+private:
+  struct Entry {
+    std::string scope;
+    sim_vector results;
+    Clock::time_point expires;
+  };
+
+  using lru_list = std::list<std::pair<std::string, Entry>>;
+
+  // The memory an entry is charged for.
+  static size_t cost(const std::string& token, const Entry& entry);
+
+  // Drop expired entries, then the least recently used ones until `extra`
+  // more bytes fit in the budget. Must be called with the mutex held.
+  void evict(Clock::time_point now, size_t extra);
+
+  const size_t max_bytes_;
+  const std::chrono::seconds ttl_;
+  lru_list entries_; // Most recently used first, so also soonest to expire last.
+  std::unordered_map<std::string, lru_list::iterator> index_;
+  size_t bytes_ = 0;
+  std::mt19937_64 rng_;
+  std::mutex mutex_;
+};
+
+}
+
+#endif
@@ -3,36 +3,58 @@
 
 #include <fmt/format.h>
 
+// Log messages below this level are compiled out. Set with the
+// IQDB_MIN_LOG_LEVEL CMake option, e.g. 1 to compile out DEBUG messages.
+#ifndef IQDB_MIN_LOG_LEVEL
+#define IQDB_MIN_LOG_LEVEL 0
+#endif
+
 namespace iqdb {
 
 // The logging verbosity level. 0 = DEBUG, 1 = INFO, 2 = WARN, 3 = ERROR.
 extern int debug_level;
 
-template<typename... Args>
-inline void LOG(std::string format, int level, Args... args) {
-  if (level >= debug_level) {
-    fmt::print(stderr, format, args...); \
+// Format a log message and hand it to the log writer thread, or write it to
+// stderr directly if the writer isn't running or is backed up.
+void log_write(fmt::string_view prefix, fmt::string_view format, fmt::format_args args);
+
+// Start a background thread that writes queued log messages to stderr.
+// Messages are flushed when the program exits.
+void start_log_writer();
+
+// Write out all queued messages and stop the log writer thread.
+void stop_log_writer();
+
+// The level is checked before anything is formatted, so arguments should be
+// passed as-is rather than pre-formatted (e.g. pass a HaarSignature instead
+// of calling to_string() on it).
+template<int level, typename... Args>
+inline void LOG(fmt::string_view prefix, fmt::format_string<Args...> format, Args&&... args) {
+  if constexpr (level >= IQDB_MIN_LOG_LEVEL) {
+    if (level >= debug_level) {
+      log_write(prefix, format, fmt::make_format_args(args...));
+    }
   }
 }
 
 template<typename... Args>
-inline void DEBUG(std::string format, Args... args) {
-  LOG("[debug] " + format, 0, args...);
+inline void DEBUG(fmt::format_string<Args...> format, Args&&... args) {
+  LOG<0>("[debug] ", format, std::forward<Args>(args)...);
 }
 
 template<typename... Args>
-inline void INFO(std::string format, Args... args) {
-  LOG("[info] " + format, 1, args...);
+inline void INFO(fmt::format_string<Args...> format, Args&&... args) {
+  LOG<1>("[info] ", format, std::forward<Args>(args)...);
 }
 
 template<typename... Args>
-inline void WARN(std::string format, Args... args) {
-  LOG("[warn] " + format, 2, args...);
+inline void WARN(fmt::format_string<Args...> format, Args&&... args) {
+  LOG<2>("[warn] ", format, std::forward<Args>(args)...);
 }
 
 template<typename... Args>
-inline void ERROR(std::string format, Args... args) {
-  LOG("[error] " + format, 3, args...);
+inline void ERROR(fmt::format_string<Args...> format, Args&&... args) {
+  LOG<3>("[error] ", format, std::forward<Args>(args)...);
 }
 
 }
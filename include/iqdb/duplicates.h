@@ -0,0 +1,28 @@
+#ifndef IQDB_DUPLICATES_H
+#define IQDB_DUPLICATES_H
+
+#include <string>
+
+#include <iqdb/types.h>
+
+namespace iqdb {
+
+// Settings for `iqdb dupes`, set with `--name=value` command line flags.
+struct DuplicateOptions {
+  Score threshold = 90;    // The lowest score for two images to count as duplicates.
+  size_t threads = 0;      // Threads for checking images (0 = one per CPU).
+  size_t block = 4096;     // Images to read from the database and check at a time.
+  bool pairs = false;      // Write every pair, as well as the clusters.
+  std::string output;      // The file to write results to (empty = stdout).
+};
+
+// Set an option from a `--name=value` command line flag.
+void parse_option(DuplicateOptions& options, const std::string& flag);
+
+// Find clusters of near-duplicate images in a database, and write them out as
+// JSON lines.
+void find_duplicates(const std::string& database_filename, const DuplicateOptions& options);
+
+}
+
+#endif
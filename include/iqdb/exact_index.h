@@ -0,0 +1,48 @@
+#ifndef IQDB_EXACT_INDEX_H
+#define IQDB_EXACT_INDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include <iqdb/haar_signature.h>
+#include <iqdb/types.h>
+
+namespace iqdb {
+
+// An index from the hash of an image's canonical signature to its post ids,
+// for finding exact duplicates without a similarity scan. The canonical
+// signature is the sorted coefficients plus the luminance quantized to 2^-20,
+// so that the same image always hashes the same even if its luminance went
+// through a lossy round trip.
+//
+// Only a 64-bit hash is stored per image, so a lookup returns candidates that
+// the caller must confirm with `sameImage` against the stored signatures. Not
+// thread-safe; the owner must lock it like the rest of the in-memory index.
+class ExactIndex {
+public:
+  void add(const HaarSignature& signature, postId post_id);
+  void remove(const HaarSignature& signature, postId post_id);
+  void clear();
+
+  // The posts whose signature might be identical to `signature`.
+  std::vector<postId> candidates(const HaarSignature& signature) const;
+
+  // Whether two signatures have the same canonical form.
+  static bool sameImage(const HaarSignature& a, const HaarSignature& b) noexcept;
+
+  size_t size() const noexcept { return index_.size(); }
+
+  // The approximate number of bytes used by the index.
+  size_t memoryUsage() const noexcept;
+
+private:
+  static uint64_t hash(const HaarSignature& signature) noexcept;
+
+  std::unordered_multimap<uint64_t, postId> index_;
+};
+
+}
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef IQDB_FOLLOWER_H
+#define IQDB_FOLLOWER_H
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+
+namespace httplib {
+class Client;
+}
+
+namespace iqdb {
+
+class IQDB;
+
+// How far a follower has got.
+struct FollowerStatus {
+  std::string epoch;       // The epoch of the leader's change log.
+  uint64_t seq = 0;        // The last change applied.
+  uint64_t leader_seq = 0; // The leader's last change, when last heard from.
+  bool following = false;  // False until the first snapshot has been loaded.
+  std::string error;       // The last error talking to the leader, if it hasn't worked since.
+};
+
+// Keeps a local index in sync with a leader server's index: loads a snapshot
+// of the leader's images, then replays the leader's change stream. If the
+// leader restarts, or the follower falls too far behind, it loads a new
+// snapshot. Changes are applied under `mutex`, like writes to the index.
+class Follower {
+public:
+  // Follow the collection at `prefix` (e.g. "" or "/c/name") on `leader`, given as host:port.
+  Follower(const std::string& leader, const std::string& prefix, IQDB& db, std::shared_mutex& mutex);
+  ~Follower();
+
+  void start();
+  void stop();
+  FollowerStatus status() const;
+
+private:
+  void run();
+  void loadSnapshot(httplib::Client& client);
+  bool pollChanges(httplib::Client& client);
+  void setError(const std::string& error);
+
+  std::string host_;
+  int port_;
+  const std::string prefix_;
+  IQDB& db_;
+  std::shared_mutex& mutex_;
+
+  std::thread thread_;
+  std::atomic<bool> stopping_ = false;
+
+  mutable std::mutex status_mutex_;
+  FollowerStatus status_;
+};
+
+}
+
+#endif
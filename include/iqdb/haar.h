@@ -30,11 +30,11 @@
 namespace iqdb {
 
 /* Number of pixels on one side of image; required to be a power of 2. */
-#define NUM_PIXELS 128
+constexpr int NUM_PIXELS = 128;
 /* Totals pixels in a square image. */
-#define NUM_PIXELS_SQUARED (NUM_PIXELS * NUM_PIXELS)
+constexpr int NUM_PIXELS_SQUARED = NUM_PIXELS * NUM_PIXELS;
 /* Number of Haar coeffients we retain as signature for an image. */
-#define NUM_COEFS 40
+constexpr int NUM_COEFS = 40;
 
 typedef double Unit;
 typedef int16_t Idx;
@@ -53,6 +53,11 @@ void transform(Unit *a, Unit *b, Unit *c);
 void transformChar(unsigned char *c1, unsigned char *c2, unsigned char *c3, Unit *a, Unit *b, Unit *c);
 int calcHaar(Unit *cdata1, Unit *cdata2, Unit *cdata3, Idx *sig1, Idx *sig2, Idx *sig3, double *avgl);
 
+/* The individual stages of transform() and calcHaar(), for benchmarking. */
+void RGB_2_YIQ(Unit *a, Unit *b, Unit *c);
+void haar2D(Unit a[]);
+void get_m_largests(Unit *cdata, Idx *sig);
+
 }
 
 #endif
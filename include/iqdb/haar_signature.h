@@ -2,6 +2,9 @@
 #define HAAR_SIGNATURE_H
 
 #include <string>
+#include <vector>
+
+#include <fmt/format.h>
 #include <iqdb/haar.h>
 
 namespace iqdb {
@@ -25,4 +28,14 @@ struct HaarSignature {
 
 }
 
+// Format a signature as its hash, so it can be passed to the log functions
+// without paying for to_string() when the message is filtered out.
+template <>
+struct fmt::formatter<iqdb::HaarSignature> : fmt::formatter<fmt::string_view> {
+  template <typename FormatContext>
+  auto format(const iqdb::HaarSignature& signature, FormatContext& ctx) const {
+    return fmt::formatter<fmt::string_view>::format(signature.to_string(), ctx);
+  }
+};
+
 #endif
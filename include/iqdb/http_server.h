@@ -0,0 +1,165 @@
+#ifndef IQDB_HTTP_SERVER_H
+#define IQDB_HTTP_SERVER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <regex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <iqdb/metrics.h>
+
+namespace iqdb {
+
+// Header names are compared case-insensitively.
+struct HeaderLess {
+  bool operator()(const std::string& a, const std::string& b) const;
+};
+
+using Headers = std::multimap<std::string, std::string, HeaderLess>;
+
+// A parsed HTTP request. The members are named like cpp-httplib's Request.
+struct HttpRequest {
+  std::string method;
+  std::string path;    // The path, without the query string.
+  std::string version; // E.g. "HTTP/1.1".
+  Headers headers;
+  std::string body;
+  std::multimap<std::string, std::string> params; // The decoded query string.
+  std::smatch matches;     // The route's regex groups, matched against `path`.
+  std::string remote_addr; // The client's IP address, or "unix" for Unix socket clients.
+  Clock::time_point received; // When the whole request had been read.
+
+  bool has_param(const std::string& name) const;
+  std::string get_param_value(const std::string& name) const;
+  std::string get_header_value(const std::string& name) const;
+};
+
+// Streams a chunked response body. write() never blocks; it returns false if
+// the connection has been closed.
+class HttpDataSink {
+public:
+  virtual ~HttpDataSink() = default;
+  virtual bool write(const char* data, size_t length) = 0;
+  virtual void done() = 0;
+};
+
+// A response, filled in by a handler. The members are named like
+// cpp-httplib's Response.
+struct HttpResponse {
+  // Called repeatedly with the offset written so far until it calls
+  // sink.done(), or returns false to abort the response. Each call should
+  // write a page of the body, not all of it: between calls, the provider is
+  // set aside while the client is behind on reading.
+  using ContentProvider = std::function<bool(size_t offset, HttpDataSink& sink)>;
+
+  int status = 200;
+  Headers headers;
+  std::string body;
+  ContentProvider content_provider; // If set, the body is streamed with chunked encoding instead.
+
+  void set_header(const std::string& name, const std::string& value);
+  void set_content(std::string content, const std::string& content_type);
+  void set_chunked_content_provider(const std::string& content_type, ContentProvider provider);
+};
+
+// Settings for HttpServer.
+struct HttpServerOptions {
+  size_t io_threads = 1;                                   // Event loop threads.
+  std::chrono::seconds keep_alive_timeout { 60 };          // How long an idle connection is kept open.
+  size_t keep_alive_max = 0;                               // The most requests per connection (0 = unlimited).
+  std::chrono::seconds read_timeout { 10 };                // How long a client may take to send a request, or to read a response.
+  size_t max_body = 64 << 20;                              // The largest request body accepted.
+};
+
+// An HTTP/1.1 server built on epoll. A few event loop threads accept
+// connections, read requests, and write responses, all without blocking, so a
+// slow client or an idle keep-alive connection doesn't hold a thread. Once a
+// request has been read, its handler is called on the event loop thread; a
+// handler should hand any real work off to a worker pool and call `done` from
+// there when the response is ready. Listens on TCP ports and Unix sockets.
+class HttpServer {
+public:
+  // Reports that a response is ready, or the error that stopped the handler.
+  // Must be called exactly once, from any thread. If the response has a
+  // content provider, it's started on the calling thread, and returns once
+  // the client falls behind; the rest is run on the stream executor.
+  using Done = std::function<void(std::exception_ptr error)>;
+  using Handler = std::function<void(const HttpRequest& request, HttpResponse& response, Done done)>;
+  using Logger = std::function<void(const HttpRequest& request, const HttpResponse& response)>;
+  using ExceptionHandler = std::function<void(const HttpRequest& request, HttpResponse& response, std::exception_ptr error)>;
+
+  // Runs a task on another thread, or returns false if it can't.
+  using Executor = std::function<bool(std::function<void()> task)>;
+
+  explicit HttpServer(HttpServerOptions options = {});
+  ~HttpServer();
+  HttpServer(const HttpServer&) = delete;
+  HttpServer& operator=(const HttpServer&) = delete;
+
+  // Route requests whose path matches `pattern` to `handler`.
+  void Get(const std::string& pattern, Handler handler);
+  void Post(const std::string& pattern, Handler handler);
+  void Delete(const std::string& pattern, Handler handler);
+
+  // Called after each response is ready.
+  void set_logger(Logger logger);
+
+  // Fills in the response for an error passed to `done`.
+  void set_exception_handler(ExceptionHandler handler);
+
+  // Resumes streamed responses once their client has caught up. Without one,
+  // or when it's full, they're resumed on the event loop thread.
+  void set_stream_executor(Executor executor);
+
+  // Listen on a TCP port, or on a Unix socket at `path`. Throw on failure.
+  void bind(const std::string& host, int port);
+  void bindUnix(const std::string& path);
+
+  // Serve requests until stop() is called.
+  void run();
+
+  // Stop serving. Safe to call from a signal handler.
+  void stop();
+
+  // The number of open client connections.
+  size_t connectionCount() const noexcept { return connections_; }
+
+private:
+  class Loop;
+  class ChunkSink;
+  struct Connection;
+  struct Exchange;
+  struct Stream;
+  struct Route {
+    std::string method;
+    std::regex pattern;
+    Handler handler;
+  };
+
+  void dispatch(std::shared_ptr<Exchange> exchange);
+  void finish(std::shared_ptr<Exchange> exchange, std::exception_ptr error);
+  void produce(std::shared_ptr<Stream> stream);
+  void resume(std::shared_ptr<Stream> stream);
+
+  const HttpServerOptions options_;
+  std::vector<Route> routes_;
+  Logger logger_;
+  ExceptionHandler exception_handler_;
+  Executor stream_executor_;
+
+  std::vector<int> listeners_;
+  std::vector<std::string> unix_paths_;
+  std::vector<std::unique_ptr<Loop>> loops_;
+  std::atomic<size_t> connections_ = 0;
+};
+
+}
+
+#endif
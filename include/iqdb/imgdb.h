@@ -24,10 +24,15 @@
 #ifndef IMGDBASE_H
 #define IMGDBASE_H
 
+#include <chrono>
+#include <functional>
+#include <limits>
 #include <memory>
+#include <optional>
 #include <string>
 #include <vector>
 
+#include <iqdb/exact_index.h>
 #include <iqdb/haar.h>
 #include <iqdb/haar_signature.h>
 #include <iqdb/imglib.h>
@@ -58,6 +63,7 @@ DEFINE_ERROR(fatal_error, base_error)
 DEFINE_ERROR(simple_error, base_error)
 DEFINE_ERROR(param_error, simple_error) // An argument was invalid, e.g. non-existent image ID.
 DEFINE_ERROR(image_error, simple_error) // Could not successfully extract image data from the given file.
+DEFINE_ERROR(timeout_error, simple_error) // The query's deadline passed before it finished.
 
 typedef struct {
   Score v[3];
@@ -71,39 +77,214 @@ struct sim_value {
 };
 
 struct image_info {
-  image_info() {}
+  image_info() : id(0), avgl{} {}
   image_info(imageId i, const lumin_native &a) : id(i), avgl(a) {}
   imageId id;
   lumin_native avgl;
 };
 
 typedef std::vector<sim_value> sim_vector;
+
+// A pair of near-duplicate images. The score is the higher of the two images'
+// scores against each other.
+struct DuplicatePair {
+  postId a; // The lower post id.
+  postId b;
+  Score score;
+};
 typedef Idx sig_t[NUM_COEFS];
 
+class KnnGraph;
+class LshIndex;
+class QueryCache;
+struct CachedQuery;
+struct Neighbor;
+
+// The number of bytes used by the in-memory index.
+struct MemoryUsage {
+  size_t buckets; // The bucket_set.
+  size_t m_info;  // The image_info array.
+  BucketArenaStats bucket_arena; // Breakdown of the bucket_set's arena.
+  size_t exact_index; // The ExactIndex.
+  size_t knn_graph;   // The KnnGraph (0 if disabled).
+  size_t lsh_index;   // The LshIndex (0 if disabled).
+};
+
+using Deadline = std::chrono::steady_clock::time_point;
+
+// Restricts a query to some of the posts in the database.
+struct QueryFilter {
+  postId min_id = 0;                                  // The lowest post id to return.
+  postId max_id = std::numeric_limits<postId>::max(); // The highest post id to return.
+  std::vector<postId> post_ids;                       // If not empty, only return these posts. Must be sorted.
+
+  bool matches(postId post_id) const;
+};
+
+// Details about how a query was run, for finding out why a query was slow.
+struct QueryProfile {
+  // A bucket visited by the query.
+  struct Bucket {
+    int color;    // The YIQ channel (0-2).
+    int coef;     // The signed Haar coefficient index.
+    size_t size;  // The number of images in the bucket.
+    Score weight; // The weight subtracted from the score of each image in the bucket.
+  };
+
+  int num_colors = 0;         // 1 if the grayscale path was taken, 3 otherwise.
+  size_t images = 0;          // The number of slots scored in the DC pass.
+  std::vector<Bucket> buckets;
+  size_t ids_scattered = 0;   // The total number of bucket entries visited.
+  size_t candidates = 0;      // The number of live images compared in the top-k pass.
+  size_t heap_updates = 0;    // The number of times a candidate displaced a result.
+
+  std::chrono::steady_clock::duration dc_time {};
+  std::chrono::steady_clock::duration scatter_time {};
+  std::chrono::steady_clock::duration topk_time {};
+};
+
+// Optional per-query settings.
+struct QueryOptions {
+  // Abandon the query with a timeout_error once this time has passed.
+  std::optional<Deadline> deadline;
+
+  // If set, record how the query was run here. Profiled queries skip the
+  // cache lookup, so that the profile shows the cost of a real scan.
+  QueryProfile* profile = nullptr;
+
+  // If non-zero and the approximate index is enabled, only score the images
+  // found in this many of its tables, instead of every image. More probes
+  // give better recall but slower queries. Approximate queries aren't cached.
+  size_t probes = 0;
+
+  // If set, only return posts that match the filter. Scores are the same as
+  // in an unfiltered query. Filtered queries aren't cached.
+  std::optional<QueryFilter> filter;
+
+  // Throw a timeout_error if the deadline has passed.
+  void checkDeadline() const;
+};
+
+// One query in a batch for IQDB::queryBatch.
+struct BatchQuery {
+  HaarSignature signature;
+  size_t numres;
+};
+
 class IQDB {
 public:
-  IQDB(std::string filename = ":memory:");
+  // Open the index stored in `table` of the database file. Several IQDBs can
+  // share one file, each with its own table.
+  IQDB(std::string filename = ":memory:", std::string table = "images");
+  ~IQDB();
 
   // Image queries.
-  sim_vector queryFromSignature(const HaarSignature& img, size_t numres = 10);
-  sim_vector queryFromChannels(const std::vector<unsigned char> rchan, const std::vector<unsigned char> gchan, const std::vector<unsigned char> bchan, int numres = 10);
+  sim_vector queryFromSignature(const HaarSignature& img, size_t numres = 10, const QueryOptions& options = {});
+  sim_vector queryFromChannels(const std::vector<unsigned char> rchan, const std::vector<unsigned char> gchan, const std::vector<unsigned char> bchan, int numres = 10, const QueryOptions& options = {});
+
+  // Find every image that scores at least `min_score`, however many there
+  // are, best match first. The scores are the same as queryFromSignature's.
+  // Every image is scanned, even if `probes` is set; the filter applies.
+  // Threshold queries aren't cached.
+  sim_vector queryAboveThreshold(const HaarSignature& signature, Score min_score, const QueryOptions& options = {});
+
+  // Run several queries in one pass over the database, reading each image's
+  // info once for the whole batch instead of once per query. The results are
+  // the same as running each query with queryFromSignature, in the same order
+  // as `queries`. The deadline applies to the whole batch; probes, filters
+  // and profiles aren't supported.
+  std::vector<sim_vector> queryBatch(const std::vector<BatchQuery>& queries, const QueryOptions& options = {});
+
+  // Find images similar to a post in the database, not including the post
+  // itself. Returns nullopt if the post isn't in the database. Answered from
+  // the k-NN graph if it's enabled and `numres` is at most its k.
+  std::optional<sim_vector> querySimilar(postId post_id, size_t numres = 10, const QueryOptions& options = {});
+
+  // Find every pair of images where either image scores at least `threshold`
+  // when querying with the other, using `threads` threads. Images are read
+  // from the database `block` at a time, and each block's pairs are passed to
+  // `func` after the block is done, in order, from the calling thread. Not
+  // safe to call concurrently with anything else.
+  void findDuplicates(Score threshold, size_t threads, size_t block, std::function<void(const DuplicatePair&)> func);
+
+  // Find up to `limit` images with exactly the same signature, without a
+  // similarity scan. Matches have a score of 100.
+  sim_vector findExact(const HaarSignature& signature, size_t limit = 10);
 
   // Stats.
   size_t getImgCount();
+  MemoryUsage memoryUsage() const;
   bool isDeleted(imageId id); // XXX id is the iqdb id
+  size_t imageSlots() const noexcept { return m_info.size(); } // One more than the highest iqdb id.
 
   // DB maintenance.
   void addImage(imageId id, const HaarSignature& signature);
   std::optional<Image> getImage(imageId post_id);
+  std::vector<Image> getImages(const std::vector<imageId>& post_ids); // The images of these posts that exist, in no particular order.
+  std::vector<Image> getImages(iqdbId first, size_t limit); // Up to `limit` images from iqdb id `first` on, in id order.
   void removeImage(imageId id);
   void loadDatabase(std::string filename);
+  void compactMemory(); // Pack the buckets tightly after adding many images.
+
+  // Renumber the images so that images in the same popular buckets get nearby
+  // iqdb ids, and the gaps left by removed images are closed. Rewrites the ids
+  // in the database and rebuilds the in-memory index. No other process may
+  // have the table open, since its ids would no longer match.
+  void reorder();
+
+  // Cache the results of up to `capacity` queries. 0 disables the cache.
+  void enableQueryCache(size_t capacity);
+  QueryCache* queryCache() { return query_cache_.get(); }
+
+  // Keep the `k` nearest neighbours of every image, for querySimilar. The
+  // graph is loaded from `<dbfile>.knn` (`<dbfile>.<table>.knn` for tables
+  // other than `images`) if it was saved for this state of the database,
+  // otherwise it starts out empty. Lists are filled in by fillNeighbors or the
+  // first time they're needed, and kept up to date by addImage and
+  // removeImage. 0 disables the graph.
+  void enableKnnGraph(size_t k);
+  KnnGraph* knnGraph() { return knn_graph_.get(); }
+
+  // Build the neighbour list of `iqdb_id` if it isn't built yet. Returns false
+  // if there was nothing to do.
+  bool fillNeighbors(iqdbId iqdb_id);
+
+  // Write the k-NN graph to its file. Does nothing for in-memory databases.
+  void saveKnnGraph();
+
+  // Index every image in `tables` LSH tables, for queries with `probes` set.
+  // 0 disables the index.
+  void enableLshIndex(size_t tables);
+  LshIndex* lshIndex() { return lsh_index_.get(); }
 
 private:
+  void loadImages();
   void addImageInMemory(imageId iqdb_id, imageId post_id, const HaarSignature& signature);
+  void removeImageInMemory(const Image& image);
+  bool patchCachedQuery(CachedQuery& entry, imageId iqdb_id, imageId post_id, const HaarSignature& signature);
+  sim_vector scan(const HaarSignature& signature, size_t numres, const QueryOptions& options, Score& scale);
+  template <int Colors> sim_vector scan(const HaarSignature& signature, size_t numres, const QueryOptions& options, Score& scale);
+  template <int Colors> std::vector<Score> scoreAll(const HaarSignature& signature, const QueryOptions& options, Score& scale);
+  std::vector<iqdbId> filterCandidates(const QueryFilter& filter);
+  std::vector<sim_vector> scanBatch(const std::vector<const BatchQuery*>& queries, const QueryOptions& options, std::vector<Score>& scales);
+  sim_vector scanCandidates(const HaarSignature& signature, const std::vector<iqdbId>& candidates, size_t numres, const QueryOptions& options, Score& scale);
+  template <int Colors> sim_vector scanCandidates(const HaarSignature& signature, const std::vector<iqdbId>& candidates, size_t numres, const QueryOptions& options, Score& scale);
+  Score pairScore(const HaarSignature& query, const HaarSignature& signature, iqdbId iqdb_id);
+  std::vector<Neighbor> findNeighbors(iqdbId iqdb_id, const HaarSignature& signature, size_t count, const QueryOptions& options = {});
+  sim_vector similarFromGraph(const Image& image, size_t numres, const QueryOptions& options);
+  void addToKnnGraph(iqdbId iqdb_id, postId post_id, const HaarSignature& signature);
+  uint64_t fingerprint();
+  std::string knnFilename() const;
 
   std::vector<image_info> m_info;
   std::unique_ptr<SqliteDB> sqlite_db_;
+  std::unique_ptr<QueryCache> query_cache_;
+  std::unique_ptr<KnnGraph> knn_graph_;
+  std::unique_ptr<LshIndex> lsh_index_;
+  std::string filename_;
+  std::string table_;
   bucket_set imgbuckets;
+  ExactIndex exact_index_;
   size_t img_count = 0;
 
 private:
@@ -24,6 +24,7 @@
 #ifndef IMGDBLIB_H
 #define IMGDBLIB_H
 
+#include <iqdb/bucket_arena.h>
 #include <iqdb/haar.h>
 #include <iqdb/sqlite_db.h>
 
@@ -31,7 +32,7 @@ namespace iqdb {
 
 // Weights for the Haar coefficients.
 // Straight from the referenced paper:
-const Score weights[6][3] =
+constexpr Score weights[6][3] =
     // For scanned picture (sketch=0):
     //    Y      I      Q       idx total occurs
     {{5.00f, 19.21f, 34.37f}, // 0   58.58      1 (`DC' component)
@@ -67,14 +68,51 @@ struct ImgBin {
 
 constexpr static auto imgBin = ImgBin<NUM_PIXELS>();
 
-using bucket_t = std::vector<uint32_t>;
+// The weight of a signature's coefficient `coef` in color channel `c`.
+constexpr Score coefWeight(int c, int coef) {
+  return weights[imgBin.bin[coef < 0 ? -coef : coef]][c];
+}
+
+using bucket_t = Bucket;
 
 class bucket_set {
 public:
-  bucket_t& at(int col, int coef);
+  const bucket_t& at(int col, int coef) const;
   void add(const HaarSignature &sig, imageId iqdb_id);
   void remove(const HaarSignature &sig, imageId iqdb_id);
-  void eachBucket(const HaarSignature &sig, std::function<void(bucket_t&)> func);
+
+  // Call `func(bucket)` for each bucket an image with signature `sig` is in.
+  template <typename F>
+  void eachBucket(const HaarSignature &sig, F func) {
+    if (sig.num_colors() == 1) {
+      eachBucket<1>(sig, func);
+    } else {
+      eachBucket<3>(sig, func);
+    }
+  }
+
+  // Like eachBucket, for a signature with `Colors` color channels.
+  template <int Colors, typename F>
+  void eachBucket(const HaarSignature &sig, F func) {
+    for (int c = 0; c < Colors; c++) {
+      for (int i = 0; i < NUM_COEFS; i++) {
+        const int coef = sig.sig[c][i];
+        func(buckets[c][coef < 0][coef < 0 ? -coef : coef]);
+      }
+    }
+  }
+
+  // Remove every image from every bucket.
+  void clear();
+
+  // Pack the buckets tightly into memory, e.g. after loading the database.
+  void compact();
+
+  // The number of bytes used by the buckets.
+  size_t memoryUsage() const;
+
+  // Memory usage of the arena holding the buckets' ids.
+  BucketArenaStats arenaStats() const;
 
 private:
   static const size_t n_colors  = 3;                     // 3 color channels (YIQ)
@@ -83,6 +121,7 @@ private:
 
   // 3 * 2 * 16384 = 98304 total buckets
   bucket_t buckets[n_colors][n_signs][n_indexes];
+  BucketArena arena_;
 };
 
 }
@@ -0,0 +1,50 @@
+#ifndef IQDB_KERNELS_H
+#define IQDB_KERNELS_H
+
+#include <cstddef>
+
+#include <iqdb/haar.h>
+#include <iqdb/imgdb.h>
+#include <iqdb/types.h>
+
+namespace iqdb {
+
+// The instruction sets the hot loops are compiled for, from oldest to newest.
+enum class Isa { scalar, sse42, avx2, avx512 };
+
+// The hot loops of queries and signature computation, compiled once for each
+// ISA. The best version the CPU supports is picked at startup, so one binary
+// runs on every x86-64 machine. Every version gives bit-identical results.
+struct Kernels {
+  Isa isa;
+
+  // scores[i] = the DC part of info[i]'s score against a query with the given
+  // average luminances, for i in [0, count). `colors` is 1 or 3.
+  void (*dc)(const image_info* info, size_t count, int colors, const Score* dc_weights, const Score* avgl, Score* scores);
+
+  // Subtract `weight` from scores[id - offset] for every id in a bucket.
+  void (*scatter)(Score* scores, const iqdbId* ids, size_t count, iqdbId offset, Score weight);
+
+  // The first i in [begin, end) with scores[i] < threshold, or end if none is.
+  size_t (*find_below)(const Score* scores, size_t begin, size_t end, Score threshold);
+
+  // The first i in [begin, end) with |values[i]| > threshold, or end if none is.
+  size_t (*find_above_abs)(const Unit* values, size_t begin, size_t end, Unit threshold);
+
+  // The 2D Haar transform of one NUM_PIXELS x NUM_PIXELS channel, in place.
+  void (*haar2D)(Unit* a);
+};
+
+// The kernels in use. Chosen on first use, from the best ISA the CPU supports,
+// or from the IQDB_ISA environment variable (scalar, sse4.2, avx2 or avx512)
+// if it names an ISA the CPU supports.
+const Kernels& kernels();
+
+// The kernels for a specific ISA, or nullptr if the CPU doesn't support it.
+const Kernels* kernels_for(Isa isa);
+
+const char* isa_name(Isa isa);
+
+}
+
+#endif
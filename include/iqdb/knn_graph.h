@@ -0,0 +1,84 @@
+#ifndef IQDB_KNN_GRAPH_H
+#define IQDB_KNN_GRAPH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <iqdb/types.h>
+
+namespace iqdb {
+
+// An entry in an image's neighbour list.
+struct Neighbor {
+  iqdbId id;      // The neighbour's iqdb id.
+  postId post_id; // The neighbour's post id, to tell if the iqdb id was reused.
+  Score score;    // The neighbour's score when querying with the image's signature.
+};
+
+// The k nearest neighbours of every image, so that finding images similar to
+// a stored post is a lookup instead of a scan.
+//
+// Lists are indexed by iqdb id and hold up to k neighbours, best first. A list
+// is either built or not; lists that haven't been built yet (or were thrown
+// away) are filled in on demand by the owner. Lists aren't patched when an
+// image is removed, so entries may point at removed images, and the owner must
+// check each entry against the index before using it.
+//
+// Safe to use from concurrent queries.
+class KnnGraph {
+public:
+  static constexpr size_t max_k = 254;
+
+  explicit KnnGraph(size_t k);
+
+  size_t k() const noexcept { return k_; }
+
+  // Make room for the lists of iqdb ids below `slots`.
+  void resize(size_t slots);
+
+  // The neighbours of `id`, best first, or nullopt if its list isn't built.
+  std::optional<std::vector<Neighbor>> get(iqdbId id) const;
+
+  // Replace the list of `id` with the first k of `neighbors`, which must be
+  // sorted best first.
+  void set(iqdbId id, const std::vector<Neighbor>& neighbors);
+
+  // Insert `neighbor` into the list of `id`, if the list is built and the
+  // neighbour beats its worst entry or the list isn't full. Any older entry
+  // for the same image is replaced.
+  void offer(iqdbId id, const Neighbor& neighbor);
+
+  // Throw away the list of `id`, so that it's rebuilt when it's next needed.
+  void invalidate(iqdbId id);
+
+  // The number of built lists.
+  size_t built() const;
+
+  size_t memoryUsage() const;
+
+  // Write the graph to `filename`. `fingerprint` identifies the state of the
+  // database the graph was built for.
+  void save(const std::string& filename, uint64_t fingerprint) const;
+
+  // Read a graph written by `save`. Returns nullptr if the file doesn't exist
+  // or was written for a different k or a different database.
+  static std::unique_ptr<KnnGraph> load(const std::string& filename, size_t k, uint64_t fingerprint);
+
+private:
+  static constexpr uint8_t unbuilt = 0xff;
+
+  const size_t k_;
+  std::vector<uint8_t> sizes_;       // The length of each list, or `unbuilt`.
+  std::vector<Neighbor> neighbors_;  // k entries per list.
+  size_t built_ = 0;
+  mutable std::mutex mutex_;
+};
+
+}
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef IQDB_LSH_INDEX_H
+#define IQDB_LSH_INDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <iqdb/bucket_arena.h>
+#include <iqdb/haar_signature.h>
+#include <iqdb/types.h>
+
+namespace iqdb {
+
+// Locality-sensitive hash tables over the signatures, for approximate queries.
+//
+// A signature is treated as the set of its (channel, signed coefficient)
+// pairs. Each table is keyed by `rows` MinHashes of that set, so two images
+// land in the same bucket of a table with probability J^rows, where J is the
+// Jaccard similarity of their coefficient sets. Probing more tables finds more
+// of the true matches at the cost of more candidates to score. With 3 rows,
+// near-duplicates (J > 0.8) collide in about half the tables, while images
+// that only share a few common coefficients almost never do.
+//
+// Luminance isn't part of the key; candidates are scored exactly, DC term
+// included, by the caller. Not thread-safe; the owner must lock it like the
+// rest of the in-memory index.
+class LshIndex {
+public:
+  static constexpr size_t max_tables = 64;
+  static constexpr size_t rows = 3;
+
+  explicit LshIndex(size_t tables);
+
+  void add(const HaarSignature& signature, iqdbId iqdb_id);
+  void remove(const HaarSignature& signature, iqdbId iqdb_id);
+  void clear();
+
+  // The ids in the same bucket as `signature` in any of the first `probes`
+  // tables, sorted and without duplicates.
+  std::vector<iqdbId> candidates(const HaarSignature& signature, size_t probes) const;
+
+  size_t tables() const noexcept { return tables_; }
+
+  // The number of bytes used by the tables.
+  size_t memoryUsage() const;
+
+private:
+  static constexpr int bucket_bits = 18; // Buckets per table, as a power of two.
+
+  // The bucket of `signature` in each table.
+  std::vector<uint32_t> keys(const HaarSignature& signature) const;
+
+  Bucket& bucket(size_t table, uint32_t key) { return buckets_[(table << bucket_bits) + key]; }
+  const Bucket& bucket(size_t table, uint32_t key) const { return buckets_[(table << bucket_bits) + key]; }
+
+  const size_t tables_;
+  std::vector<Bucket> buckets_;
+  BucketArena arena_;
+};
+
+}
+
+#endif
@@ -0,0 +1,148 @@
+#ifndef IQDB_METRICS_H
+#define IQDB_METRICS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace iqdb {
+
+using Clock = std::chrono::steady_clock;
+
+// A monotonically increasing count, e.g. the number of requests served.
+class Counter {
+public:
+  explicit Counter(std::string labels = "") : labels_(labels) {}
+
+  void inc(uint64_t n = 1) noexcept { value_.fetch_add(n, std::memory_order_relaxed); }
+  uint64_t value() const noexcept { return value_.load(std::memory_order_relaxed); }
+  const std::string& labels() const noexcept { return labels_; }
+
+private:
+  const std::string labels_;
+  std::atomic<uint64_t> value_ = 0;
+};
+
+// A latency histogram with fixed buckets from 10us to 10s. Observing a value
+// is a few relaxed atomic increments, so it's cheap enough for hot paths.
+class Histogram {
+public:
+  static constexpr std::array<double, 19> bounds = {
+    0.00001, 0.000025, 0.00005, 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005,
+    0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10
+  };
+
+  explicit Histogram(std::string labels = "") : labels_(labels) {}
+
+  void observe(Clock::duration duration) noexcept;
+
+  // Append the histogram's samples in the Prometheus text format.
+  void render(std::string& out, const std::string& name) const;
+
+private:
+  const std::string labels_;
+  std::array<std::atomic<uint64_t>, bounds.size() + 1> buckets_ = {}; // The last bucket is +Inf.
+  std::atomic<uint64_t> sum_ns_ = 0;
+  std::atomic<uint64_t> count_ = 0;
+};
+
+// Records the time from construction to destruction in a histogram.
+class ScopedTimer {
+public:
+  explicit ScopedTimer(Histogram& histogram) : histogram_(histogram), start_(Clock::now()) {}
+  ~ScopedTimer() { histogram_.observe(Clock::now() - start_); }
+
+private:
+  Histogram& histogram_;
+  const Clock::time_point start_;
+};
+
+// Times consecutive phases of an operation. Each call to `lap` records the
+// time since the previous lap (or since construction) in a histogram.
+class Stopwatch {
+public:
+  Stopwatch() : last_(Clock::now()) {}
+
+  Clock::duration lap(Histogram& histogram) noexcept {
+    const auto now = Clock::now();
+    const auto elapsed = now - last_;
+    histogram.observe(elapsed);
+    last_ = now;
+    return elapsed;
+  }
+
+private:
+  Clock::time_point last_;
+};
+
+// The server's metrics, exported at `GET /metrics`.
+struct Metrics {
+  // Time spent in each phase of IQDB::queryFromSignature.
+  Histogram query_dc { R"(phase="dc")" };
+  Histogram query_scatter { R"(phase="scatter")" };
+  Histogram query_topk { R"(phase="topk")" };
+
+  // Time spent scanning for a batch of queries in IQDB::queryBatch, and time
+  // queries spent waiting for their batch to start.
+  Histogram query_batch;
+  Histogram batch_wait;
+
+  // Time spent in IQDB::addImage and IQDB::removeImage.
+  Histogram add_image;
+  Histogram remove_image;
+
+  // Time spent in SQLite calls.
+  Histogram sqlite_get { R"(op="get")" };
+  Histogram sqlite_add { R"(op="add")" };
+  Histogram sqlite_remove { R"(op="remove")" };
+
+  // Time spent waiting to lock the database.
+  Histogram lock_wait_read { R"(mode="read")" };
+  Histogram lock_wait_write { R"(mode="write")" };
+
+  // Time spent in each HTTP handler, and in parts of the handlers.
+  Histogram request_add { R"(route="add")" };
+  Histogram request_remove { R"(route="remove")" };
+  Histogram request_get { R"(route="get")" };
+  Histogram request_query { R"(route="query")" };
+  Histogram request_similar { R"(route="similar")" };
+  Histogram request_cursor { R"(route="cursor")" };
+  Histogram handler_signature { R"(step="signature")" };
+  Histogram handler_lookup { R"(step="lookup")" };
+  Histogram handler_json { R"(step="json")" };
+
+  Counter queries;
+  Counter query_timeouts;
+  Counter exact_hits { R"(result="hit")" };
+  Counter exact_misses { R"(result="miss")" };
+  Counter knn_hits { R"(result="hit")" };
+  Counter knn_misses { R"(result="miss")" };
+  Counter query_batches;
+  Counter batched_queries;
+  Counter http_connections;
+
+  // Render all metrics in the Prometheus text format.
+  std::string render() const;
+};
+
+extern Metrics metrics;
+
+// Append a metric family's HELP and TYPE header in the Prometheus text format.
+void render_header(std::string& out, const std::string& name, const std::string& type, const std::string& help);
+
+// Append a single sample in the Prometheus text format.
+void render_sample(std::string& out, const std::string& name, const std::string& labels, double value);
+
+// The resident set size of the process in bytes, or 0 if unknown.
+size_t resident_memory();
+
+// The bytes of the process's memory backed by transparent huge pages, or 0 if
+// unknown.
+size_t anon_huge_pages();
+
+}
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef IQDB_QUERY_BATCHER_H
+#define IQDB_QUERY_BATCHER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include <iqdb/haar_signature.h>
+#include <iqdb/imgdb.h>
+#include <iqdb/metrics.h>
+
+namespace iqdb {
+
+// A query was submitted after the batcher was shut down.
+DEFINE_ERROR(shutdown_error, simple_error)
+
+// A query waiting in a QueryBatcher.
+struct BatchedQuery {
+  HaarSignature signature;
+  size_t limit;
+  std::optional<Deadline> deadline;
+  Clock::time_point queued = Clock::now();
+
+  // Filled in by whoever runs the batch, before `done` is called.
+  sim_vector matches;
+  std::vector<std::optional<Image>> images;
+
+  // Called once the results are in, or with the error that stopped the query.
+  std::function<void(std::exception_ptr error)> done;
+};
+
+// Coalesces queries that arrive close together, so that they can be run in
+// one pass over the index. A batch is closed `window` after its first query
+// arrives, or as soon as it has `max_batch` queries, and is passed to `run`.
+// `run` is called on the batcher's own thread, so it should hand the batch off
+// to a worker rather than run it itself; it must call every query's `done`
+// exactly once.
+class QueryBatcher {
+public:
+  using Batch = std::vector<std::shared_ptr<BatchedQuery>>;
+
+  QueryBatcher(std::chrono::microseconds window, size_t max_batch, std::function<void(Batch)> run);
+  ~QueryBatcher();
+
+  // Queue a query for the next batch. `query->done` is called when it has run,
+  // or right away with a shutdown_error if the batcher has been shut down.
+  void submit(std::shared_ptr<BatchedQuery> query);
+
+  // Pass any queued queries to `run`, then stop.
+  void shutdown();
+
+private:
+  void loop();
+
+  const std::chrono::microseconds window_;
+  const size_t max_batch_;
+  const std::function<void(Batch)> run_;
+
+  std::mutex mutex_;
+  std::condition_variable queued_;
+  std::deque<std::shared_ptr<BatchedQuery>> pending_;
+  bool stopping_ = false;
+  std::thread thread_;
+};
+
+}
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef IQDB_QUERY_CACHE_H
+#define IQDB_QUERY_CACHE_H
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+#include <iqdb/haar_signature.h>
+#include <iqdb/imgdb.h>
+#include <iqdb/types.h>
+
+namespace iqdb {
+
+// A cached query result.
+struct CachedQuery {
+  HaarSignature signature; // The query signature.
+  size_t limit;            // The number of results asked for.
+  sim_vector results;      // The results, best match first, with post ids and normalized scores.
+  Score scale;             // The inverse of the total weight of the query's non-empty buckets (0 if none).
+};
+
+// A bounded LRU cache of query results, keyed by the query signature and
+// limit. Safe to use from concurrent queries. The owner is responsible for
+// patching or dropping entries when images are added or removed.
+class QueryCache {
+public:
+  explicit QueryCache(size_t capacity) : capacity_(capacity) {}
+
+  // Return the cached results for the query, if present.
+  std::optional<sim_vector> get(const HaarSignature& signature, size_t limit);
+
+  // Cache the results of a query, evicting the least recently used entry if full.
+  void put(const HaarSignature& signature, size_t limit, const sim_vector& results, Score scale);
+
+  // Call `func` on each entry. Entries for which `func` returns false are dropped.
+  void update(std::function<bool(CachedQuery&)> func);
+
+  // Drop all entries.
+  void clear();
+
+  size_t size();
+  size_t capacity() const noexcept { return capacity_; }
+  size_t hits() const noexcept { return hits_; }
+  size_t misses() const noexcept { return misses_; }
+
+private:
+  static std::string key(const HaarSignature& signature, size_t limit);
+
+  using lru_list = std::list<std::pair<std::string, CachedQuery>>;
+
+  const size_t capacity_;
+  lru_list entries_; // Most recently used first.
+  std::unordered_map<std::string, lru_list::iterator> index_;
+  std::mutex mutex_;
+
+  std::atomic<size_t> hits_ = 0;
+  std::atomic<size_t> misses_ = 0;
+};
+
+}
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef IQDB_REORDER_H
+#define IQDB_REORDER_H
+
+#include <string>
+
+namespace iqdb {
+
+// Settings for `iqdb reorder`, set with `--name=value` command line flags.
+struct ReorderOptions {
+  std::string table = "images"; // The table to reorder (`images_NAME` for a collection).
+};
+
+// Set an option from a `--name=value` command line flag.
+void parse_option(ReorderOptions& options, const std::string& flag);
+
+// Renumber the images in a database with IQDB::reorder. The server must not
+// be running on the database.
+void reorder_database(const std::string& database_filename, const ReorderOptions& options);
+
+}
+
+#endif
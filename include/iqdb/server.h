@@ -1,13 +1,80 @@
 #ifndef SERVER_H
 #define SERVER_H
 
+#include <functional>
 #include <string>
+#include <vector>
+#include <iqdb/http_server.h>
 #include <iqdb/imgdb.h>
+#include <iqdb/thread_pool.h>
+#include <nlohmann/json_fwd.hpp>
 
 namespace iqdb {
 
+// A request that was rejected because a worker pool's queue was full.
+DEFINE_ERROR(overloaded_error, simple_error)
+
+// Settings for the HTTP server, set with `--name=value` command line flags.
+struct ServerOptions {
+  size_t query_threads = 0;        // Threads for running queries (0 = one per CPU).
+  size_t query_queue = 64;         // Max queries waiting for a query thread.
+  std::vector<int> query_cpus;     // CPUs to pin the query threads to.
+  size_t ingest_threads = 1;       // Threads for adding and removing images.
+  size_t ingest_queue = 64;        // Max writes waiting for an ingest thread.
+  std::vector<int> ingest_cpus;    // CPUs to pin the ingest threads to.
+  size_t http_threads = 16;        // Threads for cheap requests like `/status`, and for snapshots.
+  size_t io_threads = 1;           // Event loop threads for reading requests and writing responses.
+  std::string unix_socket;         // Also listen on a Unix socket at this path (empty = TCP only).
+  size_t keep_alive_timeout = 60;  // Seconds an idle connection is kept open.
+  size_t keep_alive_max = 0;       // The most requests per connection (0 = unlimited).
+  int overload_status = 503;       // HTTP status returned when a queue is full (429 or 503).
+  int query_timeout = 0;           // Default query deadline in milliseconds (0 = no deadline).
+  size_t max_limit = 1000;         // The largest `limit` a query may ask for.
+  size_t max_batch = 1000;         // The most post ids a batch similarity query may ask for.
+  size_t query_cache = 0;          // Max number of cached query results (0 = no cache).
+  size_t cursor_memory = 64;       // Megabytes of ranked results kept for query cursors (0 = no cursors).
+  size_t cursor_ttl = 300;         // Seconds a cursor is kept after it was last read.
+  size_t cursor_depth = 1000;      // How many results are ranked for a query that asks for a cursor.
+  size_t knn = 0;                  // Neighbours per image in the k-NN graph (0 = no graph).
+  size_t knn_threads = 1;          // Threads for building the k-NN graph in the background.
+  size_t lsh_tables = 0;           // Tables in the approximate search index (0 = no index).
+  std::vector<std::string> collections; // Named collections to serve besides the default one.
+  std::string follow;              // The leader to follow as host:port, making this server read-only (empty = not a follower).
+  size_t change_log = 0;           // Recent writes kept for followers to replay (0 = none, so no followers).
+  size_t batch_window = 0;         // Microseconds to wait for concurrent queries to batch together (0 = no batching).
+  size_t batch_size = 16;          // The most queries to run in one batch.
+};
+
+// Set an option from a `--name=value` command line flag.
+void parse_option(ServerOptions& options, const std::string& flag);
+
+// Throw a param_error unless `json` is a `{ channels: { r, g, b } }` image.
+void validate_json_is_valid(nlohmann::json json);
+
+// Call `stop` when the process gets a SIGINT or SIGTERM.
+void install_signal_handlers(std::function<void()> stop);
+
+// Called once a server is listening, with a function that stops it. If given,
+// it's used instead of the signal handlers, so that tests can run a server on
+// a thread of their own.
+using StartedCallback = std::function<void(std::function<void()> stop)>;
+
+using RequestHandler = std::function<void(const HttpRequest& request, HttpResponse& response)>;
+using AsyncRequestHandler = std::function<void(const HttpRequest& request, HttpResponse& response, const HttpServer::Done& done)>;
+
+// A handler that runs `func(request, response, done)` on a worker pool, so
+// that the event loop only does I/O. `func` calls `done` itself once the
+// response is ready, which may be after it returns; exceptions it throws are
+// passed to `done` for it. If the pool's queue is full, fail fast with an
+// overloaded_error instead of making the client wait.
+HttpServer::Handler on_async(WorkerPool& pool, AsyncRequestHandler func);
+
+// A handler that runs `func(request, response)` on a worker pool, and finishes
+// the response when it returns.
+HttpServer::Handler on(WorkerPool& pool, RequestHandler func);
+
 void help();
-void http_server(const std::string host, const int port, const std::string database_filename);
+void http_server(const std::string host, const int port, const std::string database_filename, const ServerOptions& options = {}, StartedCallback on_started = nullptr);
 
 }
 
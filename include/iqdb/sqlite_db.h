@@ -3,16 +3,18 @@
 
 #include <cstdint>
 #include <functional>
+#include <memory>
 #include <mutex>
 #include <optional>
-#include <shared_mutex>
 #include <string>
+#include <utility>
 #include <vector>
 
-#include <sqlite_orm/sqlite_orm.h>
 #include <iqdb/haar_signature.h>
 #include <iqdb/types.h>
 
+struct sqlite3;
+
 namespace iqdb {
 
 // A model representing an image signature stored in the SQLite database.
@@ -27,51 +29,76 @@ struct Image {
   HaarSignature haar() const;
 };
 
-// Initialize the database, creating the table if it doesn't exist.
-static auto initStorage(const std::string& path = ":memory:") {
-  using namespace sqlite_orm;
-
-  auto storage = make_storage(path,
-    make_table("images",
-      make_column("id",       &Image::id, primary_key()),
-      make_column("post_id",  &Image::post_id, unique()),
-      make_column("avglf1",   &Image::avglf1),
-      make_column("avglf2",   &Image::avglf2),
-      make_column("avglf3",   &Image::avglf3),
-      make_column("sig",      &Image::sig)
-    )
-  );
-
-  storage.sync_schema();
-  return storage;
-}
-
 // An SQLite database containing a table of image hashes.
+//
+// Each statement is prepared once, when the database is opened, and reused for
+// every call. File databases are opened in WAL mode, so readers in other
+// connections (other collections in the same file, or `iqdb dupes` running
+// alongside the server) don't block writers, and a commit is an append to the
+// log instead of a rewrite of the journal.
 class SqliteDB {
 public:
-  using Storage = decltype(initStorage());
-
-  // Open database at path. Default to a temporary memory-only database.
-  SqliteDB(const std::string& path = ":memory:") : storage_(initStorage(path)) {};
+  // Open the table at path, creating it if it doesn't exist. Default to a
+  // temporary memory-only database. Several tables in the same file can be
+  // open at once, each with its own connection, so wait for other
+  // connections' locks instead of failing straight away. Throws
+  // std::runtime_error if the database can't be opened.
+  SqliteDB(const std::string& path = ":memory:", const std::string& table = "images");
+  ~SqliteDB();
+  SqliteDB(const SqliteDB&) = delete;
+  SqliteDB& operator=(const SqliteDB&) = delete;
 
   // Get an image from the database, if it exists.
   std::optional<Image> getImage(postId post_id);
 
+  // Get the images with the given post ids, in no particular order. Ids that
+  // aren't in the database are skipped. Looks up many ids per query, so this
+  // is much cheaper than calling getImage() for each one.
+  std::vector<Image> getImages(const std::vector<postId>& post_ids);
+
   // Add the image to the database. Replace the image if it already exists. Returns the internal IQDB id.
   int addImage(postId post_id, HaarSignature signature);
 
   // Remove the image from the database.
   void removeImage(postId post_id);
 
+  // Get up to `limit` images with an IQDB id of at least `first`, in id order.
+  std::vector<Image> getImages(iqdbId first, size_t limit);
+
   // Call a function for each image in the database.
   void eachImage(std::function<void (const Image&)>);
 
+  // Change the IQDB id of each image from `first` to `second`, in one
+  // transaction. Every image must be given a new id, and no two the same one.
+  void renumber(const std::vector<std::pair<iqdbId, iqdbId>>& ids);
+
 private:
-  // The SQLite database.
-  Storage storage_;
+  class Statement;
+
+  // How long to wait for a locked database, in milliseconds.
+  static constexpr int busy_timeout = 5000;
+
+  // How many post ids getImages() looks up per query.
+  static constexpr int batch_size = 64;
+
+  // Run a statement that returns no rows, e.g. a pragma.
+  void exec(const std::string& sql);
+
+  // The SQLite connection.
+  sqlite3* db_ = nullptr;
+
+  // The table's name, quoted for use in SQL.
+  const std::string table_;
+
+  // The prepared statements.
+  std::unique_ptr<Statement> get_;
+  std::unique_ptr<Statement> get_batch_;
+  std::unique_ptr<Statement> get_range_;
+  std::unique_ptr<Statement> add_;
+  std::unique_ptr<Statement> remove_;
 
-  // A mutex around the database
-  std::shared_mutex sql_mutex_;
+  // A mutex around the connection and its statements.
+  std::mutex sql_mutex_;
 };
 
 }
@@ -0,0 +1,69 @@
+#ifndef IQDB_THREAD_POOL_H
+#define IQDB_THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace iqdb {
+
+// A fixed-size pool of worker threads with a bounded task queue. Used to keep
+// expensive work (queries, signature computation, SQLite writes) off of the
+// HTTP server's I/O threads, and to reject work when the server is overloaded
+// instead of letting requests pile up.
+class WorkerPool {
+public:
+  // Start `threads` workers. At most `max_queue` tasks may be waiting at once.
+  // If `cpus` is non-empty, the workers are pinned to those CPUs.
+  WorkerPool(std::string name, size_t threads, size_t max_queue, std::vector<int> cpus = {});
+  ~WorkerPool();
+
+  // Queue a task to be run by a worker. Returns false if the queue is full or
+  // the pool has been shut down, in which case the task is not run.
+  bool submit(std::function<void()> task);
+
+  // Finish the queued tasks and stop the workers.
+  void shutdown();
+
+  // The number of tasks waiting to be picked up by a worker.
+  size_t queueDepth();
+
+  // The number of tasks currently being run by a worker.
+  size_t activeCount();
+
+  // The number of tasks rejected because the queue was full.
+  size_t rejectedCount() const noexcept { return rejected_; }
+
+  const std::string& name() const noexcept { return name_; }
+  size_t threadCount() const noexcept { return thread_count_; }
+  size_t maxQueue() const noexcept { return max_queue_; }
+
+private:
+  void run(size_t n);
+
+  const std::string name_;
+  const size_t thread_count_;
+  const size_t max_queue_;
+  const std::vector<int> cpus_;
+
+  std::vector<std::thread> workers_;
+  std::deque<std::function<void()>> queue_;
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  size_t active_ = 0;
+  bool stopping_ = false;
+  std::atomic<size_t> rejected_ = 0;
+};
+
+// Parse a CPU list like "0-3,8,10-11" into a list of CPU numbers.
+std::vector<int> parse_cpu_list(const std::string& list);
+
+}
+
+#endif
@@ -0,0 +1,254 @@
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+#include <iqdb/bucket_arena.h>
+#include <iqdb/debug.h>
+
+namespace iqdb {
+
+BucketArena::~BucketArena() {
+  clear();
+}
+
+// Small capacities round up to a multiple of 4 ids, so that every block is
+// 16-byte aligned. Above 16 ids there are 4 size classes per power of two:
+// (2^k, 2^(k+1)] is split into steps of 2^(k-2).
+uint32_t BucketArena::roundCapacity(uint32_t capacity) noexcept {
+  capacity = std::max(capacity, 1u);
+  if (capacity <= 16) {
+    return (capacity + 3) & ~3u;
+  }
+
+  const int k = 31 - __builtin_clz(capacity - 1);
+  const uint32_t step = 1u << (k - 2);
+  return (capacity + step - 1) & ~(step - 1);
+}
+
+size_t BucketArena::sizeClass(uint32_t capacity) noexcept {
+  if (capacity <= 16) {
+    return capacity / 4 - 1;
+  }
+
+  const int k = 31 - __builtin_clz(capacity - 1);
+  const uint32_t step = 1u << (k - 2);
+  return 4 + 4 * static_cast<size_t>(k - 4) + (capacity / step - 5);
+}
+
+uint32_t BucketArena::largeCapacity(uint32_t capacity) noexcept {
+  const size_t bytes = roundCapacity(capacity) * sizeof(uint32_t);
+  const size_t rounded = (bytes + huge_page_bytes - 1) / huge_page_bytes * huge_page_bytes;
+  return static_cast<uint32_t>(rounded / sizeof(uint32_t));
+}
+
+BucketArena::Mapping BucketArena::map(size_t bytes) {
+#ifdef MAP_HUGETLB
+  // Explicit huge pages only work if the admin has reserved some (see
+  // /proc/sys/vm/nr_hugepages), so this usually fails.
+  void* address = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (address != MAP_FAILED) {
+    return { address, bytes, true };
+  }
+#endif
+
+  // Otherwise map a little extra, then trim it so that the mapping starts on a
+  // huge page boundary, as transparent huge pages require.
+  const size_t padded = bytes + huge_page_bytes;
+  char* start = static_cast<char*>(mmap(nullptr, padded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+  if (start == MAP_FAILED) {
+    throw std::bad_alloc();
+  }
+
+  const uintptr_t aligned = (reinterpret_cast<uintptr_t>(start) + huge_page_bytes - 1) & ~(huge_page_bytes - 1);
+  char* begin = reinterpret_cast<char*>(aligned);
+  char* end = begin + bytes;
+
+  if (begin > start) {
+    munmap(start, static_cast<size_t>(begin - start));
+  }
+  if (start + padded > end) {
+    munmap(end, static_cast<size_t>(start + padded - end));
+  }
+
+#ifdef MADV_HUGEPAGE
+  madvise(begin, bytes, MADV_HUGEPAGE);
+#endif
+
+  return { begin, bytes, false };
+}
+
+uint32_t* BucketArena::allocate(uint32_t& capacity) {
+  capacity = roundCapacity(capacity);
+
+  if (isLarge(capacity)) {
+    capacity = largeCapacity(capacity);
+    const Mapping mapping = map(capacity * sizeof(uint32_t));
+    uint32_t* block = static_cast<uint32_t*>(mapping.address);
+
+    large_blocks_[block] = mapping;
+    allocated_ += mapping.bytes;
+    return block;
+  }
+
+  const size_t bytes = capacity * sizeof(uint32_t);
+  const size_t size_class = sizeClass(capacity);
+  void* block = free_lists_[size_class];
+
+  if (block != nullptr) {
+    // The next pointer of a free block is stored in the block itself.
+    memcpy(&free_lists_[size_class], block, sizeof(void*));
+    free_ -= bytes;
+  } else {
+    if (slabs_.empty() || slab_used_ + bytes > slab_bytes) {
+      slabs_.push_back(map(slab_bytes));
+      slab_used_ = 0;
+      DEBUG("Mapped bucket slab #{} (hugetlb={}).\n", slabs_.size(), slabs_.back().hugetlb);
+    }
+
+    block = static_cast<char*>(slabs_.back().address) + slab_used_;
+    slab_used_ += bytes;
+    committed_ += bytes;
+  }
+
+  allocated_ += bytes;
+  return static_cast<uint32_t*>(block);
+}
+
+uint32_t* BucketArena::reallocate(uint32_t* block, uint32_t old_capacity, uint32_t size, uint32_t& capacity) {
+  uint32_t* new_block = allocate(capacity);
+
+  if (block != nullptr) {
+    memcpy(new_block, block, size * sizeof(uint32_t));
+    deallocate(block, old_capacity);
+  }
+
+  return new_block;
+}
+
+void BucketArena::deallocate(uint32_t* block, uint32_t capacity) noexcept {
+  if (block == nullptr) {
+    return;
+  }
+
+  if (isLarge(capacity)) {
+    const auto it = large_blocks_.find(block);
+    allocated_ -= it->second.bytes;
+    munmap(it->second.address, it->second.bytes);
+    large_blocks_.erase(it);
+    return;
+  }
+
+  const size_t bytes = capacity * sizeof(uint32_t);
+  const size_t size_class = sizeClass(capacity);
+
+  memcpy(block, &free_lists_[size_class], sizeof(void*));
+  free_lists_[size_class] = block;
+  free_ += bytes;
+  allocated_ -= bytes;
+}
+
+void BucketArena::clear() noexcept {
+  for (const auto& slab : slabs_) {
+    munmap(slab.address, slab.bytes);
+  }
+
+  for (const auto& [block, mapping] : large_blocks_) {
+    munmap(mapping.address, mapping.bytes);
+  }
+
+  slabs_.clear();
+  large_blocks_.clear();
+  slab_used_ = 0;
+  free_lists_ = {};
+  free_ = allocated_ = committed_ = 0;
+}
+
+void BucketArena::compact(std::vector<Bucket*> buckets) {
+  buckets.erase(std::remove_if(buckets.begin(), buckets.end(), [](Bucket* bucket) {
+    return bucket->data_ == nullptr || isLarge(bucket->capacity_);
+  }), buckets.end());
+
+  std::sort(buckets.begin(), buckets.end(), [](Bucket* a, Bucket* b) { return a->data_ < b->data_; });
+
+  auto old_slabs = std::move(slabs_);
+  std::sort(old_slabs.begin(), old_slabs.end(), [](const Mapping& a, const Mapping& b) { return a.address < b.address; });
+
+  slabs_.clear();
+  slab_used_ = 0;
+  free_lists_ = {};
+  free_ = committed_ = allocated_ = 0;
+  for (const auto& [block, mapping] : large_blocks_) {
+    allocated_ += mapping.bytes;
+  }
+
+  // Move blocks in address order, so that each old slab can be unmapped as
+  // soon as the first block past its end is reached.
+  size_t next_slab = 0;
+  for (Bucket* bucket : buckets) {
+    while (next_slab < old_slabs.size() && static_cast<char*>(old_slabs[next_slab].address) + old_slabs[next_slab].bytes <= reinterpret_cast<char*>(bucket->data_)) {
+      munmap(old_slabs[next_slab].address, old_slabs[next_slab].bytes);
+      next_slab++;
+    }
+
+    uint32_t capacity = bucket->size_;
+    uint32_t* block = allocate(capacity);
+    memcpy(block, bucket->data_, bucket->size_ * sizeof(uint32_t));
+    bucket->data_ = block;
+    bucket->capacity_ = capacity;
+  }
+
+  for (; next_slab < old_slabs.size(); next_slab++) {
+    munmap(old_slabs[next_slab].address, old_slabs[next_slab].bytes);
+  }
+}
+
+BucketArenaStats BucketArena::stats() const noexcept {
+  BucketArenaStats stats;
+  stats.committed = committed_;
+  stats.allocated = allocated_;
+  stats.free = free_;
+
+  for (const auto& slab : slabs_) {
+    stats.mapped += slab.bytes;
+    stats.hugetlb += slab.hugetlb ? slab.bytes : 0;
+  }
+
+  for (const auto& [block, mapping] : large_blocks_) {
+    stats.mapped += mapping.bytes;
+    stats.committed += mapping.bytes;
+    stats.hugetlb += mapping.hugetlb ? mapping.bytes : 0;
+  }
+
+  return stats;
+}
+
+void Bucket::insert(BucketArena& arena, uint32_t id) {
+  if (size_ == capacity_) {
+    uint32_t capacity = capacity_ + capacity_ / 2 + 1;
+    data_ = arena.reallocate(data_, capacity_, size_, capacity);
+    capacity_ = capacity;
+  }
+
+  // Ids are almost always added in increasing order, so this is normally an append.
+  uint32_t* pos = data_ + size_;
+  if (size_ > 0 && id < data_[size_ - 1]) {
+    pos = std::upper_bound(data_, data_ + size_, id);
+    memmove(pos + 1, pos, static_cast<size_t>(data_ + size_ - pos) * sizeof(uint32_t));
+  }
+
+  *pos = id;
+  size_++;
+}
+
+void Bucket::erase(BucketArena& arena, uint32_t id) noexcept {
+  size_ = static_cast<uint32_t>(std::remove(data_, data_ + size_, id) - data_);
+
+  if (size_ == 0) {
+    arena.deallocate(data_, capacity_);
+    reset();
+  }
+}
+
+}
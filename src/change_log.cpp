@@ -0,0 +1,134 @@
+#include <random>
+
+#include <fmt/format.h>
+
+#include <iqdb/change_log.h>
+#include <iqdb/imgdb.h>
+
+namespace iqdb {
+
+static std::string random_epoch() {
+  std::random_device random;
+  const uint64_t epoch = (static_cast<uint64_t>(random()) << 32) | random();
+  return fmt::format("{:016x}", epoch);
+}
+
+ChangeLog::ChangeLog(size_t capacity) : capacity_(capacity), epoch_(random_epoch()) {
+  if (capacity == 0) {
+    throw param_error("Change log capacity must be positive");
+  }
+
+  timer_ = std::thread([this] { expireWaiters(); });
+}
+
+ChangeLog::~ChangeLog() {
+  {
+    std::lock_guard lock(mutex_);
+    stopping_ = true;
+  }
+
+  waiters_changed_.notify_all();
+  timer_.join();
+}
+
+uint64_t ChangeLog::append(Type type, postId post_id, const HaarSignature& signature) {
+  std::unique_lock lock(mutex_);
+  const uint64_t seq = ++last_seq_;
+  changes_.push_back({ seq, type, post_id, signature });
+
+  if (changes_.size() > capacity_)
+    changes_.pop_front();
+
+  // Every waiter is waiting for the change after the last one, so this wakes
+  // them all.
+  Waiters woken;
+  woken.swap(waiters_);
+  lock.unlock();
+
+  for (auto& [deadline, func] : woken) {
+    func();
+  }
+
+  return seq;
+}
+
+bool ChangeLog::waitAsync(uint64_t since, Clock::time_point deadline, std::function<void()> func) {
+  {
+    std::lock_guard lock(mutex_);
+    if (since != last_seq_ || stopping_)
+      return false;
+
+    waiters_.emplace(deadline, std::move(func));
+  }
+
+  waiters_changed_.notify_all();
+  return true;
+}
+
+void ChangeLog::wakeAll() {
+  std::unique_lock lock(mutex_);
+  Waiters woken;
+  woken.swap(waiters_);
+  lock.unlock();
+
+  for (auto& [deadline, func] : woken) {
+    func();
+  }
+}
+
+void ChangeLog::expireWaiters() {
+  std::unique_lock lock(mutex_);
+
+  while (!stopping_) {
+    if (waiters_.empty()) {
+      waiters_changed_.wait(lock);
+      continue;
+    }
+
+    // Copy the deadline: append() and wakeAll() may free the waiter while the
+    // lock is released.
+    const auto now = Clock::now();
+    const auto next = waiters_.begin()->first;
+    if (next > now) {
+      waiters_changed_.wait_until(lock, next);
+      continue;
+    }
+
+    Waiters expired;
+    while (!waiters_.empty() && waiters_.begin()->first <= now) {
+      expired.insert(waiters_.extract(waiters_.begin()));
+    }
+
+    lock.unlock();
+    for (auto& [deadline, func] : expired) {
+      func();
+    }
+    lock.lock();
+  }
+}
+
+std::optional<std::vector<ChangeLog::Change>> ChangeLog::since(uint64_t since, size_t limit) {
+  std::unique_lock lock(mutex_);
+
+  if (since > last_seq_)
+    return std::nullopt;
+
+  // The oldest change still kept is last_seq_ - changes_.size() + 1.
+  const uint64_t first = last_seq_ - changes_.size() + 1;
+  if (since + 1 < first)
+    return std::nullopt;
+
+  std::vector<Change> changes;
+  for (uint64_t seq = since + 1; seq <= last_seq_ && changes.size() < limit; seq++) {
+    changes.push_back(changes_[seq - first]);
+  }
+
+  return changes;
+}
+
+uint64_t ChangeLog::lastSeq() const {
+  std::lock_guard lock(mutex_);
+  return last_seq_;
+}
+
+}
@@ -0,0 +1,549 @@
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <iqdb/coordinator.h>
+#include <iqdb/debug.h>
+#include <iqdb/http_server.h>
+#include <iqdb/imgdb.h>
+#include <iqdb/server.h>
+#include <iqdb/thread_pool.h>
+
+#include <httplib.h>
+#include <nlohmann/json.hpp>
+
+using nlohmann::json;
+
+namespace iqdb {
+
+// A shard didn't answer in time, or couldn't be reached.
+DEFINE_ERROR(shard_error, simple_error)
+
+// Keep-alive connections to a shard that aren't in use. A request takes one,
+// or opens a new one if there are none, and puts it back when it's done, so
+// there are never more than the number of requests sent to the shard at once.
+struct IdleClients {
+  std::mutex mutex;
+  std::vector<std::unique_ptr<httplib::Client>> clients;
+};
+
+// An `iqdb http` server that owns some of the posts.
+struct Shard {
+  std::string host;
+  int port;
+  std::shared_ptr<IdleClients> idle = std::make_shared<IdleClients>();
+
+  std::string name() const { return host + ":" + std::to_string(port); }
+};
+
+// A shard's response to a request. The status is 0 if the request failed, and
+// the body is then the error.
+struct ShardResponse {
+  int status;
+  std::string body;
+};
+
+// The optional `/c/:name` prefix of a route, which is passed on to the shards.
+static const std::string collection_prefix = "(/c/[a-z0-9_]+)?";
+
+void parse_option(CoordinatorOptions& options, const std::string& flag) {
+  const auto eq = flag.find('=');
+  const std::string name = flag.substr(0, eq);
+  const std::string value = eq == std::string::npos ? "" : flag.substr(eq + 1);
+
+  try {
+    if (name == "--shards") {
+      options.shards.clear();
+      for (size_t start = 0; start <= value.size();) {
+        const size_t end = std::min(value.find(',', start), value.size());
+        options.shards.push_back(value.substr(start, end - start));
+        start = end + 1;
+      }
+    } else if (name == "--shard-timeout") {
+      options.shard_timeout = std::stoi(value);
+    } else if (name == "--max-limit") {
+      options.max_limit = std::stoul(value);
+    } else if (name == "--max-batch") {
+      options.max_batch = std::stoul(value);
+    } else if (name == "--http-threads") {
+      options.http_threads = std::stoul(value);
+    } else {
+      throw param_error("Unknown option (option=" + flag + ")");
+    }
+  } catch (const std::logic_error&) {
+    throw param_error("Invalid option value (option=" + flag + ")");
+  }
+
+  if (options.shard_timeout <= 0) {
+    throw param_error("--shard-timeout must be positive");
+  }
+}
+
+// Posts are spread over the shards by a hash of their id, so that each shard
+// gets an even share of old and new posts.
+size_t shard_for(postId post_id, size_t shards) {
+  uint64_t z = post_id + 0x9e3779b97f4a7c15; // https://prng.di.unimi.it/splitmix64.c
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+  return (z ^ (z >> 31)) % shards;
+}
+
+static Shard parse_shard(const std::string& address) {
+  const auto colon = address.rfind(':');
+  if (colon == std::string::npos || colon == 0) {
+    throw param_error("Shards must be given as host:port (shard=" + address + ")");
+  }
+
+  try {
+    return { address.substr(0, colon), std::stoi(address.substr(colon + 1)) };
+  } catch (const std::logic_error&) {
+    throw param_error("Invalid shard port (shard=" + address + ")");
+  }
+}
+
+// Send a request to a shard, waiting at most `timeout` for it to connect and
+// answer.
+static ShardResponse send(const Shard& shard, const std::string& method, const std::string& path, const std::string& body, std::chrono::milliseconds timeout) {
+  std::unique_ptr<httplib::Client> client;
+  {
+    std::lock_guard lock(shard.idle->mutex);
+    if (!shard.idle->clients.empty()) {
+      client = std::move(shard.idle->clients.back());
+      shard.idle->clients.pop_back();
+    }
+  }
+
+  if (!client) {
+    client = std::make_unique<httplib::Client>(shard.host, shard.port);
+    client->set_keep_alive(true);
+  }
+
+  client->set_connection_timeout(timeout);
+  client->set_read_timeout(timeout);
+
+  httplib::Result result = method == "POST" ? client->Post(path, body, "application/json")
+                         : method == "DELETE" ? client->Delete(path)
+                         : client->Get(path);
+
+  // A connection that failed may be left half way through a response, so
+  // it's dropped rather than reused.
+  if (!result) {
+    return { 0, httplib::to_string(result.error()) };
+  }
+
+  {
+    std::lock_guard lock(shard.idle->mutex);
+    shard.idle->clients.push_back(std::move(client));
+  }
+
+  return { result->status, result->body };
+}
+
+// Send the same request to every shard at once, and wait for all of them.
+// The first shard is sent to from this thread, and the others from `pool`,
+// or from this thread too, one after the other, if its queue is full.
+static std::vector<ShardResponse> send_all(WorkerPool& pool, const std::vector<Shard>& shards, const std::string& method, const std::string& path, const std::string& body, std::chrono::milliseconds timeout) {
+  std::vector<ShardResponse> responses(shards.size());
+  std::vector<size_t> rejected;
+
+  std::mutex mutex;
+  std::condition_variable finished;
+  size_t pending = 0;
+
+  for (size_t i = 1; i < shards.size(); i++) {
+    {
+      std::lock_guard lock(mutex);
+      pending++;
+    }
+
+    const bool queued = pool.submit([&, i] {
+      responses[i] = send(shards[i], method, path, body, timeout);
+
+      std::lock_guard lock(mutex);
+      pending--;
+      finished.notify_one();
+    });
+
+    if (!queued) {
+      std::lock_guard lock(mutex);
+      pending--;
+      rejected.push_back(i);
+    }
+  }
+
+  responses[0] = send(shards[0], method, path, body, timeout);
+  for (size_t i : rejected) {
+    responses[i] = send(shards[i], method, path, body, timeout);
+  }
+
+  std::unique_lock lock(mutex);
+  finished.wait(lock, [&] { return pending == 0; });
+  return responses;
+}
+
+// Throw a shard_error if a shard couldn't be reached.
+static void check_reachable(const Shard& shard, const ShardResponse& response) {
+  if (response.status == 0) {
+    WARN("Shard {} failed: {}\n", shard.name(), response.body);
+    throw shard_error("Shard " + shard.name() + " failed (" + response.body + ")");
+  }
+}
+
+// Sort matches from several shards by score, best first, and keep the top `limit`.
+static json merge_matches(json matches, size_t limit) {
+  std::stable_sort(matches.begin(), matches.end(), [](const json& a, const json& b) {
+    return a["score"].get<double>() > b["score"].get<double>();
+  });
+
+  if (matches.size() > limit) {
+    matches.erase(matches.begin() + static_cast<ptrdiff_t>(limit), matches.end());
+  }
+
+  return matches;
+}
+
+void coordinator(const std::string host, const int port, const CoordinatorOptions& options, StartedCallback on_started) {
+  if (options.shards.empty()) {
+    throw param_error("`iqdb coordinator` needs at least one shard (--shards=host:port,...)");
+  }
+
+  std::vector<Shard> shards;
+  for (const auto& address : options.shards) {
+    shards.push_back(parse_shard(address));
+  }
+
+  const auto shard_timeout = std::chrono::milliseconds(options.shard_timeout);
+
+  // Requests are sent to all the shards at once from here, so that a query
+  // waits for the slowest shard rather than for each of them in turn.
+  WorkerPool shard_pool("shard", options.http_threads, options.http_threads * shards.size());
+
+  // A query's own `timeout` param, if it has one, is also how long to wait
+  // for the shards.
+  auto query_timeout = [&](const json& params) {
+    if (params.contains("timeout") && params["timeout"].is_number_integer() && params["timeout"] > 0) {
+      return std::chrono::milliseconds(params["timeout"].get<int>());
+    }
+
+    return shard_timeout;
+  };
+
+  auto parse_limit = [&](const json& params) {
+    size_t limit = 10;
+    if (params.contains("limit") && params["limit"].is_number_integer()) {
+      limit = static_cast<size_t>(std::clamp<int64_t>(params["limit"], 1, static_cast<int64_t>(options.max_limit)));
+    }
+
+    return limit;
+  };
+
+  // Find the posts similar to a post: get its hash from the shard that owns
+  // it, then query every shard with it. Returns the status and the matches.
+  auto similar = [&](const std::string& prefix, postId post_id, json params) -> std::pair<int, json> {
+    const size_t limit = parse_limit(params);
+    const auto timeout = query_timeout(params);
+    const Shard& owner = shards[shard_for(post_id, shards.size())];
+
+    const ShardResponse image = send(owner, "GET", prefix + "/images/" + std::to_string(post_id), "", timeout);
+    check_reachable(owner, image);
+    if (image.status != 200) {
+      return { image.status, json::parse(image.body) };
+    }
+
+    // Ask for one extra result, since the post itself is normally the best match.
+    params["hash"] = json::parse(image.body)["hash"];
+    params["limit"] = limit + 1;
+
+    json matches = json::array();
+    const auto responses = send_all(shard_pool, shards, "POST", prefix + "/query", params.dump(), timeout);
+    for (size_t i = 0; i < shards.size(); i++) {
+      check_reachable(shards[i], responses[i]);
+      if (responses[i].status != 200) {
+        return { responses[i].status, json::parse(responses[i].body) };
+      }
+
+      for (auto& match : json::parse(responses[i].body)) {
+        if (match["post_id"] != post_id)
+          matches.push_back(std::move(match));
+      }
+    }
+
+    return { 200, merge_matches(std::move(matches), limit) };
+  };
+
+  // Requests mostly wait on the shards, so they're handled on a pool of
+  // their own while the event loop goes on reading and writing.
+  WorkerPool http_pool("http", options.http_threads, options.http_threads * 4);
+  HttpServer server;
+
+  // Bind before starting anything, so that a port in use is reported first.
+  server.bind(host, port);
+  if (on_started) {
+    on_started([&server] { server.stop(); });
+  } else {
+    install_signal_handlers([&server] { server.stop(); });
+  }
+
+  // Find the posts on every shard that are exact duplicates of an image being
+  // added. A shard falls back to a similarity scan when it has no exact
+  // duplicates, so only matches with the image's own hash count.
+  auto find_duplicates = [&](const std::string& prefix, postId post_id, const std::string& body) {
+    const auto params = json::parse(body);
+    validate_json_is_valid(params);
+    const auto channels = params["channels"];
+    const std::string hash = HaarSignature::from_channels(channels["r"], channels["g"], channels["b"]).to_string();
+
+    const json query = { { "hash", hash }, { "limit", options.max_limit } };
+    const auto responses = send_all(shard_pool, shards, "POST", prefix + "/query?exact=1", query.dump(), shard_timeout);
+
+    json duplicates = json::array();
+    for (size_t i = 0; i < shards.size(); i++) {
+      check_reachable(shards[i], responses[i]);
+      if (responses[i].status != 200) {
+        throw shard_error("Shard " + shards[i].name() + " failed (HTTP " + std::to_string(responses[i].status) + ")");
+      }
+
+      for (const auto& match : json::parse(responses[i].body)) {
+        if (match["hash"] == hash && match["post_id"] != post_id)
+          duplicates.push_back(match["post_id"]);
+      }
+    }
+
+    return std::make_pair(hash, duplicates);
+  };
+
+  // Adds, removes and lookups go to the shard that owns the post. The shard's
+  // response is passed back as is.
+  auto forward = [&](const HttpRequest& request, HttpResponse& response, const std::string& method) {
+    const postId post_id = std::stoi(request.matches[2]);
+    const Shard& shard = shards[shard_for(post_id, shards.size())];
+
+    // With `?dedupe=1`, the duplicates may be on any shard, so they're looked
+    // for on all of them before the add. The owning shard checks again when it
+    // adds the image, but an exact duplicate added to another shard in between
+    // isn't caught.
+    if (method == "POST" && request.has_param("dedupe") && (request.get_param_value("dedupe") == "1" || request.get_param_value("dedupe") == "true")) {
+      const auto [hash, duplicates] = find_duplicates(request.matches[1], post_id, request.body);
+
+      if (!duplicates.empty()) {
+        const json data = {
+          { "post_id", post_id },
+          { "hash", hash },
+          { "duplicates", duplicates },
+        };
+
+        response.status = 409;
+        response.set_content(data.dump(4), "application/json");
+        return;
+      }
+    }
+
+    std::string path = request.path;
+    if (request.has_param("dedupe")) {
+      path += "?dedupe=" + request.get_param_value("dedupe");
+    }
+
+    const ShardResponse result = send(shard, method, path, request.body, shard_timeout);
+    check_reachable(shard, result);
+
+    response.status = result.status;
+    response.set_content(result.body, "application/json");
+  };
+
+  server.Post(collection_prefix + "/images/(\\d+)", on(http_pool, [&](const auto &request, auto &response) {
+    forward(request, response, "POST");
+  }));
+
+  server.Delete(collection_prefix + "/images/(\\d+)", on(http_pool, [&](const auto &request, auto &response) {
+    forward(request, response, "DELETE");
+  }));
+
+  server.Get(collection_prefix + "/images/(\\d+)", on(http_pool, [&](const auto &request, auto &response) {
+    forward(request, response, "GET");
+  }));
+
+  // Each shard returns its own top `limit` matches; the best `limit` of those
+  // are the best overall. Each shard scales its scores by the weights of the
+  // query's buckets it has images in, which on all but small shards is every
+  // one of them, so the scores can be compared across shards.
+  server.Post(collection_prefix + "/query", on(http_pool, [&](const auto &request, auto &response) {
+    const auto params = json::parse(request.body);
+
+    // Threshold queries return every shard's matches above `min_score`.
+    const size_t limit = params.contains("min_score") ? std::numeric_limits<size_t>::max() : parse_limit(params);
+
+    // Each shard would keep its own cursor, and pages can't be merged without
+    // reading ahead on every shard.
+    if (params.contains("cursor") && params["cursor"] == true) {
+      throw param_error("Cursors aren't supported by the coordinator");
+    }
+
+    std::string path = request.path;
+    if (request.has_param("exact")) {
+      path += "?exact=" + request.get_param_value("exact");
+    }
+
+    json matches = json::array();
+    json profiles = json::array();
+    const auto responses = send_all(shard_pool, shards, "POST", path, request.body, query_timeout(params));
+
+    for (size_t i = 0; i < shards.size(); i++) {
+      check_reachable(shards[i], responses[i]);
+
+      // If any shard rejects the query, so does the coordinator.
+      if (responses[i].status != 200) {
+        response.status = responses[i].status;
+        response.set_content(responses[i].body, "application/json");
+        return;
+      }
+
+      json data = json::parse(responses[i].body);
+
+      // Profiled queries return `{ matches, profile }`.
+      if (data.is_object()) {
+        profiles += { { "shard", shards[i].name() }, { "profile", data["profile"] } };
+        data = data["matches"];
+      }
+
+      for (auto& match : data) {
+        matches.push_back(std::move(match));
+      }
+    }
+
+    json data = merge_matches(std::move(matches), limit);
+    if (!profiles.empty()) {
+      data = {
+        { "matches", data },
+        { "profiles", profiles },
+      };
+    }
+
+    response.set_content(data.dump(4), "application/json");
+  }));
+
+  server.Get(collection_prefix + "/images/(\\d+)/similar", on(http_pool, [&](const auto &request, auto &response) {
+    json params = json::object();
+    for (const auto& [name, value] : request.params) {
+      const bool integer = !value.empty() && value.size() < 10 && std::all_of(value.begin(), value.end(), ::isdigit);
+      params[name] = integer ? json(std::stoll(value)) : json(value);
+    }
+
+    const auto [status, data] = similar(request.matches[1], std::stoi(request.matches[2]), params);
+    response.status = status;
+    response.set_content(data.dump(4), "application/json");
+  }));
+
+  server.Post(collection_prefix + "/images/similar", on(http_pool, [&](const auto &request, auto &response) {
+    const auto params = json::parse(request.body);
+    if (!params.contains("post_ids") || !params["post_ids"].is_array()) {
+      throw param_error("POST /images/similar requires a `post_ids` array");
+    }
+
+    const std::vector<postId> post_ids = params["post_ids"];
+    if (post_ids.size() > options.max_batch) {
+      throw param_error("Too many post ids (max=" + std::to_string(options.max_batch) + ")");
+    }
+
+    json query = params;
+    query.erase("post_ids");
+
+    json data = json::array();
+    for (postId post_id : post_ids) {
+      const auto [status, matches] = similar(request.matches[1], post_id, query);
+
+      if (status == 200) {
+        data += { { "post_id", post_id }, { "matches", matches } };
+      } else {
+        data += { { "post_id", post_id }, { "message", matches.value("message", "Not found") } };
+      }
+    }
+
+    response.set_content(data.dump(4), "application/json");
+  }));
+
+  // The total number of images, and each shard's own status. Unreachable
+  // shards are reported instead of failing the whole request.
+  server.Get(collection_prefix + "/status", on(http_pool, [&](const auto &request, auto &response) {
+    const auto responses = send_all(shard_pool, shards, "GET", request.path, "", shard_timeout);
+
+    size_t images = 0;
+    json statuses = json::array();
+    for (size_t i = 0; i < shards.size(); i++) {
+      if (responses[i].status != 200) {
+        statuses += { { "shard", shards[i].name() }, { "error", responses[i].status ? "HTTP " + std::to_string(responses[i].status) : responses[i].body } };
+        continue;
+      }
+
+      const json status = json::parse(responses[i].body);
+      images += status.value("images", size_t(0));
+      statuses += { { "shard", shards[i].name() }, { "status", status } };
+    }
+
+    json data = {
+      { "images", images },
+      { "shards", statuses },
+    };
+
+    response.set_content(data.dump(4), "application/json");
+  }));
+
+  server.set_logger([](const auto &req, const auto &res) {
+    INFO("{} \"{} {} {}\" {} {}\n", req.remote_addr, req.method, req.path, req.version, res.status, res.body.size());
+  });
+
+  server.set_exception_handler([](const auto& req, auto& res, std::exception_ptr ep) {
+    json data;
+    res.status = 500;
+
+    try {
+      std::rethrow_exception(ep);
+    } catch (shard_error &e) {
+      data = {
+        { "message", e.what() }
+      };
+
+      res.status = 503;
+    } catch (overloaded_error &e) {
+      data = {
+        { "message", e.what() }
+      };
+
+      res.status = 503;
+      res.set_header("Retry-After", "1");
+    } catch (param_error &e) {
+      data = {
+        { "message", e.what() }
+      };
+
+      res.status = 400;
+    } catch (std::exception &e) {
+      data = {
+        { "message", e.what() }
+      };
+
+      ERROR("Exception: {}\n", e.what());
+    } catch (...) {
+      data = {
+        { "message", "Unknown exception" }
+      };
+      ERROR("Exception: {}\n", "Unknown exception");
+    }
+
+    res.set_content(data.dump(4), "application/json");
+  });
+
+  INFO("Coordinating {} shards, listening on {}:{}.\n", shards.size(), host, port);
+  server.run();
+  INFO("Stopping coordinator...\n");
+
+  http_pool.shutdown();
+  shard_pool.shutdown();
+}
+
+}
@@ -0,0 +1,79 @@
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+
+#include <iqdb/cursor_cache.h>
+
+namespace iqdb {
+
+CursorCache::CursorCache(size_t max_bytes, std::chrono::seconds ttl) : max_bytes_(max_bytes), ttl_(ttl), rng_(std::random_device()()) {
+}
+
+size_t CursorCache::cost(const std::string& token, const Entry& entry) {
+  return sizeof(Entry) + token.size() + entry.scope.size() + entry.results.capacity() * sizeof(sim_value);
+}
+
+void CursorCache::evict(Clock::time_point now, size_t extra) {
+  while (!entries_.empty() && (entries_.back().second.expires < now || bytes_ + extra > max_bytes_)) {
+    bytes_ -= cost(entries_.back().first, entries_.back().second);
+    index_.erase(entries_.back().first);
+    entries_.pop_back();
+  }
+}
+
+std::optional<std::string> CursorCache::put(const std::string& scope, sim_vector results) {
+  results.shrink_to_fit();
+
+  std::unique_lock lock(mutex_);
+  const auto now = Clock::now();
+
+  // A 128-bit random token, so that cursors can't be guessed.
+  char token[33];
+  std::snprintf(token, sizeof(token), "%016" PRIx64 "%016" PRIx64, static_cast<uint64_t>(rng_()), static_cast<uint64_t>(rng_()));
+
+  Entry entry { scope, std::move(results), now + ttl_ };
+  const size_t size = cost(token, entry);
+  if (size > max_bytes_)
+    return std::nullopt;
+
+  evict(now, size);
+  entries_.emplace_front(token, std::move(entry));
+  index_[token] = entries_.begin();
+  bytes_ += size;
+
+  return token;
+}
+
+std::optional<CursorPage> CursorCache::get(const std::string& token, const std::string& scope, size_t offset, size_t limit) {
+  std::unique_lock lock(mutex_);
+  const auto now = Clock::now();
+  evict(now, 0);
+
+  auto it = index_.find(token);
+  if (it == index_.end() || it->second->second.scope != scope)
+    return std::nullopt;
+
+  entries_.splice(entries_.begin(), entries_, it->second);
+  Entry& entry = it->second->second;
+  entry.expires = now + ttl_;
+
+  const auto& results = entry.results;
+  const size_t first = std::min(offset, results.size());
+  const size_t last = first + std::min(limit, results.size() - first);
+
+  return CursorPage { sim_vector(results.begin() + static_cast<ptrdiff_t>(first), results.begin() + static_cast<ptrdiff_t>(last)), results.size() };
+}
+
+size_t CursorCache::size() {
+  std::unique_lock lock(mutex_);
+  evict(Clock::now(), 0);
+  return entries_.size();
+}
+
+size_t CursorCache::bytes() {
+  std::unique_lock lock(mutex_);
+  evict(Clock::now(), 0);
+  return bytes_;
+}
+
+}
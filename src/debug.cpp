@@ -1,4 +1,11 @@
-#include <dlfcn.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
 
 #include <iqdb/debug.h>
 
@@ -6,4 +13,244 @@ namespace iqdb {
 
 int debug_level = 1; // INFO
 
+// A bounded lock-free multi-producer, single-consumer queue of log messages.
+// Each slot has a sequence number saying whether it's free for the producer
+// whose ticket is `sequence`, or full and ready for the consumer whose ticket
+// is `sequence - 1`. Producers don't wait for the writer: if the ring is
+// full, the message is written directly instead.
+//
+// https://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+class LogRing {
+public:
+  static constexpr size_t slot_count = 1024;
+  static constexpr size_t message_size = 2048 - 2 * sizeof(size_t);
+
+  struct Slot {
+    std::atomic<size_t> sequence;
+    size_t length;
+    char message[message_size];
+  };
+
+  LogRing() {
+    for (size_t i = 0; i < slot_count; i++) {
+      slots_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  // Claim a free slot. Returns nullptr if the ring is full.
+  Slot* claim() noexcept {
+    size_t pos = head_.load(std::memory_order_relaxed);
+
+    while (true) {
+      Slot& slot = slots_[pos % slot_count];
+      const size_t sequence = slot.sequence.load(std::memory_order_acquire);
+      const auto diff = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(pos);
+
+      if (diff == 0) {
+        if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          return &slot;
+        }
+      } else if (diff < 0) {
+        return nullptr;
+      } else {
+        pos = head_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // Hand a claimed slot to the consumer. Sequentially consistent, like
+  // ready(), so that the writer can't miss a message as it goes to sleep.
+  void publish(Slot* slot) noexcept {
+    slot->sequence.fetch_add(1);
+  }
+
+  // Whether the next message is ready to be drained. Must be called with
+  // log_drain_mutex held.
+  bool ready() const noexcept {
+    return slots_[tail_ % slot_count].sequence.load() == tail_ + 1;
+  }
+
+  // Write out every message claimed so far, waiting for producers that are
+  // still formatting theirs. Must be called with log_drain_mutex held.
+  void drainAll(FILE* file) {
+    const size_t head = head_.load(std::memory_order_acquire);
+
+    while (tail_ < head) {
+      if (drain(file) == 0) {
+        std::this_thread::yield();
+      }
+    }
+  }
+
+  // Write out all published messages. Must be called with log_drain_mutex held.
+  size_t drain(FILE* file) {
+    size_t count = 0;
+
+    while (true) {
+      Slot& slot = slots_[tail_ % slot_count];
+      if (slot.sequence.load(std::memory_order_acquire) != tail_ + 1) {
+        break;
+      }
+
+      fwrite(slot.message, 1, slot.length, file);
+      slot.sequence.store(tail_ + slot_count, std::memory_order_release);
+      tail_++;
+      count++;
+    }
+
+    if (count) {
+      fflush(file);
+    }
+
+    return count;
+  }
+
+private:
+  std::array<Slot, slot_count> slots_;
+  alignas(64) std::atomic<size_t> head_ = 0;
+  alignas(64) size_t tail_ = 0;
+};
+
+static LogRing log_ring;
+static std::atomic<bool> log_writer_running = false;
+static std::atomic<size_t> log_producers = 0; // Producers that saw the writer running and haven't published yet.
+static std::thread log_writer;
+static std::mutex log_writer_mutex; // Serializes starting and stopping the writer.
+
+// Serializes draining the ring, so that a producer writing a message directly
+// can write out the queued messages first and keep the log in order.
+static std::mutex log_drain_mutex;
+
+// The writer sleeps until a producer publishes a message. Producers only take
+// the mutex when the writer is asleep.
+static std::mutex log_wakeup_mutex;
+static std::condition_variable log_wakeup;
+static std::atomic<bool> log_writer_sleeping = false;
+static bool log_writer_stopping = false; // Guarded by log_wakeup_mutex.
+
+static void drain_log() {
+  std::lock_guard lock(log_drain_mutex);
+  log_ring.drain(stderr);
+}
+
+static bool log_ready() {
+  std::lock_guard lock(log_drain_mutex);
+  return log_ring.ready();
+}
+
+static void wake_log_writer() {
+  // Either the writer sees the new message before it sleeps, or we see that
+  // it's asleep: the publish, this load, and the writer's store and ready()
+  // check are all sequentially consistent.
+  if (log_writer_sleeping.load()) {
+    std::lock_guard lock(log_wakeup_mutex);
+    log_wakeup.notify_one();
+  }
+}
+
+static void log_write_direct(fmt::string_view prefix, fmt::string_view format, fmt::format_args args) {
+  fmt::memory_buffer buffer;
+  fmt::format_to(std::back_inserter(buffer), "{}", prefix);
+  fmt::vformat_to(std::back_inserter(buffer), format, args);
+
+  // Write out the queued messages first, including this thread's own.
+  std::lock_guard lock(log_drain_mutex);
+  log_ring.drainAll(stderr);
+  fwrite(buffer.data(), 1, buffer.size(), stderr);
+}
+
+void log_write(fmt::string_view prefix, fmt::string_view format, fmt::format_args args) {
+  log_producers.fetch_add(1);
+  if (!log_writer_running.load()) {
+    log_producers.fetch_sub(1);
+    log_write_direct(prefix, format, args);
+    return;
+  }
+
+  LogRing::Slot* slot = log_ring.claim();
+  if (slot == nullptr) {
+    log_producers.fetch_sub(1);
+    log_write_direct(prefix, format, args);
+    return;
+  }
+
+  auto result = fmt::format_to_n(slot->message, LogRing::message_size, "{}", prefix);
+  const size_t remaining = LogRing::message_size - std::min(result.size, LogRing::message_size);
+  auto message = fmt::vformat_to_n(result.out, remaining, format, args);
+
+  if (message.size > remaining) {
+    // Too long for a slot; publish an empty message and write it directly,
+    // after the messages queued before it.
+    slot->length = 0;
+    log_ring.publish(slot);
+    log_producers.fetch_sub(1);
+    log_write_direct(prefix, format, args);
+  } else {
+    slot->length = static_cast<size_t>(message.out - slot->message);
+    log_ring.publish(slot);
+    log_producers.fetch_sub(1);
+    wake_log_writer();
+  }
+}
+
+void start_log_writer() {
+  std::unique_lock lock(log_writer_mutex);
+  if (log_writer_running) {
+    return;
+  }
+
+  {
+    std::lock_guard wakeup_lock(log_wakeup_mutex);
+    log_writer_stopping = false;
+  }
+
+  log_writer = std::thread([] {
+    std::unique_lock wakeup_lock(log_wakeup_mutex);
+
+    while (!log_writer_stopping) {
+      wakeup_lock.unlock();
+      drain_log();
+      wakeup_lock.lock();
+
+      log_writer_sleeping.store(true);
+      log_wakeup.wait(wakeup_lock, [] { return log_writer_stopping || log_ready(); });
+      log_writer_sleeping.store(false);
+    }
+
+    wakeup_lock.unlock();
+    drain_log();
+  });
+
+  log_writer_running.store(true);
+
+  static bool registered = false;
+  if (!registered) {
+    registered = true;
+    atexit(stop_log_writer);
+  }
+}
+
+void stop_log_writer() {
+  std::unique_lock lock(log_writer_mutex);
+  if (!log_writer_running) {
+    return;
+  }
+
+  // New messages are written directly from here on. Wait for the producers
+  // that saw the writer running to publish their messages, which the writer
+  // then writes out before it exits.
+  log_writer_running.store(false);
+  while (log_producers.load() != 0) {
+    std::this_thread::yield();
+  }
+
+  {
+    std::lock_guard wakeup_lock(log_wakeup_mutex);
+    log_writer_stopping = true;
+  }
+
+  log_wakeup.notify_one();
+  log_writer.join();
+}
+
 }
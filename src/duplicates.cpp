@@ -0,0 +1,292 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include <iqdb/debug.h>
+#include <iqdb/duplicates.h>
+#include <iqdb/imgdb.h>
+#include <iqdb/imglib.h>
+#include <iqdb/metrics.h>
+
+namespace iqdb {
+
+// A bucket of the image being checked, and the weight of sharing it.
+struct QueryBucket {
+  const bucket_t* bucket;
+  Score weight;
+};
+
+// Per-thread scratch space for findDuplicates.
+struct DuplicateScratch {
+  std::vector<Score> shared;        // The weight of the buckets each candidate shares with the image, by iqdb id.
+  std::vector<iqdbId> candidates;   // The ids with a non-zero `shared`.
+  std::vector<QueryBucket> buckets;
+  std::vector<DuplicatePair> pairs; // The pairs found in the current block.
+};
+
+// The DC part of an image's raw score when querying with `query`, as computed
+// by queryFromSignature.
+static Score dc_score(const image_info& query, int num_colors, const image_info& image) {
+  Score s = 0;
+  for (int c = 0; c < num_colors; c++) {
+    s += weights[0][c] * std::abs(image.avgl.v[c] - query.avgl.v[c]);
+  }
+
+  return s;
+}
+
+// This is an all-pairs similarity join over the buckets. An image's raw score
+// for a query is its DC term minus the weights of the buckets it shares with
+// the query. The DC term is never negative, so a match must share buckets
+// worth at least the threshold's share of the query's total weight. The
+// biggest buckets of each query are therefore skipped when collecting
+// candidates, as long as their weights add up to less than that: every match
+// must also share one of the remaining, smaller buckets. Candidates are scored
+// exactly afterwards, with a binary search in each skipped bucket.
+//
+// Shared bucket weights are the same from both images' side, so each pair is
+// only scored once, by the image that finds it first.
+void IQDB::findDuplicates(Score threshold, size_t threads, size_t block, std::function<void(const DuplicatePair&)> func) {
+  if (threshold <= 0)
+    throw param_error("Duplicate threshold must be positive");
+
+  threads = std::max<size_t>(threads, 1);
+  block = std::max<size_t>(block, 1);
+
+  // Find the scale of each image's own query, and how many colors it has, in
+  // one pass over the buckets. Every image is in all of its own buckets.
+  std::vector<Score> scales(m_info.size(), 0);
+  std::vector<uint8_t> colors(m_info.size(), 0);
+
+  for (int c = 0; c < 3; c++) {
+    for (int index = 1; index < NUM_PIXELS_SQUARED; index++) {
+      const Score weight = weights[imgBin.bin[index]][c];
+
+      for (int coef : { index, -index }) {
+        for (iqdbId id : imgbuckets.at(c, coef)) {
+          scales[id] -= weight;
+          colors[id] = static_cast<uint8_t>(c + 1);
+        }
+      }
+    }
+  }
+
+  auto check = [&](DuplicateScratch& scratch, iqdbId i, const HaarSignature& haar) {
+    const Score scale = scales[i];
+    if (scale == 0)
+      return;
+
+    // A match has a raw score of at most `limit` (scales are negative).
+    const Score limit = threshold * scale / 100;
+
+    scratch.buckets.clear();
+    for (int c = 0; c < haar.num_colors(); c++) {
+      for (int b = 0; b < NUM_COEFS; b++) {
+        const int coef = haar.sig[c][b];
+        scratch.buckets.push_back({ &imgbuckets.at(c, coef), coefWeight(c, coef) });
+      }
+    }
+
+    std::sort(scratch.buckets.begin(), scratch.buckets.end(), [](const auto& a, const auto& b) {
+      return a.bucket->size() > b.bucket->size();
+    });
+
+    size_t skipped = 0;
+    Score skipped_weight = 0;
+    while (skipped < scratch.buckets.size() && skipped_weight + scratch.buckets[skipped].weight < -limit) {
+      skipped_weight += scratch.buckets[skipped++].weight;
+    }
+
+    for (size_t b = skipped; b < scratch.buckets.size(); b++) {
+      for (iqdbId j : *scratch.buckets[b].bucket) {
+        if (j == i)
+          continue;
+
+        if (scratch.shared[j] == 0)
+          scratch.candidates.push_back(j);
+
+        scratch.shared[j] += scratch.buckets[b].weight;
+      }
+    }
+
+    for (iqdbId j : scratch.candidates) {
+      Score shared = scratch.shared[j];
+      scratch.shared[j] = 0;
+
+      // Skip candidates that can't match even if they're in every skipped bucket.
+      const Score dc = dc_score(m_info[i], haar.num_colors(), m_info[j]);
+      if (dc - shared - skipped_weight > limit)
+        continue;
+
+      for (size_t b = 0; b < skipped; b++) {
+        const bucket_t& bucket = *scratch.buckets[b].bucket;
+        if (std::binary_search(bucket.begin(), bucket.end(), j))
+          shared += scratch.buckets[b].weight;
+      }
+
+      const Score score = (dc - shared) * 100 * (static_cast<Score>(1.0) / scale);
+      if (score < threshold)
+        continue;
+
+      // If `j` came first and found this pair from its side, it's already been reported.
+      const Score reverse = scales[j] == 0 ? 0 : (dc_score(m_info[j], colors[j], m_info[i]) - shared) * 100 * (static_cast<Score>(1.0) / scales[j]);
+      if (j < i && reverse >= threshold)
+        continue;
+
+      const postId a = m_info[i].id, b = m_info[j].id;
+      scratch.pairs.push_back({ std::min(a, b), std::max(a, b), std::max(score, reverse) });
+    }
+
+    scratch.candidates.clear();
+  };
+
+  std::vector<DuplicateScratch> scratch(threads);
+  for (auto& s : scratch) {
+    s.shared.assign(m_info.size(), 0);
+  }
+
+  std::vector<Image> images;
+  size_t checked = 0, found = 0;
+  const auto start = Clock::now();
+
+  auto run_block = [&] {
+    std::atomic<size_t> next = 0;
+    std::vector<std::thread> workers;
+
+    for (size_t t = 0; t < threads; t++) {
+      workers.emplace_back([&, t] {
+        for (size_t n = next++; n < images.size(); n = next++) {
+          check(scratch[t], images[n].id, images[n].haar());
+        }
+      });
+    }
+
+    for (auto& worker : workers) {
+      worker.join();
+    }
+
+    std::vector<DuplicatePair> pairs;
+    for (auto& s : scratch) {
+      pairs.insert(pairs.end(), s.pairs.begin(), s.pairs.end());
+      s.pairs.clear();
+    }
+
+    std::sort(pairs.begin(), pairs.end(), [](const auto& x, const auto& y) {
+      return std::make_pair(x.a, x.b) < std::make_pair(y.a, y.b);
+    });
+
+    for (const auto& pair : pairs) {
+      func(pair);
+    }
+
+    checked += images.size();
+    found += pairs.size();
+    images.clear();
+
+    const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    INFO("Checked {}/{} images ({} pairs, {:.0f} images/second)...\n", checked, img_count, found, static_cast<double>(checked) / seconds);
+  };
+
+  sqlite_db_->eachImage([&](const Image& image) {
+    images.push_back(image);
+    if (images.size() >= block)
+      run_block();
+  });
+
+  run_block();
+}
+
+void parse_option(DuplicateOptions& options, const std::string& flag) {
+  const auto eq = flag.find('=');
+  const std::string name = flag.substr(0, eq);
+  const std::string value = eq == std::string::npos ? "" : flag.substr(eq + 1);
+
+  try {
+    if (name == "--threshold") {
+      options.threshold = std::stof(value);
+    } else if (name == "--threads") {
+      options.threads = std::stoul(value);
+    } else if (name == "--block") {
+      options.block = std::stoul(value);
+    } else if (name == "--pairs") {
+      options.pairs = true;
+    } else if (name == "--output") {
+      options.output = value;
+    } else {
+      throw param_error("Unknown option (option=" + flag + ")");
+    }
+  } catch (const std::logic_error&) {
+    throw param_error("Invalid option value (option=" + flag + ")");
+  }
+
+  if (options.threshold <= 0 || options.threshold > 100) {
+    throw param_error("--threshold must be between 0 and 100");
+  }
+}
+
+void find_duplicates(const std::string& database_filename, const DuplicateOptions& options) {
+  IQDB db(database_filename);
+
+  FILE* out = options.output.empty() ? stdout : fopen(options.output.c_str(), "w");
+  if (out == nullptr) {
+    throw param_error("Couldn't open output file (file=" + options.output + ")");
+  }
+
+  // Union-find over post ids, with path halving.
+  std::unordered_map<postId, postId> parent;
+  auto find = [&](postId post_id) {
+    while (parent[post_id] != post_id) {
+      post_id = parent[post_id] = parent[parent[post_id]];
+    }
+    return post_id;
+  };
+
+  size_t pairs = 0;
+  const auto start = Clock::now();
+  const size_t threads = options.threads ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+
+  db.findDuplicates(options.threshold, threads, options.block, [&](const DuplicatePair& pair) {
+    if (options.pairs) {
+      const nlohmann::json line = { { "post_ids", { pair.a, pair.b } }, { "score", pair.score } };
+      fprintf(out, "%s\n", line.dump().c_str());
+    }
+
+    parent.try_emplace(pair.a, pair.a);
+    parent.try_emplace(pair.b, pair.b);
+    const postId a = find(pair.a), b = find(pair.b);
+    parent[std::max(a, b)] = std::min(a, b);
+    pairs++;
+  });
+
+  // Each cluster's root is its lowest post id.
+  std::unordered_map<postId, std::vector<postId>> members;
+  for (const auto& [post_id, _] : parent) {
+    members[find(post_id)].push_back(post_id);
+  }
+
+  std::vector<std::vector<postId>> clusters;
+  for (auto& [root, cluster] : members) {
+    std::sort(cluster.begin(), cluster.end());
+    clusters.push_back(std::move(cluster));
+  }
+
+  std::sort(clusters.begin(), clusters.end());
+  for (const auto& cluster : clusters) {
+    const nlohmann::json line = { { "post_ids", cluster } };
+    fprintf(out, "%s\n", line.dump().c_str());
+  }
+
+  if (out != stdout) {
+    fclose(out);
+  }
+
+  const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+  INFO("Found {} clusters ({} pairs) in {:.1f} seconds.\n", clusters.size(), pairs, seconds);
+}
+
+}
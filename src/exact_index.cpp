@@ -0,0 +1,88 @@
+#include <algorithm>
+#include <cmath>
+
+#include <iqdb/exact_index.h>
+
+namespace iqdb {
+
+static int64_t quantize(double avglf) noexcept {
+  return std::llround(avglf * (1 << 20));
+}
+
+// https://prng.di.unimi.it/splitmix64.c
+static uint64_t mix(uint64_t h, uint64_t value) noexcept {
+  uint64_t z = h ^ (value + 0x9e3779b97f4a7c15);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+  return z ^ (z >> 31);
+}
+
+uint64_t ExactIndex::hash(const HaarSignature& signature) noexcept {
+  uint64_t h = 0;
+
+  for (double avglf : signature.avglf) {
+    h = mix(h, static_cast<uint64_t>(quantize(avglf)));
+  }
+
+  // The coefficients are packed four to a word.
+  for (int c = 0; c < 3; c++) {
+    for (int i = 0; i < NUM_COEFS; i += 4) {
+      uint64_t word = 0;
+      for (int j = i; j < std::min(i + 4, NUM_COEFS); j++) {
+        word = word << 16 | static_cast<uint16_t>(signature.sig[c][j]);
+      }
+      h = mix(h, word);
+    }
+  }
+
+  return h;
+}
+
+bool ExactIndex::sameImage(const HaarSignature& a, const HaarSignature& b) noexcept {
+  for (int c = 0; c < 3; c++) {
+    if (quantize(a.avglf[c]) != quantize(b.avglf[c]))
+      return false;
+
+    if (!std::equal(&a.sig[c][0], &a.sig[c][NUM_COEFS], &b.sig[c][0]))
+      return false;
+  }
+
+  return true;
+}
+
+void ExactIndex::add(const HaarSignature& signature, postId post_id) {
+  index_.emplace(hash(signature), post_id);
+}
+
+void ExactIndex::remove(const HaarSignature& signature, postId post_id) {
+  auto [begin, end] = index_.equal_range(hash(signature));
+
+  for (auto it = begin; it != end; ++it) {
+    if (it->second == post_id) {
+      index_.erase(it);
+      return;
+    }
+  }
+}
+
+void ExactIndex::clear() {
+  index_.clear();
+}
+
+std::vector<postId> ExactIndex::candidates(const HaarSignature& signature) const {
+  std::vector<postId> post_ids;
+  auto [begin, end] = index_.equal_range(hash(signature));
+
+  for (auto it = begin; it != end; ++it) {
+    post_ids.push_back(it->second);
+  }
+
+  return post_ids;
+}
+
+size_t ExactIndex::memoryUsage() const noexcept {
+  // Each node holds a next pointer, the key and the value.
+  return index_.bucket_count() * sizeof(void*) + index_.size() * (sizeof(void*) + sizeof(uint64_t) + sizeof(postId));
+}
+
+}
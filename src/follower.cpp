@@ -0,0 +1,275 @@
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <httplib.h>
+#include <nlohmann/json.hpp>
+
+#include <iqdb/debug.h>
+#include <iqdb/follower.h>
+#include <iqdb/imgdb.h>
+#include <iqdb/metrics.h>
+
+using nlohmann::json;
+
+namespace iqdb {
+
+// How long the leader may hold a request for changes open before answering
+// that there aren't any.
+static const auto poll_wait = std::chrono::seconds(10);
+
+// How long to wait before trying again after an error.
+static const auto retry_interval = std::chrono::seconds(1);
+
+// The most changes to ask for at a time.
+static const size_t change_batch = 1000;
+
+// Snapshot images are applied this many at a time, so that queries can get in
+// between.
+static const size_t snapshot_batch = 1000;
+
+// Lock the index for writing, recording how long we waited.
+static std::unique_lock<std::shared_mutex> write_lock(std::shared_mutex& mutex) {
+  ScopedTimer timer(metrics.lock_wait_write);
+  return std::unique_lock(mutex);
+}
+
+Follower::Follower(const std::string& leader, const std::string& prefix, IQDB& db, std::shared_mutex& mutex)
+  : prefix_(prefix), db_(db), mutex_(mutex) {
+  const auto colon = leader.rfind(':');
+  if (colon == std::string::npos || colon == 0) {
+    throw param_error("The leader must be given as host:port (leader=" + leader + ")");
+  }
+
+  try {
+    host_ = leader.substr(0, colon);
+    port_ = std::stoi(leader.substr(colon + 1));
+  } catch (const std::logic_error&) {
+    throw param_error("Invalid leader port (leader=" + leader + ")");
+  }
+}
+
+Follower::~Follower() {
+  stop();
+}
+
+void Follower::start() {
+  thread_ = std::thread([this] { run(); });
+}
+
+void Follower::stop() {
+  stopping_ = true;
+  if (thread_.joinable())
+    thread_.join();
+}
+
+FollowerStatus Follower::status() const {
+  std::lock_guard lock(status_mutex_);
+  return status_;
+}
+
+void Follower::setError(const std::string& error) {
+  std::lock_guard lock(status_mutex_);
+  status_.error = error;
+}
+
+void Follower::run() {
+  httplib::Client client(host_, port_);
+  client.set_connection_timeout(std::chrono::seconds(5));
+  client.set_read_timeout(poll_wait + std::chrono::seconds(10));
+
+  bool need_snapshot = true;
+  while (!stopping_) {
+    try {
+      if (need_snapshot) {
+        loadSnapshot(client);
+        need_snapshot = false;
+      }
+
+      need_snapshot = !pollChanges(client);
+    } catch (const std::exception& e) {
+      WARN("Couldn't follow {}:{}{}: {}\n", host_, port_, prefix_, e.what());
+      setError(e.what());
+
+      for (auto until = Clock::now() + retry_interval; !stopping_ && Clock::now() < until;) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      }
+    }
+  }
+}
+
+// Load the leader's images, then remove any local images it doesn't have.
+// Images that are already the same locally are left alone, so restarting a
+// follower with a persistent database is cheap.
+void Follower::loadSnapshot(httplib::Client& client) {
+  INFO("Loading snapshot from {}:{}{}...\n", host_, port_, prefix_);
+  const auto start = Clock::now();
+
+  {
+    std::lock_guard lock(status_mutex_);
+    status_.following = false;
+  }
+
+  std::vector<postId> old_posts;
+  {
+    std::shared_lock lock(mutex_);
+    for (iqdbId first = 0;;) {
+      const auto images = db_.getImages(first, snapshot_batch);
+      for (const auto& image : images) {
+        old_posts.push_back(image.post_id);
+      }
+
+      if (images.empty())
+        break;
+
+      first = images.back().id + 1;
+    }
+  }
+
+  std::sort(old_posts.begin(), old_posts.end());
+  std::vector<bool> seen(old_posts.size(), false);
+
+  std::string epoch;
+  uint64_t seq = 0;
+  bool have_header = false;
+  std::string buffer, error;
+  std::vector<std::pair<postId, std::string>> batch;
+  size_t loaded = 0, changed = 0, removed = 0;
+
+  auto apply = [&] {
+    auto lock = write_lock(mutex_);
+
+    for (const auto& [post_id, hash] : batch) {
+      auto it = std::lower_bound(old_posts.begin(), old_posts.end(), post_id);
+      if (it != old_posts.end() && *it == post_id)
+        seen[static_cast<size_t>(it - old_posts.begin())] = true;
+
+      auto image = db_.getImage(post_id);
+      if (!image || image->haar().to_string() != hash) {
+        db_.addImage(post_id, HaarSignature::from_hash(hash));
+        changed++;
+      }
+    }
+
+    loaded += batch.size();
+    batch.clear();
+  };
+
+  // The snapshot is a header line with the epoch and sequence number it was
+  // taken at, then one line per image.
+  int status = 0;
+  auto result = client.Get(prefix_ + "/snapshot", [&](const httplib::Response& response) {
+    status = response.status;
+    return status == 200;
+  }, [&](const char* data, size_t length) {
+    try {
+      buffer.append(data, length);
+
+      size_t begin = 0;
+      for (size_t end; (end = buffer.find('\n', begin)) != std::string::npos; begin = end + 1) {
+        const json line = json::parse(buffer.begin() + static_cast<ptrdiff_t>(begin), buffer.begin() + static_cast<ptrdiff_t>(end));
+
+        if (!have_header) {
+          epoch = line["epoch"];
+          seq = line["seq"];
+          have_header = true;
+        } else {
+          batch.emplace_back(line["post_id"], line["hash"]);
+          if (batch.size() >= snapshot_batch)
+            apply();
+        }
+      }
+
+      buffer.erase(0, begin);
+    } catch (const std::exception& e) {
+      error = e.what();
+      return false;
+    }
+
+    return !stopping_.load();
+  });
+
+  if (!error.empty()) {
+    throw simple_error("Couldn't load snapshot (" + error + ")");
+  } else if (!result) {
+    throw simple_error("Couldn't load snapshot (" + httplib::to_string(result.error()) + ")");
+  } else if (status != 200) {
+    throw simple_error("Couldn't load snapshot (HTTP " + std::to_string(status) + ")");
+  } else if (!have_header || !buffer.empty()) {
+    throw simple_error("Couldn't load snapshot (truncated)");
+  }
+
+  apply();
+
+  {
+    auto lock = write_lock(mutex_);
+
+    for (size_t i = 0; i < old_posts.size(); i++) {
+      if (!seen[i]) {
+        db_.removeImage(old_posts[i]);
+        removed++;
+      }
+    }
+  }
+
+  {
+    std::lock_guard lock(status_mutex_);
+    status_ = { epoch, seq, seq, true, "" };
+  }
+
+  const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+  INFO("Loaded snapshot from {}:{}{} ({} images, {} changed, {} removed, seq={}, {:.1f} seconds).\n", host_, port_, prefix_, loaded, changed, removed, seq, seconds);
+}
+
+// Apply the next changes from the leader, waiting for some if there aren't
+// any. Returns false if a new snapshot is needed.
+bool Follower::pollChanges(httplib::Client& client) {
+  const FollowerStatus current = status();
+  const std::string path = prefix_ + "/changes?since=" + std::to_string(current.seq) + "&limit=" + std::to_string(change_batch)
+    + "&wait=" + std::to_string(std::chrono::milliseconds(poll_wait).count());
+
+  auto result = client.Get(path);
+  if (!result) {
+    throw simple_error("Couldn't get changes (" + httplib::to_string(result.error()) + ")");
+  } else if (result->status == 410) {
+    INFO("Leader {}:{}{} no longer has changes since {}; loading a new snapshot.\n", host_, port_, prefix_, current.seq);
+    return false;
+  } else if (result->status != 200) {
+    throw simple_error("Couldn't get changes (HTTP " + std::to_string(result->status) + ")");
+  }
+
+  const json data = json::parse(result->body);
+  if (data["epoch"] != current.epoch) {
+    INFO("Leader {}:{}{} has restarted; loading a new snapshot.\n", host_, port_, prefix_);
+    return false;
+  }
+
+  uint64_t seq = current.seq;
+  const json& changes = data["changes"];
+
+  if (!changes.empty()) {
+    auto lock = write_lock(mutex_);
+
+    for (const auto& change : changes) {
+      if (change["type"] == "add") {
+        db_.addImage(change["post_id"], HaarSignature::from_hash(change["hash"]));
+      } else {
+        db_.removeImage(change["post_id"]);
+      }
+
+      seq = change["seq"];
+    }
+  }
+
+  std::lock_guard lock(status_mutex_);
+  status_.seq = seq;
+  status_.leader_seq = data["seq"];
+  status_.error.clear();
+
+  DEBUG("Applied {} changes from {}:{}{} (seq={}).\n", changes.size(), host_, port_, prefix_, seq);
+  return true;
+}
+
+}
@@ -53,84 +53,33 @@
 
 /* imgSeek Includes */
 #include <iqdb/haar.h>
+#include <iqdb/kernels.h>
 
 namespace iqdb {
 
 // RGB -> YIQ colorspace conversion; Y luminance, I,Q chrominance.
 // If RGB in [0..255] then Y in [0..255] and I,Q in [-127..127].
-#define RGB_2_YIQ(a, b, c)                            \
-  do {                                                \
-    int i;                                            \
-                                                      \
-    for (i = 0; i < NUM_PIXELS_SQUARED; i++) {        \
-      Unit Y, I, Q;                                   \
-                                                      \
-      Y = 0.299 * a[i] + 0.587 * b[i] + 0.114 * c[i]; \
-      I = 0.596 * a[i] - 0.275 * b[i] - 0.321 * c[i]; \
-      Q = 0.212 * a[i] - 0.523 * b[i] + 0.311 * c[i]; \
-      a[i] = Y;                                       \
-      b[i] = I;                                       \
-      c[i] = Q;                                       \
-    }                                                 \
-  } while (0)
-
-// Do the Haar tensorial 2d transform itself.
-// Here input is RGB data [0..255] in Unit arrays
-// Computation is (almost) in-situ.
-static void
-haar2D(Unit a[]) {
+void RGB_2_YIQ(Unit *a, Unit *b, Unit *c) {
   int i;
-  Unit t[NUM_PIXELS >> 1];
-
-  // Decompose rows:
-  for (i = 0; i < NUM_PIXELS_SQUARED; i += NUM_PIXELS) {
-    int h, h1;
-    Unit C = 1;
-
-    for (h = NUM_PIXELS; h > 1; h = h1) {
-      int j1, j2, k;
-
-      h1 = h >> 1; // h = 2*h1
-      C *= 0.7071; // 1/sqrt(2)
-      for (k = 0, j1 = j2 = i; k < h1; k++, j1++, j2 += 2) {
-        int j21 = j2 + 1;
-
-        t[k] = (a[j2] - a[j21]) * C;
-        a[j1] = (a[j2] + a[j21]);
-      }
-      // Write back subtraction results:
-      memcpy(a + i + h1, t, h1 * sizeof(a[0]));
-    }
-    // Fix first element of each row:
-    a[i] *= C; // C = 1/sqrt(NUM_PIXELS)
-  }
 
-  // Decompose columns:
-  for (i = 0; i < NUM_PIXELS; i++) {
-    Unit C = 1;
-    int h, h1;
-
-    for (h = NUM_PIXELS; h > 1; h = h1) {
-      int j1, j2, k;
-
-      h1 = h >> 1;
-      C *= 0.7071; // 1/sqrt(2) = 0.7071
-      for (k = 0, j1 = j2 = i; k < h1;
-           k++, j1 += NUM_PIXELS, j2 += 2 * NUM_PIXELS) {
-        int j21 = j2 + NUM_PIXELS;
-
-        t[k] = (a[j2] - a[j21]) * C;
-        a[j1] = (a[j2] + a[j21]);
-      }
-      // Write back subtraction results:
-      for (k = 0, j1 = i + h1 * NUM_PIXELS; k < h1; k++, j1 += NUM_PIXELS)
-        a[j1] = t[k];
-    }
-    // Fix first element of each column:
-    a[i] *= C;
+  for (i = 0; i < NUM_PIXELS_SQUARED; i++) {
+    Unit Y, I, Q;
+
+    Y = 0.299 * a[i] + 0.587 * b[i] + 0.114 * c[i];
+    I = 0.596 * a[i] - 0.275 * b[i] - 0.321 * c[i];
+    Q = 0.212 * a[i] - 0.523 * b[i] + 0.311 * c[i];
+    a[i] = Y;
+    b[i] = I;
+    c[i] = Q;
   }
 }
 
+// Do the Haar tensorial 2d transform itself, with the best version of the
+// kernel for this CPU.
+void haar2D(Unit a[]) {
+  kernels().haar2D(a);
+}
+
 /* Do the Haar tensorial 2d transform itself.
    Here input is RGB data [0..255] in Unit arrays.
    Results are available in a, b, and c.
@@ -170,8 +119,7 @@ void transformChar(unsigned char *c1, unsigned char *c2, unsigned char *c3,
 
 // Find the NUM_COEFS largest numbers in cdata[] (in magnitude that is)
 // and store their indices in sig[].
-inline static void
-get_m_largests(Unit *cdata, Idx *sig) {
+void get_m_largests(Unit *cdata, Idx *sig) {
   int cnt = 0;
   Idx i = 0;
   valStruct val;
@@ -187,17 +135,16 @@ get_m_largests(Unit *cdata, Idx *sig) {
   }
   // Queue is full (size is NUM_COEFS)
 
-  for (/*i = NUM_COEFS+1*/; i < NUM_PIXELS_SQUARED; i++) {
-    val.d = fabs(cdata[i]);
+  // Skip ahead to each coefficient bigger than the smallest one in the queue.
+  const Kernels& k = kernels();
+  for (size_t next = NUM_COEFS + 1; (next = k.find_above_abs(cdata, next, NUM_PIXELS_SQUARED, vq.top().d)) < NUM_PIXELS_SQUARED; next++) {
+    val.d = fabs(cdata[next]);
 
-    if (val.d > vq.top().d) {
-      // Make room by dropping smallest entry:
-      vq.pop();
-      // Insert val as new entry:
-      val.i = i;
-      vq.push(val);
-    }
-    // else discard: do nothing
+    // Make room by dropping smallest entry:
+    vq.pop();
+    // Insert val as new entry:
+    val.i = static_cast<Idx>(next);
+    vq.push(val);
   }
 
   // Empty the (non-empty) queue and fill-in sig:
@@ -0,0 +1,1019 @@
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+
+#include <fmt/format.h>
+
+#include <iqdb/debug.h>
+#include <iqdb/http_server.h>
+#include <iqdb/imgdb.h>
+
+namespace iqdb {
+
+// The largest request line and headers accepted.
+static const size_t max_header_size = 64 * 1024;
+
+// How much to read from a socket at a time.
+static const size_t read_size = 64 * 1024;
+
+// How much of a streamed response may be waiting to be sent before the
+// content provider is set aside until the client catches up, and how far the
+// client has to catch up before it's resumed.
+static const size_t stream_high_water = 1 << 20;
+static const size_t stream_low_water = stream_high_water / 2;
+
+// How often idle and slow connections are looked for.
+static const auto sweep_interval = std::chrono::seconds(1);
+
+// The epoll data of the loop's eventfd, and the flag marking a listener's;
+// connections are numbered from 1.
+static const uint64_t wake_id = 0;
+static const uint64_t listener_flag = 1ull << 63;
+
+bool HeaderLess::operator()(const std::string& a, const std::string& b) const {
+  return std::lexicographical_compare(a.begin(), a.end(), b.begin(), b.end(), [](unsigned char x, unsigned char y) {
+    return std::tolower(x) < std::tolower(y);
+  });
+}
+
+// Compare two header values case-insensitively.
+static bool iequals(const std::string& a, const std::string& b) {
+  return !HeaderLess()(a, b) && !HeaderLess()(b, a);
+}
+
+bool HttpRequest::has_param(const std::string& name) const {
+  return params.find(name) != params.end();
+}
+
+std::string HttpRequest::get_param_value(const std::string& name) const {
+  auto it = params.find(name);
+  return it == params.end() ? "" : it->second;
+}
+
+std::string HttpRequest::get_header_value(const std::string& name) const {
+  auto it = headers.find(name);
+  return it == headers.end() ? "" : it->second;
+}
+
+void HttpResponse::set_header(const std::string& name, const std::string& value) {
+  headers.emplace(name, value);
+}
+
+void HttpResponse::set_content(std::string content, const std::string& content_type) {
+  body = std::move(content);
+  headers.erase("Content-Type");
+  headers.emplace("Content-Type", content_type);
+}
+
+void HttpResponse::set_chunked_content_provider(const std::string& content_type, ContentProvider provider) {
+  content_provider = std::move(provider);
+  headers.erase("Content-Type");
+  headers.emplace("Content-Type", content_type);
+}
+
+static const char* status_message(int status) {
+  switch (status) {
+    case 100: return "Continue";
+    case 200: return "OK";
+    case 400: return "Bad Request";
+    case 403: return "Forbidden";
+    case 404: return "Not Found";
+    case 409: return "Conflict";
+    case 410: return "Gone";
+    case 413: return "Payload Too Large";
+    case 429: return "Too Many Requests";
+    case 431: return "Request Header Fields Too Large";
+    case 500: return "Internal Server Error";
+    case 501: return "Not Implemented";
+    case 503: return "Service Unavailable";
+    default: return "Unknown";
+  }
+}
+
+// Decode %XX escapes, and `+` as a space if `plus` is set (in query strings).
+static std::string url_decode(const std::string& s, bool plus) {
+  std::string out;
+  out.reserve(s.size());
+
+  for (size_t i = 0; i < s.size(); i++) {
+    if (s[i] == '%' && i + 2 < s.size() && std::isxdigit(static_cast<unsigned char>(s[i + 1])) && std::isxdigit(static_cast<unsigned char>(s[i + 2]))) {
+      out += static_cast<char>(std::stoi(s.substr(i + 1, 2), nullptr, 16));
+      i += 2;
+    } else if (s[i] == '+' && plus) {
+      out += ' ';
+    } else {
+      out += s[i];
+    }
+  }
+
+  return out;
+}
+
+static void parse_query_string(const std::string& query, std::multimap<std::string, std::string>& params) {
+  for (size_t start = 0; start < query.size();) {
+    const size_t end = std::min(query.find('&', start), query.size());
+    const std::string pair = query.substr(start, end - start);
+    const size_t eq = pair.find('=');
+
+    if (!pair.empty()) {
+      if (eq == std::string::npos) {
+        params.emplace(url_decode(pair, true), "");
+      } else {
+        params.emplace(url_decode(pair.substr(0, eq), true), url_decode(pair.substr(eq + 1), true));
+      }
+    }
+
+    start = end + 1;
+  }
+}
+
+// The status line and headers of a response.
+static std::string response_head(const HttpResponse& response, bool chunked, bool keep_alive) {
+  std::string head = fmt::format("HTTP/1.1 {} {}\r\n", response.status, status_message(response.status));
+
+  for (const auto& [name, value] : response.headers) {
+    head += name + ": " + value + "\r\n";
+  }
+
+  if (chunked) {
+    head += "Transfer-Encoding: chunked\r\n";
+  } else {
+    head += fmt::format("Content-Length: {}\r\n", response.body.size());
+  }
+
+  head += keep_alive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+  return head;
+}
+
+struct HttpServer::Connection {
+  int fd;
+  uint64_t id;
+  std::string remote_addr;
+  std::string in;            // Bytes read but not yet parsed.
+  std::string out;           // Bytes waiting to be written.
+  size_t out_offset = 0;
+  bool busy = false;         // A request is being handled, or the connection is closing.
+  bool close_after_write = false;
+  bool read_closed = false;  // The client shut down its side; close once it's been answered.
+  bool sent_continue = false;
+  size_t requests = 0;
+  uint32_t events = 0;       // The epoll events we're waiting for.
+  Clock::time_point last_active = Clock::now();
+  std::shared_ptr<Stream> stream;
+};
+
+struct HttpServer::Exchange {
+  HttpRequest request;
+  HttpResponse response;
+  Loop* loop;
+  uint64_t connection;
+  bool keep_alive;
+};
+
+// A streamed response's progress, shared between the thread running the
+// content provider and the event loop sending it. The provider is run until
+// `stream_high_water` bytes are waiting to be sent, then parked; the event
+// loop resumes it once the client has read enough of them.
+struct HttpServer::Stream {
+  std::shared_ptr<Exchange> exchange;
+  std::mutex mutex;
+  size_t posted = 0;  // Bytes handed to the event loop.
+  size_t written = 0; // Bytes written to the socket.
+  size_t offset = 0;  // Body bytes produced, as passed to the content provider.
+  bool closed = false;
+  bool parked = false;
+};
+
+// One event loop thread, with its own epoll instance and connections. Other
+// threads hand it work with post().
+class HttpServer::Loop {
+public:
+  explicit Loop(HttpServer& server);
+  ~Loop();
+
+  void addListener(int fd, size_t index);
+  void start();
+  void join();
+  void stop();
+
+  // Run `task` on the loop's thread.
+  void post(std::function<void(Loop&)> task);
+
+  // Send a complete response on a connection, then read its next request.
+  void complete(uint64_t id, std::string data, bool keep_alive);
+
+  // Send part of a streamed response.
+  void append(uint64_t id, std::string data);
+
+  // Close a connection whose response couldn't be finished.
+  void abort(uint64_t id);
+
+  // Send the writes of a streamed response's progress to `stream`.
+  void attach(uint64_t id, std::shared_ptr<Stream> stream);
+
+private:
+  void run();
+  void accept(int listener);
+  void read(Connection& c);
+  void parse(Connection& c);
+  void flush(Connection& c);
+  void reject(Connection& c, int status, const std::string& message);
+  void update(Connection& c);
+  void closeIfAnswered(uint64_t id);
+  void close(Connection& c);
+  void sweep();
+
+  HttpServer& server_;
+  int epoll_;
+  int wake_;
+  std::thread thread_;
+  std::atomic<bool> stopping_ = false;
+
+  std::mutex mutex_;
+  std::vector<std::function<void(Loop&)>> tasks_;
+
+  std::unordered_map<uint64_t, std::unique_ptr<Connection>> connections_;
+  uint64_t next_id_ = 1;
+  std::vector<int> listeners_;
+};
+
+HttpServer::Loop::Loop(HttpServer& server) : server_(server) {
+  epoll_ = epoll_create1(EPOLL_CLOEXEC);
+  wake_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+  if (epoll_ < 0 || wake_ < 0) {
+    throw simple_error(std::string("Couldn't create event loop: ") + strerror(errno));
+  }
+
+  epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.u64 = wake_id;
+  epoll_ctl(epoll_, EPOLL_CTL_ADD, wake_, &event);
+}
+
+HttpServer::Loop::~Loop() {
+  join();
+  ::close(wake_);
+  ::close(epoll_);
+}
+
+void HttpServer::Loop::addListener(int fd, size_t index) {
+  // With EPOLLEXCLUSIVE, a new connection wakes up only one of the loops.
+  epoll_event event = {};
+  event.events = EPOLLIN | EPOLLEXCLUSIVE;
+  event.data.u64 = listener_flag | index;
+  epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, &event);
+  listeners_.push_back(fd);
+}
+
+void HttpServer::Loop::start() {
+  thread_ = std::thread([this] { run(); });
+}
+
+void HttpServer::Loop::join() {
+  if (thread_.joinable())
+    thread_.join();
+}
+
+void HttpServer::Loop::stop() {
+  stopping_ = true;
+  const uint64_t one = 1;
+  [[maybe_unused]] auto result = ::write(wake_, &one, sizeof(one));
+}
+
+void HttpServer::Loop::post(std::function<void(Loop&)> task) {
+  {
+    std::lock_guard lock(mutex_);
+    tasks_.push_back(std::move(task));
+  }
+
+  const uint64_t one = 1;
+  [[maybe_unused]] auto result = ::write(wake_, &one, sizeof(one));
+}
+
+void HttpServer::Loop::run() {
+  std::vector<epoll_event> events(256);
+  auto next_sweep = Clock::now() + sweep_interval;
+
+  while (!stopping_) {
+    const int n = epoll_wait(epoll_, events.data(), static_cast<int>(events.size()), 1000);
+    if (n < 0 && errno != EINTR) {
+      ERROR("epoll_wait failed: {}\n", strerror(errno));
+      break;
+    }
+
+    for (int i = 0; i < n; i++) {
+      const uint64_t id = events[i].data.u64;
+
+      if (id == wake_id) {
+        uint64_t count;
+        [[maybe_unused]] auto result = ::read(wake_, &count, sizeof(count));
+
+        std::vector<std::function<void(Loop&)>> tasks;
+        {
+          std::lock_guard lock(mutex_);
+          tasks.swap(tasks_);
+        }
+
+        for (auto& task : tasks) {
+          task(*this);
+        }
+      } else if (id & listener_flag) {
+        accept(listeners_[id & ~listener_flag]);
+      } else {
+        auto it = connections_.find(id);
+        if (it == connections_.end())
+          continue;
+
+        Connection& c = *it->second;
+        if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+          read(c);
+        } else if (events[i].events & EPOLLOUT) {
+          flush(c);
+        }
+      }
+    }
+
+    if (Clock::now() >= next_sweep) {
+      sweep();
+      next_sweep = Clock::now() + sweep_interval;
+    }
+  }
+
+  while (!connections_.empty()) {
+    close(*connections_.begin()->second);
+  }
+}
+
+void HttpServer::Loop::accept(int listener) {
+  while (!stopping_) {
+    sockaddr_storage address = {};
+    socklen_t length = sizeof(address);
+    const int fd = accept4(listener, reinterpret_cast<sockaddr*>(&address), &length, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+    if (fd < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED)
+        WARN("accept failed: {}\n", strerror(errno));
+      return;
+    }
+
+    auto c = std::make_unique<Connection>();
+    c->fd = fd;
+    c->id = next_id_++;
+
+    char host[INET6_ADDRSTRLEN] = "";
+    if (address.ss_family == AF_INET) {
+      inet_ntop(AF_INET, &reinterpret_cast<sockaddr_in*>(&address)->sin_addr, host, sizeof(host));
+      c->remote_addr = host;
+    } else if (address.ss_family == AF_INET6) {
+      inet_ntop(AF_INET6, &reinterpret_cast<sockaddr_in6*>(&address)->sin6_addr, host, sizeof(host));
+      c->remote_addr = host;
+    } else {
+      c->remote_addr = "unix";
+    }
+
+    if (address.ss_family != AF_UNIX) {
+      const int one = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+
+    epoll_event event = {};
+    event.events = c->events = EPOLLIN;
+    event.data.u64 = c->id;
+    epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, &event);
+
+    server_.connections_++;
+    metrics.http_connections.inc();
+    connections_.emplace(c->id, std::move(c));
+  }
+}
+
+void HttpServer::Loop::read(Connection& c) {
+  char buffer[read_size];
+
+  while (true) {
+    const ssize_t n = ::recv(c.fd, buffer, sizeof(buffer), 0);
+
+    if (n > 0) {
+      c.in.append(buffer, static_cast<size_t>(n));
+      c.last_active = Clock::now();
+
+      if (c.in.size() > max_header_size + server_.options_.max_body) {
+        reject(c, 413, "Request too large");
+        return;
+      }
+    } else if (n == 0) {
+      // The client shut down its side of the connection, but it may still be
+      // waiting for the answers to the requests it sent.
+      c.read_closed = true;
+      break;
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      break;
+    } else if (errno != EINTR) {
+      close(c);
+      return;
+    }
+  }
+
+  const uint64_t id = c.id;
+  parse(c);
+  closeIfAnswered(id);
+}
+
+// Parse the next request on a connection, if all of it has arrived, and pass
+// it to its handler.
+void HttpServer::Loop::parse(Connection& c) {
+  if (c.busy)
+    return;
+
+  const size_t header_end = c.in.find("\r\n\r\n");
+  if (header_end == std::string::npos) {
+    if (c.in.size() > max_header_size)
+      reject(c, 431, "Request headers too large");
+    return;
+  }
+
+  auto exchange = std::make_shared<Exchange>();
+  HttpRequest& request = exchange->request;
+
+  // The request line, e.g. `GET /status?x=1 HTTP/1.1`.
+  const size_t line_end = c.in.find("\r\n");
+  const std::string line = c.in.substr(0, line_end);
+  const size_t space1 = line.find(' ');
+  const size_t space2 = line.rfind(' ');
+
+  if (space1 == std::string::npos || space2 == space1) {
+    reject(c, 400, "Invalid request line");
+    return;
+  }
+
+  request.method = line.substr(0, space1);
+  request.version = line.substr(space2 + 1);
+  const std::string target = line.substr(space1 + 1, space2 - space1 - 1);
+
+  if (request.version != "HTTP/1.1" && request.version != "HTTP/1.0") {
+    reject(c, 400, "Unsupported HTTP version");
+    return;
+  }
+
+  const size_t question = target.find('?');
+  request.path = url_decode(target.substr(0, question), false);
+  if (question != std::string::npos) {
+    parse_query_string(target.substr(question + 1), request.params);
+  }
+
+  for (size_t start = line_end + 2; start < header_end;) {
+    const size_t end = c.in.find("\r\n", start);
+    const size_t colon = c.in.find(':', start);
+
+    if (colon == std::string::npos || colon > end) {
+      reject(c, 400, "Invalid header");
+      return;
+    }
+
+    const size_t value_start = c.in.find_first_not_of(" \t", colon + 1);
+    const size_t value_end = c.in.find_last_not_of(" \t", end - 1);
+    const std::string value = value_start < end && value_end != std::string::npos && value_end >= value_start ? c.in.substr(value_start, value_end - value_start + 1) : "";
+
+    request.headers.emplace(c.in.substr(start, colon - start), value);
+    start = end + 2;
+  }
+
+  if (request.headers.count("Transfer-Encoding")) {
+    reject(c, 501, "Chunked request bodies aren't supported; send a Content-Length");
+    return;
+  }
+
+  size_t length = 0;
+  const std::string content_length = request.get_header_value("Content-Length");
+  if (!content_length.empty()) {
+    if (!std::all_of(content_length.begin(), content_length.end(), ::isdigit) || content_length.size() > 18) {
+      reject(c, 400, "Invalid Content-Length");
+      return;
+    }
+
+    length = std::stoull(content_length);
+  }
+
+  if (length > server_.options_.max_body) {
+    reject(c, 413, "Request body too large");
+    return;
+  }
+
+  const size_t body_start = header_end + 4;
+  if (c.in.size() < body_start + length) {
+    // Clients that ask first wait for a 100 Continue before sending the body.
+    if (!c.sent_continue && iequals(request.get_header_value("Expect"), "100-continue")) {
+      c.out += "HTTP/1.1 100 Continue\r\n\r\n";
+      c.sent_continue = true;
+      flush(c);
+    }
+
+    return;
+  }
+
+  request.body = c.in.substr(body_start, length);
+  request.remote_addr = c.remote_addr;
+  request.received = Clock::now();
+  c.in.erase(0, body_start + length);
+  c.sent_continue = false;
+  c.requests++;
+
+  const std::string connection = request.get_header_value("Connection");
+  const bool close_requested = iequals(connection, "close");
+  const bool keep_alive_requested = iequals(connection, "keep-alive");
+  exchange->keep_alive = (request.version == "HTTP/1.1" ? !close_requested : keep_alive_requested)
+    && (server_.options_.keep_alive_max == 0 || c.requests < server_.options_.keep_alive_max);
+
+  exchange->loop = this;
+  exchange->connection = c.id;
+  c.busy = true;
+  update(c);
+
+  server_.dispatch(std::move(exchange));
+}
+
+void HttpServer::Loop::flush(Connection& c) {
+  while (c.out_offset < c.out.size()) {
+    const ssize_t n = ::send(c.fd, c.out.data() + c.out_offset, c.out.size() - c.out_offset, MSG_NOSIGNAL);
+
+    if (n > 0) {
+      c.out_offset += static_cast<size_t>(n);
+      c.last_active = Clock::now();
+
+      if (c.stream) {
+        std::unique_lock lock(c.stream->mutex);
+        c.stream->written += static_cast<size_t>(n);
+
+        if (c.stream->parked && c.stream->posted <= c.stream->written + stream_low_water) {
+          c.stream->parked = false;
+          lock.unlock();
+          server_.resume(c.stream);
+        }
+      }
+    } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    } else if (n < 0 && errno == EINTR) {
+      continue;
+    } else {
+      close(c);
+      return;
+    }
+  }
+
+  if (c.out_offset == c.out.size()) {
+    c.out.clear();
+    c.out_offset = 0;
+
+    if (c.close_after_write) {
+      close(c);
+      return;
+    }
+  }
+
+  update(c);
+}
+
+// Answer a request that couldn't be parsed, and close the connection.
+void HttpServer::Loop::reject(Connection& c, int status, const std::string& message) {
+  HttpResponse response;
+  response.status = status;
+  response.set_content(fmt::format("{{\"message\": \"{}\"}}", message), "application/json");
+
+  c.busy = true;
+  c.close_after_write = true;
+  c.in.clear();
+  c.out += response_head(response, false, false) + response.body;
+  flush(c);
+}
+
+// Wait for input only when we're ready for the next request, and for output
+// only when there's something to send.
+void HttpServer::Loop::update(Connection& c) {
+  const uint32_t events = (c.busy || c.read_closed ? 0u : EPOLLIN) | (c.out.empty() ? 0u : EPOLLOUT);
+  if (events == c.events)
+    return;
+
+  epoll_event event = {};
+  event.events = c.events = events;
+  event.data.u64 = c.id;
+  epoll_ctl(epoll_, EPOLL_CTL_MOD, c.fd, &event);
+}
+
+// Close a connection whose client has shut down its side, once every request
+// it sent has been answered. Anything still being written is sent first.
+void HttpServer::Loop::closeIfAnswered(uint64_t id) {
+  auto it = connections_.find(id);
+  if (it == connections_.end())
+    return;
+
+  Connection& c = *it->second;
+  if (!c.read_closed || c.busy)
+    return;
+
+  if (c.out.empty())
+    close(c);
+  else
+    c.close_after_write = true;
+}
+
+void HttpServer::Loop::close(Connection& c) {
+  if (c.stream) {
+    std::lock_guard lock(c.stream->mutex);
+    c.stream->closed = true;
+  }
+
+  epoll_ctl(epoll_, EPOLL_CTL_DEL, c.fd, nullptr);
+  ::close(c.fd);
+  server_.connections_--;
+  connections_.erase(c.id);
+}
+
+void HttpServer::Loop::complete(uint64_t id, std::string data, bool keep_alive) {
+  auto it = connections_.find(id);
+  if (it == connections_.end())
+    return;
+
+  Connection& c = *it->second;
+  c.out += data;
+  c.stream.reset();
+  c.busy = false;
+  c.close_after_write = !keep_alive;
+  c.last_active = Clock::now();
+
+  flush(c);
+
+  // Handle the next pipelined request, if it has already arrived.
+  it = connections_.find(id);
+  if (it != connections_.end() && !it->second->close_after_write)
+    parse(*it->second);
+
+  closeIfAnswered(id);
+}
+
+void HttpServer::Loop::append(uint64_t id, std::string data) {
+  auto it = connections_.find(id);
+  if (it == connections_.end())
+    return;
+
+  it->second->out += data;
+  flush(*it->second);
+}
+
+void HttpServer::Loop::abort(uint64_t id) {
+  auto it = connections_.find(id);
+  if (it != connections_.end())
+    close(*it->second);
+}
+
+void HttpServer::Loop::attach(uint64_t id, std::shared_ptr<Stream> stream) {
+  auto it = connections_.find(id);
+  if (it != connections_.end()) {
+    it->second->stream = std::move(stream);
+    return;
+  }
+
+  std::lock_guard lock(stream->mutex);
+  stream->closed = true;
+}
+
+// Close connections that have been idle too long, or whose client has
+// stopped sending its request or reading its response.
+void HttpServer::Loop::sweep() {
+  const auto now = Clock::now();
+  std::vector<Connection*> expired;
+
+  for (auto& [id, c] : connections_) {
+    const bool writing = !c->out.empty();
+    const bool idle = !c->busy && c->in.empty() && !writing;
+
+    if (idle && now - c->last_active > server_.options_.keep_alive_timeout) {
+      expired.push_back(c.get());
+    } else if ((writing || (!c->busy && !c->in.empty())) && now - c->last_active > server_.options_.read_timeout) {
+      expired.push_back(c.get());
+    }
+  }
+
+  for (Connection* c : expired) {
+    close(*c);
+  }
+}
+
+// Sends a streamed response's chunks to its event loop. Never blocks; the
+// caller checks how far behind the client is between calls to the provider.
+class HttpServer::ChunkSink : public HttpDataSink {
+public:
+  ChunkSink(std::function<void(std::string)> send, Stream& stream) : send_(std::move(send)), stream_(stream) {}
+
+  bool write(const char* data, size_t length) override {
+    if (length == 0)
+      return !failed_;
+
+    if (!post(fmt::format("{:x}\r\n", length) + std::string(data, length) + "\r\n"))
+      return false;
+
+    stream_.offset += length;
+    return true;
+  }
+
+  void done() override { done_ = true; }
+
+  bool post(std::string data) {
+    {
+      std::lock_guard lock(stream_.mutex);
+      if (stream_.closed) {
+        failed_ = true;
+        return false;
+      }
+
+      stream_.posted += data.size();
+    }
+
+    send_(std::move(data));
+    return true;
+  }
+
+  bool finished() const noexcept { return done_; }
+  bool failed() const noexcept { return failed_; }
+
+private:
+  std::function<void(std::string)> send_;
+  Stream& stream_;
+  bool done_ = false;
+  bool failed_ = false;
+};
+
+HttpServer::HttpServer(HttpServerOptions options) : options_(options) {
+  if (options_.io_threads == 0) {
+    throw param_error("The server needs at least one I/O thread");
+  }
+
+  for (size_t i = 0; i < options_.io_threads; i++) {
+    loops_.push_back(std::make_unique<Loop>(*this));
+  }
+}
+
+HttpServer::~HttpServer() {
+  stop();
+  loops_.clear();
+
+  for (int fd : listeners_) {
+    ::close(fd);
+  }
+
+  for (const auto& path : unix_paths_) {
+    unlink(path.c_str());
+  }
+}
+
+void HttpServer::Get(const std::string& pattern, Handler handler) {
+  routes_.push_back({ "GET", std::regex(pattern), std::move(handler) });
+}
+
+void HttpServer::Post(const std::string& pattern, Handler handler) {
+  routes_.push_back({ "POST", std::regex(pattern), std::move(handler) });
+}
+
+void HttpServer::Delete(const std::string& pattern, Handler handler) {
+  routes_.push_back({ "DELETE", std::regex(pattern), std::move(handler) });
+}
+
+void HttpServer::set_logger(Logger logger) {
+  logger_ = std::move(logger);
+}
+
+void HttpServer::set_exception_handler(ExceptionHandler handler) {
+  exception_handler_ = std::move(handler);
+}
+
+void HttpServer::set_stream_executor(Executor executor) {
+  stream_executor_ = std::move(executor);
+}
+
+static void listen_on(int fd, const std::string& address) {
+  if (listen(fd, SOMAXCONN) < 0) {
+    const std::string error = strerror(errno);
+    ::close(fd);
+    throw simple_error("Couldn't listen on " + address + " (" + error + ")");
+  }
+}
+
+void HttpServer::bind(const std::string& host, int port) {
+  const std::string address = host + ":" + std::to_string(port);
+
+  addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+
+  addrinfo* result = nullptr;
+  if (int error = getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &result); error != 0) {
+    throw simple_error("Couldn't resolve " + address + " (" + gai_strerror(error) + ")");
+  }
+
+  // Use the first address that we can bind to.
+  int fd = -1;
+  std::string error;
+  for (addrinfo* info = result; info != nullptr; info = info->ai_next) {
+    fd = socket(info->ai_family, info->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, info->ai_protocol);
+    if (fd < 0) {
+      error = strerror(errno);
+      continue;
+    }
+
+    const int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    if (::bind(fd, info->ai_addr, info->ai_addrlen) == 0)
+      break;
+
+    error = strerror(errno);
+    ::close(fd);
+    fd = -1;
+  }
+
+  freeaddrinfo(result);
+  if (fd < 0) {
+    throw simple_error("Couldn't bind to " + address + " (" + error + ")");
+  }
+
+  listen_on(fd, address);
+  listeners_.push_back(fd);
+}
+
+void HttpServer::bindUnix(const std::string& path) {
+  sockaddr_un address = {};
+  address.sun_family = AF_UNIX;
+
+  if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+    throw param_error("Invalid Unix socket path (path=" + path + ")");
+  }
+
+  std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+  // Remove the socket left behind by a previous run, but not other files.
+  struct stat st;
+  if (lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+    unlink(path.c_str());
+  }
+
+  const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0 || ::bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+    const std::string error = strerror(errno);
+    if (fd >= 0)
+      ::close(fd);
+    throw simple_error("Couldn't bind to " + path + " (" + error + ")");
+  }
+
+  listen_on(fd, path);
+  listeners_.push_back(fd);
+  unix_paths_.push_back(path);
+}
+
+void HttpServer::run() {
+  for (auto& loop : loops_) {
+    for (size_t i = 0; i < listeners_.size(); i++) {
+      loop->addListener(listeners_[i], i);
+    }
+
+    loop->start();
+  }
+
+  for (auto& loop : loops_) {
+    loop->join();
+  }
+}
+
+void HttpServer::stop() {
+  for (auto& loop : loops_) {
+    loop->stop();
+  }
+}
+
+void HttpServer::dispatch(std::shared_ptr<Exchange> exchange) {
+  HttpRequest& request = exchange->request;
+
+  for (const auto& route : routes_) {
+    if (route.method != request.method || !std::regex_match(request.path, request.matches, route.pattern))
+      continue;
+
+    try {
+      route.handler(request, exchange->response, [this, exchange](std::exception_ptr error) { finish(exchange, error); });
+    } catch (...) {
+      finish(exchange, std::current_exception());
+    }
+
+    return;
+  }
+
+  exchange->response.status = 404;
+  finish(exchange, nullptr);
+}
+
+void HttpServer::finish(std::shared_ptr<Exchange> exchange, std::exception_ptr error) {
+  HttpResponse& response = exchange->response;
+  Loop* loop = exchange->loop;
+  const uint64_t id = exchange->connection;
+  const bool keep_alive = exchange->keep_alive;
+
+  if (error) {
+    response.content_provider = nullptr;
+    if (exception_handler_) {
+      exception_handler_(exchange->request, response, error);
+    } else {
+      response.status = 500;
+    }
+  }
+
+  if (logger_) {
+    logger_(exchange->request, response);
+  }
+
+  if (!response.content_provider) {
+    std::string data = response_head(response, false, keep_alive) + response.body;
+    loop->post([id, data = std::move(data), keep_alive](Loop& l) mutable { l.complete(id, std::move(data), keep_alive); });
+    return;
+  }
+
+  // Start streaming the body on this thread. The event loop resumes it once
+  // the client has read what's been sent so far.
+  auto stream = std::make_shared<Stream>();
+  stream->exchange = std::move(exchange);
+  loop->post([id, stream](Loop& l) { l.attach(id, stream); });
+
+  ChunkSink sink([loop, id](std::string data) {
+    loop->post([id, data = std::move(data)](Loop& l) mutable { l.append(id, std::move(data)); });
+  }, *stream);
+
+  sink.post(response_head(response, true, keep_alive));
+  produce(std::move(stream));
+}
+
+// Run a streamed response's content provider until it's done, or until the
+// client falls too far behind, in which case the event loop calls resume()
+// once it has caught up.
+void HttpServer::produce(std::shared_ptr<Stream> stream) {
+  Exchange& exchange = *stream->exchange;
+  Loop* loop = exchange.loop;
+  const uint64_t id = exchange.connection;
+  const bool keep_alive = exchange.keep_alive;
+
+  ChunkSink sink([loop, id](std::string data) {
+    loop->post([id, data = std::move(data)](Loop& l) mutable { l.append(id, std::move(data)); });
+  }, *stream);
+
+  bool ok = true;
+  while (ok && !sink.finished() && !sink.failed()) {
+    {
+      std::lock_guard lock(stream->mutex);
+      if (stream->closed)
+        return;
+
+      if (stream->posted >= stream->written + stream_high_water) {
+        stream->parked = true;
+        return;
+      }
+    }
+
+    try {
+      ok = exchange.response.content_provider(stream->offset, sink);
+    } catch (const std::exception& e) {
+      ERROR("Exception while streaming {}: {}\n", exchange.request.path, e.what());
+      ok = false;
+    }
+  }
+
+  if (ok && !sink.failed()) {
+    std::unique_lock lock(stream->mutex);
+    stream->posted += 5;
+    lock.unlock();
+
+    loop->post([id, keep_alive](Loop& l) { l.complete(id, "0\r\n\r\n", keep_alive); });
+  } else {
+    loop->post([id](Loop& l) { l.abort(id); });
+  }
+}
+
+// Called on the event loop when a parked stream's client has caught up.
+void HttpServer::resume(std::shared_ptr<Stream> stream) {
+  if (stream_executor_ && stream_executor_([this, stream] { produce(stream); }))
+    return;
+
+  produce(std::move(stream));
+}
+
+}
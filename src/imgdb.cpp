@@ -24,6 +24,9 @@
 #include <sys/mman.h>
 
 #include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
 #include <memory>
 #include <vector>
 
@@ -31,44 +34,117 @@
 #include <iqdb/imgdb.h>
 #include <iqdb/imglib.h>
 #include <iqdb/haar_signature.h>
+#include <iqdb/kernels.h>
+#include <iqdb/knn_graph.h>
+#include <iqdb/lsh_index.h>
+#include <iqdb/metrics.h>
+#include <iqdb/query_cache.h>
 #include <iqdb/sqlite_db.h>
 
 namespace iqdb {
 
 void bucket_set::add(const HaarSignature &sig, imageId iqdb_id) {
   eachBucket(sig, [&](auto& bucket) {
-    bucket.push_back(iqdb_id);
+    bucket.insert(arena_, iqdb_id);
   });
 }
 
 void bucket_set::remove(const HaarSignature &sig, imageId iqdb_id) {
   eachBucket(sig, [&](auto& bucket) {
-    // https://en.wikipedia.org/wiki/Erase-remove_idiom
-    bucket.erase(std::remove(bucket.begin(), bucket.end(), iqdb_id), bucket.end());
+    bucket.erase(arena_, iqdb_id);
   });
 }
 
-bucket_t& bucket_set::at(int color, int coef) {
+const bucket_t& bucket_set::at(int color, int coef) const {
   const int sign = coef < 0;
   return buckets[color][sign][abs(coef)];
 }
 
-void bucket_set::eachBucket(const HaarSignature &sig, std::function<void(bucket_t&)> func) {
-  for (int c = 0; c < sig.num_colors(); c++) {
-    for (int i = 0; i < NUM_COEFS; i++) {
-      const int coef = sig.sig[c][i];
-      auto& bucket = at(c, coef);
-      func(bucket);
+void bucket_set::clear() {
+  for (auto& color : buckets) {
+    for (auto& sign : color) {
+      for (auto& bucket : sign) {
+        bucket.reset();
+      }
+    }
+  }
+
+  arena_.clear();
+}
+
+void bucket_set::compact() {
+  std::vector<bucket_t*> all;
+  for (auto& color : buckets) {
+    for (auto& sign : color) {
+      for (auto& bucket : sign) {
+        all.push_back(&bucket);
+      }
+    }
+  }
+
+  arena_.compact(std::move(all));
+}
+
+size_t bucket_set::memoryUsage() const {
+  return sizeof(buckets) + arena_.stats().committed;
+}
+
+BucketArenaStats bucket_set::arenaStats() const {
+  BucketArenaStats stats = arena_.stats();
+
+  for (const auto& color : buckets) {
+    for (const auto& sign : color) {
+      for (const auto& bucket : sign) {
+        stats.used += bucket.size() * sizeof(bucket_t::value_type);
+      }
+    }
+  }
+
+  return stats;
+}
+
+// Call `func(c, coef)` for each bucket that both the query and the image are
+// in, in the same order as queryFromSignature visits the query's buckets.
+template <typename F>
+static void eachSharedBucket(const HaarSignature& query, const HaarSignature& haar, F func) {
+  const int num_colors = std::min(query.num_colors(), haar.num_colors());
+
+  for (int c = 0; c < num_colors; c++) {
+    for (int b = 0; b < NUM_COEFS; b++) {
+      const int coef = query.sig[c][b];
+
+      if (std::binary_search(&haar.sig[c][0], &haar.sig[c][NUM_COEFS], coef)) {
+        func(c, coef);
+      }
     }
   }
 }
 
 void IQDB::addImage(imageId post_id, const HaarSignature& haar) {
-  removeImage(post_id);
+  ScopedTimer timer(metrics.add_image);
+
+  // The upsert keeps the row's id when the post is already in the table, so a
+  // replaced image is swapped out of the same slot in memory.
+  auto old_image = sqlite_db_->getImage(post_id);
   int iqdb_id = sqlite_db_->addImage(post_id, haar);
+
+  if (old_image)
+    removeImageInMemory(*old_image);
+  else
+    img_count++;
+
   addImageInMemory(iqdb_id, post_id, haar);
-  img_count++;
-  DEBUG("Added post #{} to memory and database (iqdb={} haar={}).\n", post_id, iqdb_id, haar.to_string());
+
+  if (query_cache_) {
+    query_cache_->update([&](auto& entry) {
+      return patchCachedQuery(entry, iqdb_id, post_id, haar);
+    });
+  }
+
+  if (knn_graph_)
+    addToKnnGraph(iqdb_id, post_id, haar);
+
+  DEBUG("Added post #{} to memory and database (iqdb={} haar={}).\n", post_id, iqdb_id, haar);
 }
 
 void IQDB::addImageInMemory(imageId iqdb_id, imageId post_id, const HaarSignature& haar) {
@@ -78,6 +154,10 @@ void IQDB::addImageInMemory(imageId iqdb_id, imageId post_id, const HaarSignatur
   }
 
   imgbuckets.add(haar, iqdb_id);
+  exact_index_.add(haar, post_id);
+
+  if (lsh_index_)
+    lsh_index_->add(haar, iqdb_id);
 
   image_info& info = m_info.at(iqdb_id);
   info.id = post_id;
@@ -86,10 +166,251 @@ void IQDB::addImageInMemory(imageId iqdb_id, imageId post_id, const HaarSignatur
   info.avgl.v[2] = static_cast<Score>(haar.avglf[2]);
 }
 
+// Score a newly added image against a cached query, and insert it into the
+// cached results if it's one of the top matches. Returns false if the entry
+// can't be patched and must be dropped instead.
+bool IQDB::patchCachedQuery(CachedQuery& entry, imageId iqdb_id, imageId post_id, const HaarSignature& haar) {
+  const HaarSignature& query = entry.signature;
+  const image_info& info = m_info.at(iqdb_id);
+
+  if (isDeleted(iqdb_id))
+    return true;
+
+  // None of the query's buckets were non-empty, so every score was 0.
+  if (entry.scale == 0)
+    return false;
+
+  // Compute the raw score exactly like queryFromSignature does.
+  Score s = 0;
+  for (int c = 0; c < query.num_colors(); c++) {
+    s += weights[0][c] * std::abs(info.avgl.v[c] - static_cast<Score>(query.avglf[c]));
+  }
+
+  bool scale_changed = false;
+  eachSharedBucket(query, haar, [&](int c, int coef) {
+    // If the new image is alone in this bucket, then the bucket was empty
+    // when the query ran, so it didn't count towards the query's scale.
+    scale_changed |= imgbuckets.at(c, coef).size() == 1;
+    s -= coefWeight(c, coef);
+  });
+
+  if (scale_changed)
+    return false;
+
+  const Score score = s * 100 * entry.scale;
+  auto& results = entry.results;
+
+  if (results.size() >= entry.limit && !(score > results.back().score))
+    return true;
+
+  auto pos = std::upper_bound(results.begin(), results.end(), score, [](Score new_score, const sim_value& value) {
+    return new_score > value.score;
+  });
+
+  results.emplace(pos, post_id, score);
+  if (results.size() > entry.limit)
+    results.pop_back();
+
+  return true;
+}
+
+// How many of a new image's nearest neighbours to rescore from their side when
+// patching the k-NN graph, as a multiple of k.
+static const size_t knn_graph_candidates = 4;
+
+// Give a newly added image its own neighbour list, and insert it into the
+// lists of the images it beats.
+//
+// Scores aren't symmetric: an image's neighbours are scored with its own
+// signature and its own scale. Rescoring every image from its side would be as
+// slow as rebuilding the whole graph, so only the new image's nearest
+// neighbours are rescored. An image that's close to the new image from its own
+// side but not from the new image's side can be missed. Its list is then
+// slightly worse than a full rebuild would make it.
+void IQDB::addToKnnGraph(iqdbId iqdb_id, postId post_id, const HaarSignature& haar) {
+  knn_graph_->resize(m_info.size());
+
+  const auto candidates = findNeighbors(iqdb_id, haar, knn_graph_candidates * knn_graph_->k());
+  knn_graph_->set(iqdb_id, candidates);
+
+  for (const auto& candidate : candidates) {
+    auto image = sqlite_db_->getImage(candidate.post_id);
+    if (!image || image->id != candidate.id)
+      continue;
+
+    knn_graph_->offer(candidate.id, { iqdb_id, post_id, pairScore(image->haar(), haar, iqdb_id) });
+  }
+}
+
+// The score that queryFromSignature would give image `iqdb_id` when querying
+// with `query`.
+Score IQDB::pairScore(const HaarSignature& query, const HaarSignature& haar, iqdbId iqdb_id) {
+  const image_info& info = m_info.at(iqdb_id);
+
+  Score s = 0;
+  for (int c = 0; c < query.num_colors(); c++) {
+    s += weights[0][c] * std::abs(info.avgl.v[c] - static_cast<Score>(query.avglf[c]));
+  }
+
+  eachSharedBucket(query, haar, [&](int c, int coef) {
+    s -= coefWeight(c, coef);
+  });
+
+  Score scale = 0;
+  for (int c = 0; c < query.num_colors(); c++) {
+    for (int b = 0; b < NUM_COEFS; b++) {
+      const int coef = query.sig[c][b];
+      if (!imgbuckets.at(c, coef).empty())
+        scale -= coefWeight(c, coef);
+    }
+  }
+
+  if (scale == 0)
+    return 0;
+
+  return s * 100 * (static_cast<Score>(1.0) / scale);
+}
+
+// Find the `count` nearest neighbours of image `iqdb_id` with a full scan.
+std::vector<Neighbor> IQDB::findNeighbors(iqdbId iqdb_id, const HaarSignature& haar, size_t count, const QueryOptions& options) {
+  std::vector<Neighbor> neighbors;
+  Score scale = 0;
+
+  // Ask for one extra result, since the image itself is normally the best match.
+  for (const auto& match : scan(haar, count + 1, options, scale)) {
+    if (match.id != iqdb_id && neighbors.size() < count)
+      neighbors.push_back({ match.id, m_info[match.id].id, match.score });
+  }
+
+  return neighbors;
+}
+
+sim_vector IQDB::similarFromGraph(const Image& image, size_t numres, const QueryOptions& options) {
+  const iqdbId iqdb_id = image.id;
+  sim_vector matches;
+
+  if (auto neighbors = knn_graph_->get(iqdb_id)) {
+    // Skip neighbours that have been removed since the list was built.
+    bool stale = false;
+    for (const auto& neighbor : *neighbors) {
+      if (neighbor.id >= m_info.size() || isDeleted(neighbor.id) || m_info[neighbor.id].id != neighbor.post_id) {
+        stale = true;
+      } else if (matches.size() < numres) {
+        matches.emplace_back(neighbor.post_id, neighbor.score);
+      }
+    }
+
+    // A list that's short without any removed neighbours means there are no
+    // other images to find.
+    if (matches.size() >= numres || !stale) {
+      metrics.knn_hits.inc();
+      return matches;
+    }
+  }
+
+  metrics.knn_misses.inc();
+  const auto neighbors = findNeighbors(iqdb_id, image.haar(), knn_graph_->k(), options);
+  knn_graph_->set(iqdb_id, neighbors);
+
+  matches.clear();
+  for (size_t i = 0; i < neighbors.size() && i < numres; i++) {
+    matches.emplace_back(neighbors[i].post_id, neighbors[i].score);
+  }
+
+  return matches;
+}
+
+bool IQDB::fillNeighbors(iqdbId iqdb_id) {
+  if (!knn_graph_ || iqdb_id >= m_info.size() || isDeleted(iqdb_id) || knn_graph_->get(iqdb_id))
+    return false;
+
+  auto image = sqlite_db_->getImage(m_info[iqdb_id].id);
+  if (!image || image->id != iqdb_id)
+    return false;
+
+  knn_graph_->set(iqdb_id, findNeighbors(iqdb_id, image->haar(), knn_graph_->k()));
+  return true;
+}
+
+void IQDB::enableKnnGraph(size_t k) {
+  knn_graph_.reset();
+
+  if (k == 0)
+    return;
+
+  if (filename_ != ":memory:")
+    knn_graph_ = KnnGraph::load(knnFilename(), k, fingerprint());
+
+  if (!knn_graph_)
+    knn_graph_ = std::make_unique<KnnGraph>(k);
+
+  knn_graph_->resize(m_info.size());
+}
+
+void IQDB::saveKnnGraph() {
+  if (knn_graph_ && filename_ != ":memory:")
+    knn_graph_->save(knnFilename(), fingerprint());
+}
+
+std::string IQDB::knnFilename() const {
+  return table_ == "images" ? filename_ + ".knn" : filename_ + "." + table_ + ".knn";
+}
+
+// A hash of which post is at which iqdb id, to tell if a saved k-NN graph
+// still matches the database.
+uint64_t IQDB::fingerprint() {
+  uint64_t h = 14695981039346656037ull; // FNV-1a
+
+  for (iqdbId id = 0; id < m_info.size(); id++) {
+    if (!isDeleted(id)) {
+      h = (h ^ id) * 1099511628211ull;
+      h = (h ^ m_info[id].id) * 1099511628211ull;
+    }
+  }
+
+  return h;
+}
+
+void IQDB::enableLshIndex(size_t tables) {
+  lsh_index_.reset();
+
+  if (tables == 0)
+    return;
+
+  lsh_index_ = std::make_unique<LshIndex>(tables);
+  sqlite_db_->eachImage([&](const auto& image) {
+    lsh_index_->add(image.haar(), image.id);
+  });
+
+  INFO("Built LSH index ({} tables, {} bytes).\n", tables, lsh_index_->memoryUsage());
+}
+
+void IQDB::enableQueryCache(size_t capacity) {
+  if (capacity == 0) {
+    query_cache_.reset();
+  } else {
+    query_cache_ = std::make_unique<QueryCache>(capacity);
+  }
+}
+
 void IQDB::loadDatabase(std::string filename) {
-  sqlite_db_ = std::make_unique<SqliteDB>(filename);
+  sqlite_db_ = std::make_unique<SqliteDB>(filename, table_);
+  filename_ = filename;
+  loadImages();
+}
+
+// Rebuild the in-memory index from the images in the database.
+void IQDB::loadImages() {
+  img_count = 0;
   m_info.clear();
-  imgbuckets = bucket_set();
+  imgbuckets.clear();
+  exact_index_.clear();
+
+  if (lsh_index_)
+    lsh_index_->clear();
+
+  if (query_cache_)
+    query_cache_->clear();
 
   sqlite_db_->eachImage([&](const auto& image) {
     addImageInMemory(image.id, image.post_id, image.haar());
@@ -100,7 +421,18 @@ void IQDB::loadDatabase(std::string filename) {
     }
   });
 
-  INFO("Loaded {} images from {}.\n", getImgCount(), filename);
+  compactMemory();
+  INFO("Loaded {} images from {} (table={}).\n", getImgCount(), filename_, table_);
+
+  if (knn_graph_)
+    enableKnnGraph(knn_graph_->k());
+}
+
+void IQDB::compactMemory() {
+  imgbuckets.compact();
+
+  const auto stats = imgbuckets.arenaStats();
+  DEBUG("Compacted buckets (committed={} used={} fragmentation={:.3f}).\n", stats.committed, stats.used, stats.fragmentation());
 }
 
 bool IQDB::isDeleted(imageId iqdb_id) {
@@ -111,60 +443,305 @@ std::optional<Image> IQDB::getImage(imageId post_id) {
   return sqlite_db_->getImage(post_id);
 }
 
-sim_vector IQDB::queryFromChannels(std::vector<unsigned char> rchan, std::vector<unsigned char> gchan, std::vector<unsigned char> bchan, int numres) {
+std::vector<Image> IQDB::getImages(const std::vector<imageId>& post_ids) {
+  return sqlite_db_->getImages(post_ids);
+}
+
+std::vector<Image> IQDB::getImages(iqdbId first, size_t limit) {
+  return sqlite_db_->getImages(first, limit);
+}
+
+bool QueryFilter::matches(postId post_id) const {
+  if (post_id < min_id || post_id > max_id)
+    return false;
+
+  return post_ids.empty() || std::binary_search(post_ids.begin(), post_ids.end(), post_id);
+}
+
+void QueryOptions::checkDeadline() const {
+  if (deadline && std::chrono::steady_clock::now() > *deadline) {
+    throw timeout_error("Query deadline exceeded");
+  }
+}
+
+sim_vector IQDB::queryFromChannels(std::vector<unsigned char> rchan, std::vector<unsigned char> gchan, std::vector<unsigned char> bchan, int numres, const QueryOptions& options) {
   HaarSignature signature = HaarSignature::from_channels(rchan, gchan, bchan);
-  return queryFromSignature(signature, numres);
+  return queryFromSignature(signature, numres, options);
 }
 
-sim_vector IQDB::queryFromSignature(const HaarSignature &signature, size_t numres) {
+// How many images to score between deadline checks.
+static const size_t deadline_check_interval = 1 << 16;
+
+// Filtered queries only score the matching images if fewer than one in this
+// many images match.
+static const size_t filter_scan_ratio = 16;
+
+// The iqdb ids of the live images that match `filter`, in order.
+std::vector<iqdbId> IQDB::filterCandidates(const QueryFilter& filter) {
+  std::vector<iqdbId> candidates;
+
+  for (iqdbId id = 0; id < m_info.size(); id++) {
+    if (!isDeleted(id) && filter.matches(m_info[id].id))
+      candidates.push_back(id);
+  }
+
+  return candidates;
+}
+
+sim_vector IQDB::queryFromSignature(const HaarSignature &signature, size_t numres, const QueryOptions& options) {
+  DEBUG("Querying signature={}\n", signature);
+  options.checkDeadline();
+  metrics.queries.inc();
+
+  const bool approximate = options.probes && lsh_index_;
+  const bool cacheable = !approximate && !options.filter;
+
+  if (query_cache_ && !options.profile && cacheable) {
+    if (auto results = query_cache_->get(signature, numres)) {
+      return *results;
+    }
+  }
+
   Score scale = 0;
-  std::vector<Score> scores(m_info.size(), 0);
-  std::priority_queue<sim_value> pqResults; /* results priority queue; largest at top */
-  sim_vector V; /* output results */
+  sim_vector V;
 
-  DEBUG("Querying signature={}\n", signature.to_string());
+  if (approximate) {
+    auto candidates = lsh_index_->candidates(signature, options.probes);
+    if (options.filter) {
+      candidates.erase(std::remove_if(candidates.begin(), candidates.end(), [&](iqdbId id) { return !options.filter->matches(m_info[id].id); }), candidates.end());
+    }
 
-  // Luminance score (DC coefficient).
-  for (size_t i = 0; i < scores.size(); i++) {
-    auto image_info = m_info[i];
-    Score s = 0;
+    V = scanCandidates(signature, candidates, numres, options, scale);
+  } else if (options.filter) {
+    // If only a few images match the filter, only score those. Otherwise a
+    // full scan is faster than looking up every matching image in each bucket.
+    const auto candidates = filterCandidates(*options.filter);
 
-    for (int c = 0; c < signature.num_colors(); c++) {
-      s += weights[0][c] * std::abs(image_info.avgl.v[c] - static_cast<Score>(signature.avglf[c]));
+    if (candidates.size() * filter_scan_ratio < m_info.size()) {
+      V = scanCandidates(signature, candidates, numres, options, scale);
+    } else {
+      V = scan(signature, numres, options, scale);
     }
+  } else {
+    V = scan(signature, numres, options, scale);
+  }
 
-    scores[i] = s;
+  for (auto& value : V) {
+    value.id = m_info[value.id].id; // XXX replace iqdb id with post id
   }
 
-  for (int c = 0; c < signature.num_colors(); c++) {
+  if (query_cache_ && cacheable)
+    query_cache_->put(signature, numres, V, scale);
+
+  return V;
+}
+
+// Call `func(k)` for each `candidates[k]` that's in `bucket`. Both are sorted.
+// Small buckets are merged with the candidates; in big buckets, each
+// candidate is found with a galloping search from the previous one.
+template <typename F>
+static void intersect(const std::vector<iqdbId>& candidates, const bucket_t& bucket, F func) {
+  const iqdbId* it = bucket.begin();
+  const iqdbId* end = bucket.end();
+
+  if (bucket.size() <= candidates.size()) {
+    for (size_t k = 0; k < candidates.size() && it != end; k++) {
+      while (it != end && *it < candidates[k])
+        it++;
+
+      if (it != end && *it == candidates[k])
+        func(k);
+    }
+
+    return;
+  }
+
+  for (size_t k = 0; k < candidates.size() && it != end; k++) {
+    size_t step = 1;
+    while (step < static_cast<size_t>(end - it) && it[step] < candidates[k])
+      step *= 2;
+
+    it = std::lower_bound(it + step / 2, it + std::min(step + 1, static_cast<size_t>(end - it)), candidates[k]);
+    if (it != end && *it == candidates[k])
+      func(k);
+  }
+}
+
+// Like scan, but only score `candidates`, which must be sorted.
+template <int Colors>
+sim_vector IQDB::scanCandidates(const HaarSignature &signature, const std::vector<iqdbId>& candidates, size_t numres, const QueryOptions& options, Score& scale) {
+  std::vector<Score> scores(candidates.size(), 0);
+  scale = 0;
+
+  QueryProfile* profile = options.profile;
+  if (profile) {
+    profile->num_colors = Colors;
+    profile->images = candidates.size();
+    profile->candidates = candidates.size();
+  }
+
+  Stopwatch stopwatch;
+
+  for (size_t k = 0; k < candidates.size(); k++) {
+    const image_info& info = m_info[candidates[k]];
+    for (int c = 0; c < Colors; c++) {
+      scores[k] += weights[0][c] * std::abs(info.avgl.v[c] - static_cast<Score>(signature.avglf[c]));
+    }
+  }
+
+  auto elapsed = stopwatch.lap(metrics.query_dc);
+  if (profile)
+    profile->dc_time = elapsed;
+
+  for (int c = 0; c < Colors; c++) {
+    for (int b = 0; b < NUM_COEFS; b++) {
+      const int coef = signature.sig[c][b];
+      const auto& bucket = imgbuckets.at(c, coef);
+      const Score weight = coefWeight(c, coef);
+
+      if (profile)
+        profile->buckets.push_back({ c, coef, bucket.size(), weight });
+
+      if (bucket.empty())
+        continue;
+
+      options.checkDeadline();
+      scale -= weight;
+
+      size_t scattered = 0;
+      intersect(candidates, bucket, [&](size_t k) {
+        scores[k] -= weight;
+        scattered++;
+      });
+
+      if (profile)
+        profile->ids_scattered += scattered;
+    }
+  }
+
+  elapsed = stopwatch.lap(metrics.query_scatter);
+  if (profile)
+    profile->scatter_time = elapsed;
+
+  sim_vector V;
+  for (size_t k = 0; k < candidates.size(); k++) {
+    V.emplace_back(candidates[k], scores[k]);
+  }
+
+  const size_t count = std::min(numres, V.size());
+  std::partial_sort(V.begin(), V.begin() + static_cast<ptrdiff_t>(count), V.end(), [](const auto& a, const auto& b) { return a.score < b.score; });
+  V.erase(V.begin() + static_cast<ptrdiff_t>(count), V.end());
+
+  if (scale != 0)
+    scale = static_cast<Score>(1.0) / scale;
+
+  for (auto& value : V) {
+    value.score = value.score * 100 * scale;
+  }
+
+  elapsed = stopwatch.lap(metrics.query_topk);
+  if (profile)
+    profile->topk_time = elapsed;
+
+  return V;
+}
+
+// Score every image against a signature with `Colors` color channels. The
+// raw scores are indexed by iqdb id; lower is better. `scale` is set to minus
+// the total weight of the query's non-empty buckets, the best possible score
+// apart from the DC term.
+template <int Colors>
+std::vector<Score> IQDB::scoreAll(const HaarSignature &signature, const QueryOptions& options, Score& scale) {
+  std::vector<Score> scores(m_info.size(), 0);
+  scale = 0;
+
+  QueryProfile* profile = options.profile;
+  if (profile) {
+    profile->num_colors = Colors;
+    profile->images = scores.size();
+  }
+
+  const Kernels& k = kernels();
+  Stopwatch stopwatch;
+
+  // Luminance score (DC coefficient).
+  const Score avgl[3] = { static_cast<Score>(signature.avglf[0]), static_cast<Score>(signature.avglf[1]), static_cast<Score>(signature.avglf[2]) };
+  for (size_t i = 0; i < scores.size(); i += deadline_check_interval) {
+    options.checkDeadline();
+    k.dc(&m_info[i], std::min(deadline_check_interval, scores.size() - i), Colors, weights[0], avgl, &scores[i]);
+  }
+
+  auto elapsed = stopwatch.lap(metrics.query_dc);
+  if (profile)
+    profile->dc_time = elapsed;
+
+  for (int c = 0; c < Colors; c++) {
     for (int b = 0; b < NUM_COEFS; b++) { // for every coef on a sig
       const int coef = signature.sig[c][b];
       auto &bucket = imgbuckets.at(c, coef);
 
+      const Score weight = coefWeight(c, coef);
+
+      if (profile) {
+        profile->buckets.push_back({ c, coef, bucket.size(), weight });
+        profile->ids_scattered += bucket.size();
+      }
+
       if (bucket.empty())
         continue;
 
-      const int w = imgBin.bin[abs(coef)];
-      Score weight = weights[w][c];
+      options.checkDeadline();
       scale -= weight;
 
-      for (auto index : bucket) {
-        scores[index] -= weight;
-      }
+      k.scatter(scores.data(), bucket.begin(), bucket.size(), 0, weight);
     }
   }
 
+  elapsed = stopwatch.lap(metrics.query_scatter);
+  if (profile)
+    profile->scatter_time = elapsed;
+
+  return scores;
+}
+
+// Score every image against a signature with `Colors` color channels, and
+// return the top `numres` images. `scale` is set to the factor that turns raw
+// scores into the 0 to 100 scores of the results.
+template <int Colors>
+sim_vector IQDB::scan(const HaarSignature &signature, size_t numres, const QueryOptions& options, Score& scale) {
+  const std::vector<Score> scores = scoreAll<Colors>(signature, options, scale);
+  std::priority_queue<sim_value> pqResults; /* results priority queue; largest at top */
+  sim_vector V; /* output results */
+
+  QueryProfile* profile = options.profile;
+  const Kernels& k = kernels();
+  Stopwatch stopwatch;
+
+  // Images that are deleted, or don't match the query's filter, can't be results.
+  const QueryFilter* filter = options.filter ? &*options.filter : nullptr;
+  auto excluded = [&](iqdbId id) {
+    return isDeleted(id) || (filter && !filter->matches(m_info[id].id));
+  };
+
   // Fill up the numres-bounded priority queue (largest at top):
+  size_t heap_updates = 0;
   iqdbId i = 0;
   for (; pqResults.size() < numres && i < scores.size(); i++) {
-    if (!isDeleted(i))
+    if (!excluded(i))
       pqResults.emplace(i, scores[i]);
   }
 
-  for (; i < scores.size(); i++) {
-    if (!isDeleted(i) && scores[i] < pqResults.top().score) {
-      pqResults.pop();
-      pqResults.emplace(i, scores[i]);
+  // Skip ahead to each image that beats the worst result so far.
+  for (size_t begin = i; !pqResults.empty() && begin < scores.size(); begin += deadline_check_interval) {
+    options.checkDeadline();
+    const size_t end = std::min(begin + deadline_check_interval, scores.size());
+
+    for (size_t next = begin; (next = k.find_below(scores.data(), next, end, pqResults.top().score)) < end; next++) {
+      if (!excluded(static_cast<iqdbId>(next))) {
+        pqResults.pop();
+        pqResults.emplace(static_cast<iqdbId>(next), scores[next]);
+        heap_updates++;
+      }
     }
   }
 
@@ -173,7 +750,6 @@ sim_vector IQDB::queryFromSignature(const HaarSignature &signature, size_t numre
 
   while (!pqResults.empty()) {
     auto value = pqResults.top();
-    value.id = m_info[value.id].id; // XXX replace iqdb id with post id
     value.score = value.score * 100 * scale;
 
     V.push_back(value);
@@ -181,29 +757,365 @@ sim_vector IQDB::queryFromSignature(const HaarSignature &signature, size_t numre
   }
 
   std::reverse(V.begin(), V.end());
+  auto elapsed = stopwatch.lap(metrics.query_topk);
+
+  if (profile) {
+    profile->topk_time = elapsed;
+    profile->heap_updates = heap_updates;
+    profile->candidates = 0;
+    for (iqdbId id = 0; id < scores.size(); id++) {
+      profile->candidates += !excluded(id);
+    }
+  }
+
+  return V;
+}
+
+// Dispatch on the number of color channels once per query, so that the loops
+// over the channels in the templates above are unrolled, and grayscale queries
+// get their own leaner version.
+sim_vector IQDB::scan(const HaarSignature &signature, size_t numres, const QueryOptions& options, Score& scale) {
+  return signature.num_colors() == 1 ? scan<1>(signature, numres, options, scale) : scan<3>(signature, numres, options, scale);
+}
+
+sim_vector IQDB::scanCandidates(const HaarSignature &signature, const std::vector<iqdbId>& candidates, size_t numres, const QueryOptions& options, Score& scale) {
+  return signature.num_colors() == 1 ? scanCandidates<1>(signature, candidates, numres, options, scale) : scanCandidates<3>(signature, candidates, numres, options, scale);
+}
+
+sim_vector IQDB::queryAboveThreshold(const HaarSignature &signature, Score min_score, const QueryOptions& options) {
+  DEBUG("Querying signature={} min_score={}\n", signature, min_score);
+  options.checkDeadline();
+  metrics.queries.inc();
+
+  Score scale = 0;
+  const std::vector<Score> scores = signature.num_colors() == 1 ? scoreAll<1>(signature, options, scale) : scoreAll<3>(signature, options, scale);
+
+  QueryProfile* profile = options.profile;
+  const Kernels& k = kernels();
+  Stopwatch stopwatch;
+
+  // A result's score is `raw * 100 / scale`, and scale is negative, so an
+  // image scores at least min_score if its raw score is at most
+  // `min_score * scale / 100`. Instead of keeping a heap, find those images
+  // with a single pass of find_below. The bound is loosened a little, so that
+  // rounding can't drop an image right at the threshold; the final scores are
+  // checked against min_score exactly. If none of the query's buckets have
+  // any images, every image scores 0.
+  constexpr Score infinity = std::numeric_limits<Score>::infinity();
+  const Score raw = min_score * scale / 100;
+  const Score bound = scale == 0 ? (min_score <= 0 ? infinity : -infinity) : std::nextafter(raw + std::abs(raw) * static_cast<Score>(1e-4), infinity);
+  const Score inverse = scale == 0 ? 0 : static_cast<Score>(1.0) / scale;
+
+  const QueryFilter* filter = options.filter ? &*options.filter : nullptr;
+  auto excluded = [&](iqdbId id) {
+    return isDeleted(id) || (filter && !filter->matches(m_info[id].id));
+  };
+
+  sim_vector V;
+  for (size_t begin = 0; begin < scores.size(); begin += deadline_check_interval) {
+    options.checkDeadline();
+    const size_t end = std::min(begin + deadline_check_interval, scores.size());
+
+    for (size_t next = begin; (next = k.find_below(scores.data(), next, end, bound)) < end; next++) {
+      const Score score = scores[next] * 100 * inverse;
+      if (score >= min_score && !excluded(static_cast<iqdbId>(next)))
+        V.emplace_back(static_cast<iqdbId>(next), score);
+    }
+  }
+
+  // Best match first, ties in id order.
+  std::sort(V.begin(), V.end(), [](const auto& a, const auto& b) { return a.score != b.score ? a.score > b.score : a.id < b.id; });
+  for (auto& value : V) {
+    value.id = m_info[value.id].id; // XXX replace iqdb id with post id
+  }
+
+  auto elapsed = stopwatch.lap(metrics.query_topk);
+  if (profile) {
+    profile->topk_time = elapsed;
+    profile->candidates = 0;
+    for (iqdbId id = 0; id < scores.size(); id++) {
+      profile->candidates += !excluded(id);
+    }
+  }
+
   return V;
 }
 
+std::vector<sim_vector> IQDB::queryBatch(const std::vector<BatchQuery>& queries, const QueryOptions& options) {
+  options.checkDeadline();
+  metrics.query_batches.inc();
+
+  std::vector<sim_vector> results(queries.size());
+  std::vector<size_t> pending; // The queries that weren't cached.
+  std::vector<const BatchQuery*> batch;
+
+  for (size_t q = 0; q < queries.size(); q++) {
+    metrics.queries.inc();
+    metrics.batched_queries.inc();
+
+    if (query_cache_) {
+      if (auto cached = query_cache_->get(queries[q].signature, queries[q].numres)) {
+        results[q] = std::move(*cached);
+        continue;
+      }
+    }
+
+    pending.push_back(q);
+    batch.push_back(&queries[q]);
+  }
+
+  if (batch.empty())
+    return results;
+
+  ScopedTimer timer(metrics.query_batch);
+  std::vector<Score> scales;
+  auto scanned = scanBatch(batch, options, scales);
+
+  for (size_t k = 0; k < pending.size(); k++) {
+    sim_vector& V = results[pending[k]];
+    V = std::move(scanned[k]);
+
+    for (auto& value : V) {
+      value.id = m_info[value.id].id; // XXX replace iqdb id with post id
+    }
+
+    if (query_cache_)
+      query_cache_->put(batch[k]->signature, batch[k]->numres, V, scales[k]);
+  }
+
+  return results;
+}
+
+// How many images scanBatch scores at a time. The scores of a whole batch for
+// one tile should fit in the L2 cache.
+static const size_t batch_tile = 4096;
+
+// How many ids at a time scanBatch skips over while looking for the end of a
+// bucket's part of a tile.
+static const ptrdiff_t scatter_block = 16;
+
+// Like scan, but for several queries at once. The images are scanned a tile at
+// a time: each image's info is read once per tile for every query in the
+// batch, and each query's buckets are walked in step with the tiles (buckets
+// are sorted). Every image's score is computed in the same order as scan
+// does, so the scores are exactly the same.
+std::vector<sim_vector> IQDB::scanBatch(const std::vector<const BatchQuery*>& queries, const QueryOptions& options, std::vector<Score>& scales) {
+  // A query's position in one of its buckets.
+  struct Cursor {
+    const iqdbId* it;
+    const iqdbId* end;
+    Score weight;
+  };
+
+  const size_t count = queries.size();
+  const size_t slots = m_info.size();
+
+  std::vector<int> colors(count);
+  std::vector<std::array<Score, 3>> avgl(count);
+  std::vector<std::vector<Cursor>> cursors(count);
+  scales.assign(count, 0);
+
+  for (size_t q = 0; q < count; q++) {
+    const HaarSignature& signature = queries[q]->signature;
+    colors[q] = signature.num_colors();
+
+    for (int c = 0; c < colors[q]; c++) {
+      avgl[q][c] = static_cast<Score>(signature.avglf[c]);
+
+      for (int b = 0; b < NUM_COEFS; b++) {
+        const int coef = signature.sig[c][b];
+        const auto& bucket = imgbuckets.at(c, coef);
+        const Score weight = coefWeight(c, coef);
+
+        if (bucket.empty())
+          continue;
+
+        scales[q] -= weight;
+        cursors[q].push_back({ bucket.begin(), bucket.end(), weight });
+      }
+    }
+  }
+
+  const Kernels& k = kernels();
+  std::vector<Score> scores(count * batch_tile);
+  std::vector<std::priority_queue<sim_value>> heaps(count); /* results priority queues; largest at top */
+
+  for (size_t base = 0; base < slots; base += batch_tile) {
+    options.checkDeadline();
+    const size_t size = std::min(batch_tile, slots - base);
+
+    // Luminance score (DC coefficient). The tile's infos stay in the cache
+    // from one query to the next.
+    for (size_t q = 0; q < count; q++) {
+      k.dc(&m_info[base], size, colors[q], weights[0], avgl[q].data(), &scores[q * batch_tile]);
+    }
+
+    // The part of each bucket in this tile.
+    const size_t end = base + size;
+    for (size_t q = 0; q < count; q++) {
+      Score* tile = &scores[q * batch_tile];
+
+      for (auto& cursor : cursors[q]) {
+        // Find where the bucket leaves the tile a block of ids at a time
+        // (the ids are sorted), then scatter the ids before it in one go.
+        const iqdbId* stop = cursor.it;
+        while (cursor.end - stop >= scatter_block && stop[scatter_block - 1] < end)
+          stop += scatter_block;
+        while (stop != cursor.end && *stop < end)
+          stop++;
+
+        k.scatter(tile, cursor.it, static_cast<size_t>(stop - cursor.it), static_cast<iqdbId>(base), cursor.weight);
+        cursor.it = stop;
+      }
+    }
+
+    for (size_t q = 0; q < count; q++) {
+      const Score* tile = &scores[q * batch_tile];
+      auto& heap = heaps[q];
+      const size_t numres = queries[q]->numres;
+
+      size_t i = 0;
+      for (; i < size && heap.size() < numres; i++) {
+        if (!isDeleted(static_cast<iqdbId>(base + i)))
+          heap.emplace(static_cast<iqdbId>(base + i), tile[i]);
+      }
+
+      if (heap.empty())
+        continue;
+
+      for (size_t next = i; (next = k.find_below(tile, next, size, heap.top().score)) < size; next++) {
+        if (!isDeleted(static_cast<iqdbId>(base + next))) {
+          heap.pop();
+          heap.emplace(static_cast<iqdbId>(base + next), tile[next]);
+        }
+      }
+    }
+  }
+
+  std::vector<sim_vector> results(count);
+  for (size_t q = 0; q < count; q++) {
+    const Score scale = scales[q] != 0 ? static_cast<Score>(1.0) / scales[q] : 0;
+    scales[q] = scale;
+
+    auto& heap = heaps[q];
+    while (!heap.empty()) {
+      auto value = heap.top();
+      value.score = value.score * 100 * scale;
+
+      results[q].push_back(value);
+      heap.pop();
+    }
+
+    std::reverse(results[q].begin(), results[q].end());
+  }
+
+  return results;
+}
+
+std::optional<sim_vector> IQDB::querySimilar(postId post_id, size_t numres, const QueryOptions& options) {
+  auto image = sqlite_db_->getImage(post_id);
+  if (!image)
+    return std::nullopt;
+
+  // Profiled queries always scan, so that the profile shows the cost of a real
+  // scan. The graph doesn't know about filters either.
+  if (knn_graph_ && numres <= knn_graph_->k() && !options.profile && !options.filter)
+    return similarFromGraph(*image, numres, options);
+
+  // Ask for one extra result, since the post itself is normally the best match.
+  sim_vector matches = queryFromSignature(image->haar(), numres + 1, options);
+  matches.erase(std::remove_if(matches.begin(), matches.end(), [&](const auto& match) { return match.id == post_id; }), matches.end());
+
+  if (matches.size() > numres)
+    matches.erase(matches.begin() + numres, matches.end());
+
+  return matches;
+}
+
+sim_vector IQDB::findExact(const HaarSignature& signature, size_t limit) {
+  sim_vector matches;
+
+  // The index only stores hashes, so check each candidate's real signature.
+  for (postId post_id : exact_index_.candidates(signature)) {
+    if (matches.size() >= limit)
+      break;
+
+    auto image = sqlite_db_->getImage(post_id);
+    if (image && ExactIndex::sameImage(signature, image->haar()))
+      matches.emplace_back(post_id, 100.0f);
+  }
+
+  std::sort(matches.begin(), matches.end(), [](const auto& a, const auto& b) { return a.id < b.id; });
+  (matches.empty() ? metrics.exact_misses : metrics.exact_hits).inc();
+  return matches;
+}
+
 void IQDB::removeImage(imageId post_id) {
+  ScopedTimer timer(metrics.remove_image);
   auto image = sqlite_db_->getImage(post_id);
   if (image == std::nullopt) {
     WARN("Couldn't remove post #{}; post not in sqlite database.\n", post_id);
     return;
   }
 
-  imgbuckets.remove(image->haar(), image->id);
-  m_info.at(image->id).avgl.v[0] = 0;
+  removeImageInMemory(*image);
   sqlite_db_->removeImage(post_id);
 
   INFO("Removed post #{} from memory and database.\n", post_id);
 }
 
+void IQDB::removeImageInMemory(const Image& image) {
+  const HaarSignature haar = image.haar();
+  const postId post_id = image.post_id;
+  imgbuckets.remove(haar, image.id);
+  exact_index_.remove(haar, post_id);
+
+  if (lsh_index_)
+    lsh_index_->remove(haar, image.id);
+  m_info.at(image.id).avgl.v[0] = 0;
+
+  // Other lists that contain this image are fixed when they're next used.
+  if (knn_graph_)
+    knn_graph_->invalidate(image.id);
+
+  // Drop cached queries that returned this image (we don't know what the next
+  // best match was), or whose scale changed because a bucket became empty.
+  if (query_cache_) {
+    query_cache_->update([&](auto& entry) {
+      for (const auto& result : entry.results) {
+        if (result.id == post_id)
+          return false;
+      }
+
+      bool scale_changed = false;
+      eachSharedBucket(entry.signature, haar, [&](int c, int coef) {
+        scale_changed |= imgbuckets.at(c, coef).empty();
+      });
+
+      return !scale_changed;
+    });
+  }
+}
+
 size_t IQDB::getImgCount() {
   return img_count;
 }
 
-IQDB::IQDB(std::string filename) : sqlite_db_(nullptr) {
+MemoryUsage IQDB::memoryUsage() const {
+  return MemoryUsage {
+    imgbuckets.memoryUsage(),
+    m_info.capacity() * sizeof(image_info),
+    imgbuckets.arenaStats(),
+    exact_index_.memoryUsage(),
+    knn_graph_ ? knn_graph_->memoryUsage() : 0,
+    lsh_index_ ? lsh_index_->memoryUsage() : 0,
+  };
+}
+
+IQDB::IQDB(std::string filename, std::string table) : sqlite_db_(nullptr), table_(table) {
   loadDatabase(filename);
 }
 
+IQDB::~IQDB() = default;
+
 }
@@ -21,14 +21,20 @@
 #include <cstring>
 #include <cstdlib>
 #include <string>
+#include <vector>
 
+#include <iqdb/coordinator.h>
 #include <iqdb/debug.h>
+#include <iqdb/duplicates.h>
+#include <iqdb/reorder.h>
 #include <iqdb/server.h>
 #include <iqdb/sqlite_db.h>
 
 using namespace iqdb;
 
 int main(int argc, char **argv) {
+  start_log_writer();
+
   try {
     // open_swap();
     if (argc < 2)
@@ -42,11 +48,65 @@ int main(int argc, char **argv) {
     }
 
     if (!strcasecmp(argv[1], "http")) {
-      const std::string host = argc >= 2 ? argv[2] : "localhost";
-      const int port = argc >= 3 ? std::stoi(argv[3]) : 8000;
-      const std::string filename = argc >= 4 ? argv[4] : "iqdb.db";
+      ServerOptions options;
+      std::vector<std::string> args;
+
+      for (int i = 2; i < argc; i++) {
+        if (!strncmp(argv[i], "--", 2)) {
+          parse_option(options, argv[i]);
+        } else {
+          args.push_back(argv[i]);
+        }
+      }
+
+      const std::string host = args.size() >= 1 ? args[0] : "localhost";
+      const int port = args.size() >= 2 ? std::stoi(args[1]) : 8000;
+      const std::string filename = args.size() >= 3 ? args[2] : "iqdb.db";
+
+      http_server(host, port, filename, options);
+    } else if (!strcasecmp(argv[1], "dupes")) {
+      DuplicateOptions options;
+      std::vector<std::string> args;
+
+      for (int i = 2; i < argc; i++) {
+        if (!strncmp(argv[i], "--", 2)) {
+          parse_option(options, argv[i]);
+        } else {
+          args.push_back(argv[i]);
+        }
+      }
+
+      const std::string filename = args.size() >= 1 ? args[0] : "iqdb.db";
+      find_duplicates(filename, options);
+    } else if (!strcasecmp(argv[1], "reorder")) {
+      ReorderOptions options;
+      std::vector<std::string> args;
+
+      for (int i = 2; i < argc; i++) {
+        if (!strncmp(argv[i], "--", 2)) {
+          parse_option(options, argv[i]);
+        } else {
+          args.push_back(argv[i]);
+        }
+      }
+
+      const std::string filename = args.size() >= 1 ? args[0] : "iqdb.db";
+      reorder_database(filename, options);
+    } else if (!strcasecmp(argv[1], "coordinator")) {
+      CoordinatorOptions options;
+      std::vector<std::string> args;
+
+      for (int i = 2; i < argc; i++) {
+        if (!strncmp(argv[i], "--", 2)) {
+          parse_option(options, argv[i]);
+        } else {
+          args.push_back(argv[i]);
+        }
+      }
 
-      http_server(host, port, filename);
+      const std::string host = args.size() >= 1 ? args[0] : "localhost";
+      const int port = args.size() >= 2 ? std::stoi(args[1]) : 8000;
+      coordinator(host, port, options);
     } else {
       help();
     }
@@ -0,0 +1,238 @@
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <iqdb/debug.h>
+#include <iqdb/kernels.h>
+
+// Each kernel is written once, as an always-inline function, and compiled
+// once per ISA by inlining it into a wrapper with that ISA's target attribute.
+// This file is built with -ffp-contract=off, so that the AVX2 and AVX-512
+// versions don't fuse multiplies and adds, which would round differently.
+#define IQDB_INLINE static inline __attribute__((always_inline))
+
+#if defined(__x86_64__) || defined(__i386__)
+#define IQDB_X86 1
+#endif
+
+namespace iqdb {
+
+template <int Colors>
+IQDB_INLINE void dc_body(const image_info* info, size_t count, const Score* dc_weights, const Score* avgl, Score* scores) {
+  for (size_t i = 0; i < count; i++) {
+    Score s = 0;
+    for (int c = 0; c < Colors; c++) {
+      s += dc_weights[c] * std::abs(info[i].avgl.v[c] - avgl[c]);
+    }
+    scores[i] = s;
+  }
+}
+
+// Separate loops for grayscale and color queries, so that the loop over the
+// channels is unrolled and the loop over the images vectorizes.
+IQDB_INLINE void dc_dispatch(const image_info* info, size_t count, int colors, const Score* dc_weights, const Score* avgl, Score* scores) {
+  if (colors == 1) {
+    dc_body<1>(info, count, dc_weights, avgl, scores);
+  } else {
+    dc_body<3>(info, count, dc_weights, avgl, scores);
+  }
+}
+
+IQDB_INLINE void scatter_body(Score* scores, const iqdbId* ids, size_t count, iqdbId offset, Score weight) {
+  for (size_t i = 0; i < count; i++) {
+    scores[ids[i] - offset] -= weight;
+  }
+}
+
+// Searches check a block at a time without branching, so that the
+// comparisons vectorize, and only look at single values in the block that
+// has a match.
+static const size_t search_block = 16;
+
+IQDB_INLINE size_t find_below_body(const Score* scores, size_t begin, size_t end, Score threshold) {
+  size_t i = begin;
+  for (; i + search_block <= end; i += search_block) {
+    int found = 0;
+#pragma GCC unroll 1
+    for (size_t j = 0; j < search_block; j++) {
+      found |= scores[i + j] < threshold;
+    }
+
+    if (found)
+      break;
+  }
+
+  for (; i < end; i++) {
+    if (scores[i] < threshold)
+      return i;
+  }
+
+  return end;
+}
+
+IQDB_INLINE size_t find_above_abs_body(const Unit* values, size_t begin, size_t end, Unit threshold) {
+  size_t i = begin;
+  for (; i + search_block <= end; i += search_block) {
+    int found = 0;
+#pragma GCC unroll 1
+    for (size_t j = 0; j < search_block; j++) {
+      found |= std::fabs(values[i + j]) > threshold;
+    }
+
+    if (found)
+      break;
+  }
+
+  for (; i < end; i++) {
+    if (std::fabs(values[i]) > threshold)
+      return i;
+  }
+
+  return end;
+}
+
+// Do the Haar tensorial 2d transform itself.
+// Here input is RGB data [0..255] in Unit arrays
+// Computation is (almost) in-situ.
+IQDB_INLINE void haar2D_body(Unit a[]) {
+  int i;
+  Unit t[NUM_PIXELS >> 1];
+
+  // Decompose rows:
+  for (i = 0; i < NUM_PIXELS_SQUARED; i += NUM_PIXELS) {
+    int h, h1;
+    Unit C = 1;
+
+    for (h = NUM_PIXELS; h > 1; h = h1) {
+      int j1, j2, k;
+
+      h1 = h >> 1; // h = 2*h1
+      C *= 0.7071; // 1/sqrt(2)
+      for (k = 0, j1 = j2 = i; k < h1; k++, j1++, j2 += 2) {
+        int j21 = j2 + 1;
+
+        t[k] = (a[j2] - a[j21]) * C;
+        a[j1] = (a[j2] + a[j21]);
+      }
+      // Write back subtraction results:
+      memcpy(a + i + h1, t, h1 * sizeof(a[0]));
+    }
+    // Fix first element of each row:
+    a[i] *= C; // C = 1/sqrt(NUM_PIXELS)
+  }
+
+  // Decompose columns:
+  for (i = 0; i < NUM_PIXELS; i++) {
+    Unit C = 1;
+    int h, h1;
+
+    for (h = NUM_PIXELS; h > 1; h = h1) {
+      int j1, j2, k;
+
+      h1 = h >> 1;
+      C *= 0.7071; // 1/sqrt(2) = 0.7071
+      for (k = 0, j1 = j2 = i; k < h1;
+           k++, j1 += NUM_PIXELS, j2 += 2 * NUM_PIXELS) {
+        int j21 = j2 + NUM_PIXELS;
+
+        t[k] = (a[j2] - a[j21]) * C;
+        a[j1] = (a[j2] + a[j21]);
+      }
+      // Write back subtraction results:
+      for (k = 0, j1 = i + h1 * NUM_PIXELS; k < h1; k++, j1 += NUM_PIXELS)
+        a[j1] = t[k];
+    }
+    // Fix first element of each column:
+    a[i] *= C;
+  }
+}
+
+// Define the kernels for one ISA, compiled with the given target attribute.
+#define IQDB_DEFINE_KERNELS(name, attributes)                                                                                        \
+  attributes static void dc_##name(const image_info* info, size_t count, int colors, const Score* dc_weights, const Score* avgl, Score* scores) { \
+    dc_dispatch(info, count, colors, dc_weights, avgl, scores);                                                                      \
+  }                                                                                                                                  \
+  attributes static void scatter_##name(Score* scores, const iqdbId* ids, size_t count, iqdbId offset, Score weight) {             \
+    scatter_body(scores, ids, count, offset, weight);                                                                                \
+  }                                                                                                                                  \
+  attributes static size_t find_below_##name(const Score* scores, size_t begin, size_t end, Score threshold) {                      \
+    return find_below_body(scores, begin, end, threshold);                                                                           \
+  }                                                                                                                                  \
+  attributes static size_t find_above_abs_##name(const Unit* values, size_t begin, size_t end, Unit threshold) {                    \
+    return find_above_abs_body(values, begin, end, threshold);                                                                       \
+  }                                                                                                                                  \
+  attributes static void haar2D_##name(Unit* a) {                                                                                    \
+    haar2D_body(a);                                                                                                                  \
+  }                                                                                                                                  \
+  static const Kernels name##_kernels = { Isa::name, dc_##name, scatter_##name, find_below_##name, find_above_abs_##name, haar2D_##name };
+
+IQDB_DEFINE_KERNELS(scalar, )
+
+#ifdef IQDB_X86
+IQDB_DEFINE_KERNELS(sse42, __attribute__((target("sse4.2"))))
+IQDB_DEFINE_KERNELS(avx2, __attribute__((target("avx2"))))
+IQDB_DEFINE_KERNELS(avx512, __attribute__((target("avx512f,prefer-vector-width=512"))))
+#endif
+
+const char* isa_name(Isa isa) {
+  switch (isa) {
+    case Isa::scalar: return "scalar";
+    case Isa::sse42: return "sse4.2";
+    case Isa::avx2: return "avx2";
+    case Isa::avx512: return "avx512";
+  }
+
+  return "unknown";
+}
+
+const Kernels* kernels_for(Isa isa) {
+#ifdef IQDB_X86
+  __builtin_cpu_init();
+
+  switch (isa) {
+    case Isa::scalar: return &scalar_kernels;
+    case Isa::sse42: return __builtin_cpu_supports("sse4.2") ? &sse42_kernels : nullptr;
+    case Isa::avx2: return __builtin_cpu_supports("avx2") ? &avx2_kernels : nullptr;
+    case Isa::avx512: return __builtin_cpu_supports("avx512f") ? &avx512_kernels : nullptr;
+  }
+
+  return nullptr;
+#else
+  return isa == Isa::scalar ? &scalar_kernels : nullptr;
+#endif
+}
+
+static const Kernels& select_kernels() {
+  static const Isa all[] = { Isa::avx512, Isa::avx2, Isa::sse42, Isa::scalar };
+  const char* requested = std::getenv("IQDB_ISA");
+
+  if (requested) {
+    for (Isa isa : all) {
+      if (requested == std::string(isa_name(isa))) {
+        if (const Kernels* k = kernels_for(isa)) {
+          INFO("Using {} kernels (IQDB_ISA={}).\n", isa_name(isa), requested);
+          return *k;
+        }
+      }
+    }
+
+    WARN("IQDB_ISA={} isn't an ISA this CPU supports; ignoring it.\n", requested);
+  }
+
+  for (Isa isa : all) {
+    if (const Kernels* k = kernels_for(isa)) {
+      INFO("Using {} kernels.\n", isa_name(isa));
+      return *k;
+    }
+  }
+
+  return scalar_kernels;
+}
+
+const Kernels& kernels() {
+  static const Kernels& selected = select_kernels();
+  return selected;
+}
+
+}
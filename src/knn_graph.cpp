@@ -0,0 +1,171 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#include <iqdb/debug.h>
+#include <iqdb/imgdb.h>
+#include <iqdb/knn_graph.h>
+
+namespace iqdb {
+
+// The file starts with this header, followed by the list sizes and then k
+// neighbours per list, all in native byte order.
+struct KnnGraphHeader {
+  char magic[8];
+  uint32_t k;
+  uint32_t slots;
+  uint64_t fingerprint;
+};
+
+static const char knn_graph_magic[8] = { 'I', 'Q', 'D', 'B', 'K', 'N', 'N', '1' };
+
+KnnGraph::KnnGraph(size_t k) : k_(k) {
+  if (k == 0 || k > max_k) {
+    throw param_error("k-NN graph size must be between 1 and " + std::to_string(max_k));
+  }
+}
+
+void KnnGraph::resize(size_t slots) {
+  std::unique_lock lock(mutex_);
+
+  if (slots > sizes_.size()) {
+    sizes_.resize(slots, unbuilt);
+    neighbors_.resize(slots * k_);
+  }
+}
+
+std::optional<std::vector<Neighbor>> KnnGraph::get(iqdbId id) const {
+  std::unique_lock lock(mutex_);
+
+  if (id >= sizes_.size() || sizes_[id] == unbuilt)
+    return std::nullopt;
+
+  const auto first = neighbors_.begin() + static_cast<ptrdiff_t>(id * k_);
+  return std::vector<Neighbor>(first, first + sizes_[id]);
+}
+
+void KnnGraph::set(iqdbId id, const std::vector<Neighbor>& neighbors) {
+  std::unique_lock lock(mutex_);
+
+  if (id >= sizes_.size())
+    return;
+
+  const size_t size = std::min(k_, neighbors.size());
+  std::copy(neighbors.begin(), neighbors.begin() + static_cast<ptrdiff_t>(size), neighbors_.begin() + static_cast<ptrdiff_t>(id * k_));
+
+  built_ += sizes_[id] == unbuilt;
+  sizes_[id] = static_cast<uint8_t>(size);
+}
+
+void KnnGraph::offer(iqdbId id, const Neighbor& neighbor) {
+  std::unique_lock lock(mutex_);
+
+  if (id >= sizes_.size() || sizes_[id] == unbuilt)
+    return;
+
+  Neighbor* first = &neighbors_[id * k_];
+  Neighbor* last = first + sizes_[id];
+
+  last = std::remove_if(first, last, [&](const Neighbor& other) { return other.id == neighbor.id; });
+  size_t size = static_cast<size_t>(last - first);
+
+  Neighbor* pos = std::find_if(first, last, [&](const Neighbor& other) { return neighbor.score > other.score; });
+  if (pos == first + k_)
+    return;
+
+  // Shift the worse entries down, dropping the last one if the list is full.
+  size = std::min(k_, size + 1);
+  std::move_backward(pos, first + size - 1, first + size);
+  *pos = neighbor;
+  sizes_[id] = static_cast<uint8_t>(size);
+}
+
+void KnnGraph::invalidate(iqdbId id) {
+  std::unique_lock lock(mutex_);
+
+  if (id < sizes_.size() && sizes_[id] != unbuilt) {
+    sizes_[id] = unbuilt;
+    built_--;
+  }
+}
+
+size_t KnnGraph::built() const {
+  std::unique_lock lock(mutex_);
+  return built_;
+}
+
+size_t KnnGraph::memoryUsage() const {
+  std::unique_lock lock(mutex_);
+  return sizes_.capacity() * sizeof(uint8_t) + neighbors_.capacity() * sizeof(Neighbor);
+}
+
+void KnnGraph::save(const std::string& filename, uint64_t fingerprint) const {
+  std::unique_lock lock(mutex_);
+
+  KnnGraphHeader header = {};
+  std::memcpy(header.magic, knn_graph_magic, sizeof(header.magic));
+  header.k = static_cast<uint32_t>(k_);
+  header.slots = static_cast<uint32_t>(sizes_.size());
+  header.fingerprint = fingerprint;
+
+  // Write to a temporary file first, so that a crash never leaves a torn graph behind.
+  const std::string tmp = filename + ".tmp";
+  std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  file.write(reinterpret_cast<const char*>(sizes_.data()), static_cast<std::streamsize>(sizes_.size() * sizeof(uint8_t)));
+  file.write(reinterpret_cast<const char*>(neighbors_.data()), static_cast<std::streamsize>(neighbors_.size() * sizeof(Neighbor)));
+  file.close();
+
+  if (!file || std::rename(tmp.c_str(), filename.c_str()) != 0) {
+    std::remove(tmp.c_str());
+    throw simple_error("Couldn't write k-NN graph (file=" + filename + ")");
+  }
+
+  INFO("Saved k-NN graph to {} ({} of {} lists built).\n", filename, built_, sizes_.size());
+}
+
+std::unique_ptr<KnnGraph> KnnGraph::load(const std::string& filename, size_t k, uint64_t fingerprint) {
+  std::ifstream file(filename, std::ios::binary);
+  if (!file)
+    return nullptr;
+
+  KnnGraphHeader header = {};
+  file.read(reinterpret_cast<char*>(&header), sizeof(header));
+
+  if (!file || std::memcmp(header.magic, knn_graph_magic, sizeof(header.magic)) != 0) {
+    WARN("Ignoring k-NN graph with a bad header (file={}).\n", filename);
+    return nullptr;
+  } else if (header.k != k) {
+    INFO("Ignoring k-NN graph built for a different k (file={} k={}).\n", filename, header.k);
+    return nullptr;
+  } else if (header.fingerprint != fingerprint) {
+    INFO("Ignoring k-NN graph built for a different version of the database (file={}).\n", filename);
+    return nullptr;
+  }
+
+  auto graph = std::make_unique<KnnGraph>(k);
+  graph->sizes_.resize(header.slots);
+  graph->neighbors_.resize(header.slots * k);
+  file.read(reinterpret_cast<char*>(graph->sizes_.data()), static_cast<std::streamsize>(graph->sizes_.size() * sizeof(uint8_t)));
+  file.read(reinterpret_cast<char*>(graph->neighbors_.data()), static_cast<std::streamsize>(graph->neighbors_.size() * sizeof(Neighbor)));
+
+  if (!file) {
+    WARN("Ignoring truncated k-NN graph (file={}).\n", filename);
+    return nullptr;
+  }
+
+  for (uint8_t size : graph->sizes_) {
+    if (size != unbuilt && size > k) {
+      WARN("Ignoring corrupt k-NN graph (file={}).\n", filename);
+      return nullptr;
+    }
+
+    graph->built_ += size != unbuilt;
+  }
+
+  INFO("Loaded k-NN graph from {} ({} of {} lists built).\n", filename, graph->built_, graph->sizes_.size());
+  return graph;
+}
+
+}
@@ -0,0 +1,91 @@
+#include <algorithm>
+#include <limits>
+#include <string>
+
+#include <iqdb/imgdb.h>
+#include <iqdb/lsh_index.h>
+
+namespace iqdb {
+
+// https://prng.di.unimi.it/splitmix64.c
+static uint64_t mix(uint64_t z) noexcept {
+  z += 0x9e3779b97f4a7c15;
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+  return z ^ (z >> 31);
+}
+
+LshIndex::LshIndex(size_t tables) : tables_(tables), buckets_(tables << bucket_bits) {
+  if (tables == 0 || tables > max_tables) {
+    throw param_error("Number of LSH tables must be between 1 and " + std::to_string(max_tables));
+  }
+}
+
+std::vector<uint32_t> LshIndex::keys(const HaarSignature& signature) const {
+  std::vector<uint64_t> minhashes(tables_ * rows, std::numeric_limits<uint64_t>::max());
+
+  for (int c = 0; c < signature.num_colors(); c++) {
+    for (int i = 0; i < NUM_COEFS; i++) {
+      const uint64_t element = mix((static_cast<uint64_t>(c) << 16) | static_cast<uint16_t>(signature.sig[c][i]));
+
+      // Each MinHash uses a different hash function, derived from the element's hash.
+      for (size_t h = 0; h < minhashes.size(); h++) {
+        minhashes[h] = std::min(minhashes[h], mix(element ^ (h * 0xd1b54a32d192ed03)));
+      }
+    }
+  }
+
+  std::vector<uint32_t> keys(tables_);
+  for (size_t t = 0; t < tables_; t++) {
+    uint64_t key = 0;
+    for (size_t r = 0; r < rows; r++) {
+      key = mix(key ^ minhashes[t * rows + r]);
+    }
+
+    keys[t] = static_cast<uint32_t>(key >> (64 - bucket_bits));
+  }
+
+  return keys;
+}
+
+void LshIndex::add(const HaarSignature& signature, iqdbId iqdb_id) {
+  const auto table_keys = keys(signature);
+  for (size_t t = 0; t < tables_; t++) {
+    bucket(t, table_keys[t]).insert(arena_, iqdb_id);
+  }
+}
+
+void LshIndex::remove(const HaarSignature& signature, iqdbId iqdb_id) {
+  const auto table_keys = keys(signature);
+  for (size_t t = 0; t < tables_; t++) {
+    bucket(t, table_keys[t]).erase(arena_, iqdb_id);
+  }
+}
+
+void LshIndex::clear() {
+  for (auto& b : buckets_) {
+    b.reset();
+  }
+
+  arena_.clear();
+}
+
+std::vector<iqdbId> LshIndex::candidates(const HaarSignature& signature, size_t probes) const {
+  const auto table_keys = keys(signature);
+  std::vector<iqdbId> ids;
+
+  for (size_t t = 0; t < std::min(probes, tables_); t++) {
+    const Bucket& b = bucket(t, table_keys[t]);
+    ids.insert(ids.end(), b.begin(), b.end());
+  }
+
+  std::sort(ids.begin(), ids.end());
+  ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+  return ids;
+}
+
+size_t LshIndex::memoryUsage() const {
+  return buckets_.capacity() * sizeof(Bucket) + arena_.stats().committed;
+}
+
+}
@@ -0,0 +1,126 @@
+#include <unistd.h>
+
+#include <cstdio>
+#include <string>
+
+#include <fmt/format.h>
+#include <iqdb/metrics.h>
+
+namespace iqdb {
+
+Metrics metrics;
+
+void Histogram::observe(Clock::duration duration) noexcept {
+  const uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+  const double seconds = static_cast<double>(ns) / 1e9;
+
+  size_t i = 0;
+  while (i < bounds.size() && seconds > bounds[i]) {
+    i++;
+  }
+
+  buckets_[i].fetch_add(1, std::memory_order_relaxed);
+  sum_ns_.fetch_add(ns, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Histogram::render(std::string& out, const std::string& name) const {
+  const std::string prefix = labels_.empty() ? "" : labels_ + ",";
+  uint64_t cumulative = 0;
+
+  for (size_t i = 0; i < bounds.size(); i++) {
+    cumulative += buckets_[i].load(std::memory_order_relaxed);
+    out += fmt::format("{}_bucket{{{}le=\"{}\"}} {}\n", name, prefix, bounds[i], cumulative);
+  }
+
+  cumulative += buckets_[bounds.size()].load(std::memory_order_relaxed);
+  out += fmt::format("{}_bucket{{{}le=\"+Inf\"}} {}\n", name, prefix, cumulative);
+  render_sample(out, name + "_sum", labels_, static_cast<double>(sum_ns_.load(std::memory_order_relaxed)) / 1e9);
+  render_sample(out, name + "_count", labels_, static_cast<double>(count_.load(std::memory_order_relaxed)));
+}
+
+void render_header(std::string& out, const std::string& name, const std::string& type, const std::string& help) {
+  out += fmt::format("# HELP {} {}\n# TYPE {} {}\n", name, help, name, type);
+}
+
+void render_sample(std::string& out, const std::string& name, const std::string& labels, double value) {
+  if (labels.empty()) {
+    out += fmt::format("{} {}\n", name, value);
+  } else {
+    out += fmt::format("{}{{{}}} {}\n", name, labels, value);
+  }
+}
+
+static void render_histograms(std::string& out, const std::string& name, const std::string& help, std::initializer_list<const Histogram*> histograms) {
+  render_header(out, name, "histogram", help);
+  for (const auto* histogram : histograms) {
+    histogram->render(out, name);
+  }
+}
+
+static void render_counters(std::string& out, const std::string& name, const std::string& help, std::initializer_list<const Counter*> counters) {
+  render_header(out, name, "counter", help);
+  for (const Counter* counter : counters) {
+    render_sample(out, name, counter->labels(), static_cast<double>(counter->value()));
+  }
+}
+
+std::string Metrics::render() const {
+  std::string out;
+
+  render_histograms(out, "iqdb_query_phase_seconds", "Time spent in each phase of a query.", { &query_dc, &query_scatter, &query_topk });
+  render_histograms(out, "iqdb_query_batch_seconds", "Time spent scanning for a batch of queries.", { &query_batch });
+  render_histograms(out, "iqdb_batch_wait_seconds", "Time a query spent waiting for its batch to start.", { &batch_wait });
+  render_histograms(out, "iqdb_add_image_seconds", "Time spent adding an image.", { &add_image });
+  render_histograms(out, "iqdb_remove_image_seconds", "Time spent removing an image.", { &remove_image });
+  render_histograms(out, "iqdb_sqlite_seconds", "Time spent in SQLite calls.", { &sqlite_get, &sqlite_add, &sqlite_remove });
+  render_histograms(out, "iqdb_lock_wait_seconds", "Time spent waiting to lock the database.", { &lock_wait_read, &lock_wait_write });
+  render_histograms(out, "iqdb_request_seconds", "Time spent handling a request.", { &request_add, &request_remove, &request_get, &request_query, &request_similar, &request_cursor });
+  render_histograms(out, "iqdb_handler_step_seconds", "Time spent in each step of a request handler.", { &handler_signature, &handler_lookup, &handler_json });
+  render_counters(out, "iqdb_queries_total", "Number of queries run.", { &queries });
+  render_counters(out, "iqdb_query_timeouts_total", "Number of queries abandoned because their deadline passed.", { &query_timeouts });
+  render_counters(out, "iqdb_exact_lookups_total", "Number of exact duplicate lookups, by whether a duplicate was found.", { &exact_hits, &exact_misses });
+  render_counters(out, "iqdb_query_batches_total", "Number of query batches run.", { &query_batches });
+  render_counters(out, "iqdb_batched_queries_total", "Number of queries run as part of a batch.", { &batched_queries });
+  render_counters(out, "iqdb_http_connections_total", "Number of HTTP connections accepted.", { &http_connections });
+  render_counters(out, "iqdb_knn_graph_lookups_total", "Number of similar post lookups answered by the k-NN graph, by whether the post's neighbour list was usable.", { &knn_hits, &knn_misses });
+
+  return out;
+}
+
+size_t resident_memory() {
+  size_t pages = 0, resident = 0;
+  FILE* file = fopen("/proc/self/statm", "r");
+
+  if (file == nullptr) {
+    return 0;
+  }
+
+  if (fscanf(file, "%zu %zu", &pages, &resident) != 2) {
+    resident = 0;
+  }
+
+  fclose(file);
+  return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
+
+size_t anon_huge_pages() {
+  size_t total = 0, kb = 0;
+  char line[256];
+  FILE* file = fopen("/proc/self/smaps_rollup", "r");
+
+  if (file == nullptr) {
+    return 0;
+  }
+
+  while (fgets(line, sizeof(line), file)) {
+    if (sscanf(line, "AnonHugePages: %zu kB", &kb) == 1) {
+      total += kb * 1024;
+    }
+  }
+
+  fclose(file);
+  return total;
+}
+
+}
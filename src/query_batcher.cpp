@@ -0,0 +1,72 @@
+#include <algorithm>
+#include <utility>
+
+#include <iqdb/query_batcher.h>
+
+namespace iqdb {
+
+QueryBatcher::QueryBatcher(std::chrono::microseconds window, size_t max_batch, std::function<void(Batch)> run)
+  : window_(window), max_batch_(max_batch), run_(std::move(run)) {
+  if (max_batch == 0) {
+    throw param_error("Batch size must be positive");
+  }
+
+  thread_ = std::thread([this] { loop(); });
+}
+
+QueryBatcher::~QueryBatcher() {
+  shutdown();
+}
+
+void QueryBatcher::submit(std::shared_ptr<BatchedQuery> query) {
+  {
+    std::lock_guard lock(mutex_);
+    if (!stopping_) {
+      pending_.push_back(std::move(query));
+      query = nullptr;
+    }
+  }
+
+  // Nothing would ever run a query queued after the last batch.
+  if (query) {
+    query->done(std::make_exception_ptr(shutdown_error("The server is shutting down")));
+    return;
+  }
+
+  queued_.notify_one();
+}
+
+void QueryBatcher::shutdown() {
+  {
+    std::lock_guard lock(mutex_);
+    stopping_ = true;
+  }
+
+  queued_.notify_one();
+  if (thread_.joinable())
+    thread_.join();
+}
+
+void QueryBatcher::loop() {
+  std::unique_lock lock(mutex_);
+
+  while (true) {
+    queued_.wait(lock, [&] { return stopping_ || !pending_.empty(); });
+    if (pending_.empty())
+      return;
+
+    // Give other queries until the end of the window to join the first one.
+    const auto close = pending_.front()->queued + window_;
+    queued_.wait_until(lock, close, [&] { return stopping_ || pending_.size() >= max_batch_; });
+
+    const size_t size = std::min(pending_.size(), max_batch_);
+    Batch batch(std::make_move_iterator(pending_.begin()), std::make_move_iterator(pending_.begin() + static_cast<ptrdiff_t>(size)));
+    pending_.erase(pending_.begin(), pending_.begin() + static_cast<ptrdiff_t>(size));
+
+    lock.unlock();
+    run_(std::move(batch));
+    lock.lock();
+  }
+}
+
+}
@@ -0,0 +1,72 @@
+#include <cstring>
+#include <string>
+
+#include <iqdb/query_cache.h>
+
+namespace iqdb {
+
+std::string QueryCache::key(const HaarSignature& signature, size_t limit) {
+  std::string key(sizeof(HaarSignature) + sizeof(limit), '\0');
+  std::memcpy(key.data(), &signature, sizeof(HaarSignature));
+  std::memcpy(key.data() + sizeof(HaarSignature), &limit, sizeof(limit));
+  return key;
+}
+
+std::optional<sim_vector> QueryCache::get(const HaarSignature& signature, size_t limit) {
+  std::unique_lock lock(mutex_);
+
+  auto it = index_.find(key(signature, limit));
+  if (it == index_.end()) {
+    misses_++;
+    return std::nullopt;
+  }
+
+  hits_++;
+  entries_.splice(entries_.begin(), entries_, it->second);
+  return it->second->second.results;
+}
+
+void QueryCache::put(const HaarSignature& signature, size_t limit, const sim_vector& results, Score scale) {
+  std::unique_lock lock(mutex_);
+
+  auto k = key(signature, limit);
+  auto it = index_.find(k);
+  if (it != index_.end()) {
+    entries_.erase(it->second);
+    index_.erase(it);
+  }
+
+  entries_.emplace_front(k, CachedQuery { signature, limit, results, scale });
+  index_[k] = entries_.begin();
+
+  while (entries_.size() > capacity_) {
+    index_.erase(entries_.back().first);
+    entries_.pop_back();
+  }
+}
+
+void QueryCache::update(std::function<bool(CachedQuery&)> func) {
+  std::unique_lock lock(mutex_);
+
+  for (auto it = entries_.begin(); it != entries_.end();) {
+    if (func(it->second)) {
+      ++it;
+    } else {
+      index_.erase(it->first);
+      it = entries_.erase(it);
+    }
+  }
+}
+
+void QueryCache::clear() {
+  std::unique_lock lock(mutex_);
+  entries_.clear();
+  index_.clear();
+}
+
+size_t QueryCache::size() {
+  std::unique_lock lock(mutex_);
+  return entries_.size();
+}
+
+}
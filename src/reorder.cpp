@@ -0,0 +1,117 @@
+#include <algorithm>
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <iqdb/debug.h>
+#include <iqdb/imgdb.h>
+#include <iqdb/imglib.h>
+#include <iqdb/metrics.h>
+#include <iqdb/reorder.h>
+#include <iqdb/sqlite_db.h>
+
+namespace iqdb {
+
+// How many of the biggest buckets decide the order of the images.
+static const int order_buckets = 32;
+
+// A query scatters into its buckets in id order, touching every cache line of
+// the scores array that holds an id from the bucket. A bucket whose images
+// have nearby ids touches fewer lines than one whose images are spread over
+// the whole array. Every image is in over a hundred buckets, so they can't
+// all be contiguous; the biggest buckets are the ones most queries hit, so
+// they're the ones kept together.
+//
+// Each image gets a bitmask of which of the `order_buckets` biggest buckets
+// it's in, biggest bucket first, and the images are sorted by their masks in
+// reflected Gray code order. Then the biggest bucket is one run of ids, the
+// next is two runs, the next four, and so on, where sorting the masks as
+// plain numbers would give each bucket twice as many runs. Images with the
+// same mask keep their old relative order. Renumbering the images also
+// closes the gaps that removed images leave behind, which shrinks the arrays
+// that every query scans.
+void IQDB::reorder() {
+  const auto start = Clock::now();
+
+  std::vector<std::pair<size_t, const bucket_t*>> sizes;
+  for (int c = 0; c < 3; c++) {
+    for (int coef = 1; coef < NUM_PIXELS_SQUARED; coef++) {
+      sizes.emplace_back(imgbuckets.at(c, coef).size(), &imgbuckets.at(c, coef));
+      sizes.emplace_back(imgbuckets.at(c, -coef).size(), &imgbuckets.at(c, -coef));
+    }
+  }
+
+  const size_t ranked = std::min<size_t>(order_buckets, sizes.size());
+  std::partial_sort(sizes.begin(), sizes.begin() + static_cast<ptrdiff_t>(ranked), sizes.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+
+  std::unordered_map<const bucket_t*, int> rank;
+  for (size_t r = 0; r < ranked; r++) {
+    rank[sizes[r].second] = static_cast<int>(r);
+  }
+
+  std::vector<std::pair<uint64_t, iqdbId>> order; // (Gray code rank, old iqdb id)
+  order.reserve(getImgCount());
+  iqdbId max_id = 0;
+
+  sqlite_db_->eachImage([&](const Image& image) {
+    uint64_t mask = 0;
+    imgbuckets.eachBucket(image.haar(), [&](const bucket_t& bucket) {
+      auto it = rank.find(&bucket);
+      if (it != rank.end())
+        mask |= uint64_t(1) << (63 - it->second);
+    });
+
+    // The position of `mask` in the Gray code sequence.
+    for (int shift = 1; shift < 64; shift *= 2) {
+      mask ^= mask >> shift;
+    }
+
+    order.emplace_back(mask, image.id);
+    max_id = std::max(max_id, image.id);
+  });
+
+  std::sort(order.begin(), order.end());
+
+  std::vector<std::pair<iqdbId, iqdbId>> ids; // (old id, new id)
+  size_t moved = 0;
+  for (size_t i = 0; i < order.size(); i++) {
+    ids.emplace_back(order[i].second, static_cast<iqdbId>(i + 1));
+    moved += order[i].second != i + 1;
+  }
+
+  if (moved == 0) {
+    INFO("The images in table {} are already in order.\n", table_);
+    return;
+  }
+
+  INFO("Renumbering {} of {} images in table {}...\n", moved, order.size(), table_);
+  sqlite_db_->renumber(ids);
+  loadImages();
+
+  const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+  INFO("Reordered {} images in {:.1f} seconds (highest id was {}, now {}).\n", order.size(), seconds, max_id, order.size());
+}
+
+void parse_option(ReorderOptions& options, const std::string& flag) {
+  const auto eq = flag.find('=');
+  const std::string name = flag.substr(0, eq);
+  const std::string value = eq == std::string::npos ? "" : flag.substr(eq + 1);
+
+  if (name == "--table") {
+    options.table = value;
+  } else {
+    throw param_error("Unknown option (option=" + flag + ")");
+  }
+
+  if (options.table.empty() || !std::all_of(options.table.begin(), options.table.end(), [](char c) { return (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '_'; })) {
+    throw param_error("Invalid table name (table=" + options.table + ")");
+  }
+}
+
+void reorder_database(const std::string& database_filename, const ReorderOptions& options) {
+  IQDB db(database_filename, options.table);
+  db.reorder();
+}
+
+}
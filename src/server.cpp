@@ -18,30 +18,84 @@
     Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 \**************************************************************************/
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <csignal>
 #include <cstddef>
 #include <cstring>
+#include <map>
 #include <string>
 #include <memory>
 #include <mutex>
+#include <optional>
 #include <shared_mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
+#include <iqdb/change_log.h>
+#include <iqdb/cursor_cache.h>
 #include <iqdb/debug.h>
+#include <iqdb/follower.h>
 #include <iqdb/imgdb.h>
 #include <iqdb/imglib.h>
 #include <iqdb/haar_signature.h>
+#include <iqdb/http_server.h>
+#include <iqdb/kernels.h>
+#include <iqdb/knn_graph.h>
+#include <iqdb/lsh_index.h>
+#include <iqdb/metrics.h>
+#include <iqdb/query_batcher.h>
+#include <iqdb/query_cache.h>
+#include <iqdb/server.h>
+#include <iqdb/thread_pool.h>
 #include <iqdb/types.h>
 
-#include <httplib.h>
 #include <nlohmann/json.hpp>
 
 using nlohmann::json;
-using httplib::Server;
 using iqdb::IQDB;
 
 namespace iqdb {
 
-static Server server;
+// How to stop the server on SIGINT or SIGTERM.
+static std::function<void()> signal_stop;
+
+// A request for a collection that doesn't exist.
+DEFINE_ERROR(not_found_error, param_error)
+
+// A write to a server that's following another server.
+DEFINE_ERROR(read_only_error, simple_error)
+
+// An index with its own table in the database file. Every collection shares
+// the server's worker pools.
+struct Collection {
+  std::unique_ptr<IQDB> db;
+  std::shared_mutex mutex;
+  std::unique_ptr<ChangeLog> changes;  // The writes made to the index, for followers (null on followers).
+  std::unique_ptr<Follower> follower;  // Replays another server's writes (null unless --follow is set).
+  std::unique_ptr<QueryBatcher> batcher; // Runs concurrent queries together (null unless --batch-window is set).
+};
+
+// How many images to send at a time in a snapshot.
+static const size_t snapshot_page = 1000;
+
+// The optional `/c/:name` prefix of a route. Without it, a request goes to the
+// default collection.
+static const std::string collection_prefix = "(?:/c/([a-z0-9_]+))?";
+
+// The table a collection is stored in.
+static std::string collection_table(const std::string& name) {
+  return name.empty() ? "images" : "images_" + name;
+}
+
+static bool valid_collection_name(const std::string& name) {
+  return !name.empty() && name.size() <= 64 && std::all_of(name.begin(), name.end(), [](char c) {
+    return (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '_';
+  });
+}
 
 static void signal_handler(int signal, siginfo_t* info, void* ucontext) {
   INFO("Received signal {} ({})\n", signal, strsignal(signal));
@@ -51,12 +105,14 @@ static void signal_handler(int signal, siginfo_t* info, void* ucontext) {
     exit(1);
   }
 
-  if (server.is_running()) {
-    server.stop();
+  if (signal_stop) {
+    signal_stop();
   }
 }
 
-void install_signal_handlers() {
+void install_signal_handlers(std::function<void()> stop) {
+  signal_stop = std::move(stop);
+
   struct sigaction action = {};
   sigfillset(&action.sa_mask);
   action.sa_flags = SA_RESTART | SA_SIGINFO;
@@ -68,6 +124,11 @@ void install_signal_handlers() {
   sigaction(SIGSEGV, &action, NULL);
 }
 
+// Whether a boolean URL parameter is set, e.g. `?dedupe=1`.
+static bool is_true(const std::string& value) {
+  return value == "1" || value == "true";
+}
+
 bool check_is_valid(nlohmann::json json) {
   if(json.is_array() && json.size() == NUM_PIXELS_SQUARED) {
     return std::all_of(json.begin(), json.end(), [](const nlohmann::json& el){ return el.is_number_integer(); });
@@ -88,23 +149,590 @@ void validate_json_is_valid(nlohmann::json json) {
   }
 }
 
-void http_server(const std::string host, const int port, const std::string database_filename) {
+void parse_option(ServerOptions& options, const std::string& flag) {
+  const auto eq = flag.find('=');
+  const std::string name = flag.substr(0, eq);
+  const std::string value = eq == std::string::npos ? "" : flag.substr(eq + 1);
+
+  try {
+    if (name == "--query-threads") {
+      options.query_threads = std::stoul(value);
+    } else if (name == "--query-queue") {
+      options.query_queue = std::stoul(value);
+    } else if (name == "--query-cpus") {
+      options.query_cpus = parse_cpu_list(value);
+    } else if (name == "--ingest-threads") {
+      options.ingest_threads = std::stoul(value);
+    } else if (name == "--ingest-queue") {
+      options.ingest_queue = std::stoul(value);
+    } else if (name == "--ingest-cpus") {
+      options.ingest_cpus = parse_cpu_list(value);
+    } else if (name == "--http-threads") {
+      options.http_threads = std::stoul(value);
+    } else if (name == "--io-threads") {
+      options.io_threads = std::stoul(value);
+    } else if (name == "--unix-socket") {
+      options.unix_socket = value;
+    } else if (name == "--keep-alive-timeout") {
+      options.keep_alive_timeout = std::stoul(value);
+    } else if (name == "--keep-alive-max") {
+      options.keep_alive_max = std::stoul(value);
+    } else if (name == "--overload-status") {
+      options.overload_status = std::stoi(value);
+    } else if (name == "--query-timeout") {
+      options.query_timeout = std::stoi(value);
+    } else if (name == "--max-limit") {
+      options.max_limit = std::stoul(value);
+    } else if (name == "--max-batch") {
+      options.max_batch = std::stoul(value);
+    } else if (name == "--query-cache") {
+      options.query_cache = std::stoul(value);
+    } else if (name == "--cursor-memory") {
+      options.cursor_memory = std::stoul(value);
+    } else if (name == "--cursor-ttl") {
+      options.cursor_ttl = std::stoul(value);
+    } else if (name == "--cursor-depth") {
+      options.cursor_depth = std::stoul(value);
+    } else if (name == "--knn") {
+      options.knn = std::stoul(value);
+    } else if (name == "--knn-threads") {
+      options.knn_threads = std::stoul(value);
+    } else if (name == "--lsh-tables") {
+      options.lsh_tables = std::stoul(value);
+    } else if (name == "--follow") {
+      options.follow = value;
+    } else if (name == "--change-log") {
+      options.change_log = std::stoul(value);
+    } else if (name == "--batch-window") {
+      options.batch_window = std::stoul(value);
+    } else if (name == "--batch-size") {
+      options.batch_size = std::stoul(value);
+    } else if (name == "--collections") {
+      options.collections.clear();
+      for (size_t start = 0; start <= value.size();) {
+        const size_t end = std::min(value.find(',', start), value.size());
+        const std::string collection = value.substr(start, end - start);
+
+        if (!valid_collection_name(collection)) {
+          throw param_error("Invalid collection name (name=" + collection + "); names may only contain a-z, 0-9 and _");
+        }
+
+        options.collections.push_back(collection);
+        start = end + 1;
+      }
+    } else {
+      throw param_error("Unknown option (option=" + flag + ")");
+    }
+  } catch (const std::logic_error&) {
+    throw param_error("Invalid option value (option=" + flag + ")");
+  }
+
+  if (options.overload_status != 429 && options.overload_status != 503) {
+    throw param_error("--overload-status must be 429 or 503");
+  }
+
+  if (options.batch_size == 0) {
+    throw param_error("--batch-size must be positive");
+  }
+
+  if (options.http_threads == 0 || options.io_threads == 0) {
+    throw param_error("--http-threads and --io-threads must be positive");
+  }
+
+  if (options.knn > KnnGraph::max_k) {
+    throw param_error("--knn must be at most " + std::to_string(KnnGraph::max_k));
+  }
+
+  if (options.lsh_tables > LshIndex::max_tables) {
+    throw param_error("--lsh-tables must be at most " + std::to_string(LshIndex::max_tables));
+  }
+}
+
+HttpServer::Handler on_async(WorkerPool& pool, AsyncRequestHandler func) {
+  return [&pool, func](const HttpRequest& request, HttpResponse& response, HttpServer::Done done) {
+    const bool queued = pool.submit([&request, &response, func, done] {
+      try {
+        func(request, response, done);
+      } catch (...) {
+        done(std::current_exception());
+      }
+    });
+
+    if (!queued) {
+      WARN("Rejected request; {} queue is full (depth={}).\n", pool.name(), pool.maxQueue());
+      done(std::make_exception_ptr(overloaded_error("Server is overloaded, try again later")));
+    }
+  };
+}
+
+HttpServer::Handler on(WorkerPool& pool, RequestHandler func) {
+  return on_async(pool, [func](const HttpRequest& request, HttpResponse& response, const HttpServer::Done& done) {
+    func(request, response);
+    done(nullptr);
+  });
+}
+
+static double to_ms(std::chrono::steady_clock::duration duration) {
+  return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+// Convert a query profile to JSON for `POST /query` with `profile: true`.
+static nlohmann::json profile_to_json(const QueryProfile& profile) {
+  nlohmann::json buckets = json::array();
+  for (const auto& bucket : profile.buckets) {
+    buckets += {
+      { "color", bucket.color },
+      { "coef", bucket.coef },
+      { "size", bucket.size },
+      { "weight", bucket.weight },
+    };
+  }
+
+  return {
+    { "num_colors", profile.num_colors },
+    { "grayscale", profile.num_colors == 1 },
+    { "images", profile.images },
+    { "buckets", buckets },
+    { "ids_scattered", profile.ids_scattered },
+    { "candidates", profile.candidates },
+    { "heap_updates", profile.heap_updates },
+    { "time_ms", {
+      { "dc", to_ms(profile.dc_time) },
+      { "scatter", to_ms(profile.scatter_time) },
+      { "topk", to_ms(profile.topk_time) },
+    }},
+  };
+}
+
+// Lock the database for reading or writing, recording how long we waited.
+static std::shared_lock<std::shared_mutex> read_lock(std::shared_mutex& mutex) {
+  ScopedTimer timer(metrics.lock_wait_read);
+  return std::shared_lock(mutex);
+}
+
+static std::unique_lock<std::shared_mutex> write_lock(std::shared_mutex& mutex) {
+  ScopedTimer timer(metrics.lock_wait_write);
+  return std::unique_lock(mutex);
+}
+
+static void render_pool_metrics(std::string& out, std::initializer_list<WorkerPool*> pools) {
+  render_header(out, "iqdb_pool_queue_depth", "gauge", "Number of tasks waiting for a worker thread.");
+  for (auto* pool : pools) {
+    render_sample(out, "iqdb_pool_queue_depth", "pool=\"" + pool->name() + "\"", static_cast<double>(pool->queueDepth()));
+  }
+
+  render_header(out, "iqdb_pool_active_threads", "gauge", "Number of worker threads running a task.");
+  for (auto* pool : pools) {
+    render_sample(out, "iqdb_pool_active_threads", "pool=\"" + pool->name() + "\"", static_cast<double>(pool->activeCount()));
+  }
+
+  render_header(out, "iqdb_pool_rejected_total", "counter", "Number of requests rejected because the queue was full.");
+  for (auto* pool : pools) {
+    render_sample(out, "iqdb_pool_rejected_total", "pool=\"" + pool->name() + "\"", static_cast<double>(pool->rejectedCount()));
+  }
+}
+
+// The `limit` param of a query, clamped to [1, --max-limit].
+static size_t parse_limit(const json& params, const ServerOptions& options) {
+  size_t limit = 10;
+  if (params.contains("limit") && params["limit"].is_number_integer()) {
+    limit = static_cast<size_t>(std::clamp<int64_t>(params["limit"], 1, static_cast<int64_t>(options.max_limit)));
+  }
+
+  return limit;
+}
+
+// The `filter` param of a query, e.g. `{ "min_id": 1000, "post_ids": [1, 2, 3] }`.
+static std::optional<QueryFilter> parse_filter(const json& params) {
+  if (!params.contains("filter"))
+    return std::nullopt;
+
+  const json& filter = params["filter"];
+  if (!filter.is_object()) {
+    throw param_error("`filter` must be an object");
+  }
+
+  QueryFilter query_filter;
+  if (filter.contains("min_id")) {
+    if (!filter["min_id"].is_number_unsigned())
+      throw param_error("`filter.min_id` must be a post id");
+    query_filter.min_id = filter["min_id"];
+  }
+
+  if (filter.contains("max_id")) {
+    if (!filter["max_id"].is_number_unsigned())
+      throw param_error("`filter.max_id` must be a post id");
+    query_filter.max_id = filter["max_id"];
+  }
+
+  if (filter.contains("post_ids")) {
+    const json& post_ids = filter["post_ids"];
+    if (!post_ids.is_array() || post_ids.empty() || !std::all_of(post_ids.begin(), post_ids.end(), [](const json& id) { return id.is_number_unsigned(); }))
+      throw param_error("`filter.post_ids` must be a non-empty array of post ids");
+
+    query_filter.post_ids = post_ids.get<std::vector<postId>>();
+    std::sort(query_filter.post_ids.begin(), query_filter.post_ids.end());
+    query_filter.post_ids.erase(std::unique(query_filter.post_ids.begin(), query_filter.post_ids.end()), query_filter.post_ids.end());
+  }
+
+  return query_filter;
+}
+
+// The deadline of a query from its `timeout` param (or --query-timeout) in
+// milliseconds, counted from when the request arrived, so that time spent
+// waiting in the queue counts against it. Also the `probes` param, for an
+// approximate search, and the `filter` param.
+static QueryOptions parse_query_options(const json& params, const ServerOptions& options, Clock::time_point start) {
+  QueryOptions query_options;
+  int timeout = options.query_timeout;
+  if (params.contains("timeout") && params["timeout"].is_number_integer()) {
+    timeout = params["timeout"];
+  }
+  if (timeout > 0) {
+    query_options.deadline = start + std::chrono::milliseconds(timeout);
+  }
+
+  if (params.contains("probes") && params["probes"].is_number_unsigned()) {
+    query_options.probes = params["probes"];
+  }
+
+  query_options.filter = parse_filter(params);
+
+  return query_options;
+}
+
+// The URL params of a GET request as a JSON object, with integer values
+// converted to numbers, so they can be parsed like a POST body.
+static json url_params(const HttpRequest& request) {
+  json params = json::object();
+  for (const auto& [name, value] : request.params) {
+    const bool integer = !value.empty() && value.size() < 10 && std::all_of(value.begin(), value.end(), ::isdigit);
+    params[name] = integer ? json(std::stoll(value)) : json(value);
+  }
+
+  return params;
+}
+
+// Look up the stored images of a query's matches. Must be called with the
+// database locked.
+static std::vector<std::optional<Image>> lookup_images(IQDB& db, const sim_vector& matches) {
+  Stopwatch stopwatch;
+  std::vector<imageId> post_ids;
+
+  for (const auto &match : matches) {
+    post_ids.push_back(match.id);
+  }
+
+  // Fetch them all in one query, then put them back in the order of the matches.
+  std::unordered_map<imageId, Image> found;
+  for (auto& image : db.getImages(post_ids)) {
+    found.emplace(image.post_id, std::move(image));
+  }
+
+  std::vector<std::optional<Image>> images;
+  for (const auto &match : matches) {
+    auto it = found.find(match.id);
+    images.push_back(it != found.end() ? std::optional<Image>(it->second) : std::nullopt);
+  }
+
+  stopwatch.lap(metrics.handler_lookup);
+  return images;
+}
+
+// Run a batch of queries from a collection's batcher in one pass, and hand
+// each query its own results. Queries whose deadline passes while they wait
+// time out on their own, without holding up the rest of the batch.
+static void run_batch(Collection& collection, QueryBatcher::Batch& batch) {
+  const auto now = Clock::now();
+  QueryBatcher::Batch live;
+  std::vector<BatchQuery> queries;
+  std::optional<Deadline> deadline = now;
+
+  for (auto& query : batch) {
+    metrics.batch_wait.observe(now - query->queued);
+
+    if (query->deadline && *query->deadline < now) {
+      query->done(std::make_exception_ptr(timeout_error("Query deadline exceeded")));
+      continue;
+    }
+
+    // The batch can run until the last of its deadlines, or forever if any query doesn't have one.
+    deadline = query->deadline && deadline ? std::max(*deadline, *query->deadline) : std::optional<Deadline>();
+    queries.push_back({ query->signature, query->limit });
+    live.push_back(query);
+  }
+
+  if (live.empty())
+    return;
+
+  try {
+    QueryOptions options;
+    options.deadline = deadline;
+
+    auto lock = read_lock(collection.mutex);
+    auto results = collection.db->queryBatch(queries, options);
+
+    for (size_t i = 0; i < live.size(); i++) {
+      live[i]->images = lookup_images(*collection.db, results[i]);
+      live[i]->matches = std::move(results[i]);
+    }
+  } catch (...) {
+    for (auto& query : live) {
+      query->done(std::current_exception());
+    }
+
+    return;
+  }
+
+  const auto finished = Clock::now();
+  for (auto& query : live) {
+    if (query->deadline && *query->deadline < finished) {
+      query->done(std::make_exception_ptr(timeout_error("Query deadline exceeded")));
+    } else {
+      query->done(nullptr);
+    }
+  }
+}
+
+// Stream a JSON array of matches, like matches_to_json's, looking up
+// `snapshot_page` images at a time. Images removed since the query ran are left
+// out.
+static void stream_matches(HttpResponse& response, Collection& collection, sim_vector matches) {
+  auto shared = std::make_shared<sim_vector>(std::move(matches));
+
+  response.set_chunked_content_provider("application/json", [&collection, shared, next = size_t(0), first = true](size_t, HttpDataSink& sink) mutable {
+    std::string out = next == 0 ? "[" : "";
+    const size_t end = std::min(next + snapshot_page, shared->size());
+    const sim_vector page(shared->begin() + static_cast<ptrdiff_t>(next), shared->begin() + static_cast<ptrdiff_t>(end));
+
+    auto lock = read_lock(collection.mutex);
+    const auto images = lookup_images(*collection.db, page);
+    lock.unlock();
+
+    for (size_t i = 0; i < page.size(); i++) {
+      if (!images[i])
+        continue;
+
+      out += first ? "\n" : ",\n";
+      out += json({ { "post_id", page[i].id }, { "score", page[i].score }, { "hash", images[i]->haar().to_string() } }).dump();
+      first = false;
+    }
+
+    next = end;
+    if (next == shared->size())
+      out += "\n]";
+
+    sink.write(out.data(), out.size());
+    if (next == shared->size())
+      sink.done();
+
+    return true;
+  });
+}
+
+static json matches_to_json(const sim_vector& matches, const std::vector<std::optional<Image>>& images) {
+  json data = json::array();
+
+  for (size_t i = 0; i < matches.size(); i++) {
+    auto haar = images[i]->haar();
+
+    data += {
+      { "post_id", matches[i].id },
+      { "score", matches[i].score },
+      { "hash", haar.to_string() },
+    };
+  }
+
+  return data;
+}
+
+void http_server(const std::string host, const int port, const std::string database_filename, const ServerOptions& options, StartedCallback on_started) {
   INFO("Starting server...\n");
 
-  std::shared_mutex mutex_;
-  auto memory_db = std::make_unique<IQDB>(database_filename);
+  // The default collection is "", stored in the `images` table.
+  std::map<std::string, Collection> collections;
+  collections[""];
+  for (const auto& name : options.collections) {
+    collections[name];
+  }
 
-  install_signal_handlers();
+  for (auto& [name, collection] : collections) {
+    collection.db = std::make_unique<IQDB>(database_filename, collection_table(name));
+    collection.db->enableQueryCache(options.query_cache);
+    collection.db->enableLshIndex(options.lsh_tables);
 
-  server.Post("/images/(\\d+)", [&](const auto &request, auto &response) {
-    std::unique_lock lock(mutex_);
+    if (!options.follow.empty()) {
+      collection.follower = std::make_unique<Follower>(options.follow, name.empty() ? "" : "/c/" + name, *collection.db, collection.mutex);
+    } else if (options.change_log) {
+      collection.changes = std::make_unique<ChangeLog>(options.change_log);
+    }
+  }
+
+  // Followers only take writes from their leader.
+  auto check_writable = [&] {
+    if (!options.follow.empty()) {
+      throw read_only_error("This server is a read-only follower of " + options.follow);
+    }
+  };
+
+  // The collection a request is for, from its route's `/c/:name` prefix.
+  auto find_collection = [&](const HttpRequest& request) -> Collection& {
+    auto it = collections.find(request.matches[1]);
+    if (it == collections.end()) {
+      throw not_found_error("Collection not found (name=" + request.matches[1].str() + ")");
+    }
+
+    return it->second;
+  };
+
+  const size_t query_threads = options.query_threads ? options.query_threads : std::max(1u, std::thread::hardware_concurrency());
+  WorkerPool query_pool("query", query_threads, options.query_queue, options.query_cpus);
+  WorkerPool ingest_pool("ingest", options.ingest_threads, options.ingest_queue, options.ingest_cpus);
+
+  // Cheap requests get their own pool, so that they're never stuck behind a
+  // full query or ingest queue. Streamed responses are resumed here once
+  // their client has caught up, a page at a time.
+  WorkerPool http_pool("http", options.http_threads, options.http_threads * 4);
+
+  HttpServerOptions http_options;
+  http_options.io_threads = options.io_threads;
+  http_options.keep_alive_timeout = std::chrono::seconds(options.keep_alive_timeout);
+  http_options.keep_alive_max = options.keep_alive_max;
+  HttpServer server(http_options);
+  server.set_stream_executor([&http_pool](std::function<void()> task) { return http_pool.submit(std::move(task)); });
+
+  // Bind before starting any threads, so that a port that's already in use is
+  // reported before there's anything to stop. Connections wait in the listen
+  // backlog until the server runs.
+  server.bind(host, port);
+  INFO("Listening on {}:{}.\n", host, port);
+
+  if (!options.unix_socket.empty()) {
+    server.bindUnix(options.unix_socket);
+    INFO("Listening on {}.\n", options.unix_socket);
+  }
+
+  // Ranked results kept for paging through with `GET /query/:cursor`.
+  std::unique_ptr<CursorCache> cursors;
+  if (options.cursor_memory) {
+    cursors = std::make_unique<CursorCache>(options.cursor_memory << 20, std::chrono::seconds(options.cursor_ttl));
+  }
+
+  // Batches of queries are run on the query pool like any other query.
+  if (options.batch_window) {
+    for (auto& [name, collection] : collections) {
+      collection.batcher = std::make_unique<QueryBatcher>(std::chrono::microseconds(options.batch_window), options.batch_size, [&query_pool, &collection = collection](QueryBatcher::Batch batch) {
+        auto shared = std::make_shared<QueryBatcher::Batch>(std::move(batch));
 
-    const postId post_id = std::stoi(request.matches[1]);
+        if (!query_pool.submit([&collection, shared] { run_batch(collection, *shared); })) {
+          WARN("Rejected batch of {} queries; {} queue is full (depth={}).\n", shared->size(), query_pool.name(), query_pool.maxQueue());
+
+          for (auto& query : *shared) {
+            query->done(std::make_exception_ptr(overloaded_error("Server is overloaded, try again later")));
+          }
+        }
+      });
+    }
+  }
+
+  if (on_started) {
+    on_started([&server] { server.stop(); });
+  } else {
+    install_signal_handlers([&server] { server.stop(); });
+  }
+
+  // Pick the kernels now, so that the choice is logged at startup.
+  kernels();
+
+  // Build the k-NN graph in the background, one list at a time so that writes
+  // can get in between. Lists for images added meanwhile are built by addImage.
+  std::atomic<bool> stopping = false;
+  std::atomic<size_t> knn_builders = options.knn ? options.knn_threads : 0;
+  std::vector<std::thread> knn_threads;
+
+  if (options.knn) {
+    for (auto& [name, collection] : collections) {
+      collection.db->enableKnnGraph(options.knn);
+    }
+
+    for (size_t t = 0; t < options.knn_threads; t++) {
+      knn_threads.emplace_back([&, t] {
+        const auto start = Clock::now();
+        size_t built = 0;
+
+        for (auto& [name, collection] : collections) {
+          for (iqdbId id = static_cast<iqdbId>(t); !stopping; id += static_cast<iqdbId>(options.knn_threads)) {
+            auto lock = read_lock(collection.mutex);
+            if (id >= collection.db->imageSlots())
+              break;
+
+            built += collection.db->fillNeighbors(id);
+          }
+        }
+
+        // The last builder to finish saves the graphs.
+        if (--knn_builders == 0 && !stopping) {
+          for (auto& [name, collection] : collections) {
+            auto lock = read_lock(collection.mutex);
+            INFO("Built k-NN graph for {} ({} lists, {:.1f} seconds).\n", collection_table(name), collection.db->knnGraph()->built(), std::chrono::duration<double>(Clock::now() - start).count());
+
+            try {
+              collection.db->saveKnnGraph();
+            } catch (const std::exception& e) {
+              ERROR("{}\n", e.what());
+            }
+          }
+        }
+
+        DEBUG("k-NN graph builder {} finished (built={}).\n", t, built);
+      });
+    }
+  }
+
+  server.Post(collection_prefix + "/images/(\\d+)", on(ingest_pool, [&](const auto &request, auto &response) {
+    ScopedTimer timer(metrics.request_add);
+    Collection& collection = find_collection(request);
+    const postId post_id = std::stoi(request.matches[2]);
+    check_writable();
+
+    Stopwatch stopwatch;
     const auto json = json::parse(request.body);
     validate_json_is_valid(json);
     const auto channels = json["channels"];
     const auto signature = HaarSignature::from_channels(channels["r"], channels["g"], channels["b"]);
-    memory_db->addImage(post_id, signature);
+    stopwatch.lap(metrics.handler_signature);
+
+    auto lock = write_lock(collection.mutex);
+
+    // With `?dedupe=1`, don't add the image if another post is an exact
+    // duplicate of it.
+    if (is_true(request.get_param_value("dedupe"))) {
+      sim_vector duplicates = collection.db->findExact(signature, options.max_limit);
+      duplicates.erase(std::remove_if(duplicates.begin(), duplicates.end(), [&](const auto& match) { return match.id == post_id; }), duplicates.end());
+
+      if (!duplicates.empty()) {
+        lock.unlock();
+
+        nlohmann::json data = {
+          { "post_id", post_id },
+          { "hash", signature.to_string() },
+          { "duplicates", json::array() },
+        };
+
+        for (const auto& duplicate : duplicates) {
+          data["duplicates"].push_back(duplicate.id);
+        }
+
+        response.status = 409;
+        response.set_content(data.dump(4), "application/json");
+        return;
+      }
+    }
+
+    collection.db->addImage(post_id, signature);
+    if (collection.changes)
+      collection.changes->append(ChangeLog::Type::add, post_id, signature);
+    lock.unlock();
 
     nlohmann::json data = {
       { "post_id", post_id },
@@ -112,26 +740,34 @@ void http_server(const std::string host, const int port, const std::string datab
     };
 
     response.set_content(data.dump(4), "application/json");
-  });
+  }));
 
-  server.Delete("/images/(\\d+)", [&](const auto &request, auto &response) {
-    std::unique_lock lock(mutex_);
+  server.Delete(collection_prefix + "/images/(\\d+)", on(ingest_pool, [&](const auto &request, auto &response) {
+    ScopedTimer timer(metrics.request_remove);
+    Collection& collection = find_collection(request);
+    const postId post_id = std::stoi(request.matches[2]);
+    check_writable();
 
-    const postId post_id = std::stoi(request.matches[1]);
-    memory_db->removeImage(post_id);
+    auto lock = write_lock(collection.mutex);
+    collection.db->removeImage(post_id);
+    if (collection.changes)
+      collection.changes->append(ChangeLog::Type::remove, post_id);
+    lock.unlock();
 
     json data = {
       { "post_id", post_id },
     };
 
     response.set_content(data.dump(4), "application/json");
-  });
+  }));
 
-  server.Get("/images/(\\d+)", [&](const auto &request, auto &response) {
-    std::unique_lock lock(mutex_);
+  server.Get(collection_prefix + "/images/(\\d+)", on(http_pool, [&](const auto &request, auto &response) {
+    ScopedTimer timer(metrics.request_get);
+    Collection& collection = find_collection(request);
+    auto lock = write_lock(collection.mutex);
 
-    const postId post_id = std::stoi(request.matches[1]);
-    auto image = memory_db->getImage(post_id);
+    const postId post_id = std::stoi(request.matches[2]);
+    auto image = collection.db->getImage(post_id);
 
     json data;
     if (image == std::nullopt) {
@@ -146,61 +782,579 @@ void http_server(const std::string host, const int port, const std::string datab
       };
     }
     response.set_content(data.dump(4), "application/json");
-  });
-
-  server.Post("/query", [&](const auto &request, auto &response) {
-    std::shared_lock lock(mutex_);
+  }));
 
+  server.Post(collection_prefix + "/query", on_async(query_pool, [&](const auto &request, auto &response, const HttpServer::Done& done) {
+    const auto started = Clock::now();
+    Collection& collection = find_collection(request);
     const auto json = json::parse(request.body);
-    int limit = 10;
-    if (json.contains("limit") && json["limit"].is_number_integer()) {
-      limit = json["limit"];
+
+    const size_t limit = parse_limit(json, options);
+    QueryOptions query_options = parse_query_options(json, options, request.received);
+
+    QueryProfile profile;
+    if (json.contains("profile") && json["profile"].is_boolean() && json["profile"]) {
+      query_options.profile = &profile;
     }
 
-    sim_vector matches;
-    if (json.contains("hash")) {
-      HaarSignature haar = HaarSignature::from_hash(json["hash"]);
-      matches = memory_db->queryFromSignature(haar, limit);
-    } else if (json.contains("channels")) {
-      validate_json_is_valid(json);
-      const auto channels = json["channels"];
-      matches = memory_db->queryFromChannels(channels["r"], channels["g"], channels["b"], limit);
-    } else {
+    if (!json.contains("hash") && !json.contains("channels")) {
       throw param_error("POST /query requires either `hash` or `channels` param");
     }
 
-    nlohmann::json data = json::array();
-    for (const auto &match : matches) {
-      auto image = memory_db->getImage(match.id);
-      auto haar = image->haar();
+    // With `cursor`, rank up to --cursor-depth results and keep them, so that
+    // later pages can be read with `GET /query/:cursor` without scanning again.
+    const bool cursor = json.contains("cursor") && json["cursor"].is_boolean() && json["cursor"];
+    if (cursor && !cursors) {
+      throw param_error("Cursors are disabled (--cursor-memory=0)");
+    }
 
-      data += {
-        { "post_id", match.id },
-        { "score", match.score },
-        { "hash", haar.to_string() },
+    // With `min_score`, return every match that scores at least that, however
+    // many there are, instead of the top `limit`.
+    std::optional<Score> min_score;
+    if (json.contains("min_score") && json["min_score"].is_number()) {
+      min_score = json["min_score"].template get<Score>();
+    }
+    if (min_score && cursor) {
+      throw param_error("`min_score` can't be combined with `cursor`");
+    }
+
+    // Look for exact duplicates first, and only fall back to a similarity
+    // scan if there are none.
+    const bool exact = is_true(request.get_param_value("exact")) || (json.contains("exact") && json["exact"].is_boolean() && json["exact"]);
+
+    auto parse_signature = [&] {
+      Stopwatch stopwatch;
+      HaarSignature signature;
+      if (json.contains("hash")) {
+        signature = HaarSignature::from_hash(json["hash"]);
+      } else {
+        validate_json_is_valid(json);
+        const auto channels = json["channels"];
+        signature = HaarSignature::from_channels(channels["r"], channels["g"], channels["b"]);
+      }
+      stopwatch.lap(metrics.handler_signature);
+      return signature;
+    };
+
+    // Plain queries wait to run together with any others that arrive at the
+    // same time. Queries with options that change how the scan runs go on
+    // their own. A batched query's response is finished on the thread that
+    // runs its batch.
+    if (collection.batcher && !exact && !cursor && !min_score && !query_options.profile && !query_options.probes && !query_options.filter) {
+      auto query = std::make_shared<BatchedQuery>();
+      query->signature = parse_signature();
+      query->limit = limit;
+      query->deadline = query_options.deadline;
+      query->done = [query = query.get(), &response, done, started](std::exception_ptr error) {
+        if (!error) {
+          Stopwatch stopwatch;
+          response.set_content(matches_to_json(query->matches, query->images).dump(4), "application/json");
+          stopwatch.lap(metrics.handler_json);
+        }
+
+        metrics.request_query.observe(Clock::now() - started);
+        done(error);
       };
+
+      collection.batcher->submit(query);
+      return;
+    }
+
+    {
+      ScopedTimer timer(metrics.request_query);
+      const HaarSignature signature = parse_signature();
+
+      const size_t depth = cursor ? std::max(limit, options.cursor_depth) : limit;
+
+      auto lock = read_lock(collection.mutex);
+      sim_vector matches;
+      if (min_score) {
+        matches = collection.db->queryAboveThreshold(signature, *min_score, query_options);
+      } else {
+        if (exact) {
+          matches = collection.db->findExact(signature, depth);
+        }
+        if (matches.empty()) {
+          matches = collection.db->queryFromSignature(signature, depth, query_options);
+        }
+      }
+
+      // There may be any number of matches above a threshold, so they're
+      // streamed a page at a time instead of built into one response.
+      if (min_score && !query_options.profile) {
+        lock.unlock();
+        stream_matches(response, collection, std::move(matches));
+        done(nullptr);
+        return;
+      }
+
+      std::optional<std::string> token;
+      const size_t total = matches.size();
+      if (cursor) {
+        token = cursors->put(request.matches[1], matches);
+        matches.erase(matches.begin() + static_cast<ptrdiff_t>(std::min(limit, total)), matches.end());
+      }
+
+      const auto images = lookup_images(*collection.db, matches);
+      lock.unlock();
+
+      Stopwatch stopwatch;
+      nlohmann::json data = matches_to_json(matches, images);
+
+      // Queries with a cursor or a profile return `{ matches, ... }`.
+      if (cursor || query_options.profile) {
+        data = { { "matches", data } };
+      }
+      if (cursor) {
+        data["cursor"] = token ? nlohmann::json(*token) : nlohmann::json(nullptr);
+        data["total"] = total;
+      }
+      if (query_options.profile) {
+        data["profile"] = profile_to_json(profile);
+      }
+
+      response.set_content(data.dump(4), "application/json");
+      stopwatch.lap(metrics.handler_json);
+    }
+
+    done(nullptr);
+  }));
+
+  // Read a page of the results kept by a query with `cursor`. Images removed
+  // since the query ran are left out of the page.
+  server.Get(collection_prefix + "/query/([0-9a-f]+)", on(http_pool, [&](const auto &request, auto &response) {
+    ScopedTimer timer(metrics.request_cursor);
+    Collection& collection = find_collection(request);
+    const json params = url_params(request);
+    const size_t limit = parse_limit(params, options);
+
+    size_t offset = 0;
+    if (params.contains("offset") && params["offset"].is_number_integer()) {
+      offset = static_cast<size_t>(std::max<int64_t>(params["offset"].get<int64_t>(), 0));
     }
 
+    auto page = cursors ? cursors->get(request.matches[2], request.matches[1], offset, limit) : std::nullopt;
+    if (!page) {
+      throw not_found_error("Cursor not found or expired");
+    }
+
+    auto lock = read_lock(collection.mutex);
+    auto images = lookup_images(*collection.db, page->matches);
+    lock.unlock();
+
+    sim_vector matches;
+    std::vector<std::optional<Image>> found;
+    for (size_t i = 0; i < images.size(); i++) {
+      if (images[i]) {
+        matches.push_back(page->matches[i]);
+        found.push_back(std::move(images[i]));
+      }
+    }
+
+    const json data = {
+      { "matches", matches_to_json(matches, found) },
+      { "cursor", request.matches[2] },
+      { "total", page->total },
+    };
+
     response.set_content(data.dump(4), "application/json");
-  });
+  }));
 
-  server.Get("/status", [&](const auto &request, auto &response) {
-    std::shared_lock lock(mutex_);
+  // Find images similar to a post that's already in the database.
+  server.Get(collection_prefix + "/images/(\\d+)/similar", on(query_pool, [&](const auto &request, auto &response) {
+    ScopedTimer timer(metrics.request_similar);
+    Collection& collection = find_collection(request);
+    const postId post_id = std::stoi(request.matches[2]);
+    const json params = url_params(request);
+    const size_t limit = parse_limit(params, options);
+    const QueryOptions query_options = parse_query_options(params, options, request.received);
 
-    const size_t count = memory_db->getImgCount();
-    json data = {{"images", count}};
+    auto lock = read_lock(collection.mutex);
+    const auto matches = collection.db->querySimilar(post_id, limit, query_options);
 
+    if (!matches) {
+      lock.unlock();
+      response.status = 404;
+      response.set_content(json({ { "message", "Not found" } }).dump(4), "application/json");
+      return;
+    }
+
+    const auto images = lookup_images(*collection.db, *matches);
+    lock.unlock();
+
+    Stopwatch stopwatch;
+    response.set_content(matches_to_json(*matches, images).dump(4), "application/json");
+    stopwatch.lap(metrics.handler_json);
+  }));
+
+  // Find images similar to each of many posts. The lock is released between
+  // posts, so a large batch doesn't hold up writes.
+  server.Post(collection_prefix + "/images/similar", on(query_pool, [&](const auto &request, auto &response) {
+    ScopedTimer timer(metrics.request_similar);
+    Collection& collection = find_collection(request);
+    const auto json = json::parse(request.body);
+    const size_t limit = parse_limit(json, options);
+    const QueryOptions query_options = parse_query_options(json, options, request.received);
+
+    if (!json.contains("post_ids") || !json["post_ids"].is_array()) {
+      throw param_error("POST /images/similar requires a `post_ids` array");
+    }
+
+    const std::vector<postId> post_ids = json["post_ids"];
+    if (post_ids.size() > options.max_batch) {
+      throw param_error("Too many post ids (max=" + std::to_string(options.max_batch) + ")");
+    }
+
+    nlohmann::json data = json::array();
+
+    for (postId post_id : post_ids) {
+      auto lock = read_lock(collection.mutex);
+      const auto matches = collection.db->querySimilar(post_id, limit, query_options);
+
+      if (!matches) {
+        lock.unlock();
+        data += { { "post_id", post_id }, { "message", "Not found" } };
+        continue;
+      }
+
+      const auto images = lookup_images(*collection.db, *matches);
+      lock.unlock();
+
+      data += { { "post_id", post_id }, { "matches", matches_to_json(*matches, images) } };
+    }
+
+    Stopwatch stopwatch;
     response.set_content(data.dump(4), "application/json");
-  });
+    stopwatch.lap(metrics.handler_json);
+  }));
+
+  // The writes made since a sequence number, for followers. With `wait`, hold
+  // the request open for up to that many milliseconds until there's a change.
+  // A waiting request doesn't hold a thread: it's parked on the change log,
+  // and answered on the http pool once there's a change or the wait is over.
+  // Returns a 410 if the changes have already been dropped from the log.
+  server.Get(collection_prefix + "/changes", on_async(http_pool, [&](const auto &request, auto &response, const HttpServer::Done& done) {
+    Collection& collection = find_collection(request);
+    if (!collection.changes) {
+      throw not_found_error("This server doesn't keep a change log");
+    }
+
+    // URL params are parsed as signed integers.
+    const json params = url_params(request);
+    auto has_count = [&](const char* name) { return params.contains(name) && params[name].is_number_integer() && params[name].template get<int64_t>() >= 0; };
+
+    if (!has_count("since")) {
+      throw param_error("GET /changes requires a `since` sequence number");
+    }
+
+    const uint64_t since = params["since"].template get<uint64_t>();
+    const size_t limit = has_count("limit") ? std::clamp<size_t>(params["limit"].template get<size_t>(), 1, 10000) : 1000;
+    const auto wait = std::chrono::milliseconds(has_count("wait") ? std::min<int64_t>(params["wait"].template get<int64_t>(), 60000) : 0);
+
+    auto respond = [&collection, &response, since, limit] {
+      const auto changes = collection.changes->since(since, limit);
+      const uint64_t seq = collection.changes->lastSeq();
+
+      if (!changes) {
+        json data = {
+          { "message", "Changes since " + std::to_string(since) + " are no longer available" },
+          { "epoch", collection.changes->epoch() },
+          { "seq", seq },
+        };
+
+        response.status = 410;
+        response.set_content(data.dump(4), "application/json");
+        return;
+      }
+
+      json entries = json::array();
+      for (const auto& change : *changes) {
+        if (change.type == ChangeLog::Type::add) {
+          entries += { { "seq", change.seq }, { "type", "add" }, { "post_id", change.post_id }, { "hash", change.signature.to_string() } };
+        } else {
+          entries += { { "seq", change.seq }, { "type", "remove" }, { "post_id", change.post_id } };
+        }
+      }
+
+      json data = {
+        { "epoch", collection.changes->epoch() },
+        { "seq", seq },
+        { "changes", entries },
+      };
+
+      response.set_content(data.dump(), "application/json");
+    };
+
+    // A change wakes every waiting follower at once, which can be more than
+    // the http queue holds. The followers didn't cause the burst, so the ones
+    // that don't fit are answered on the waking thread instead of rejected.
+    const bool waiting = wait.count() > 0 && collection.changes->waitAsync(since, Clock::now() + wait, [&http_pool, respond, done] {
+      auto finish = [respond, done] {
+        try {
+          respond();
+          done(nullptr);
+        } catch (...) {
+          done(std::current_exception());
+        }
+      };
+
+      if (!http_pool.submit(finish)) {
+        finish();
+      }
+    });
+
+    if (!waiting) {
+      respond();
+      done(nullptr);
+    }
+  }));
+
+  // Every image in the collection, as JSON lines, after a header line with
+  // the change log's epoch and sequence number. The images are read a page at
+  // a time, so writes can get in between; a follower replays the changes
+  // after the header's sequence number to catch up with them.
+  server.Get(collection_prefix + "/snapshot", on(http_pool, [&](const auto &request, auto &response) {
+    Collection& collection = find_collection(request);
+    if (!collection.changes) {
+      throw not_found_error("This server doesn't keep a change log");
+    }
+
+    // Changes are logged while the write lock is held, so every change up to
+    // `seq` is already in the database.
+    json header;
+    {
+      auto lock = read_lock(collection.mutex);
+      header = { { "epoch", collection.changes->epoch() }, { "seq", collection.changes->lastSeq() } };
+    }
+
+    response.set_chunked_content_provider("application/x-ndjson", [&collection, header, next = iqdbId(0), started = false](size_t, HttpDataSink& sink) mutable {
+      std::string out;
+      if (!started) {
+        out = header.dump() + "\n";
+        started = true;
+      }
+
+      auto lock = read_lock(collection.mutex);
+      const auto images = collection.db->getImages(next, snapshot_page);
+      lock.unlock();
+
+      for (const auto& image : images) {
+        out += json({ { "post_id", image.post_id }, { "hash", image.haar().to_string() } }).dump() + "\n";
+        next = image.id + 1;
+      }
+
+      sink.write(out.data(), out.size());
+      if (images.empty())
+        sink.done();
+
+      return true;
+    });
+  }));
+
+  server.Get(collection_prefix + "/status", on(http_pool, [&](const auto &request, auto &response) {
+    Collection& collection = find_collection(request);
+    auto lock = read_lock(collection.mutex);
+
+    const size_t count = collection.db->getImgCount();
+    json data = {
+      { "images", count },
+      { "query_queue", query_pool.queueDepth() },
+      { "ingest_queue", ingest_pool.queueDepth() },
+      { "isa", isa_name(kernels().isa) },
+    };
+
+    if (auto cache = collection.db->queryCache()) {
+      data["query_cache"] = {
+        { "size", cache->size() },
+        { "hits", cache->hits() },
+        { "misses", cache->misses() },
+      };
+    }
+
+    if (auto graph = collection.db->knnGraph()) {
+      data["knn_graph"] = {
+        { "k", graph->k() },
+        { "built", graph->built() },
+        { "building", knn_builders > 0 },
+      };
+    }
+
+    if (collection.changes) {
+      data["change_log"] = {
+        { "epoch", collection.changes->epoch() },
+        { "seq", collection.changes->lastSeq() },
+      };
+    }
+
+    if (collection.follower) {
+      const FollowerStatus status = collection.follower->status();
+      data["follower"] = {
+        { "leader", options.follow },
+        { "following", status.following },
+        { "epoch", status.epoch },
+        { "seq", status.seq },
+        { "lag", status.leader_seq > status.seq ? status.leader_seq - status.seq : 0 },
+        { "error", status.error },
+      };
+    }
+
+    if (request.matches[1].str().empty()) {
+      data["collections"] = options.collections;
+    }
+
+    response.set_content(data.dump(4), "application/json");
+  }));
+
+  server.Get("/metrics", on(http_pool, [&](const auto &request, auto &response) {
+    std::string out = metrics.render();
+
+    // A snapshot of each collection, so that the locks aren't held while rendering.
+    struct CollectionStats {
+      std::string labels; // `collection="name"`, or nothing for the default collection.
+      size_t count;
+      MemoryUsage memory;
+      std::optional<std::array<size_t, 3>> cache; // Size, hits and misses.
+      std::optional<size_t> knn_lists;
+    };
+
+    std::vector<CollectionStats> stats;
+    for (auto& [name, collection] : collections) {
+      auto lock = read_lock(collection.mutex);
+      CollectionStats& s = stats.emplace_back();
+      s.labels = name.empty() ? "" : "collection=\"" + name + "\"";
+      s.count = collection.db->getImgCount();
+      s.memory = collection.db->memoryUsage();
+
+      if (auto cache = collection.db->queryCache())
+        s.cache = { cache->size(), cache->hits(), cache->misses() };
+
+      if (auto graph = collection.db->knnGraph())
+        s.knn_lists = graph->built();
+    }
+
+    // Add a sample's own labels to its collection's labels.
+    auto labels = [](const CollectionStats& s, const std::string& extra) {
+      return s.labels.empty() ? extra : s.labels + "," + extra;
+    };
+
+    render_header(out, "iqdb_images", "gauge", "Number of images in the database.");
+    for (const auto& s : stats) {
+      render_sample(out, "iqdb_images", s.labels, static_cast<double>(s.count));
+    }
+
+    render_header(out, "iqdb_memory_bytes", "gauge", "Bytes used by each in-memory structure.");
+    for (const auto& s : stats) {
+      render_sample(out, "iqdb_memory_bytes", labels(s, R"(structure="buckets")"), static_cast<double>(s.memory.buckets));
+      render_sample(out, "iqdb_memory_bytes", labels(s, R"(structure="m_info")"), static_cast<double>(s.memory.m_info));
+      render_sample(out, "iqdb_memory_bytes", labels(s, R"(structure="exact_index")"), static_cast<double>(s.memory.exact_index));
+      render_sample(out, "iqdb_memory_bytes", labels(s, R"(structure="knn_graph")"), static_cast<double>(s.memory.knn_graph));
+      render_sample(out, "iqdb_memory_bytes", labels(s, R"(structure="lsh_index")"), static_cast<double>(s.memory.lsh_index));
+    }
+
+    render_header(out, "iqdb_resident_memory_bytes", "gauge", "Resident set size of the process.");
+    render_sample(out, "iqdb_resident_memory_bytes", "", static_cast<double>(resident_memory()));
+
+    render_header(out, "iqdb_anon_huge_pages_bytes", "gauge", "Memory of the process backed by transparent huge pages.");
+    render_sample(out, "iqdb_anon_huge_pages_bytes", "", static_cast<double>(anon_huge_pages()));
+
+    render_header(out, "iqdb_bucket_arena_bytes", "gauge", "Memory of the bucket arena, by state.");
+    for (const auto& s : stats) {
+      render_sample(out, "iqdb_bucket_arena_bytes", labels(s, R"(state="mapped")"), static_cast<double>(s.memory.bucket_arena.mapped));
+      render_sample(out, "iqdb_bucket_arena_bytes", labels(s, R"(state="committed")"), static_cast<double>(s.memory.bucket_arena.committed));
+      render_sample(out, "iqdb_bucket_arena_bytes", labels(s, R"(state="allocated")"), static_cast<double>(s.memory.bucket_arena.allocated));
+      render_sample(out, "iqdb_bucket_arena_bytes", labels(s, R"(state="free")"), static_cast<double>(s.memory.bucket_arena.free));
+      render_sample(out, "iqdb_bucket_arena_bytes", labels(s, R"(state="used")"), static_cast<double>(s.memory.bucket_arena.used));
+      render_sample(out, "iqdb_bucket_arena_bytes", labels(s, R"(state="hugetlb")"), static_cast<double>(s.memory.bucket_arena.hugetlb));
+    }
+
+    render_header(out, "iqdb_bucket_arena_fragmentation", "gauge", "Fraction of committed bucket arena memory that doesn't hold ids.");
+    for (const auto& s : stats) {
+      render_sample(out, "iqdb_bucket_arena_fragmentation", s.labels, s.memory.bucket_arena.fragmentation());
+    }
+
+    render_pool_metrics(out, { &query_pool, &ingest_pool, &http_pool });
+
+    render_header(out, "iqdb_http_open_connections", "gauge", "Number of open HTTP connections.");
+    render_sample(out, "iqdb_http_open_connections", "", static_cast<double>(server.connectionCount()));
+
+    if (cursors) {
+      render_header(out, "iqdb_query_cursors", "gauge", "Number of query cursors kept.");
+      render_sample(out, "iqdb_query_cursors", "", static_cast<double>(cursors->size()));
+
+      render_header(out, "iqdb_query_cursor_bytes", "gauge", "Bytes of ranked results kept for query cursors.");
+      render_sample(out, "iqdb_query_cursor_bytes", "", static_cast<double>(cursors->bytes()));
+    }
+
+    if (options.query_cache) {
+      render_header(out, "iqdb_query_cache_entries", "gauge", "Number of cached query results.");
+      for (const auto& s : stats) {
+        render_sample(out, "iqdb_query_cache_entries", s.labels, static_cast<double>((*s.cache)[0]));
+      }
+
+      render_header(out, "iqdb_query_cache_hits_total", "counter", "Number of queries answered from the cache.");
+      for (const auto& s : stats) {
+        render_sample(out, "iqdb_query_cache_hits_total", s.labels, static_cast<double>((*s.cache)[1]));
+      }
+
+      render_header(out, "iqdb_query_cache_misses_total", "counter", "Number of queries not found in the cache.");
+      for (const auto& s : stats) {
+        render_sample(out, "iqdb_query_cache_misses_total", s.labels, static_cast<double>((*s.cache)[2]));
+      }
+    }
+
+    if (options.knn) {
+      render_header(out, "iqdb_knn_graph_lists", "gauge", "Number of built neighbour lists in the k-NN graph.");
+      for (const auto& s : stats) {
+        render_sample(out, "iqdb_knn_graph_lists", s.labels, static_cast<double>(*s.knn_lists));
+      }
+    }
+
+    response.set_content(out, "text/plain; version=0.0.4");
+  }));
 
   server.set_logger([](const auto &req, const auto &res) {
     INFO("{} \"{} {} {}\" {} {}\n", req.remote_addr, req.method, req.path, req.version, res.status, res.body.size());
   });
 
-  server.set_exception_handler([](const auto& req, auto& res, std::exception_ptr ep) {
+  server.set_exception_handler([&options](const auto& req, auto& res, std::exception_ptr ep) {
     json data;
+    res.status = 500;
+
     try {
       std::rethrow_exception(ep);
+    } catch (not_found_error &e) {
+      data = {
+        { "message", e.what() }
+      };
+
+      res.status = 404;
+    } catch (read_only_error &e) {
+      data = {
+        { "message", e.what() }
+      };
+
+      res.status = 403;
+    } catch (overloaded_error &e) {
+      data = {
+        { "message", e.what() }
+      };
+
+      res.status = options.overload_status;
+      res.set_header("Retry-After", "1");
+    } catch (shutdown_error &e) {
+      data = {
+        { "message", e.what() }
+      };
+
+      res.status = 503;
+    } catch (timeout_error &e) {
+      data = {
+        { "message", e.what() }
+      };
+
+      WARN("Query timed out: {} {}\n", req.method, req.path);
+      metrics.query_timeouts.inc();
+      res.status = 503;
     } catch (std::exception &e) {
       const auto message = e.what();
 
@@ -218,19 +1372,112 @@ void http_server(const std::string host, const int port, const std::string datab
     }
 
     res.set_content(data.dump(4), "application/json");
-    res.status = 500;
   });
 
-  INFO("Listening on {}:{}.\n", host, port);
-  server.listen(host.c_str(), port);
+  for (auto& [name, collection] : collections) {
+    if (collection.follower)
+      collection.follower->start();
+  }
+
+  server.run();
   INFO("Stopping server...\n");
+
+  for (auto& [name, collection] : collections) {
+    if (collection.follower)
+      collection.follower->stop();
+  }
+
+  // Queries still waiting for a batch are handed to the query pool. Queries
+  // that the pool runs after this fail with a shutdown_error.
+  for (auto& [name, collection] : collections) {
+    if (collection.batcher)
+      collection.batcher->shutdown();
+  }
+
+  query_pool.shutdown();
+  ingest_pool.shutdown();
+  http_pool.shutdown();
+
+  // Answer any long polls for changes that are still waiting, instead of
+  // waiting for the timer.
+  for (auto& [name, collection] : collections) {
+    if (collection.changes)
+      collection.changes->wakeAll();
+  }
+
+  stopping = true;
+  for (auto& thread : knn_threads) {
+    thread.join();
+  }
+
+  for (auto& [name, collection] : collections) {
+    try {
+      collection.db->saveKnnGraph();
+    } catch (const std::exception& e) {
+      ERROR("{}\n", e.what());
+    }
+  }
 }
 
 void help() {
   printf(
     "Usage: iqdb COMMAND [ARGS...]\n"
-    "  iqdb http [host] [port] [dbfile]  Run HTTP server on given host/port.\n"
-    "  iqdb help                         Show this help.\n"
+    "  iqdb http [host] [port] [dbfile] [OPTIONS...]  Run HTTP server on given host/port.\n"
+    "  iqdb dupes [dbfile] [OPTIONS...]               Find clusters of near-duplicate images.\n"
+    "  iqdb reorder [dbfile] [OPTIONS...]             Renumber images so similar ones have nearby ids.\n"
+    "  iqdb coordinator [host] [port] [OPTIONS...]    Run HTTP server that splits posts between shard servers.\n"
+    "  iqdb help                                      Show this help.\n"
+    "\n"
+    "HTTP server options:\n"
+    "  --query-threads=N     Threads for running queries (default: one per CPU).\n"
+    "  --query-queue=N       Max queries waiting for a thread before rejecting (default: 64).\n"
+    "  --query-cpus=LIST     Pin query threads to these CPUs (e.g. 0-3,6).\n"
+    "  --ingest-threads=N    Threads for adding and removing images (default: 1).\n"
+    "  --ingest-queue=N      Max writes waiting for a thread before rejecting (default: 64).\n"
+    "  --ingest-cpus=LIST    Pin ingest threads to these CPUs.\n"
+    "  --http-threads=N      Threads for cheap requests like /status, and for snapshots (default: 16).\n"
+    "  --io-threads=N        Threads for reading requests and writing responses (default: 1).\n"
+    "  --unix-socket=PATH    Also listen on a Unix socket at PATH.\n"
+    "  --keep-alive-timeout=S  Close connections idle for S seconds (default: 60).\n"
+    "  --keep-alive-max=N    Close connections after N requests (default: 0, unlimited).\n"
+    "  --overload-status=N   Status to return when a queue is full, 429 or 503 (default: 503).\n"
+    "  --query-timeout=MS    Default query deadline in milliseconds (default: none).\n"
+    "  --max-limit=N         The largest `limit` a query may ask for (default: 1000).\n"
+    "  --max-batch=N         The most post ids a batch similarity query may ask for (default: 1000).\n"
+    "  --query-cache=N       Cache the results of up to N queries (default: 0, disabled).\n"
+    "  --cursor-memory=MB    Memory for results kept for query cursors (default: 64, 0 disables cursors).\n"
+    "  --cursor-ttl=S        Drop a cursor S seconds after it was last read (default: 300).\n"
+    "  --cursor-depth=N      How many results a query with `cursor` ranks and keeps (default: 1000).\n"
+    "  --knn=K               Keep a graph of each image's K nearest neighbours for similar post\n"
+    "                        lookups, saved to DBFILE.knn (default: 0, disabled).\n"
+    "  --knn-threads=N       Threads for building the k-NN graph in the background (default: 1).\n"
+    "  --lsh-tables=N        Build N LSH tables for approximate queries with `probes` (default: 0, disabled).\n"
+    "  --collections=LIST    Also serve these named collections under /c/NAME, each stored in its\n"
+    "                        own images_NAME table (e.g. sfw,nsfw).\n"
+    "  --change-log=N        Keep the last N writes for followers to replay, e.g. 100000. Followers\n"
+    "                        need a leader started with this (default: 0, disabled).\n"
+    "  --follow=HOST:PORT    Run as a read-only follower of another server, replaying its writes.\n"
+    "  --batch-window=US     Wait up to US microseconds for concurrent queries to run together in\n"
+    "                        one pass (default: 0, disabled).\n"
+    "  --batch-size=N        The most queries to run in one batch (default: 16).\n"
+    "\n"
+    "Duplicate finder options:\n"
+    "  --threshold=SCORE     The lowest score for two images to count as duplicates (default: 90).\n"
+    "  --threads=N           Threads for checking images (default: one per CPU).\n"
+    "  --block=N             Images to read from the database and check at a time (default: 4096).\n"
+    "  --pairs               Write every matching pair, as well as the clusters.\n"
+    "  --output=FILE         Write the results to FILE instead of stdout.\n"
+    "\n"
+    "Reorder options:\n"
+    "  --table=NAME          The table to reorder, e.g. images_nsfw for a collection (default: images).\n"
+    "\n"
+    "Coordinator options:\n"
+    "  --shards=LIST         The shard servers, as host:port,host:port,... The order decides which\n"
+    "                        shard owns each post, so it must not change.\n"
+    "  --shard-timeout=MS    How long to wait for a shard, unless a query has a `timeout` (default: 5000).\n"
+    "  --max-limit=N         The largest `limit` a query may ask for (default: 1000).\n"
+    "  --max-batch=N         The most post ids a batch similarity query may ask for (default: 1000).\n"
+    "  --http-threads=N      Threads for handling requests (default: 64).\n"
   );
 
   exit(0);
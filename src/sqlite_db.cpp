@@ -1,59 +1,267 @@
-#include <fstream>
-#include <iostream>
+#include <algorithm>
 #include <optional>
+#include <stdexcept>
 #include <vector>
 
+#include <sqlite3.h>
+
 #include <iqdb/debug.h>
 #include <iqdb/imglib.h>
+#include <iqdb/metrics.h>
 #include <iqdb/sqlite_db.h>
 #include <iqdb/types.h>
 
 namespace iqdb {
 
-using namespace sqlite_orm;
+// The columns of an Image, in the order Statement::image() reads them.
+static const std::string image_columns = "id, post_id, avglf1, avglf2, avglf3, sig";
+
+[[noreturn]] static void throw_error(sqlite3* db, const std::string& what) {
+  throw std::runtime_error(what + ": " + sqlite3_errmsg(db));
+}
+
+// A prepared statement. It's reset after each use by a Reset guard, so that it
+// doesn't hold a read transaction open between calls.
+class SqliteDB::Statement {
+public:
+  Statement(sqlite3* db, const std::string& sql) : db_(db) {
+    if (sqlite3_prepare_v3(db, sql.c_str(), -1, SQLITE_PREPARE_PERSISTENT, &stmt_, nullptr) != SQLITE_OK)
+      throw_error(db, "couldn't prepare `" + sql + "`");
+  }
+
+  ~Statement() { sqlite3_finalize(stmt_); }
+  Statement(const Statement&) = delete;
+  Statement& operator=(const Statement&) = delete;
+
+  struct Reset {
+    Statement& statement;
+    ~Reset() { sqlite3_reset(statement.stmt_); sqlite3_clear_bindings(statement.stmt_); }
+  };
+
+  void bind(int index, int64_t value) { check(sqlite3_bind_int64(stmt_, index, value)); }
+  void bind(int index, double value) { check(sqlite3_bind_double(stmt_, index, value)); }
+  void bind(int index, const void* data, size_t size) { check(sqlite3_bind_blob(stmt_, index, data, static_cast<int>(size), SQLITE_STATIC)); }
+
+  // Step to the next row. Returns false when there are no more rows.
+  bool step() {
+    int rc = sqlite3_step(stmt_);
+    if (rc == SQLITE_ROW)
+      return true;
+    else if (rc == SQLITE_DONE)
+      return false;
+    else
+      throw_error(db_, "query failed");
+  }
+
+  int64_t integer(int column) const { return sqlite3_column_int64(stmt_, column); }
+
+  // Read the current row as an Image, from the columns in `image_columns`.
+  Image image() const {
+    auto sig = static_cast<const char*>(sqlite3_column_blob(stmt_, 5));
+    auto size = static_cast<size_t>(sqlite3_column_bytes(stmt_, 5));
+
+    return Image {
+      static_cast<iqdbId>(integer(0)), static_cast<postId>(integer(1)),
+      sqlite3_column_double(stmt_, 2), sqlite3_column_double(stmt_, 3), sqlite3_column_double(stmt_, 4),
+      std::vector<char>(sig, sig + size),
+    };
+  }
+
+private:
+  void check(int rc) {
+    if (rc != SQLITE_OK)
+      throw_error(db_, "couldn't bind parameter");
+  }
+
+  sqlite3* db_;
+  sqlite3_stmt* stmt_ = nullptr;
+};
 
 HaarSignature Image::haar() const {
   lumin_t avglf = { avglf1, avglf2, avglf3 };
   return HaarSignature(avglf, *(signature_t*)sig.data());
 }
 
+SqliteDB::SqliteDB(const std::string& path, const std::string& table) : table_("\"" + table + "\"") {
+  if (sqlite3_open_v2(path.c_str(), &db_, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, nullptr) != SQLITE_OK) {
+    std::string error = db_ ? sqlite3_errmsg(db_) : "out of memory";
+    sqlite3_close(db_);
+    throw std::runtime_error("couldn't open " + path + ": " + error);
+  }
+
+  try {
+    sqlite3_busy_timeout(db_, busy_timeout);
+
+    // WAL mode with synchronous=NORMAL only syncs at checkpoints. A crash of
+    // the process loses nothing; a power loss can lose the last few commits,
+    // but never corrupts the database. (Memory databases ignore the WAL pragma.)
+    exec("PRAGMA journal_mode = WAL");
+    exec("PRAGMA synchronous = NORMAL");
+    exec("PRAGMA mmap_size = 268435456"); // 256MB
+    exec("PRAGMA cache_size = -32768");   // 32MB
+
+    exec("CREATE TABLE IF NOT EXISTS " + table_ + " ("
+      "id INTEGER PRIMARY KEY NOT NULL, "
+      "post_id INTEGER UNIQUE NOT NULL, "
+      "avglf1 REAL NOT NULL, "
+      "avglf2 REAL NOT NULL, "
+      "avglf3 REAL NOT NULL, "
+      "sig BLOB NOT NULL)");
+
+    std::string placeholders = "?";
+    for (int i = 1; i < batch_size; i++)
+      placeholders += ", ?";
+
+    get_ = std::make_unique<Statement>(db_, "SELECT " + image_columns + " FROM " + table_ + " WHERE post_id = ?");
+    get_batch_ = std::make_unique<Statement>(db_, "SELECT " + image_columns + " FROM " + table_ + " WHERE post_id IN (" + placeholders + ")");
+    get_range_ = std::make_unique<Statement>(db_, "SELECT " + image_columns + " FROM " + table_ + " WHERE id >= ? ORDER BY id LIMIT ?");
+    add_ = std::make_unique<Statement>(db_,
+      "INSERT INTO " + table_ + " (post_id, avglf1, avglf2, avglf3, sig) VALUES (?, ?, ?, ?, ?) "
+      "ON CONFLICT (post_id) DO UPDATE SET avglf1 = excluded.avglf1, avglf2 = excluded.avglf2, avglf3 = excluded.avglf3, sig = excluded.sig "
+      "RETURNING id");
+    remove_ = std::make_unique<Statement>(db_, "DELETE FROM " + table_ + " WHERE post_id = ?");
+  } catch (...) {
+    get_.reset(); get_batch_.reset(); get_range_.reset(); add_.reset(); remove_.reset();
+    sqlite3_close(db_);
+    throw;
+  }
+}
+
+SqliteDB::~SqliteDB() {
+  // The statements must be finalized before the connection can be closed.
+  get_.reset(); get_batch_.reset(); get_range_.reset(); add_.reset(); remove_.reset();
+  sqlite3_close(db_);
+}
+
+void SqliteDB::exec(const std::string& sql) {
+  if (sqlite3_exec(db_, sql.c_str(), nullptr, nullptr, nullptr) != SQLITE_OK)
+    throw_error(db_, "`" + sql + "` failed");
+}
+
 void SqliteDB::eachImage(std::function<void (const Image&)> func) {
-  for (auto& image : storage_.iterate<Image>()) {
-    func(image);
+  Statement each(db_, "SELECT " + image_columns + " FROM " + table_);
+  Statement::Reset reset { each };
+
+  while (each.step()) {
+    func(each.image());
   }
 }
 
 std::optional<Image> SqliteDB::getImage(postId post_id) {
-  std::unique_lock lock(sql_mutex_);
-  auto results = storage_.get_all<Image>(where(c(&Image::post_id) == post_id));
+  ScopedTimer timer(metrics.sqlite_get);
+  std::lock_guard lock(sql_mutex_);
+  Statement::Reset reset { *get_ };
 
-  if (results.size() == 1) {
-    return results[0];
+  get_->bind(1, static_cast<int64_t>(post_id));
+  if (get_->step()) {
+    return get_->image();
   } else {
     DEBUG("Couldn't find post #{} in sqlite database.\n", post_id);
     return std::nullopt;
   }
 }
 
+std::vector<Image> SqliteDB::getImages(const std::vector<postId>& post_ids) {
+  ScopedTimer timer(metrics.sqlite_get);
+  std::vector<Image> images;
+
+  std::vector<postId> ids = post_ids;
+  std::sort(ids.begin(), ids.end());
+  ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+  images.reserve(ids.size());
+
+  std::lock_guard lock(sql_mutex_);
+  for (size_t i = 0; i < ids.size(); i += batch_size) {
+    Statement::Reset reset { *get_batch_ };
+
+    // A short last batch fills the rest of the placeholders with its last id.
+    const size_t end = std::min(ids.size(), i + batch_size);
+    for (int n = 0; n < batch_size; n++) {
+      get_batch_->bind(n + 1, static_cast<int64_t>(ids[std::min(i + static_cast<size_t>(n), end - 1)]));
+    }
+
+    while (get_batch_->step()) {
+      images.push_back(get_batch_->image());
+    }
+  }
+
+  return images;
+}
+
+std::vector<Image> SqliteDB::getImages(iqdbId first, size_t limit) {
+  std::lock_guard lock(sql_mutex_);
+  Statement::Reset reset { *get_range_ };
+  std::vector<Image> images;
+
+  get_range_->bind(1, static_cast<int64_t>(first));
+  get_range_->bind(2, static_cast<int64_t>(limit));
+  while (get_range_->step()) {
+    images.push_back(get_range_->image());
+  }
+
+  return images;
+}
+
 int SqliteDB::addImage(postId post_id, HaarSignature signature) {
-  int id = -1;
-  auto sig_ptr = (const char*)signature.sig;
-  std::vector<char> sig_blob(sig_ptr, sig_ptr + sizeof(signature.sig));
-  Image image {
-    0, post_id, signature.avglf[0], signature.avglf[1], signature.avglf[2], sig_blob
-  };
+  ScopedTimer timer(metrics.sqlite_add);
+  std::lock_guard lock(sql_mutex_);
+  Statement::Reset reset { *add_ };
 
-  storage_.transaction([&] {
-    removeImage(post_id);
-    id = storage_.insert(image);
-    return true;
-  });
+  add_->bind(1, static_cast<int64_t>(post_id));
+  add_->bind(2, signature.avglf[0]);
+  add_->bind(3, signature.avglf[1]);
+  add_->bind(4, signature.avglf[2]);
+  add_->bind(5, signature.sig, sizeof(signature.sig));
 
+  if (!add_->step())
+    throw std::runtime_error("couldn't add post #" + std::to_string(post_id));
+
+  int id = static_cast<int>(add_->integer(0));
+  add_->step(); // Finish the statement, so the insert is committed.
   return id;
 }
 
+void SqliteDB::renumber(const std::vector<std::pair<iqdbId, iqdbId>>& ids) {
+  std::lock_guard lock(sql_mutex_);
+  exec("BEGIN IMMEDIATE");
+
+  try {
+    // Move every row to a negative id first, so that no new id collides with
+    // an old one that hasn't been changed yet.
+    exec("UPDATE " + table_ + " SET id = -1 - id");
+
+    Statement update(db_, "UPDATE " + table_ + " SET id = ? WHERE id = ?");
+    for (const auto& [from, to] : ids) {
+      Statement::Reset reset { update };
+      update.bind(1, static_cast<int64_t>(to));
+      update.bind(2, -1 - static_cast<int64_t>(from));
+      update.step();
+    }
+
+    int64_t missed = 0;
+    {
+      Statement remaining(db_, "SELECT COUNT(*) FROM " + table_ + " WHERE id < 0");
+      Statement::Reset reset { remaining };
+      missed = remaining.step() ? remaining.integer(0) : 0;
+    }
+
+    if (missed != 0)
+      throw std::runtime_error("couldn't renumber " + table_ + ": " + std::to_string(missed) + " images weren't given a new id");
+
+    exec("COMMIT");
+  } catch (...) {
+    sqlite3_exec(db_, "ROLLBACK", nullptr, nullptr, nullptr);
+    throw;
+  }
+}
+
 void SqliteDB::removeImage(postId post_id) {
-  storage_.remove_all<Image>(where(c(&Image::post_id) == post_id));
+  ScopedTimer timer(metrics.sqlite_remove);
+  std::lock_guard lock(sql_mutex_);
+  Statement::Reset reset { *remove_ };
+
+  remove_->bind(1, static_cast<int64_t>(post_id));
+  remove_->step();
 }
 
 }
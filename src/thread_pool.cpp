@@ -0,0 +1,143 @@
+#include <pthread.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <sstream>
+#include <string>
+
+#include <iqdb/debug.h>
+#include <iqdb/imgdb.h>
+#include <iqdb/thread_pool.h>
+
+namespace iqdb {
+
+WorkerPool::WorkerPool(std::string name, size_t threads, size_t max_queue, std::vector<int> cpus)
+  : name_(name), thread_count_(std::max<size_t>(threads, 1)), max_queue_(max_queue), cpus_(cpus) {
+  for (size_t n = 0; n < thread_count_; n++) {
+    workers_.emplace_back([this, n] { run(n); });
+  }
+
+  INFO("Started {} pool ({} threads, queue size {}).\n", name_, thread_count_, max_queue_);
+}
+
+WorkerPool::~WorkerPool() {
+  shutdown();
+}
+
+bool WorkerPool::submit(std::function<void()> task) {
+  {
+    std::unique_lock lock(mutex_);
+
+    if (stopping_ || queue_.size() >= max_queue_) {
+      rejected_++;
+      return false;
+    }
+
+    queue_.push_back(std::move(task));
+  }
+
+  cond_.notify_one();
+  return true;
+}
+
+void WorkerPool::shutdown() {
+  {
+    std::unique_lock lock(mutex_);
+    if (stopping_) {
+      return;
+    }
+
+    stopping_ = true;
+  }
+
+  cond_.notify_all();
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+}
+
+size_t WorkerPool::queueDepth() {
+  std::unique_lock lock(mutex_);
+  return queue_.size();
+}
+
+size_t WorkerPool::activeCount() {
+  std::unique_lock lock(mutex_);
+  return active_;
+}
+
+void WorkerPool::run(size_t n) {
+  if (!cpus_.empty()) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+
+    // Pin each worker to its own CPU when there are enough CPUs to go around,
+    // otherwise let the workers float over the whole set.
+    if (thread_count_ > cpus_.size()) {
+      for (int cpu : cpus_) {
+        CPU_SET(cpu, &set);
+      }
+    } else {
+      CPU_SET(cpus_[n % cpus_.size()], &set);
+    }
+
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (err) {
+      WARN("Couldn't set CPU affinity for {} worker #{} (error {}).\n", name_, n, err);
+    }
+  }
+
+  while (true) {
+    std::function<void()> task;
+
+    {
+      std::unique_lock lock(mutex_);
+      cond_.wait(lock, [&] { return stopping_ || !queue_.empty(); });
+
+      if (queue_.empty()) {
+        return;
+      }
+
+      task = std::move(queue_.front());
+      queue_.pop_front();
+      active_++;
+    }
+
+    task();
+
+    std::unique_lock lock(mutex_);
+    active_--;
+  }
+}
+
+std::vector<int> parse_cpu_list(const std::string& list) {
+  std::vector<int> cpus;
+  std::stringstream stream(list);
+  std::string range;
+
+  while (std::getline(stream, range, ',')) {
+    if (range.empty()) {
+      continue;
+    }
+
+    try {
+      auto dash = range.find('-');
+      int first = std::stoi(range.substr(0, dash));
+      int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+
+      if (first < 0 || last < first || last >= CPU_SETSIZE) {
+        throw param_error("Invalid CPU range (range=" + range + ")");
+      }
+
+      for (int cpu = first; cpu <= last; cpu++) {
+        cpus.push_back(cpu);
+      }
+    } catch (const std::logic_error&) {
+      throw param_error("Invalid CPU list (list=" + list + ")");
+    }
+  }
+
+  return cpus;
+}
+
+}
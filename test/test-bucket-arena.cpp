@@ -0,0 +1,129 @@
+// Tests that buckets keep their ids sorted as they grow and shrink in the
+// arena, and that compacting the arena keeps every id and frees the gaps.
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <iqdb/bucket_arena.h>
+
+using namespace iqdb;
+
+// Whether a bucket holds exactly `ids`, in order.
+static bool holds(const Bucket& bucket, const std::vector<uint32_t>& ids) {
+  return std::equal(bucket.begin(), bucket.end(), ids.begin(), ids.end());
+}
+
+TEST_CASE("Size classes round capacities up by at most 25%", "[arena]") {
+  uint32_t last = 0;
+  for (uint32_t capacity = 1; capacity < 300000; capacity += 1 + capacity / 64) {
+    const uint32_t rounded = BucketArena::roundCapacity(capacity);
+    CHECK(rounded >= capacity);
+    CHECK(rounded >= last);
+    if (capacity >= 16)
+      CHECK(rounded <= capacity + capacity / 4);
+    last = rounded;
+  }
+}
+
+TEST_CASE("Buckets keep their ids sorted as they change", "[arena]") {
+  std::mt19937 rng(34);
+  BucketArena arena;
+  std::vector<Bucket> buckets(100);
+  std::vector<std::vector<uint32_t>> expected(buckets.size());
+
+  for (int i = 0; i < 50000; i++) {
+    const size_t b = rng() % buckets.size();
+    const uint32_t id = static_cast<uint32_t>(rng() % 2000);
+
+    if (rng() % 4 == 0) {
+      buckets[b].erase(arena, id);
+      expected[b].erase(std::remove(expected[b].begin(), expected[b].end(), id), expected[b].end());
+    } else {
+      buckets[b].insert(arena, id);
+      expected[b].insert(std::upper_bound(expected[b].begin(), expected[b].end(), id), id);
+    }
+  }
+
+  size_t ids = 0;
+  for (size_t b = 0; b < buckets.size(); b++) {
+    CHECK(holds(buckets[b], expected[b]));
+    CHECK(buckets[b].capacity() >= buckets[b].size());
+    ids += buckets[b].size();
+  }
+
+  const BucketArenaStats stats = arena.stats();
+  CHECK(stats.allocated >= ids * sizeof(uint32_t));
+  CHECK(stats.committed >= stats.allocated + stats.free);
+
+  // Empty buckets give their blocks back.
+  for (size_t b = 0; b < buckets.size(); b++) {
+    for (uint32_t id : std::vector<uint32_t>(buckets[b].begin(), buckets[b].end())) {
+      buckets[b].erase(arena, id);
+    }
+
+    CHECK(buckets[b].empty());
+  }
+
+  CHECK(arena.stats().allocated == 0);
+}
+
+TEST_CASE("Buckets can grow into large blocks of their own", "[arena]") {
+  BucketArena arena;
+  Bucket bucket;
+
+  const uint32_t count = 400000; // Over 1MB of ids.
+  for (uint32_t id = 0; id < count; id++) {
+    bucket.insert(arena, id);
+  }
+
+  REQUIRE(bucket.size() == count);
+  CHECK(std::is_sorted(bucket.begin(), bucket.end()));
+  CHECK(bucket[count - 1] == count - 1);
+  CHECK(arena.stats().allocated >= count * sizeof(uint32_t));
+
+  bucket.erase(arena, 0);
+  CHECK(bucket[0] == 1);
+  CHECK(bucket.size() == count - 1);
+}
+
+TEST_CASE("Compacting the arena keeps every id and frees the gaps", "[arena]") {
+  std::mt19937 rng(34);
+  BucketArena arena;
+  std::vector<Bucket> buckets(1000);
+  std::vector<std::vector<uint32_t>> expected(buckets.size());
+
+  // Growing buckets one id at a time leaves freed blocks behind.
+  for (uint32_t id = 0; id < 100000; id++) {
+    const size_t b = rng() % buckets.size();
+    buckets[b].insert(arena, id);
+    expected[b].push_back(id);
+  }
+
+  const BucketArenaStats before = arena.stats();
+
+  std::vector<Bucket*> live;
+  for (Bucket& bucket : buckets) {
+    if (!bucket.empty())
+      live.push_back(&bucket);
+  }
+
+  arena.compact(live);
+  const BucketArenaStats after = arena.stats();
+
+  for (size_t b = 0; b < buckets.size(); b++) {
+    CHECK(holds(buckets[b], expected[b]));
+    CHECK(buckets[b].capacity() == BucketArena::roundCapacity(static_cast<uint32_t>(buckets[b].size())));
+  }
+
+  CHECK(after.free == 0);
+  CHECK(after.allocated <= before.allocated);
+  CHECK(after.committed < before.committed);
+
+  // The buckets still work after they've been moved.
+  buckets[0].insert(arena, 0);
+  expected[0].insert(expected[0].begin(), 0);
+  CHECK(holds(buckets[0], expected[0]));
+}
@@ -0,0 +1,97 @@
+// Tests that the change log returns the changes a follower asks for, tells it
+// when it has fallen too far behind, and wakes up waiting readers.
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <iqdb/change_log.h>
+
+using namespace iqdb;
+using namespace std::chrono_literals;
+
+TEST_CASE("The change log returns the changes after a sequence number", "[change-log]") {
+  ChangeLog log(3);
+  CHECK(log.lastSeq() == 0);
+  CHECK(log.since(0, 10)->empty());
+
+  for (postId post_id = 1; post_id <= 5; post_id++) {
+    CHECK(log.append(post_id % 2 ? ChangeLog::Type::add : ChangeLog::Type::remove, post_id) == post_id);
+  }
+
+  // Changes 3 to 5 are kept.
+  const auto changes = log.since(2, 10);
+  REQUIRE(changes);
+  REQUIRE(changes->size() == 3);
+  for (size_t i = 0; i < 3; i++) {
+    CHECK((*changes)[i].seq == 3 + i);
+    CHECK((*changes)[i].post_id == 3 + i);
+  }
+
+  CHECK((*changes)[0].type == ChangeLog::Type::add);
+  CHECK((*changes)[1].type == ChangeLog::Type::remove);
+
+  CHECK(log.since(3, 1)->size() == 1);
+  CHECK(log.since(3, 1)->front().seq == 4);
+  CHECK(log.since(5, 10)->empty());
+}
+
+TEST_CASE("The change log tells a reader that has fallen behind or is ahead", "[change-log]") {
+  ChangeLog log(3);
+  for (postId post_id = 1; post_id <= 5; post_id++) {
+    log.append(ChangeLog::Type::add, post_id);
+  }
+
+  // Change 2 has been dropped, so a reader that has seen only change 1 has
+  // missed it, but a reader that has seen change 2 hasn't missed anything.
+  CHECK(!log.since(0, 10));
+  CHECK(!log.since(1, 10));
+  CHECK(log.since(2, 10));
+
+  // A reader ahead of the log is following an older run of the server.
+  CHECK(!log.since(6, 10));
+}
+
+TEST_CASE("Waiting readers are woken by the next change", "[change-log]") {
+  ChangeLog log(10);
+  log.append(ChangeLog::Type::add, 1);
+
+  std::atomic<int> woken = 0;
+
+  // There's nothing to wait for if the reader is behind or ahead.
+  CHECK(!log.waitAsync(0, Clock::now() + 10s, [&] { woken++; }));
+  CHECK(!log.waitAsync(2, Clock::now() + 10s, [&] { woken++; }));
+
+  CHECK(log.waitAsync(1, Clock::now() + 10s, [&] { woken++; }));
+  CHECK(log.waitAsync(1, Clock::now() + 10s, [&] { woken++; }));
+  CHECK(woken == 0);
+
+  log.append(ChangeLog::Type::remove, 1);
+  CHECK(woken == 2);
+
+  // Each waiter is called only once.
+  log.append(ChangeLog::Type::add, 2);
+  CHECK(woken == 2);
+}
+
+TEST_CASE("Waiting readers are woken at their deadline or by wakeAll", "[change-log]") {
+  ChangeLog log(10);
+  std::atomic<int> expired = 0, woken = 0;
+
+  CHECK(log.waitAsync(0, Clock::now() + 50ms, [&] { expired++; }));
+  CHECK(log.waitAsync(0, Clock::now() + 1h, [&] { woken++; }));
+
+  const auto deadline = Clock::now() + 5s;
+  while (expired == 0 && Clock::now() < deadline) {
+    std::this_thread::sleep_for(1ms);
+  }
+
+  CHECK(expired == 1);
+  CHECK(woken == 0);
+
+  log.wakeAll();
+  CHECK(woken == 1);
+  CHECK(expired == 1);
+}
@@ -0,0 +1,143 @@
+// Tests that the 1-channel and 3-channel query paths score images like the
+// formula they unroll, and that grayscale images only use their Y buckets.
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <random>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <iqdb/imgdb.h>
+#include <iqdb/imglib.h>
+
+#include "test-helpers.h"
+
+using namespace iqdb;
+
+static_assert(coefWeight(0, 1) == weights[1][0], "coefWeight must be usable in constant expressions");
+
+// The (channel, coefficient) pairs of the buckets an image is in.
+static std::set<std::pair<int, int>> buckets_of(const HaarSignature& signature) {
+  std::set<std::pair<int, int>> buckets;
+  for (int c = 0; c < signature.num_colors(); c++) {
+    for (int b = 0; b < NUM_COEFS; b++) {
+      buckets.emplace(c, signature.sig[c][b]);
+    }
+  }
+
+  return buckets;
+}
+
+// The score of `image` for a query with `query`, straight from the formula.
+static Score reference_score(const HaarSignature& query, const HaarSignature& image, const std::set<std::pair<int, int>>& used) {
+  const auto image_buckets = buckets_of(image);
+
+  Score s = 0, scale = 0;
+  for (int c = 0; c < query.num_colors(); c++) {
+    s += weights[0][c] * std::abs(static_cast<Score>(image.avglf[c]) - static_cast<Score>(query.avglf[c]));
+
+    for (int b = 0; b < NUM_COEFS; b++) {
+      const int coef = query.sig[c][b];
+      if (image_buckets.count({ c, coef }))
+        s -= coefWeight(c, coef);
+      if (used.count({ c, coef }))
+        scale -= coefWeight(c, coef);
+    }
+  }
+
+  return s * 100 / scale;
+}
+
+TEST_CASE("Coefficient weights come from the weight table by bin", "[channels]") {
+  for (int c = 0; c < 3; c++) {
+    for (int coef = 1; coef < NUM_PIXELS_SQUARED; coef++) {
+      CHECK(coefWeight(c, coef) == weights[imgBin.bin[coef]][c]);
+      CHECK(coefWeight(c, -coef) == coefWeight(c, coef));
+    }
+  }
+}
+
+TEST_CASE("Grayscale images are only in their Y buckets", "[channels]") {
+  std::mt19937 rng(46);
+  const auto buckets = std::make_unique<bucket_set>();
+  const HaarSignature gray = random_signature(rng, true), color = random_signature(rng);
+  REQUIRE(gray.num_colors() == 1);
+  REQUIRE(color.num_colors() == 3);
+
+  int visited = 0;
+  buckets->eachBucket(gray, [&](bucket_t&) { visited++; });
+  CHECK(visited == NUM_COEFS);
+
+  visited = 0;
+  buckets->eachBucket(color, [&](bucket_t&) { visited++; });
+  CHECK(visited == 3 * NUM_COEFS);
+
+  buckets->add(gray, 1);
+  buckets->add(color, 2);
+  for (int b = 0; b < NUM_COEFS; b++) {
+    CHECK(buckets->at(0, gray.sig[0][b]).size() >= 1);
+    CHECK(buckets->at(1, color.sig[1][b]).size() == 1);
+
+    for (int c = 1; c < 3; c++) {
+      for (iqdbId id : buckets->at(c, gray.sig[c][b])) {
+        CHECK(id == 2);
+      }
+    }
+  }
+
+  buckets->remove(gray, 1);
+  buckets->remove(color, 2);
+  for (int c = 0; c < 3; c++) {
+    for (int b = 0; b < NUM_COEFS; b++) {
+      CHECK(buckets->at(c, gray.sig[c][b]).empty());
+      CHECK(buckets->at(c, color.sig[c][b]).empty());
+    }
+  }
+}
+
+TEST_CASE("Grayscale and color queries score images like the formula", "[channels]") {
+  std::mt19937 rng(46);
+  IQDB db;
+
+  std::vector<HaarSignature> signatures;
+  std::set<std::pair<int, int>> used;
+  for (postId post_id = 1; post_id <= 300; post_id++) {
+    signatures.push_back(random_signature(rng, post_id % 3 == 0));
+    db.addImage(post_id, signatures.back());
+
+    const auto image_buckets = buckets_of(signatures.back());
+    used.insert(image_buckets.begin(), image_buckets.end());
+  }
+
+  // A filter for a few posts takes the candidate path instead of the full scan.
+  QueryOptions few;
+  few.filter = QueryFilter();
+  few.filter->post_ids = { 3, 4, 50, 51, 150 };
+
+  for (size_t q = 0; q < 40; q++) {
+    const HaarSignature query = q < 30 ? signatures[q * 10] : random_signature(rng, q % 2 == 0);
+
+    std::vector<std::pair<Score, postId>> expected;
+    for (postId post_id = 1; post_id <= signatures.size(); post_id++) {
+      expected.emplace_back(reference_score(query, signatures[post_id - 1], used), post_id);
+    }
+
+    for (const sim_vector& matches : { db.queryFromSignature(query, 20), db.queryFromSignature(query, 20, few) }) {
+      REQUIRE(!matches.empty());
+      for (const sim_value& match : matches) {
+        CHECK(std::abs(match.score - expected[match.id - 1].first) < 1e-3f);
+      }
+    }
+
+    // The reference scores every image, so the best matches can be compared too.
+    const sim_vector matches = db.queryFromSignature(query, 5);
+    std::sort(expected.begin(), expected.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+    for (size_t i = 0; i < matches.size(); i++) {
+      CHECK(std::abs(matches[i].score - expected[i].first) < 1e-3f);
+    }
+  }
+}
@@ -0,0 +1,182 @@
+// Tests that filtered queries return the unfiltered matches that pass the
+// filter, and that named collections are kept apart.
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <httplib.h>
+#include <iqdb/imgdb.h>
+#include <iqdb/server.h>
+#include <nlohmann/json.hpp>
+
+#include "test-helpers.h"
+
+using namespace iqdb;
+using nlohmann::json;
+
+// The unfiltered matches that pass `filter`, up to `limit`.
+static sim_vector filtered(const sim_vector& matches, const QueryFilter& filter, size_t limit) {
+  sim_vector result;
+  for (const sim_value& match : matches) {
+    if (filter.matches(match.id) && result.size() < limit)
+      result.push_back(match);
+  }
+
+  return result;
+}
+
+TEST_CASE("Filters match post id ranges and lists", "[collections]") {
+  QueryFilter filter;
+  CHECK(filter.matches(0));
+  CHECK(filter.matches(1000000));
+
+  filter.min_id = 10;
+  filter.max_id = 20;
+  CHECK(!filter.matches(9));
+  CHECK(filter.matches(10));
+  CHECK(filter.matches(20));
+  CHECK(!filter.matches(21));
+
+  filter.post_ids = { 5, 12, 15, 30 };
+  CHECK(!filter.matches(5));
+  CHECK(filter.matches(12));
+  CHECK(!filter.matches(13));
+  CHECK(!filter.matches(30));
+}
+
+TEST_CASE("Filtered queries return the matches that pass the filter", "[collections]") {
+  std::mt19937 rng(40);
+  IQDB db;
+
+  std::vector<HaarSignature> signatures;
+  for (postId post_id = 1; post_id <= 1000; post_id++) {
+    signatures.push_back(random_signature(rng, post_id % 7 == 0));
+    db.addImage(post_id, signatures.back());
+  }
+
+  db.removeImage(20);
+
+  // A few posts are scored on their own; a wide range is a filtered full scan.
+  QueryFilter few;
+  few.post_ids = { 3, 20, 150, 151, 600, 999, 5000 };
+
+  QueryFilter range;
+  range.min_id = 100;
+  range.max_id = 900;
+
+  for (const QueryFilter& filter : { few, range }) {
+    QueryOptions options;
+    options.filter = filter;
+
+    for (size_t q = 0; q < signatures.size(); q += 97) {
+      const sim_vector all = db.queryFromSignature(signatures[q], 1000);
+      CHECK(same_results(db.queryFromSignature(signatures[q], 10, options), filtered(all, filter, 10)));
+    }
+  }
+
+  QueryOptions options;
+  options.filter = few;
+  CHECK(db.queryFromSignature(signatures[0], 100, options).size() == 5);
+}
+
+TEST_CASE("Collections in the same file are kept apart", "[collections]") {
+  std::mt19937 rng(40);
+  const std::string filename = "/tmp/iqdb-test-collections-" + std::to_string(getpid()) + ".sqlite";
+  const HaarSignature a = random_signature(rng), b = random_signature(rng);
+
+  {
+    IQDB images(filename), other(filename, "images_other");
+    images.addImage(1, a);
+    other.addImage(1, b);
+    other.addImage(2, a);
+  }
+
+  {
+    IQDB images(filename), other(filename, "images_other");
+    CHECK(images.getImgCount() == 1);
+    CHECK(other.getImgCount() == 2);
+    CHECK(images.getImage(1)->haar().to_string() == a.to_string());
+    CHECK(other.getImage(1)->haar().to_string() == b.to_string());
+    CHECK(!images.getImage(2));
+  }
+
+  for (const std::string suffix : { "", "-wal", "-shm" }) {
+    std::remove((filename + suffix).c_str());
+  }
+}
+
+TEST_CASE("Collections have routes of their own", "[collections]") {
+  std::mt19937 rng(40);
+  const int port = free_port();
+
+  ServerOptions options;
+  parse_option(options, "--collections=sfw,nsfw_2");
+  CHECK(options.collections == std::vector<std::string> { "sfw", "nsfw_2" });
+
+  ServerOptions invalid;
+  CHECK_THROWS_AS(parse_option(invalid, "--collections=sfw,Bad-Name"), param_error);
+  CHECK_THROWS_AS(parse_option(invalid, "--collections=sfw,"), param_error);
+
+  BackgroundServer server([&](StartedCallback started) { http_server("127.0.0.1", port, ":memory:", options, started); });
+  httplib::Client client("127.0.0.1", port);
+
+  const json image = random_image(rng);
+  const auto added = client.Post("/c/sfw/images/1", image.dump(), "application/json");
+  REQUIRE(added);
+  REQUIRE(added->status == 200);
+  const std::string hash = json::parse(added->body)["hash"];
+
+  for (postId post_id = 2; post_id <= 5; post_id++) {
+    const auto other = client.Post("/images/" + std::to_string(post_id), random_image(rng).dump(), "application/json");
+    REQUIRE(other);
+  }
+
+  const auto sfw = client.Post("/c/sfw/query", json({ { "hash", hash } }).dump(), "application/json");
+  REQUIRE(sfw);
+  REQUIRE(sfw->status == 200);
+  const json matches = json::parse(sfw->body);
+  REQUIRE(matches.size() == 1);
+  CHECK(matches[0]["post_id"] == 1);
+
+  const auto unprefixed = client.Post("/query", json({ { "hash", hash } }).dump(), "application/json");
+  REQUIRE(unprefixed);
+  for (const json& match : json::parse(unprefixed->body)) {
+    CHECK(match["post_id"] != 1);
+  }
+
+  const auto nsfw = client.Get("/c/nsfw_2/status");
+  REQUIRE(nsfw);
+  CHECK(json::parse(nsfw->body)["images"] == 0);
+
+  const auto status = client.Get("/status");
+  REQUIRE(status);
+  CHECK(json::parse(status->body)["images"] == 4);
+  CHECK(json::parse(status->body)["collections"] == json::array({ "sfw", "nsfw_2" }));
+
+  const auto missing = client.Post("/c/nope/query", json({ { "hash", hash } }).dump(), "application/json");
+  REQUIRE(missing);
+  CHECK(missing->status == 404);
+
+  // Filters are applied over HTTP too.
+  const auto filter = client.Post("/query", json({ { "hash", hash }, { "filter", { { "post_ids", { 5, 3 } } } } }).dump(), "application/json");
+  REQUIRE(filter);
+  REQUIRE(filter->status == 200);
+  std::vector<postId> found;
+  for (const json& match : json::parse(filter->body)) {
+    found.push_back(match["post_id"]);
+  }
+  std::sort(found.begin(), found.end());
+  CHECK(found == std::vector<postId> { 3, 5 });
+
+  const auto bad_filter = client.Post("/query", json({ { "hash", hash }, { "filter", { { "min_id", -1 } } } }).dump(), "application/json");
+  REQUIRE(bad_filter);
+  CHECK(bad_filter->status != 200);
+  CHECK(json::parse(bad_filter->body)["message"] == "`filter.min_id` must be a post id");
+}
@@ -0,0 +1,117 @@
+// Tests that the coordinator spreads posts over its shards, merges their
+// results, and finds duplicates across them.
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <httplib.h>
+#include <iqdb/coordinator.h>
+#include <iqdb/server.h>
+#include <nlohmann/json.hpp>
+
+#include "test-helpers.h"
+
+using namespace iqdb;
+using nlohmann::json;
+
+static json post(int port, const std::string& path, const json& body, int expected_status = 200) {
+  httplib::Client client("127.0.0.1", port);
+  const auto result = client.Post(path, body.dump(), "application/json");
+  REQUIRE(result);
+  REQUIRE(result->status == expected_status);
+  return json::parse(result->body);
+}
+
+static json get(int port, const std::string& path) {
+  httplib::Client client("127.0.0.1", port);
+  const auto result = client.Get(path);
+  REQUIRE(result);
+  REQUIRE(result->status == 200);
+  return json::parse(result->body);
+}
+
+// Two shards and a coordinator in front of them.
+struct TestCluster {
+  const int shard_ports[2] = { free_port(), free_port() };
+  const int coordinator_port = free_port();
+
+  BackgroundServer shard1 { [this](StartedCallback started) { http_server("127.0.0.1", shard_ports[0], ":memory:", {}, started); } };
+  BackgroundServer shard2 { [this](StartedCallback started) { http_server("127.0.0.1", shard_ports[1], ":memory:", {}, started); } };
+  BackgroundServer coordinator { [this](StartedCallback started) {
+    CoordinatorOptions options;
+    options.shards = { "127.0.0.1:" + std::to_string(shard_ports[0]), "127.0.0.1:" + std::to_string(shard_ports[1]) };
+    options.http_threads = 4;
+    iqdb::coordinator("127.0.0.1", coordinator_port, options, started);
+  } };
+};
+
+TEST_CASE("The coordinator returns the best of every shard's matches", "[coordinator]") {
+  std::mt19937 rng(41);
+  TestCluster cluster;
+
+  std::vector<std::string> hashes;
+  for (postId post_id = 1; post_id <= 40; post_id++) {
+    hashes.push_back(post(cluster.coordinator_port, "/images/" + std::to_string(post_id), random_image(rng))["hash"]);
+  }
+
+  // Every post is on the shard that owns it, and only there.
+  const json status = get(cluster.coordinator_port, "/status");
+  CHECK(status["images"] == 40);
+  for (size_t shard = 0; shard < 2; shard++) {
+    size_t owned = 0;
+    for (postId post_id = 1; post_id <= 40; post_id++) {
+      owned += shard_for(post_id, 2) == shard;
+    }
+
+    CHECK(owned > 0);
+    CHECK(status["shards"][shard]["status"]["images"] == owned);
+  }
+
+  for (size_t q = 0; q < hashes.size(); q += 7) {
+    const json query = { { "hash", hashes[q] }, { "limit", 5 } };
+
+    // The top 5 of both shards' top 5.
+    json expected = post(cluster.shard_ports[0], "/query", query);
+    for (const auto& match : post(cluster.shard_ports[1], "/query", query)) {
+      expected.push_back(match);
+    }
+
+    std::stable_sort(expected.begin(), expected.end(), [](const json& a, const json& b) { return a["score"] > b["score"]; });
+    expected.erase(expected.begin() + 5, expected.end());
+
+    INFO("query=" << q);
+    const json merged = post(cluster.coordinator_port, "/query", query);
+    CHECK(merged == expected);
+    CHECK(merged[0]["hash"] == hashes[q]);
+  }
+}
+
+TEST_CASE("The coordinator finds duplicates on other shards", "[coordinator]") {
+  std::mt19937 rng(42);
+  TestCluster cluster;
+
+  const json image = random_image(rng);
+  post(cluster.coordinator_port, "/images/1", image);
+
+  // A post on the other shard, so that only the coordinator can see the
+  // duplicate.
+  postId other = 2;
+  while (shard_for(other, 2) == shard_for(1, 2)) {
+    other++;
+  }
+
+  const json conflict = post(cluster.coordinator_port, "/images/" + std::to_string(other) + "?dedupe=1", image, 409);
+  CHECK(conflict["post_id"] == other);
+  CHECK(conflict["duplicates"] == json::array({ 1 }));
+  CHECK(get(cluster.coordinator_port, "/status")["images"] == 1);
+
+  // Replacing the post itself isn't a duplicate, and without `dedupe` the
+  // image is added anyway.
+  post(cluster.coordinator_port, "/images/1?dedupe=1", image);
+  post(cluster.coordinator_port, "/images/" + std::to_string(other), image);
+  CHECK(get(cluster.coordinator_port, "/status")["images"] == 2);
+}
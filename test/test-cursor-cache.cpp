@@ -0,0 +1,178 @@
+// Tests that query cursors serve pages of the results ranked by the query,
+// and that they expire and are evicted to stay within their memory budget.
+
+#include <chrono>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <httplib.h>
+#include <iqdb/coordinator.h>
+#include <iqdb/cursor_cache.h>
+#include <iqdb/server.h>
+#include <nlohmann/json.hpp>
+
+#include "test-helpers.h"
+
+using namespace iqdb;
+using nlohmann::json;
+
+// `count` results with post ids and scores counting down from `first`.
+static sim_vector ranked(postId first, size_t count) {
+  sim_vector results;
+  for (size_t i = 0; i < count; i++) {
+    results.emplace_back(first - static_cast<postId>(i), static_cast<Score>(first - i));
+  }
+
+  return results;
+}
+
+TEST_CASE("Cursors return pages of their results", "[cursor]") {
+  CursorCache cache(1 << 20, std::chrono::seconds(60));
+
+  const auto token = cache.put("", ranked(100, 50));
+  REQUIRE(token);
+  CHECK(token->size() == 32);
+  CHECK(token->find_first_not_of("0123456789abcdef") == std::string::npos);
+  CHECK(*cache.put("", ranked(10, 5)) != *token);
+  CHECK(cache.size() == 2);
+  CHECK(cache.bytes() > 0);
+
+  const auto first = cache.get(*token, "", 0, 10);
+  REQUIRE(first);
+  CHECK(first->total == 50);
+  CHECK(same_results(first->matches, ranked(100, 10)));
+
+  const auto last = cache.get(*token, "", 45, 10);
+  REQUIRE(last);
+  CHECK(same_results(last->matches, ranked(55, 5)));
+
+  const auto past_end = cache.get(*token, "", 100, 10);
+  REQUIRE(past_end);
+  CHECK(past_end->matches.empty());
+  CHECK(past_end->total == 50);
+
+  // Cursors belong to the collection they were made for.
+  CHECK(!cache.get(*token, "other", 0, 10));
+  CHECK(!cache.get("0123456789abcdef0123456789abcdef", "", 0, 10));
+}
+
+TEST_CASE("Cursors are dropped when they expire or don't fit", "[cursor]") {
+  const size_t size = 1000 * sizeof(sim_value);
+
+  // Room for two cursors of 1000 results, but not three.
+  CursorCache cache(5 * size / 2, std::chrono::seconds(60));
+  const auto a = cache.put("", ranked(1000, 1000));
+  const auto b = cache.put("", ranked(1000, 1000));
+  REQUIRE(a);
+  REQUIRE(b);
+
+  // Reading `a` makes `b` the least recently used.
+  CHECK(cache.get(*a, "", 0, 1));
+  const auto c = cache.put("", ranked(1000, 1000));
+  REQUIRE(c);
+  CHECK(cache.size() == 2);
+  CHECK(cache.get(*a, "", 0, 1));
+  CHECK(!cache.get(*b, "", 0, 1));
+  CHECK(cache.bytes() <= cache.maxBytes());
+
+  CHECK(!cache.put("", ranked(10000, 10000)));
+
+  CursorCache expiring(1 << 20, std::chrono::seconds(0));
+  const auto token = expiring.put("", ranked(10, 10));
+  REQUIRE(token);
+  std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  CHECK(!expiring.get(*token, "", 0, 10));
+  CHECK(expiring.size() == 0);
+  CHECK(expiring.bytes() == 0);
+}
+
+TEST_CASE("Queries with a cursor can be paged through", "[cursor]") {
+  std::mt19937 rng(48);
+  const int port = free_port();
+
+  ServerOptions options;
+  options.cursor_depth = 20;
+  options.collections = { "other" };
+  BackgroundServer server([&](StartedCallback started) { http_server("127.0.0.1", port, ":memory:", options, started); });
+  httplib::Client client("127.0.0.1", port);
+
+  std::vector<std::string> hashes;
+  for (postId post_id = 1; post_id <= 30; post_id++) {
+    const auto added = client.Post("/images/" + std::to_string(post_id), random_image(rng).dump(), "application/json");
+    REQUIRE(added);
+    hashes.push_back(json::parse(added->body)["hash"]);
+  }
+
+  const auto all = client.Post("/query", json({ { "hash", hashes[0] }, { "limit", 20 } }).dump(), "application/json");
+  REQUIRE(all);
+  const json expected = json::parse(all->body);
+
+  const auto queried = client.Post("/query", json({ { "hash", hashes[0] }, { "limit", 5 }, { "cursor", true } }).dump(), "application/json");
+  REQUIRE(queried);
+  REQUIRE(queried->status == 200);
+  const json first = json::parse(queried->body);
+  CHECK(first["total"] == 20);
+  CHECK(first["matches"] == json(std::vector<json>(expected.begin(), expected.begin() + 5)));
+
+  const std::string cursor = first["cursor"];
+  const auto page = client.Get("/query/" + cursor + "?offset=5&limit=10");
+  REQUIRE(page);
+  REQUIRE(page->status == 200);
+  CHECK(json::parse(page->body)["matches"] == json(std::vector<json>(expected.begin() + 5, expected.begin() + 15)));
+  CHECK(json::parse(page->body)["cursor"] == cursor);
+
+  // Removed images are left out of later pages.
+  const postId removed = expected[7]["post_id"];
+  REQUIRE(client.Delete("/images/" + std::to_string(removed)));
+  const auto without = client.Get("/query/" + cursor + "?offset=5&limit=10");
+  REQUIRE(without);
+  const json matches = json::parse(without->body)["matches"];
+  CHECK(matches.size() == 9);
+  for (const json& match : matches) {
+    CHECK(match["post_id"] != removed);
+  }
+
+  const auto other = client.Get("/c/other/query/" + cursor);
+  REQUIRE(other);
+  CHECK(other->status == 404);
+
+  const auto unknown = client.Get("/query/0123456789abcdef0123456789abcdef");
+  REQUIRE(unknown);
+  CHECK(unknown->status == 404);
+
+  const auto threshold = client.Post("/query", json({ { "hash", hashes[0] }, { "min_score", 50 }, { "cursor", true } }).dump(), "application/json");
+  REQUIRE(threshold);
+  CHECK(threshold->status != 200);
+  CHECK(json::parse(threshold->body)["message"] == "`min_score` can't be combined with `cursor`");
+}
+
+TEST_CASE("Cursors can be turned off, and aren't supported by the coordinator", "[cursor]") {
+  std::mt19937 rng(48);
+  const int port = free_port(), coordinator_port = free_port();
+
+  ServerOptions options;
+  options.cursor_memory = 0;
+  BackgroundServer server([&](StartedCallback started) { http_server("127.0.0.1", port, ":memory:", options, started); });
+  BackgroundServer coordinator([&](StartedCallback started) {
+    CoordinatorOptions coordinator_options;
+    coordinator_options.shards = { "127.0.0.1:" + std::to_string(port) };
+    iqdb::coordinator("127.0.0.1", coordinator_port, coordinator_options, started);
+  });
+
+  const json query = { { "hash", random_signature(rng).to_string() }, { "cursor", true } };
+
+  httplib::Client client("127.0.0.1", port);
+  const auto disabled = client.Post("/query", query.dump(), "application/json");
+  REQUIRE(disabled);
+  CHECK(disabled->status != 200);
+  CHECK(json::parse(disabled->body)["message"] == "Cursors are disabled (--cursor-memory=0)");
+
+  httplib::Client coordinator_client("127.0.0.1", coordinator_port);
+  const auto rejected = coordinator_client.Post("/query", query.dump(), "application/json");
+  REQUIRE(rejected);
+  CHECK(rejected->status == 400);
+}
@@ -0,0 +1,166 @@
+// Tests that the all-pairs duplicate search finds the same pairs as querying
+// with every image, and that `iqdb dupes` writes them out as clusters.
+
+#include <unistd.h>
+
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <random>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <iqdb/duplicates.h>
+#include <iqdb/imgdb.h>
+#include <nlohmann/json.hpp>
+
+#include "test-helpers.h"
+
+using namespace iqdb;
+using nlohmann::json;
+
+// A copy of `signature` with `changes` of its coefficients replaced.
+static HaarSignature near_copy(const HaarSignature& signature, std::mt19937& rng, size_t changes) {
+  HaarSignature copy = signature;
+  for (size_t n = 0; n < changes; n++) {
+    const int c = static_cast<int>(rng() % 3);
+    int16_t* first = &copy.sig[c][0];
+    int16_t* last = &copy.sig[c][NUM_COEFS];
+
+    int16_t coef;
+    do {
+      coef = static_cast<int16_t>(1000 + rng() % 1000);
+    } while (std::find(first, last, coef) != last);
+
+    first[rng() % NUM_COEFS] = coef;
+    std::sort(first, last);
+  }
+
+  return copy;
+}
+
+TEST_CASE("Duplicate pairs match a query with every image", "[dupes]") {
+  std::mt19937 rng(38);
+  IQDB db;
+
+  std::vector<HaarSignature> signatures;
+  for (postId post_id = 1; post_id <= 400; post_id++) {
+    if (post_id > 20 && rng() % 4 == 0) {
+      const HaarSignature& original = signatures[rng() % signatures.size()];
+      signatures.push_back(near_copy(original, rng, rng() % 40));
+    } else {
+      signatures.push_back(random_signature(rng, post_id % 9 == 0));
+    }
+
+    db.addImage(post_id, signatures.back());
+  }
+
+  for (const Score threshold : { 80.0f, 50.0f }) {
+    // Each pair, with the higher of its two scores.
+    std::map<std::pair<postId, postId>, Score> expected;
+    for (postId post_id = 1; post_id <= signatures.size(); post_id++) {
+      for (const sim_value& match : db.queryFromSignature(signatures[post_id - 1], signatures.size())) {
+        if (match.id == post_id || match.score < threshold)
+          continue;
+
+        const auto key = std::make_pair(std::min(post_id, match.id), std::max(post_id, match.id));
+        expected[key] = std::max(expected[key], match.score);
+      }
+    }
+
+    REQUIRE(expected.size() > 20);
+
+    std::map<std::pair<postId, postId>, Score> found;
+    db.findDuplicates(threshold, 3, 64, [&](const DuplicatePair& pair) {
+      CHECK(pair.a < pair.b);
+      CHECK(found.emplace(std::make_pair(pair.a, pair.b), pair.score).second);
+    });
+
+    REQUIRE(found.size() == expected.size());
+    for (const auto& [key, score] : expected) {
+      REQUIRE(found.count(key));
+      CHECK(std::abs(found[key] - score) < 1e-3f);
+    }
+
+    // The number of threads and the block size don't change the output.
+    std::vector<std::pair<postId, postId>> serial, parallel;
+    db.findDuplicates(threshold, 1, 1000, [&](const DuplicatePair& pair) { serial.emplace_back(pair.a, pair.b); });
+    db.findDuplicates(threshold, 4, 1000, [&](const DuplicatePair& pair) { parallel.emplace_back(pair.a, pair.b); });
+    CHECK(serial == parallel);
+  }
+
+  CHECK_THROWS_AS(db.findDuplicates(0, 1, 1, [](const DuplicatePair&) {}), param_error);
+}
+
+TEST_CASE("Duplicate options are parsed from flags", "[dupes]") {
+  DuplicateOptions options;
+  parse_option(options, "--threshold=75.5");
+  parse_option(options, "--threads=3");
+  parse_option(options, "--block=100");
+  parse_option(options, "--pairs");
+  parse_option(options, "--output=dupes.jsonl");
+
+  CHECK(options.threshold == 75.5f);
+  CHECK(options.threads == 3);
+  CHECK(options.block == 100);
+  CHECK(options.pairs);
+  CHECK(options.output == "dupes.jsonl");
+
+  CHECK_THROWS_AS(parse_option(options, "--bogus=1"), param_error);
+  CHECK_THROWS_AS(parse_option(options, "--threads=many"), param_error);
+  CHECK_THROWS_AS(parse_option(options, "--threshold=0"), param_error);
+  CHECK_THROWS_AS(parse_option(options, "--threshold=101"), param_error);
+}
+
+TEST_CASE("Duplicates are written out as clusters", "[dupes]") {
+  std::mt19937 rng(38);
+  const std::string filename = "/tmp/iqdb-test-dupes-" + std::to_string(getpid()) + ".sqlite";
+  const std::string output = filename + ".jsonl";
+
+  {
+    IQDB db(filename);
+    for (postId post_id = 1; post_id <= 20; post_id++) {
+      db.addImage(post_id, random_signature(rng));
+    }
+
+    // Clusters are joined through any of their pairs.
+    const HaarSignature first = random_signature(rng), second = random_signature(rng);
+    db.addImage(30, first);
+    db.addImage(31, near_copy(first, rng, 2));
+    db.addImage(32, near_copy(near_copy(first, rng, 2), rng, 2));
+    db.addImage(40, second);
+    db.addImage(41, second);
+  }
+
+  DuplicateOptions options;
+  options.pairs = true;
+  options.threads = 2;
+  options.block = 7;
+  options.output = output;
+  find_duplicates(filename, options);
+
+  std::vector<json> pairs, clusters;
+  std::ifstream file(output);
+  for (std::string line; std::getline(file, line);) {
+    const json value = json::parse(line);
+    (value.contains("score") ? pairs : clusters).push_back(value);
+  }
+
+  CHECK(pairs.size() >= 3);
+  for (const json& pair : pairs) {
+    CHECK(pair["score"] >= options.threshold);
+  }
+
+  REQUIRE(clusters.size() == 2);
+  CHECK(clusters[0]["post_ids"] == json::array({ 30, 31, 32 }));
+  CHECK(clusters[1]["post_ids"] == json::array({ 40, 41 }));
+
+  for (const std::string suffix : { "", "-wal", "-shm", ".jsonl" }) {
+    std::remove((filename + suffix).c_str());
+  }
+}
@@ -0,0 +1,141 @@
+// Tests that exact duplicates are found from the index without a scan, and
+// that uploads and queries can ask for them.
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <string>
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <httplib.h>
+#include <iqdb/exact_index.h>
+#include <iqdb/imgdb.h>
+#include <iqdb/server.h>
+#include <nlohmann/json.hpp>
+
+#include "test-helpers.h"
+
+using namespace iqdb;
+using nlohmann::json;
+
+// A random signature whose luminance is a multiple of the index's 2^-20
+// quantum, so that a small change to it can't cross a rounding boundary.
+static HaarSignature quantized_signature(std::mt19937& rng) {
+  HaarSignature signature = random_signature(rng);
+  for (double& avglf : signature.avglf) {
+    avglf = std::round(avglf * (1 << 20)) / (1 << 20);
+  }
+
+  return signature;
+}
+
+TEST_CASE("Signatures are the same image if only their luminance's last bits differ", "[exact]") {
+  std::mt19937 rng(35);
+  const HaarSignature signature = quantized_signature(rng);
+
+  HaarSignature jittered = signature;
+  jittered.avglf[0] += 1e-9;
+  CHECK(ExactIndex::sameImage(signature, jittered));
+
+  HaarSignature brighter = signature;
+  brighter.avglf[0] += 1e-3;
+  CHECK(!ExactIndex::sameImage(signature, brighter));
+
+  HaarSignature changed = signature;
+  changed.sig[1][0] = static_cast<int16_t>(changed.sig[1][0] == 1 ? 2 : 1);
+  std::sort(&changed.sig[1][0], &changed.sig[1][NUM_COEFS]);
+  CHECK(!ExactIndex::sameImage(signature, changed));
+}
+
+TEST_CASE("The exact index finds every post with a signature", "[exact]") {
+  std::mt19937 rng(35);
+  const HaarSignature signature = quantized_signature(rng), other = quantized_signature(rng);
+
+  ExactIndex index;
+  index.add(signature, 1);
+  index.add(signature, 2);
+  index.add(other, 3);
+
+  auto candidates = index.candidates(signature);
+  std::sort(candidates.begin(), candidates.end());
+  CHECK(candidates == std::vector<postId> { 1, 2 });
+
+  HaarSignature jittered = signature;
+  jittered.avglf[2] -= 1e-9;
+  CHECK(index.candidates(jittered).size() == 2);
+
+  index.remove(signature, 1);
+  CHECK(index.candidates(signature) == std::vector<postId> { 2 });
+  CHECK(index.candidates(other) == std::vector<postId> { 3 });
+  CHECK(index.size() == 2);
+
+  index.clear();
+  CHECK(index.candidates(other).empty());
+}
+
+TEST_CASE("IQDB finds exact duplicates and keeps them up to date", "[exact]") {
+  std::mt19937 rng(35);
+  IQDB db;
+
+  std::vector<HaarSignature> signatures;
+  for (postId post_id = 1; post_id <= 50; post_id++) {
+    signatures.push_back(random_signature(rng));
+    db.addImage(post_id, signatures.back());
+  }
+
+  db.addImage(100, signatures[9]);
+  db.addImage(101, signatures[9]);
+
+  const sim_vector matches = db.findExact(signatures[9]);
+  REQUIRE(matches.size() == 3);
+  CHECK(matches[0].id == 10);
+  CHECK(matches[1].id == 100);
+  CHECK(matches[2].id == 101);
+  CHECK(matches[0].score == 100);
+
+  CHECK(db.findExact(signatures[9], 1).size() == 1);
+  CHECK(db.findExact(random_signature(rng)).empty());
+
+  db.removeImage(100);
+  CHECK(db.findExact(signatures[9]).size() == 2);
+}
+
+TEST_CASE("Uploads with dedupe are refused if the image is already there", "[exact]") {
+  std::mt19937 rng(35);
+  const int port = free_port();
+  BackgroundServer server([&](StartedCallback started) { http_server("127.0.0.1", port, ":memory:", {}, started); });
+  httplib::Client client("127.0.0.1", port);
+
+  const json image = random_image(rng);
+  const auto added = client.Post("/images/1", image.dump(), "application/json");
+  REQUIRE(added);
+  REQUIRE(added->status == 200);
+  const std::string hash = json::parse(added->body)["hash"];
+
+  const auto duplicate = client.Post("/images/2?dedupe=1", image.dump(), "application/json");
+  REQUIRE(duplicate);
+  CHECK(duplicate->status == 409);
+  CHECK(json::parse(duplicate->body)["duplicates"] == json::array({ 1 }));
+
+  // A post isn't a duplicate of itself.
+  const auto replaced = client.Post("/images/1?dedupe=1", image.dump(), "application/json");
+  REQUIRE(replaced);
+  CHECK(replaced->status == 200);
+
+  const auto exact = client.Post("/query?exact=1", json({ { "hash", hash } }).dump(), "application/json");
+  REQUIRE(exact);
+  REQUIRE(exact->status == 200);
+  const json matches = json::parse(exact->body);
+  REQUIRE(matches.size() == 1);
+  CHECK(matches[0]["post_id"] == 1);
+  CHECK(matches[0]["score"] == 100);
+
+  // If there's no exact match, the query falls back to a similarity search.
+  const auto added2 = client.Post("/images/2", random_image(rng).dump(), "application/json");
+  REQUIRE(added2);
+  const auto similar = client.Post("/query?exact=1", json({ { "hash", random_signature(rng).to_string() } }).dump(), "application/json");
+  REQUIRE(similar);
+  REQUIRE(similar->status == 200);
+  CHECK(json::parse(similar->body).size() == 2);
+}
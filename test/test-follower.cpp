@@ -0,0 +1,126 @@
+// Tests that a follower loads a snapshot of its leader, then replays the
+// leader's changes, and ends up with the same index.
+
+#include <chrono>
+#include <random>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <httplib.h>
+#include <iqdb/follower.h>
+#include <iqdb/imgdb.h>
+#include <iqdb/server.h>
+#include <nlohmann/json.hpp>
+
+#include "test-helpers.h"
+
+using namespace iqdb;
+using nlohmann::json;
+using namespace std::chrono_literals;
+
+// Send a request to the leader, and return its JSON response.
+static json request(int port, const std::string& method, const std::string& path, const json& body = {}) {
+  httplib::Client client("127.0.0.1", port);
+  const auto result = method == "POST" ? client.Post(path, body.dump(), "application/json") : method == "DELETE" ? client.Delete(path) : client.Get(path);
+  REQUIRE(result);
+  REQUIRE(result->status == 200);
+  return json::parse(result->body);
+}
+
+// Wait until the follower has applied every change the leader has made.
+static bool caught_up(Follower& follower, int leader_port) {
+  const uint64_t seq = request(leader_port, "GET", "/status")["change_log"]["seq"];
+
+  for (const auto deadline = Clock::now() + 10s; Clock::now() < deadline;) {
+    const FollowerStatus status = follower.status();
+    if (status.following && status.seq == seq)
+      return true;
+
+    std::this_thread::sleep_for(10ms);
+  }
+
+  return false;
+}
+
+// Whether the follower's index returns the same matches as the leader's.
+static bool same_matches(IQDB& db, std::shared_mutex& mutex, int leader_port, const std::string& hash) {
+  const json expected = request(leader_port, "POST", "/query", { { "hash", hash }, { "limit", 10 } });
+
+  std::shared_lock lock(mutex);
+  const sim_vector matches = db.queryFromSignature(HaarSignature::from_hash(hash), 10);
+  if (matches.size() != expected.size())
+    return false;
+
+  for (size_t i = 0; i < matches.size(); i++) {
+    if (matches[i].id != expected[i]["post_id"] || matches[i].score != expected[i]["score"].get<Score>())
+      return false;
+  }
+
+  return true;
+}
+
+TEST_CASE("A follower loads a snapshot, then replays the leader's changes", "[follower]") {
+  std::mt19937 rng(42);
+  const int leader_port = free_port();
+
+  // The follower already has a post the leader doesn't, and an old version of
+  // one the leader has.
+  IQDB db;
+  std::shared_mutex mutex;
+  db.addImage(1, random_signature(rng));
+  db.addImage(999, random_signature(rng));
+
+  // The leader is stopped first, which ends the follower's wait for changes,
+  // so that the follower can stop without waiting for it to time out.
+  Follower follower("127.0.0.1:" + std::to_string(leader_port), "", db, mutex);
+
+  ServerOptions options;
+  options.change_log = 100;
+  BackgroundServer leader([&](StartedCallback started) { http_server("127.0.0.1", leader_port, ":memory:", options, started); });
+
+  std::vector<std::string> hashes;
+  for (postId post_id = 1; post_id <= 30; post_id++) {
+    hashes.push_back(request(leader_port, "POST", "/images/" + std::to_string(post_id), random_image(rng))["hash"]);
+  }
+
+  follower.start();
+  REQUIRE(caught_up(follower, leader_port));
+  {
+    std::shared_lock lock(mutex);
+    CHECK(db.getImage(30));
+    CHECK(!db.getImage(999));
+  }
+
+  for (size_t q = 0; q < hashes.size(); q += 5) {
+    CHECK(same_matches(db, mutex, leader_port, hashes[q]));
+  }
+
+  // Changes made after the snapshot are replayed: new posts, replaced posts,
+  // and removed posts.
+  for (postId post_id = 25; post_id <= 40; post_id++) {
+    const std::string hash = request(leader_port, "POST", "/images/" + std::to_string(post_id), random_image(rng))["hash"];
+    if (post_id > 30)
+      hashes.push_back(hash);
+    else
+      hashes[post_id - 1] = hash;
+  }
+
+  for (postId post_id = 2; post_id <= 10; post_id += 2) {
+    request(leader_port, "DELETE", "/images/" + std::to_string(post_id));
+  }
+
+  REQUIRE(caught_up(follower, leader_port));
+  {
+    std::shared_lock lock(mutex);
+    for (postId post_id = 1; post_id <= 40; post_id++) {
+      CHECK(db.getImage(post_id).has_value() == (post_id > 10 || post_id % 2 == 1));
+    }
+  }
+
+  for (size_t q = 0; q < hashes.size(); q += 3) {
+    CHECK(same_matches(db, mutex, leader_port, hashes[q]));
+  }
+}
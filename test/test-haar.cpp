@@ -0,0 +1,114 @@
+// Tests the stages of signature generation that the microbenchmarks time, and
+// that they add up to HaarSignature::from_channels.
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <iqdb/haar.h>
+#include <iqdb/haar_signature.h>
+#include <iqdb/imgdb.h>
+
+using namespace iqdb;
+
+// The channels of files/1.rgb, a 128x128 dump of files/1.jpg.
+static std::vector<std::vector<unsigned char>> read_channels() {
+  std::ifstream file(std::string(IQDB_TEST_FILES) + "/1.rgb", std::ios::binary);
+  const std::vector<unsigned char> pixels(std::istreambuf_iterator<char>(file), {});
+  REQUIRE(pixels.size() == 3 * NUM_PIXELS_SQUARED);
+
+  std::vector<std::vector<unsigned char>> channels(3);
+  for (size_t i = 0; i < pixels.size(); i++) {
+    channels[i % 3].push_back(pixels[i]);
+  }
+
+  return channels;
+}
+
+TEST_CASE("Gray pixels have no chrominance", "[haar]") {
+  std::vector<Unit> y(NUM_PIXELS_SQUARED), i(NUM_PIXELS_SQUARED), q(NUM_PIXELS_SQUARED);
+  for (int p = 0; p < NUM_PIXELS_SQUARED; p++) {
+    y[p] = i[p] = q[p] = p % 256;
+  }
+
+  RGB_2_YIQ(y.data(), i.data(), q.data());
+  for (int p = 0; p < NUM_PIXELS_SQUARED; p++) {
+    CHECK(std::abs(y[p] - p % 256) < 1e-9 * 256);
+    CHECK(std::abs(i[p]) < 1e-9 * 256);
+    CHECK(std::abs(q[p]) < 1e-9 * 256);
+  }
+}
+
+TEST_CASE("The Haar transform of a flat image is only its DC coefficient", "[haar]") {
+  std::vector<Unit> a(NUM_PIXELS_SQUARED, 100);
+  haar2D(a.data());
+
+  CHECK(a[0] != 0);
+  CHECK(std::all_of(a.begin() + 1, a.end(), [](Unit x) { return std::abs(x) < 1e-9; }));
+}
+
+TEST_CASE("get_m_largests finds the largest coefficients and their signs", "[haar]") {
+  std::mt19937 rng(32);
+  std::uniform_real_distribution<Unit> value(-1000, 1000);
+
+  std::vector<Unit> data(NUM_PIXELS_SQUARED);
+  for (Unit& x : data) x = value(rng);
+
+  Idx sig[NUM_COEFS];
+  get_m_largests(data.data(), sig);
+
+  // The DC coefficient at 0 is never included.
+  std::vector<int> order(NUM_PIXELS_SQUARED - 1);
+  for (int i = 1; i < NUM_PIXELS_SQUARED; i++) order[i - 1] = i;
+  std::partial_sort(order.begin(), order.begin() + NUM_COEFS, order.end(), [&](int a, int b) { return std::abs(data[a]) > std::abs(data[b]); });
+
+  std::vector<int> expected, found(sig, sig + NUM_COEFS);
+  for (int k = 0; k < NUM_COEFS; k++) {
+    expected.push_back(data[order[k]] > 0 ? order[k] : -order[k]);
+  }
+
+  std::sort(expected.begin(), expected.end());
+  std::sort(found.begin(), found.end());
+  CHECK(found == expected);
+}
+
+TEST_CASE("The stages add up to from_channels", "[haar]") {
+  auto channels = read_channels();
+  const HaarSignature signature = HaarSignature::from_channels(channels[0], channels[1], channels[2]);
+
+  std::vector<Unit> a(NUM_PIXELS_SQUARED), b(NUM_PIXELS_SQUARED), c(NUM_PIXELS_SQUARED);
+  transformChar(channels[0].data(), channels[1].data(), channels[2].data(), a.data(), b.data(), c.data());
+
+  Unit* data[3] = { a.data(), b.data(), c.data() };
+  for (int ch = 0; ch < 3; ch++) {
+    CHECK(signature.avglf[ch] == data[ch][0]);
+
+    Idx sig[NUM_COEFS];
+    get_m_largests(data[ch], sig);
+    std::sort(sig, sig + NUM_COEFS);
+    CHECK(std::equal(sig, sig + NUM_COEFS, signature.sig[ch]));
+  }
+
+  CHECK(!signature.is_grayscale());
+}
+
+TEST_CASE("Signatures round-trip through their hash", "[haar]") {
+  auto channels = read_channels();
+  const HaarSignature signature = HaarSignature::from_channels(channels[0], channels[1], channels[2]);
+  const std::string hash = signature.to_string();
+
+  CHECK(hash.size() == 2 * sizeof(HaarSignature));
+  CHECK(HaarSignature::from_hash(hash).to_string() == hash);
+
+  const HaarSignature decoded = HaarSignature::from_hash(hash);
+  CHECK(std::equal(&decoded.sig[0][0], &decoded.sig[2][NUM_COEFS], &signature.sig[0][0]));
+  CHECK(std::equal(decoded.avglf, decoded.avglf + 3, signature.avglf));
+
+  CHECK_THROWS_AS(HaarSignature::from_hash(hash.substr(1)), param_error);
+}
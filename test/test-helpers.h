@@ -0,0 +1,131 @@
+#ifndef IQDB_TEST_HELPERS_H
+#define IQDB_TEST_HELPERS_H
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <functional>
+#include <future>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <iqdb/haar_signature.h>
+#include <iqdb/imgdb.h>
+#include <iqdb/server.h>
+#include <nlohmann/json.hpp>
+
+namespace iqdb {
+
+// A random signature. Coefficients are drawn from the first `range` indexes,
+// so that images share buckets as often as real images do.
+inline HaarSignature random_signature(std::mt19937& rng, bool grayscale = false, int range = 400) {
+  std::uniform_real_distribution<double> luminance(0.0, 1.0);
+  std::uniform_real_distribution<double> chrominance(0.01, 0.1);
+  std::uniform_int_distribution<int> index(1, range);
+
+  HaarSignature signature;
+  signature.avglf[0] = luminance(rng);
+  signature.avglf[1] = grayscale ? 0 : chrominance(rng);
+  signature.avglf[2] = grayscale ? 0 : chrominance(rng);
+
+  for (int c = 0; c < 3; c++) {
+    std::set<int> used;
+    for (int b = 0; b < NUM_COEFS;) {
+      const int i = index(rng);
+      if (!used.insert(i).second)
+        continue;
+
+      signature.sig[c][b++] = static_cast<int16_t>(rng() & 1 ? i : -i);
+    }
+
+    std::sort(&signature.sig[c][0], &signature.sig[c][NUM_COEFS]);
+  }
+
+  return signature;
+}
+
+// Whether two result lists have the same posts with the same scores, in the
+// same order.
+inline bool same_results(const sim_vector& a, const sim_vector& b) {
+  return std::equal(a.begin(), a.end(), b.begin(), b.end(), [](const sim_value& x, const sim_value& y) {
+    return x.id == y.id && x.score == y.score;
+  });
+}
+
+// A TCP port on 127.0.0.1 that nothing is listening on, for a test server.
+inline int free_port() {
+  const int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  socklen_t length = sizeof(address);
+  bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+  getsockname(fd, reinterpret_cast<sockaddr*>(&address), &length);
+  close(fd);
+
+  return ntohs(address.sin_port);
+}
+
+// Runs a server, such as http_server() or coordinator(), on a thread of its
+// own until it's destroyed. `run` is passed the server's StartedCallback.
+class BackgroundServer {
+public:
+  explicit BackgroundServer(std::function<void(StartedCallback)> run) {
+    std::promise<std::function<void()>> started;
+    auto stopper = started.get_future();
+
+    thread_ = std::thread([run, &started] {
+      bool running = false;
+      try {
+        run([&](std::function<void()> stop) {
+          running = true;
+          started.set_value(std::move(stop));
+        });
+      } catch (...) {
+        if (!running)
+          started.set_exception(std::current_exception());
+      }
+    });
+
+    try {
+      stop_ = stopper.get();
+    } catch (...) {
+      thread_.join();
+      throw;
+    }
+  }
+
+  ~BackgroundServer() {
+    stop_();
+    thread_.join();
+  }
+
+private:
+  std::thread thread_;
+  std::function<void()> stop_;
+};
+
+// A random 128x128 image, as `POST /images` takes it.
+inline nlohmann::json random_image(std::mt19937& rng) {
+  std::uniform_int_distribution<int> pixel(0, 255);
+  nlohmann::json channels;
+
+  for (const char* channel : { "r", "g", "b" }) {
+    std::vector<int> values(128 * 128);
+    for (auto& value : values) value = pixel(rng);
+    channels[channel] = values;
+  }
+
+  return { { "channels", channels } };
+}
+
+}
+
+#endif
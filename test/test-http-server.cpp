@@ -0,0 +1,339 @@
+// Tests that HttpServer speaks HTTP/1.1 correctly to a real client, over a
+// Unix socket: keep-alive, pipelining, 100 Continue, half-closed connections,
+// timeouts, and streamed responses.
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <iqdb/http_server.h>
+
+using namespace iqdb;
+using namespace std::chrono_literals;
+
+// An HttpServer listening on a Unix socket of its own, run on a background
+// thread. Add routes to `server` before calling start().
+struct TestServer {
+  explicit TestServer(HttpServerOptions options = {}) : server(options) {}
+
+  ~TestServer() {
+    server.stop();
+    if (thread.joinable())
+      thread.join();
+  }
+
+  void start() {
+    static std::atomic<int> count = 0;
+    path = "/tmp/iqdb-test-" + std::to_string(getpid()) + "-" + std::to_string(count++) + ".sock";
+    server.bindUnix(path);
+    thread = std::thread([this] { server.run(); });
+  }
+
+  HttpServer server;
+  std::string path;
+  std::thread thread;
+};
+
+struct TestResponse {
+  int status = 0;
+  Headers headers;
+  std::string body;
+};
+
+// A raw HTTP client, so that tests control exactly what's sent and when.
+class TestClient {
+public:
+  explicit TestClient(const std::string& path) {
+    fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+
+    if (fd_ < 0 || connect(fd_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0)
+      throw std::runtime_error("Couldn't connect to " + path);
+
+    // Fail the test instead of hanging if the server never answers.
+    timeval timeout = { 5, 0 };
+    setsockopt(fd_, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  }
+
+  ~TestClient() { ::close(fd_); }
+
+  void send(const std::string& data) {
+    for (size_t sent = 0; sent < data.size();) {
+      const ssize_t n = ::send(fd_, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+      if (n <= 0)
+        throw std::runtime_error("Couldn't send the request");
+      sent += static_cast<size_t>(n);
+    }
+  }
+
+  void shutdownWrite() { ::shutdown(fd_, SHUT_WR); }
+
+  // Read the next response, decoding a chunked body.
+  TestResponse read() {
+    const size_t header_end = fill("\r\n\r\n");
+    TestResponse response;
+    response.status = std::stoi(buffer_.substr(9, 3));
+
+    for (size_t start = buffer_.find("\r\n") + 2; start < header_end;) {
+      const size_t end = buffer_.find("\r\n", start);
+      const size_t colon = buffer_.find(':', start);
+      response.headers.emplace(buffer_.substr(start, colon - start), buffer_.substr(colon + 2, end - colon - 2));
+      start = end + 2;
+    }
+
+    buffer_.erase(0, header_end + 4);
+
+    if (response.headers.count("Transfer-Encoding")) {
+      while (true) {
+        const size_t line_end = fill("\r\n");
+        const size_t length = std::stoul(buffer_.substr(0, line_end), nullptr, 16);
+        need(line_end + 2 + length + 2);
+        response.body += buffer_.substr(line_end + 2, length);
+        buffer_.erase(0, line_end + 2 + length + 2);
+
+        if (length == 0)
+          break;
+      }
+    } else if (response.headers.count("Content-Length")) {
+      const size_t length = std::stoul(response.headers.find("Content-Length")->second);
+      need(length);
+      response.body = buffer_.substr(0, length);
+      buffer_.erase(0, length);
+    }
+
+    return response;
+  }
+
+  // Whether the server closes the connection, rather than sending anything
+  // more, within the receive timeout.
+  bool closed() {
+    char c;
+    return buffer_.empty() && ::recv(fd_, &c, 1, 0) == 0;
+  }
+
+private:
+  // Read until the buffer contains `delimiter`, and return where it starts.
+  size_t fill(const std::string& delimiter) {
+    size_t found;
+    while ((found = buffer_.find(delimiter)) == std::string::npos) {
+      receive();
+    }
+
+    return found;
+  }
+
+  // Read until the buffer holds at least `size` bytes.
+  void need(size_t size) {
+    while (buffer_.size() < size) {
+      receive();
+    }
+  }
+
+  void receive() {
+    char data[64 * 1024];
+    const ssize_t n = ::recv(fd_, data, sizeof(data), 0);
+    if (n <= 0)
+      throw std::runtime_error("The connection closed before the response was read");
+
+    buffer_.append(data, static_cast<size_t>(n));
+  }
+
+  int fd_;
+  std::string buffer_;
+};
+
+static std::string get(const std::string& path, const std::string& headers = "") {
+  return "GET " + path + " HTTP/1.1\r\nHost: test\r\n" + headers + "\r\n";
+}
+
+// Answers with the request's path, method, and body.
+static void add_echo_route(HttpServer& server) {
+  auto echo = [](const HttpRequest& request, HttpResponse& response, HttpServer::Done done) {
+    response.set_content(request.method + " " + request.path + " " + request.body, "text/plain");
+    done(nullptr);
+  };
+
+  server.Get("/echo.*", echo);
+  server.Post("/echo.*", echo);
+}
+
+TEST_CASE("Keep-alive connections are reused until the client asks to close", "[http]") {
+  TestServer test;
+  add_echo_route(test.server);
+  test.start();
+
+  TestClient client(test.path);
+  for (int i = 0; i < 3; i++) {
+    client.send(get("/echo/" + std::to_string(i)));
+    const TestResponse response = client.read();
+    CHECK(response.status == 200);
+    CHECK(response.body == "GET /echo/" + std::to_string(i) + " ");
+    CHECK(response.headers.find("Connection")->second == "keep-alive");
+  }
+
+  CHECK(test.server.connectionCount() == 1);
+
+  client.send(get("/echo/last", "Connection: close\r\n"));
+  const TestResponse response = client.read();
+  CHECK(response.body == "GET /echo/last ");
+  CHECK(response.headers.find("Connection")->second == "close");
+  CHECK(client.closed());
+}
+
+TEST_CASE("Pipelined requests are answered in order", "[http]") {
+  TestServer test;
+
+  // The first request is answered last, from another thread.
+  test.server.Get("/slow", [](const HttpRequest&, HttpResponse& response, HttpServer::Done done) {
+    std::thread([&response, done] {
+      std::this_thread::sleep_for(100ms);
+      response.set_content("slow", "text/plain");
+      done(nullptr);
+    }).detach();
+  });
+  add_echo_route(test.server);
+  test.start();
+
+  TestClient client(test.path);
+  client.send(get("/slow") + "POST /echo HTTP/1.1\r\nContent-Length: 4\r\n\r\nbody" + get("/echo/3"));
+
+  CHECK(client.read().body == "slow");
+  CHECK(client.read().body == "POST /echo body");
+  CHECK(client.read().body == "GET /echo/3 ");
+}
+
+TEST_CASE("A client that expects 100 Continue gets it before sending the body", "[http]") {
+  TestServer test;
+  add_echo_route(test.server);
+  test.start();
+
+  TestClient client(test.path);
+  client.send("POST /echo HTTP/1.1\r\nContent-Length: 5\r\nExpect: 100-continue\r\n\r\n");
+  REQUIRE(client.read().status == 100);
+
+  client.send("hello");
+  const TestResponse response = client.read();
+  CHECK(response.status == 200);
+  CHECK(response.body == "POST /echo hello");
+}
+
+TEST_CASE("Chunked request bodies are refused with a 501", "[http]") {
+  TestServer test;
+  add_echo_route(test.server);
+  test.start();
+
+  TestClient client(test.path);
+  client.send("POST /echo HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nhello\r\n0\r\n\r\n");
+  CHECK(client.read().status == 501);
+  CHECK(client.closed());
+}
+
+TEST_CASE("A half-closed connection is answered before it's closed", "[http]") {
+  TestServer test;
+  add_echo_route(test.server);
+  test.start();
+
+  TestClient client(test.path);
+  client.send(get("/echo/1") + get("/echo/2"));
+  client.shutdownWrite();
+
+  CHECK(client.read().body == "GET /echo/1 ");
+  CHECK(client.read().body == "GET /echo/2 ");
+  CHECK(client.closed());
+}
+
+TEST_CASE("Idle connections are closed after the keep-alive timeout", "[http]") {
+  HttpServerOptions options;
+  options.keep_alive_timeout = 1s;
+  TestServer test(options);
+  add_echo_route(test.server);
+  test.start();
+
+  TestClient client(test.path);
+  client.send(get("/echo"));
+  CHECK(client.read().status == 200);
+  CHECK(client.closed());
+}
+
+TEST_CASE("Clients that stop sending their request are closed after the read timeout", "[http]") {
+  HttpServerOptions options;
+  options.read_timeout = 1s;
+  TestServer test(options);
+  add_echo_route(test.server);
+  test.start();
+
+  TestClient client(test.path);
+  client.send("GET /echo HTTP/1.1\r\nHost: te");
+  CHECK(client.closed());
+}
+
+TEST_CASE("Unix socket clients are reported as such", "[http]") {
+  TestServer test;
+  test.server.Get("/addr", [](const HttpRequest& request, HttpResponse& response, HttpServer::Done done) {
+    response.set_content(request.remote_addr, "text/plain");
+    done(nullptr);
+  });
+  test.start();
+
+  TestClient client(test.path);
+  client.send(get("/addr"));
+  CHECK(client.read().body == "unix");
+
+  client.send(get("/missing"));
+  CHECK(client.read().status == 404);
+}
+
+TEST_CASE("Streamed responses don't hold the thread while the client is behind", "[http]") {
+  const size_t page_size = 64 * 1024, pages = 64;
+  std::atomic<bool> returned = false;
+
+  TestServer test;
+  test.server.Get("/stream", [&returned](const HttpRequest&, HttpResponse& response, HttpServer::Done done) {
+    response.set_chunked_content_provider("text/plain", [page = size_t(0)](size_t offset, HttpDataSink& sink) mutable {
+      if (offset != page * page_size)
+        return false;
+
+      const std::string data(page_size, static_cast<char>('a' + page % 26));
+      sink.write(data.data(), data.size());
+      if (++page == pages)
+        sink.done();
+      return true;
+    });
+
+    // `done` returns once a bounded amount of the body is waiting to be sent,
+    // long before the client has read it all.
+    std::thread([done, &returned] {
+      done(nullptr);
+      returned = true;
+    }).detach();
+  });
+  test.start();
+
+  TestClient client(test.path);
+  client.send(get("/stream"));
+
+  const auto deadline = Clock::now() + 5s;
+  while (!returned && Clock::now() < deadline) {
+    std::this_thread::sleep_for(1ms);
+  }
+
+  CHECK(returned);
+
+  const TestResponse response = client.read();
+  REQUIRE(response.body.size() == page_size * pages);
+  for (size_t page = 0; page < pages; page++) {
+    CHECK(response.body[page * page_size] == static_cast<char>('a' + page % 26));
+  }
+}
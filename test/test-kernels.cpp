@@ -0,0 +1,116 @@
+// Tests that every ISA's kernels give bit-identical results to the scalar ones.
+
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <iqdb/imglib.h>
+#include <iqdb/kernels.h>
+
+using namespace iqdb;
+
+// The kernels of every ISA this CPU supports, apart from scalar.
+static std::vector<const Kernels*> vector_kernels() {
+  std::vector<const Kernels*> result;
+  for (Isa isa : { Isa::sse42, Isa::avx2, Isa::avx512 }) {
+    if (const Kernels* k = kernels_for(isa))
+      result.push_back(k);
+  }
+
+  return result;
+}
+
+template <typename T>
+static bool same_bits(const std::vector<T>& a, const std::vector<T>& b) {
+  return a.size() == b.size() && std::memcmp(a.data(), b.data(), a.size() * sizeof(T)) == 0;
+}
+
+// Score `count` random images against random queries with the DC and scatter
+// kernels, like IQDB::scoreAll does. Odd counts exercise the loop tails.
+static std::vector<Score> score_images(const Kernels& k, int colors, size_t count, unsigned seed) {
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<Score> luminance(0, 1);
+
+  std::vector<image_info> info(count);
+  for (auto& image : info) {
+    for (auto& v : image.avgl.v) v = luminance(rng);
+  }
+
+  const Score avgl[3] = { luminance(rng), luminance(rng), luminance(rng) };
+  std::vector<Score> scores(count);
+  k.dc(info.data(), count, colors, weights[0], avgl, scores.data());
+
+  for (int bucket = 0; bucket < 40; bucket++) {
+    std::vector<iqdbId> ids;
+    for (iqdbId id = 0; id < count; id++) {
+      if (rng() % 4 == 0)
+        ids.push_back(id);
+    }
+
+    k.scatter(scores.data(), ids.data(), ids.size(), 0, coefWeight(bucket % colors, 1 + bucket));
+  }
+
+  return scores;
+}
+
+TEST_CASE("Every ISA scores images exactly like the scalar kernels", "[kernels]") {
+  const Kernels& scalar = *kernels_for(Isa::scalar);
+
+  for (const Kernels* k : vector_kernels()) {
+    INFO("isa=" << isa_name(k->isa));
+
+    for (int colors : { 1, 3 }) {
+      for (size_t count : { size_t(1), size_t(15), size_t(1000), size_t(4099) }) {
+        CHECK(same_bits(score_images(*k, colors, count, 44), score_images(scalar, colors, count, 44)));
+      }
+    }
+  }
+}
+
+TEST_CASE("Every ISA finds the same scores as the scalar kernels", "[kernels]") {
+  const Kernels& scalar = *kernels_for(Isa::scalar);
+  std::mt19937 rng(45);
+  std::uniform_real_distribution<Score> score(-1, 1);
+  std::uniform_real_distribution<Unit> unit(-1, 1);
+
+  std::vector<Score> scores(1000);
+  std::vector<Unit> units(1000);
+  for (auto& s : scores) s = score(rng);
+  for (auto& u : units) u = unit(rng);
+
+  for (const Kernels* k : vector_kernels()) {
+    INFO("isa=" << isa_name(k->isa));
+
+    for (size_t begin : { size_t(0), size_t(3), size_t(17) }) {
+      for (Score threshold : { -0.999f, -0.99f, -0.5f, -2.0f }) {
+        CHECK(k->find_below(scores.data(), begin, scores.size(), threshold) == scalar.find_below(scores.data(), begin, scores.size(), threshold));
+      }
+
+      for (Unit threshold : { 0.999, 0.99, 0.5, 2.0 }) {
+        CHECK(k->find_above_abs(units.data(), begin, units.size(), threshold) == scalar.find_above_abs(units.data(), begin, units.size(), threshold));
+      }
+    }
+  }
+}
+
+TEST_CASE("Every ISA transforms channels exactly like the scalar kernels", "[kernels]") {
+  const Kernels& scalar = *kernels_for(Isa::scalar);
+  std::mt19937 rng(46);
+  std::uniform_real_distribution<Unit> pixel(0, 255);
+
+  std::vector<Unit> channel(NUM_PIXELS_SQUARED);
+  for (auto& p : channel) p = pixel(rng);
+
+  std::vector<Unit> expected = channel;
+  scalar.haar2D(expected.data());
+
+  for (const Kernels* k : vector_kernels()) {
+    INFO("isa=" << isa_name(k->isa));
+
+    std::vector<Unit> actual = channel;
+    k->haar2D(actual.data());
+    CHECK(same_bits(actual, expected));
+  }
+}
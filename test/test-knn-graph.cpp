@@ -0,0 +1,215 @@
+// Tests that similar-post queries answered from the k-NN graph match a full
+// scan, and that the graph is saved and thrown away with the database.
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <iqdb/imgdb.h>
+#include <iqdb/knn_graph.h>
+
+#include "test-helpers.h"
+
+using namespace iqdb;
+
+// The post ids of a list of matches, in order.
+static std::vector<postId> post_ids(const sim_vector& matches) {
+  std::vector<postId> ids;
+  for (const auto& match : matches) {
+    ids.push_back(match.id);
+  }
+
+  return ids;
+}
+
+TEST_CASE("Neighbour lists keep the best k entries", "[knn]") {
+  KnnGraph graph(3);
+  graph.resize(10);
+
+  CHECK(!graph.get(1));
+  CHECK(!graph.get(100));
+  CHECK(graph.built() == 0);
+
+  graph.set(1, { { 2, 20, 90 }, { 3, 30, 80 }, { 4, 40, 70 }, { 5, 50, 60 } });
+  auto neighbors = graph.get(1);
+  REQUIRE(neighbors);
+  REQUIRE(neighbors->size() == 3);
+  CHECK((*neighbors)[2].id == 4);
+  CHECK(graph.built() == 1);
+
+  // A better entry pushes out the worst one; a worse one is ignored.
+  graph.offer(1, { 6, 60, 85 });
+  graph.offer(1, { 7, 70, 10 });
+  neighbors = graph.get(1);
+  REQUIRE(neighbors->size() == 3);
+  CHECK((*neighbors)[0].id == 2);
+  CHECK((*neighbors)[1].id == 6);
+  CHECK((*neighbors)[2].id == 3);
+
+  // An image that's offered again moves to its new place.
+  graph.offer(1, { 3, 30, 95 });
+  neighbors = graph.get(1);
+  REQUIRE(neighbors->size() == 3);
+  CHECK((*neighbors)[0].id == 3);
+  CHECK((*neighbors)[1].id == 2);
+  CHECK((*neighbors)[2].id == 6);
+
+  // Unbuilt lists aren't started by offers.
+  graph.offer(2, { 1, 10, 50 });
+  CHECK(!graph.get(2));
+
+  graph.set(2, {});
+  REQUIRE(graph.get(2));
+  CHECK(graph.get(2)->empty());
+  graph.offer(2, { 1, 10, 50 });
+  CHECK(graph.get(2)->size() == 1);
+  CHECK(graph.built() == 2);
+
+  graph.invalidate(1);
+  graph.invalidate(1);
+  CHECK(!graph.get(1));
+  CHECK(graph.built() == 1);
+}
+
+TEST_CASE("Saved graphs are only loaded for the same k and database", "[knn]") {
+  const std::string filename = "/tmp/iqdb-test-knn-" + std::to_string(getpid()) + ".knn";
+
+  KnnGraph graph(2);
+  graph.resize(5);
+  graph.set(3, { { 1, 10, 90 }, { 4, 40, 80 } });
+  graph.set(4, {});
+  graph.save(filename, 1234);
+
+  const auto loaded = KnnGraph::load(filename, 2, 1234);
+  REQUIRE(loaded);
+  CHECK(loaded->built() == 2);
+  CHECK(!loaded->get(1));
+  REQUIRE(loaded->get(3));
+  REQUIRE(loaded->get(3)->size() == 2);
+  CHECK((*loaded->get(3))[1].post_id == 40);
+  CHECK((*loaded->get(3))[1].score == 80);
+  CHECK(loaded->get(4)->empty());
+
+  CHECK(!KnnGraph::load(filename, 3, 1234));
+  CHECK(!KnnGraph::load(filename, 2, 4321));
+
+  std::remove(filename.c_str());
+  CHECK(!KnnGraph::load(filename, 2, 1234));
+}
+
+TEST_CASE("Similar posts from the graph match a full scan", "[knn]") {
+  std::mt19937 rng(37);
+  IQDB db, graph_db;
+
+  std::vector<HaarSignature> signatures;
+  for (postId post_id = 1; post_id <= 200; post_id++) {
+    signatures.push_back(random_signature(rng, post_id % 7 == 0));
+    db.addImage(post_id, signatures.back());
+    graph_db.addImage(post_id, signatures.back());
+  }
+
+  // Lists patched as images are added are only approximate, so start with an
+  // empty graph. Build every list on demand, then ask again to use them.
+  graph_db.enableKnnGraph(5);
+  for (int pass = 0; pass < 2; pass++) {
+    for (postId post_id = 1; post_id <= 200; post_id += 13) {
+      const auto expected = db.querySimilar(post_id, 5);
+      const auto similar = graph_db.querySimilar(post_id, 5);
+      REQUIRE(similar);
+      CHECK(same_results(*similar, *expected));
+    }
+  }
+
+  // Asking for more than k neighbours falls back to a scan.
+  CHECK(same_results(*graph_db.querySimilar(1, 10), *db.querySimilar(1, 10)));
+
+  // Removed neighbours are skipped. Removing an image can empty a bucket and
+  // change every score's scale, so only compare which posts are found.
+  for (postId post_id : post_ids(*db.querySimilar(14, 2))) {
+    db.removeImage(post_id);
+    graph_db.removeImage(post_id);
+  }
+
+  for (postId post_id = 1; post_id <= 200; post_id += 13) {
+    const auto expected = db.querySimilar(post_id, 5);
+    if (!expected)
+      continue;
+
+    const auto similar = graph_db.querySimilar(post_id, 5);
+    REQUIRE(similar);
+    CHECK(post_ids(*similar) == post_ids(*expected));
+  }
+
+  // A new copy of a post goes straight into the post's list.
+  const size_t built = graph_db.knnGraph()->built();
+  graph_db.addImage(300, signatures[0]);
+  const auto copies = graph_db.querySimilar(1, 1);
+  REQUIRE(copies);
+  REQUIRE(copies->size() == 1);
+  CHECK((*copies)[0].id == 300);
+  CHECK(graph_db.knnGraph()->built() == built + 1);
+
+  // A replaced post's list is rebuilt.
+  graph_db.addImage(1, signatures[1]);
+  const auto replaced = graph_db.querySimilar(1, 1);
+  REQUIRE(replaced);
+  REQUIRE(replaced->size() == 1);
+  CHECK((*replaced)[0].id == 2);
+}
+
+TEST_CASE("The graph is saved with the database and dropped when it changes", "[knn]") {
+  std::mt19937 rng(37);
+  const std::string filename = "/tmp/iqdb-test-knn-" + std::to_string(getpid()) + ".sqlite";
+
+  std::vector<sim_vector> expected;
+  {
+    IQDB db(filename);
+    for (postId post_id = 1; post_id <= 50; post_id++) {
+      db.addImage(post_id, random_signature(rng));
+    }
+
+    db.enableKnnGraph(4);
+    for (const Image& image : db.getImages(0, 1000)) {
+      CHECK(db.fillNeighbors(image.id));
+      CHECK(!db.fillNeighbors(image.id));
+    }
+
+    CHECK(db.knnGraph()->built() == 50);
+    for (postId post_id = 1; post_id <= 50; post_id += 7) {
+      expected.push_back(*db.querySimilar(post_id, 4));
+    }
+
+    db.saveKnnGraph();
+  }
+
+  {
+    IQDB db(filename);
+    db.enableKnnGraph(4);
+    CHECK(db.knnGraph()->built() == 50);
+    for (postId post_id = 1, i = 0; post_id <= 50; post_id += 7, i++) {
+      CHECK(same_results(*db.querySimilar(post_id, 4), expected[i]));
+    }
+
+    // A graph for another k isn't used.
+    db.enableKnnGraph(3);
+    CHECK(db.knnGraph()->built() == 0);
+
+    db.removeImage(50);
+  }
+
+  {
+    // Nor is a graph for an older version of the database.
+    IQDB db(filename);
+    db.enableKnnGraph(4);
+    CHECK(db.knnGraph()->built() == 0);
+  }
+
+  for (const std::string suffix : { "", "-wal", "-shm", ".knn" }) {
+    std::remove((filename + suffix).c_str());
+  }
+}
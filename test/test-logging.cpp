@@ -0,0 +1,137 @@
+// Tests that log messages are only formatted when their level is enabled, and
+// that the log writer thread writes every message, in order.
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Before Catch2, which has INFO and WARN macros of its own. The tests call
+// LOG directly for the same reason.
+#include <fmt/format.h>
+#include <iqdb/debug.h>
+
+#include <catch2/catch_test_macros.hpp>
+
+using namespace iqdb;
+
+// Counts how many times it's been formatted.
+struct Counted {
+  int& count;
+};
+
+template <>
+struct fmt::formatter<Counted> : fmt::formatter<int> {
+  auto format(const Counted& counted, format_context& ctx) const {
+    return fmt::formatter<int>::format(++counted.count, ctx);
+  }
+};
+
+// Sends stderr to a temporary file while it's alive.
+class CapturedStderr {
+public:
+  CapturedStderr() : file_(std::tmpfile()), saved_(dup(STDERR_FILENO)) {
+    fflush(stderr);
+    dup2(fileno(file_), STDERR_FILENO);
+  }
+
+  ~CapturedStderr() {
+    restore();
+    std::fclose(file_);
+  }
+
+  // Stop capturing, and return what was written.
+  std::string restore() {
+    if (saved_ >= 0) {
+      fflush(stderr);
+      dup2(saved_, STDERR_FILENO);
+      close(saved_);
+      saved_ = -1;
+    }
+
+    std::string output;
+    std::rewind(file_);
+    for (int c; (c = std::fgetc(file_)) != EOF;) {
+      output += static_cast<char>(c);
+    }
+
+    return output;
+  }
+
+private:
+  FILE* file_;
+  int saved_;
+};
+
+// Restores the log level at the end of a test.
+struct LogLevel {
+  explicit LogLevel(int level) : saved(debug_level) { debug_level = level; }
+  ~LogLevel() { debug_level = saved; }
+  const int saved;
+};
+
+TEST_CASE("Messages below the log level aren't formatted", "[logging]") {
+  LogLevel level(1);
+  int count = 0;
+
+  CapturedStderr captured;
+  LOG<0>("[debug] ", "debug {}\n", Counted { count });
+  CHECK(count == 0);
+
+  LOG<1>("[info] ", "info {}\n", Counted { count });
+  LOG<2>("[warn] ", "warn {}\n", Counted { count });
+  CHECK(count == 2);
+
+  CHECK(captured.restore() == "[info] info 1\n[warn] warn 2\n");
+}
+
+TEST_CASE("The log writer writes every message in order", "[logging]") {
+  LogLevel level(1);
+  const int threads = 4, messages = 2000;
+  const std::string long_message(4000, 'x');
+
+  CapturedStderr captured;
+  start_log_writer();
+
+  // Enough messages to fill the ring, so that some are written directly, and
+  // some too long for a slot.
+  std::vector<std::thread> writers;
+  for (int t = 0; t < threads; t++) {
+    writers.emplace_back([&, t] {
+      for (int i = 0; i < messages; i++) {
+        if (i % 500 == 0)
+          LOG<1>("[info] ", "{} {} {}\n", t, i, long_message);
+        else
+          LOG<1>("[info] ", "{} {}\n", t, i);
+      }
+    });
+  }
+
+  for (auto& writer : writers) {
+    writer.join();
+  }
+
+  stop_log_writer();
+  const std::string output = captured.restore();
+
+  std::vector<int> next(threads, 0);
+  std::istringstream lines(output);
+  for (std::string line; std::getline(lines, line);) {
+    int t, i;
+    REQUIRE(std::sscanf(line.c_str(), "[info] %d %d", &t, &i) == 2);
+    REQUIRE(t >= 0);
+    REQUIRE(t < threads);
+    CHECK(i == next[t]);
+    next[t] = i + 1;
+
+    if (i % 500 == 0)
+      CHECK(line.size() > long_message.size());
+  }
+
+  for (int t = 0; t < threads; t++) {
+    CHECK(next[t] == messages);
+  }
+}
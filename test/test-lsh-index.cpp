@@ -0,0 +1,155 @@
+// Tests that approximate queries only score the images found in the LSH
+// tables, and score them the same as an exact query does.
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <httplib.h>
+#include <iqdb/imgdb.h>
+#include <iqdb/lsh_index.h>
+#include <iqdb/server.h>
+#include <nlohmann/json.hpp>
+
+#include "test-helpers.h"
+
+using namespace iqdb;
+using nlohmann::json;
+
+// A copy of `signature` with one of its luminance coefficients changed.
+static HaarSignature near_copy(const HaarSignature& signature) {
+  HaarSignature copy = signature;
+  copy.sig[0][0] = static_cast<int16_t>(copy.sig[0][0] - 1000);
+  std::sort(&copy.sig[0][0], &copy.sig[0][NUM_COEFS]);
+  return copy;
+}
+
+TEST_CASE("LSH tables find near-duplicates", "[lsh]") {
+  std::mt19937 rng(39);
+  LshIndex index(16);
+
+  std::vector<HaarSignature> signatures;
+  for (iqdbId id = 0; id < 200; id++) {
+    signatures.push_back(random_signature(rng, id % 7 == 0, 4000));
+    index.add(signatures.back(), id);
+  }
+
+  size_t found = 0;
+  for (iqdbId id = 0; id < 200; id++) {
+    // An image is always in its own bucket.
+    const auto candidates = index.candidates(signatures[id], 1);
+    CHECK(std::binary_search(candidates.begin(), candidates.end(), id));
+
+    const auto all = index.candidates(near_copy(signatures[id]), index.tables());
+    CHECK(std::is_sorted(all.begin(), all.end()));
+    CHECK(std::adjacent_find(all.begin(), all.end()) == all.end());
+    found += std::binary_search(all.begin(), all.end(), id);
+
+    // More probes only add candidates.
+    const auto some = index.candidates(near_copy(signatures[id]), 4);
+    CHECK(std::includes(all.begin(), all.end(), some.begin(), some.end()));
+  }
+
+  CHECK(found >= 195);
+
+  // Unrelated images rarely share a bucket.
+  size_t unrelated = 0;
+  for (int n = 0; n < 100; n++) {
+    unrelated += index.candidates(random_signature(rng, false, 4000), index.tables()).size();
+  }
+  CHECK(unrelated < 100);
+
+  // Probing more tables than there are is the same as probing them all.
+  CHECK(index.candidates(signatures[0], 100) == index.candidates(signatures[0], 16));
+
+  index.remove(signatures[3], 3);
+  const auto removed = index.candidates(signatures[3], index.tables());
+  CHECK(!std::binary_search(removed.begin(), removed.end(), 3));
+  CHECK(index.memoryUsage() > 0);
+
+  index.clear();
+  CHECK(index.candidates(signatures[0], index.tables()).empty());
+}
+
+TEST_CASE("Approximate queries score candidates like an exact query", "[lsh]") {
+  std::mt19937 rng(39);
+  IQDB db;
+  db.enableLshIndex(16);
+
+  std::vector<HaarSignature> signatures;
+  for (postId post_id = 1; post_id <= 500; post_id++) {
+    signatures.push_back(random_signature(rng, post_id % 7 == 0));
+    db.addImage(post_id, signatures.back());
+  }
+
+  // Removed images aren't found.
+  for (postId post_id = 5; post_id <= 500; post_id += 50) {
+    db.removeImage(post_id);
+  }
+
+  QueryOptions options;
+  options.probes = 16;
+
+  for (postId post_id = 1; post_id <= 500; post_id += 17) {
+    const HaarSignature query = near_copy(signatures[post_id - 1]);
+    const sim_vector exact = db.queryFromSignature(query, 500);
+    const sim_vector approximate = db.queryFromSignature(query, 10, options);
+
+    // The post is the best match either way, unless it's been removed.
+    if (post_id % 50 != 5) {
+      REQUIRE(!approximate.empty());
+      CHECK(approximate[0].id == post_id);
+      CHECK(exact[0].id == post_id);
+    }
+
+    for (const sim_value& match : approximate) {
+      CHECK(match.id % 50 != 5);
+
+      const auto it = std::find_if(exact.begin(), exact.end(), [&](const sim_value& other) { return other.id == match.id; });
+      REQUIRE(it != exact.end());
+      CHECK(std::abs(it->score - match.score) < 1e-3f);
+    }
+
+    CHECK(std::is_sorted(approximate.begin(), approximate.end(), [](const sim_value& a, const sim_value& b) { return a.score > b.score; }));
+  }
+
+  // Queries without probes still score every image.
+  const HaarSignature unrelated = random_signature(rng);
+  CHECK(db.queryFromSignature(unrelated, 20).size() == 20);
+  CHECK(db.queryFromSignature(unrelated, 20, options).size() < 20);
+}
+
+TEST_CASE("Queries can ask for probes over HTTP", "[lsh]") {
+  std::mt19937 rng(39);
+  const int port = free_port();
+
+  ServerOptions options;
+  options.lsh_tables = 8;
+  BackgroundServer server([&](StartedCallback started) { http_server("127.0.0.1", port, ":memory:", options, started); });
+  httplib::Client client("127.0.0.1", port);
+
+  std::vector<std::string> hashes;
+  for (postId post_id = 1; post_id <= 20; post_id++) {
+    const auto added = client.Post("/images/" + std::to_string(post_id), random_image(rng).dump(), "application/json");
+    REQUIRE(added);
+    hashes.push_back(json::parse(added->body)["hash"]);
+  }
+
+  const auto approximate = client.Post("/query", json({ { "hash", hashes[6] }, { "probes", 8 } }).dump(), "application/json");
+  REQUIRE(approximate);
+  REQUIRE(approximate->status == 200);
+  const json matches = json::parse(approximate->body);
+  REQUIRE(!matches.empty());
+  CHECK(matches[0]["post_id"] == 7);
+
+  const auto exact = client.Post("/query", json({ { "hash", hashes[6] } }).dump(), "application/json");
+  REQUIRE(exact);
+  CHECK(json::parse(exact->body).size() == 10);
+
+  ServerOptions too_many;
+  CHECK_THROWS_AS(parse_option(too_many, "--lsh-tables=" + std::to_string(LshIndex::max_tables + 1)), param_error);
+}
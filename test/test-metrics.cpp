@@ -0,0 +1,99 @@
+// Tests that metrics are rendered in the Prometheus text format, and that the
+// server's `/metrics` counts the work it's done.
+
+#include <chrono>
+#include <cmath>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <string>
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <httplib.h>
+#include <iqdb/metrics.h>
+#include <iqdb/server.h>
+#include <nlohmann/json.hpp>
+
+#include "test-helpers.h"
+
+using namespace iqdb;
+using nlohmann::json;
+using namespace std::chrono_literals;
+
+// The value of the sample with this name and labels, e.g. `name{a="b"}`.
+static std::optional<double> sample(const std::string& text, const std::string& series) {
+  std::istringstream lines(text);
+  for (std::string line; std::getline(lines, line);) {
+    if (line.rfind(series + " ", 0) == 0)
+      return std::stod(line.substr(series.size() + 1));
+  }
+
+  return std::nullopt;
+}
+
+TEST_CASE("Histograms count samples in cumulative buckets", "[metrics]") {
+  Histogram histogram { R"(phase="test")" };
+  histogram.observe(5us);
+  histogram.observe(1ms);
+  histogram.observe(2ms);
+  histogram.observe(20s);
+
+  std::string out;
+  histogram.render(out, "h");
+
+  CHECK(sample(out, R"(h_bucket{phase="test",le="1e-05"})") == 1);
+  CHECK(sample(out, R"(h_bucket{phase="test",le="0.001"})") == 2);
+  CHECK(sample(out, R"(h_bucket{phase="test",le="0.0025"})") == 3);
+  CHECK(sample(out, R"(h_bucket{phase="test",le="10"})") == 3);
+  CHECK(sample(out, R"(h_bucket{phase="test",le="+Inf"})") == 4);
+  CHECK(sample(out, R"(h_count{phase="test"})") == 4);
+  CHECK(std::abs(*sample(out, R"(h_sum{phase="test"})") - 20.003005) < 1e-9);
+}
+
+TEST_CASE("Samples and headers are rendered with their labels", "[metrics]") {
+  Counter counter { R"(result="hit")" };
+  counter.inc();
+  counter.inc(2);
+
+  std::string out;
+  render_header(out, "c_total", "counter", "A counter.");
+  render_sample(out, "c_total", counter.labels(), static_cast<double>(counter.value()));
+  render_sample(out, "g", "", 1.5);
+
+  CHECK(out == "# HELP c_total A counter.\n# TYPE c_total counter\nc_total{result=\"hit\"} 3\ng 1.5\n");
+}
+
+TEST_CASE("The server's metrics count its queries and images", "[metrics]") {
+  std::mt19937 rng(28);
+  const int port = free_port();
+  BackgroundServer server([&](StartedCallback started) { http_server("127.0.0.1", port, ":memory:", {}, started); });
+  httplib::Client client("127.0.0.1", port);
+
+  // Other tests share the metrics, so only count what this test adds.
+  auto scrape = [&] {
+    const auto result = client.Get("/metrics");
+    REQUIRE(result);
+    REQUIRE(result->status == 200);
+    return result->body;
+  };
+
+  const std::string before = scrape();
+  std::string hash;
+  for (postId post_id = 1; post_id <= 3; post_id++) {
+    const auto added = client.Post("/images/" + std::to_string(post_id), random_image(rng).dump(), "application/json");
+    REQUIRE(added);
+    hash = json::parse(added->body)["hash"];
+  }
+
+  const auto queried = client.Post("/query", json({ { "hash", hash } }).dump(), "application/json");
+  REQUIRE(queried);
+  REQUIRE(queried->status == 200);
+
+  const std::string after = scrape();
+  CHECK(sample(after, "iqdb_images") == 3);
+  CHECK(*sample(after, "iqdb_queries_total") - *sample(before, "iqdb_queries_total") == 1);
+  CHECK(*sample(after, "iqdb_add_image_seconds_count") - *sample(before, "iqdb_add_image_seconds_count") == 3);
+  CHECK(*sample(after, R"(iqdb_query_phase_seconds_count{phase="dc"})") > *sample(before, R"(iqdb_query_phase_seconds_count{phase="dc"})"));
+  CHECK(*sample(after, R"(iqdb_memory_bytes{structure="m_info"})") > 0);
+}
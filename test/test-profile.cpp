@@ -0,0 +1,103 @@
+// Tests that a profiled query reports the buckets it visited and the work it
+// did, without changing its results.
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <httplib.h>
+#include <iqdb/imgdb.h>
+#include <iqdb/query_cache.h>
+#include <iqdb/server.h>
+#include <nlohmann/json.hpp>
+
+#include "test-helpers.h"
+
+using namespace iqdb;
+using nlohmann::json;
+
+// The number of signatures with `coef` in color channel `c`.
+static size_t bucket_size(const std::vector<HaarSignature>& signatures, int c, int coef) {
+  return std::count_if(signatures.begin(), signatures.end(), [&](const HaarSignature& signature) {
+    return std::binary_search(&signature.sig[c][0], &signature.sig[c][NUM_COEFS], coef);
+  });
+}
+
+TEST_CASE("A profile lists every bucket a query visits", "[profile]") {
+  std::mt19937 rng(29);
+  IQDB db;
+  db.enableQueryCache(10);
+
+  std::vector<HaarSignature> signatures;
+  for (postId post_id = 1; post_id <= 200; post_id++) {
+    signatures.push_back(random_signature(rng));
+    db.addImage(post_id, signatures.back());
+  }
+
+  std::vector<HaarSignature> live;
+  for (postId post_id = 1; post_id <= 200; post_id++) {
+    if (post_id % 10 == 0)
+      db.removeImage(post_id);
+    else
+      live.push_back(signatures[post_id - 1]);
+  }
+
+  for (const bool grayscale : { false, true }) {
+    const HaarSignature query = random_signature(rng, grayscale);
+    const int colors = grayscale ? 1 : 3;
+
+    // The unprofiled query is cached, but the profiled one scans anyway.
+    const sim_vector expected = db.queryFromSignature(query, 10);
+
+    QueryProfile profile;
+    QueryOptions options;
+    options.profile = &profile;
+    CHECK(same_results(db.queryFromSignature(query, 10, options), expected));
+    CHECK(profile.num_colors == colors);
+    CHECK(profile.candidates == 180);
+    CHECK(profile.images >= 200);
+
+    REQUIRE(profile.buckets.size() == static_cast<size_t>(colors * NUM_COEFS));
+    size_t scattered = 0;
+    for (size_t i = 0; i < profile.buckets.size(); i++) {
+      const QueryProfile::Bucket& bucket = profile.buckets[i];
+      CHECK(bucket.color == static_cast<int>(i) / NUM_COEFS);
+      CHECK(bucket.coef == query.sig[bucket.color][i % NUM_COEFS]);
+      CHECK(bucket.size == bucket_size(live, bucket.color, bucket.coef));
+      CHECK(bucket.weight > 0);
+      scattered += bucket.size;
+    }
+
+    CHECK(profile.ids_scattered == scattered);
+  }
+
+  CHECK(db.queryCache()->hits() == 0);
+}
+
+TEST_CASE("POST /query returns the profile next to the matches", "[profile]") {
+  std::mt19937 rng(29);
+  const int port = free_port();
+  BackgroundServer server([&](StartedCallback started) { http_server("127.0.0.1", port, ":memory:", {}, started); });
+  httplib::Client client("127.0.0.1", port);
+
+  std::string hash;
+  for (postId post_id = 1; post_id <= 5; post_id++) {
+    const auto added = client.Post("/images/" + std::to_string(post_id), random_image(rng).dump(), "application/json");
+    REQUIRE(added);
+    hash = json::parse(added->body)["hash"];
+  }
+
+  const auto result = client.Post("/query", json({ { "hash", hash }, { "profile", true } }).dump(), "application/json");
+  REQUIRE(result);
+  REQUIRE(result->status == 200);
+
+  const json body = json::parse(result->body);
+  CHECK(body["matches"].size() == 5);
+  CHECK(body["matches"][0]["post_id"] == 5);
+  const int colors = body["profile"]["num_colors"];
+  CHECK(body["profile"]["grayscale"] == (colors == 1));
+  CHECK(body["profile"]["buckets"].size() == static_cast<size_t>(colors * NUM_COEFS));
+  CHECK(body["profile"]["candidates"] == 5);
+}
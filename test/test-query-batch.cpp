@@ -0,0 +1,94 @@
+// Tests that batched queries return exactly what the same queries return when
+// run one at a time.
+
+#include <random>
+#include <vector>
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <iqdb/imgdb.h>
+#include <iqdb/query_cache.h>
+
+#include "test-helpers.h"
+
+using namespace iqdb;
+
+// A database of `count` random images, a tenth of them grayscale, with every
+// seventh post removed again so that there are holes in the iqdb ids. The
+// same seed gives the same database.
+static std::vector<HaarSignature> fill_database(IQDB& db, postId count, unsigned seed) {
+  std::mt19937 rng(seed);
+  std::vector<HaarSignature> signatures;
+  for (postId post_id = 1; post_id <= count; post_id++) {
+    signatures.push_back(random_signature(rng, post_id % 10 == 0));
+    db.addImage(post_id, signatures.back());
+  }
+
+  for (postId post_id = 7; post_id <= count; post_id += 7) {
+    db.removeImage(post_id);
+  }
+
+  return signatures;
+}
+
+// A mix of queries: some are images in the database, some are new; some are
+// grayscale, and they ask for different numbers of results.
+static std::vector<BatchQuery> make_queries(const std::vector<HaarSignature>& signatures, size_t count, std::mt19937& rng) {
+  std::vector<BatchQuery> queries;
+  for (size_t q = 0; q < count; q++) {
+    const HaarSignature signature = q % 2 ? signatures[rng() % signatures.size()] : random_signature(rng, q % 3 == 0);
+    queries.push_back({ signature, q % 4 == 0 ? 1 : 10 + q % 40 });
+  }
+
+  return queries;
+}
+
+TEST_CASE("Batched queries return the same results as single queries", "[batch]") {
+  std::mt19937 rng(43);
+  IQDB db;
+
+  // More images than one tile of the batch scan, so that results come from
+  // several tiles.
+  const auto signatures = fill_database(db, 5000, 43);
+
+  for (size_t batch_size : { 1, 2, 7, 32 }) {
+    INFO("batch_size=" << batch_size);
+
+    const auto queries = make_queries(signatures, batch_size, rng);
+    const auto results = db.queryBatch(queries);
+    REQUIRE(results.size() == queries.size());
+
+    for (size_t q = 0; q < queries.size(); q++) {
+      INFO("query=" << q);
+      CHECK(same_results(results[q], db.queryFromSignature(queries[q].signature, queries[q].numres)));
+    }
+  }
+}
+
+TEST_CASE("Batched queries use and fill the query cache", "[batch]") {
+  std::mt19937 rng(45);
+  IQDB db, uncached;
+  db.enableQueryCache(100);
+
+  const auto signatures = fill_database(db, 500, 44);
+  fill_database(uncached, 500, 44);
+
+  const auto queries = make_queries(signatures, 16, rng);
+
+  // Half of the queries are cached before the batch runs.
+  for (size_t q = 0; q < queries.size(); q += 2) {
+    db.queryFromSignature(queries[q].signature, queries[q].numres);
+  }
+
+  const auto results = db.queryBatch(queries);
+  const size_t hits = db.queryCache()->hits();
+  CHECK(hits == queries.size() / 2);
+
+  for (size_t q = 0; q < queries.size(); q++) {
+    INFO("query=" << q);
+    CHECK(same_results(results[q], uncached.queryFromSignature(queries[q].signature, queries[q].numres)));
+    CHECK(same_results(results[q], db.queryFromSignature(queries[q].signature, queries[q].numres)));
+  }
+
+  CHECK(db.queryCache()->hits() == hits + queries.size());
+}
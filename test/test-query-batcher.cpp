@@ -0,0 +1,118 @@
+// Tests that the query batcher groups queries into batches, and calls every
+// query's `done` exactly once, even around shutdown.
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <iqdb/query_batcher.h>
+
+using namespace iqdb;
+using namespace std::chrono_literals;
+
+// A query that counts how often it's finished, and remembers the error.
+static std::shared_ptr<BatchedQuery> counted_query(std::atomic<int>& finished, std::atomic<int>& failed) {
+  auto query = std::make_shared<BatchedQuery>();
+  query->limit = 10;
+  query->done = [&finished, &failed](std::exception_ptr error) {
+    finished++;
+    failed += error != nullptr;
+  };
+
+  return query;
+}
+
+// Finishes every query of every batch on the batcher's thread, and records
+// the batch sizes.
+struct BatchRecorder {
+  std::mutex mutex;
+  std::vector<size_t> sizes;
+
+  std::function<void(QueryBatcher::Batch)> run() {
+    return [this](QueryBatcher::Batch batch) {
+      {
+        std::lock_guard lock(mutex);
+        sizes.push_back(batch.size());
+      }
+
+      for (auto& query : batch) {
+        query->done(nullptr);
+      }
+    };
+  }
+};
+
+TEST_CASE("Queries that arrive within the window run as one batch", "[batcher]") {
+  std::atomic<int> finished = 0, failed = 0;
+  BatchRecorder recorder;
+
+  {
+    QueryBatcher batcher(200ms, 16, recorder.run());
+    for (int i = 0; i < 5; i++) {
+      batcher.submit(counted_query(finished, failed));
+    }
+  }
+
+  CHECK(finished == 5);
+  CHECK(failed == 0);
+  CHECK(recorder.sizes == std::vector<size_t>{ 5 });
+}
+
+TEST_CASE("A full batch runs without waiting for the window", "[batcher]") {
+  std::atomic<int> finished = 0, failed = 0;
+  BatchRecorder recorder;
+  QueryBatcher batcher(10s, 4, recorder.run());
+
+  for (int i = 0; i < 8; i++) {
+    batcher.submit(counted_query(finished, failed));
+  }
+
+  const auto deadline = Clock::now() + 5s;
+  while (finished < 8 && Clock::now() < deadline) {
+    std::this_thread::sleep_for(1ms);
+  }
+
+  CHECK(finished == 8);
+  std::lock_guard lock(recorder.mutex);
+  CHECK(recorder.sizes == std::vector<size_t>{ 4, 4 });
+}
+
+TEST_CASE("Shutting down runs the queued queries", "[batcher]") {
+  std::atomic<int> finished = 0, failed = 0;
+  BatchRecorder recorder;
+  QueryBatcher batcher(10s, 16, recorder.run());
+
+  for (int i = 0; i < 3; i++) {
+    batcher.submit(counted_query(finished, failed));
+  }
+
+  batcher.shutdown();
+  CHECK(finished == 3);
+  CHECK(failed == 0);
+}
+
+TEST_CASE("Queries submitted after shutdown fail instead of waiting forever", "[batcher]") {
+  std::atomic<int> finished = 0, failed = 0;
+  BatchRecorder recorder;
+  QueryBatcher batcher(1ms, 16, recorder.run());
+  batcher.shutdown();
+
+  std::exception_ptr error;
+  auto query = counted_query(finished, failed);
+  query->done = [&](std::exception_ptr e) {
+    finished++;
+    error = e;
+  };
+
+  batcher.submit(query);
+  CHECK(finished == 1);
+  REQUIRE(error);
+  CHECK_THROWS_AS(std::rethrow_exception(error), shutdown_error);
+  CHECK(recorder.sizes.empty());
+}
@@ -0,0 +1,93 @@
+// Tests that cached query results stay the same as a fresh scan's while images
+// are added, replaced and removed.
+
+#include <random>
+#include <vector>
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <iqdb/imgdb.h>
+#include <iqdb/query_cache.h>
+
+#include "test-helpers.h"
+
+using namespace iqdb;
+
+TEST_CASE("Cached queries match uncached queries after adds and removes", "[cache]") {
+  std::mt19937 rng(27);
+  IQDB cached, uncached;
+  cached.enableQueryCache(100);
+
+  std::vector<HaarSignature> signatures;
+  for (postId post_id = 1; post_id <= 300; post_id++) {
+    signatures.push_back(random_signature(rng, post_id % 5 == 0));
+    cached.addImage(post_id, signatures.back());
+    uncached.addImage(post_id, signatures.back());
+  }
+
+  // Posts 1-300 are added, replaced or removed; posts above 300 are new.
+  for (int round = 0; round < 100; round++) {
+    for (size_t q = 0; q < 20; q++) {
+      cached.queryFromSignature(signatures[q * 7], 5 + q % 3);
+    }
+
+    const postId post_id = 1 + static_cast<postId>(rng() % 400);
+    if (rng() % 3 == 0) {
+      cached.removeImage(post_id);
+      uncached.removeImage(post_id);
+    } else {
+      const HaarSignature signature = random_signature(rng, rng() % 4 == 0);
+      cached.addImage(post_id, signature);
+      uncached.addImage(post_id, signature);
+    }
+
+    for (size_t q = 0; q < 20; q++) {
+      const sim_vector expected = uncached.queryFromSignature(signatures[q * 7], 5 + q % 3);
+      CHECK(same_results(cached.queryFromSignature(signatures[q * 7], 5 + q % 3), expected));
+    }
+  }
+
+  CHECK(cached.queryCache()->hits() > 0);
+}
+
+TEST_CASE("A removed post isn't returned from the cache", "[cache]") {
+  std::mt19937 rng(28);
+  IQDB db;
+  db.enableQueryCache(10);
+
+  std::vector<HaarSignature> signatures;
+  for (postId post_id = 1; post_id <= 50; post_id++) {
+    signatures.push_back(random_signature(rng));
+    db.addImage(post_id, signatures.back());
+  }
+
+  REQUIRE(db.queryFromSignature(signatures[9], 5).front().id == 10);
+  db.removeImage(10);
+
+  for (const auto& match : db.queryFromSignature(signatures[9], 5)) {
+    CHECK(match.id != 10);
+  }
+}
+
+TEST_CASE("An added or replaced post shows up in cached results", "[cache]") {
+  std::mt19937 rng(29);
+  IQDB db;
+  db.enableQueryCache(10);
+
+  for (postId post_id = 1; post_id <= 50; post_id++) {
+    db.addImage(post_id, random_signature(rng));
+  }
+
+  const HaarSignature query = random_signature(rng);
+  REQUIRE(db.queryFromSignature(query, 5).front().id != 51);
+
+  db.addImage(51, query);
+  CHECK(db.queryFromSignature(query, 5).front().id == 51);
+
+  // Replacing a post gives it the new signature in place of the old one.
+  db.addImage(20, query);
+  const sim_vector matches = db.queryFromSignature(query, 5);
+  REQUIRE(matches.size() == 5);
+  CHECK(((matches[0].id == 20 && matches[1].id == 51) || (matches[0].id == 51 && matches[1].id == 20)));
+  CHECK(matches[0].score == matches[1].score);
+}
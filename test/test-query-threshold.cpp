@@ -0,0 +1,80 @@
+// Tests that threshold queries return exactly the images that a full scan
+// scores at or above the threshold.
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <iqdb/imgdb.h>
+
+#include "test-helpers.h"
+
+using namespace iqdb;
+
+// The results of a full scan that score at least `min_score` and match
+// `filter`, best match first, ties in post id order.
+static sim_vector expected_matches(IQDB& db, const HaarSignature& signature, Score min_score, const QueryFilter& filter = {}) {
+  sim_vector matches;
+  for (const auto& match : db.queryFromSignature(signature, db.imageSlots())) {
+    if (match.score >= min_score && filter.matches(match.id))
+      matches.push_back(match);
+  }
+
+  std::sort(matches.begin(), matches.end(), [](const auto& a, const auto& b) { return a.score != b.score ? a.score > b.score : a.id < b.id; });
+  return matches;
+}
+
+TEST_CASE("Threshold queries return every image a full scan scores above the threshold", "[threshold]") {
+  std::mt19937 rng(49);
+  IQDB db;
+
+  std::vector<HaarSignature> signatures;
+  for (postId post_id = 1; post_id <= 2000; post_id++) {
+    signatures.push_back(random_signature(rng, post_id % 10 == 0));
+    db.addImage(post_id, signatures.back());
+  }
+
+  for (postId post_id = 5; post_id <= 2000; post_id += 5) {
+    db.removeImage(post_id);
+  }
+
+  for (int q = 0; q < 8; q++) {
+    // Stored images (some of them removed since), and new ones.
+    const HaarSignature signature = q % 2 ? signatures[rng() % signatures.size()] : random_signature(rng, q % 4 == 0);
+    const sim_vector all = expected_matches(db, signature, -1000);
+    REQUIRE(!all.empty());
+
+    // Thresholds that fall exactly on a result's score, so that the boundary
+    // is checked, as well as thresholds that match everything or nothing.
+    for (Score min_score : { all.front().score, all[all.size() / 100].score, all[all.size() / 2].score, all.back().score, Score(-1000), Score(101) }) {
+      INFO("query=" << q << " min_score=" << min_score);
+      CHECK(same_results(db.queryAboveThreshold(signature, min_score), expected_matches(db, signature, min_score)));
+    }
+  }
+}
+
+TEST_CASE("Threshold queries apply the filter", "[threshold]") {
+  std::mt19937 rng(50);
+  IQDB db;
+
+  for (postId post_id = 1; post_id <= 500; post_id++) {
+    db.addImage(post_id, random_signature(rng));
+  }
+
+  QueryFilter filter;
+  filter.min_id = 100;
+  filter.max_id = 300;
+
+  QueryOptions options;
+  options.filter = filter;
+
+  const HaarSignature signature = random_signature(rng);
+  const sim_vector all = expected_matches(db, signature, -1000);
+  const Score min_score = all[all.size() / 4].score;
+
+  const sim_vector matches = db.queryAboveThreshold(signature, min_score, options);
+  CHECK(!matches.empty());
+  CHECK(same_results(matches, expected_matches(db, signature, min_score, filter)));
+}
@@ -0,0 +1,70 @@
+// Tests that reordering a database renumbers its images without changing what
+// queries return.
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <iqdb/imgdb.h>
+
+#include "test-helpers.h"
+
+using namespace iqdb;
+
+TEST_CASE("Reordering closes the gaps without changing query results", "[reorder]") {
+  std::mt19937 rng(50);
+  const std::string filename = "/tmp/iqdb-test-reorder-" + std::to_string(getpid()) + ".sqlite";
+
+  std::vector<HaarSignature> signatures;
+  std::vector<sim_vector> expected;
+  {
+    IQDB db(filename);
+    for (postId post_id = 1; post_id <= 300; post_id++) {
+      signatures.push_back(random_signature(rng, post_id % 5 == 0));
+      db.addImage(post_id, signatures.back());
+    }
+
+    for (postId post_id = 3; post_id <= 300; post_id += 3) {
+      db.removeImage(post_id);
+    }
+
+    for (size_t q = 0; q < signatures.size(); q += 11) {
+      expected.push_back(db.queryFromSignature(signatures[q], 20));
+    }
+
+    db.reorder();
+
+    // The 200 remaining images have ids 1-200, and each post kept its image.
+    const std::vector<Image> images = db.getImages(0, 1000);
+    REQUIRE(images.size() == 200);
+    for (size_t i = 0; i < images.size(); i++) {
+      CHECK(images[i].id == static_cast<iqdbId>(i + 1));
+      CHECK(!db.isDeleted(images[i].id));
+      CHECK(images[i].post_id % 3 != 0);
+      CHECK(images[i].haar().to_string() == signatures[images[i].post_id - 1].to_string());
+    }
+
+    for (size_t q = 0, i = 0; q < signatures.size(); q += 11, i++) {
+      CHECK(same_results(db.queryFromSignature(signatures[q], 20), expected[i]));
+    }
+
+    // Nothing moves the second time.
+    db.reorder();
+    CHECK(db.getImages(0, 1000).size() == 200);
+  }
+
+  // The new ids were saved.
+  IQDB reopened(filename);
+  for (size_t q = 0, i = 0; q < signatures.size(); q += 11, i++) {
+    CHECK(same_results(reopened.queryFromSignature(signatures[q], 20), expected[i]));
+  }
+
+  for (const std::string suffix : { "", "-wal", "-shm" }) {
+    std::remove((filename + suffix).c_str());
+  }
+}
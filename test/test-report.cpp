@@ -0,0 +1,33 @@
+// Tests the latency percentiles that the benchmark tools report.
+
+#include <vector>
+
+#include <catch2/catch_test_macros.hpp>
+
+#include "../bench/report.h"
+
+using namespace iqdb::bench;
+
+TEST_CASE("Percentiles are taken from the sorted samples", "[report]") {
+  std::vector<double> samples;
+  for (int i = 1000; i >= 1; i--) {
+    samples.push_back(i);
+  }
+
+  const nlohmann::json result = percentiles(samples);
+  CHECK(result["mean"] == 500.5);
+  CHECK(result["p50"] == 501);
+  CHECK(result["p90"] == 901);
+  CHECK(result["p99"] == 991);
+  CHECK(result["p999"] == 1000);
+  CHECK(result["max"] == 1000);
+}
+
+TEST_CASE("Percentiles of a few samples stay in range", "[report]") {
+  const nlohmann::json one = percentiles({ 7 });
+  CHECK(one["p50"] == 7);
+  CHECK(one["p999"] == 7);
+  CHECK(one["max"] == 7);
+
+  CHECK(percentiles({}).empty());
+}
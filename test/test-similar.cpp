@@ -0,0 +1,104 @@
+// Tests that "more like this" queries by post id return the same matches as
+// querying with the post's signature, without the post itself.
+
+#include <algorithm>
+#include <random>
+#include <string>
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <httplib.h>
+#include <iqdb/imgdb.h>
+#include <iqdb/server.h>
+#include <nlohmann/json.hpp>
+
+#include "test-helpers.h"
+
+using namespace iqdb;
+using nlohmann::json;
+
+// The matches for a signature, without `post_id`.
+static sim_vector without(sim_vector matches, postId post_id, size_t limit) {
+  matches.erase(std::remove_if(matches.begin(), matches.end(), [&](const sim_value& match) { return match.id == post_id; }), matches.end());
+  if (matches.size() > limit)
+    matches.erase(matches.begin() + static_cast<ptrdiff_t>(limit), matches.end());
+  return matches;
+}
+
+TEST_CASE("Similar posts are the post's matches, without the post", "[similar]") {
+  std::mt19937 rng(36);
+  IQDB db;
+
+  std::vector<HaarSignature> signatures;
+  for (postId post_id = 1; post_id <= 100; post_id++) {
+    signatures.push_back(random_signature(rng, post_id % 7 == 0));
+    db.addImage(post_id, signatures.back());
+  }
+
+  // An exact copy of a post is still similar to it.
+  db.addImage(101, signatures[4]);
+
+  for (postId post_id = 1; post_id <= 100; post_id += 9) {
+    const auto similar = db.querySimilar(post_id, 5);
+    REQUIRE(similar);
+    CHECK(same_results(*similar, without(db.queryFromSignature(signatures[post_id - 1], 6), post_id, 5)));
+  }
+
+  const auto copies = db.querySimilar(5, 1);
+  REQUIRE(copies);
+  REQUIRE(copies->size() == 1);
+  CHECK((*copies)[0].id == 101);
+
+  CHECK(!db.querySimilar(1000));
+}
+
+TEST_CASE("Similar posts can be asked for one post or many", "[similar]") {
+  std::mt19937 rng(36);
+  const int port = free_port();
+
+  ServerOptions options;
+  options.max_batch = 3;
+  BackgroundServer server([&](StartedCallback started) { http_server("127.0.0.1", port, ":memory:", options, started); });
+  httplib::Client client("127.0.0.1", port);
+
+  std::vector<std::string> hashes;
+  for (postId post_id = 1; post_id <= 10; post_id++) {
+    const auto added = client.Post("/images/" + std::to_string(post_id), random_image(rng).dump(), "application/json");
+    REQUIRE(added);
+    hashes.push_back(json::parse(added->body)["hash"]);
+  }
+
+  const auto similar = client.Get("/images/4/similar?limit=3");
+  REQUIRE(similar);
+  REQUIRE(similar->status == 200);
+  const json matches = json::parse(similar->body);
+
+  const auto queried = client.Post("/query", json({ { "hash", hashes[3] }, { "limit", 4 } }).dump(), "application/json");
+  REQUIRE(queried);
+  json expected = json::array();
+  for (const json& match : json::parse(queried->body)) {
+    if (match["post_id"] != 4 && expected.size() < 3)
+      expected.push_back(match);
+  }
+
+  CHECK(matches == expected);
+
+  const auto missing = client.Get("/images/999/similar");
+  REQUIRE(missing);
+  CHECK(missing->status == 404);
+
+  const auto batch = client.Post("/images/similar", json({ { "post_ids", { 4, 999 } }, { "limit", 3 } }).dump(), "application/json");
+  REQUIRE(batch);
+  REQUIRE(batch->status == 200);
+  const json results = json::parse(batch->body);
+  REQUIRE(results.size() == 2);
+  CHECK(results[0]["post_id"] == 4);
+  CHECK(results[0]["matches"] == expected);
+  CHECK(results[1]["post_id"] == 999);
+  CHECK(results[1]["message"] == "Not found");
+
+  const auto too_many = client.Post("/images/similar", json({ { "post_ids", { 1, 2, 3, 4 } } }).dump(), "application/json");
+  REQUIRE(too_many);
+  CHECK(too_many->status != 200);
+  CHECK(json::parse(too_many->body)["message"] == "Too many post ids (max=3)");
+}
@@ -0,0 +1,126 @@
+// Tests that images keep their iqdb id when they're replaced, that renumbering
+// moves every image or none, and that a replaced image is swapped out of the
+// in-memory index.
+
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <iqdb/imgdb.h>
+#include <iqdb/sqlite_db.h>
+
+#include "test-helpers.h"
+
+using namespace iqdb;
+
+TEST_CASE("Replacing an image keeps its id", "[sqlite]") {
+  std::mt19937 rng(47);
+  SqliteDB db;
+
+  const int first = db.addImage(10, random_signature(rng));
+  const int second = db.addImage(20, random_signature(rng));
+  CHECK(first != second);
+
+  const HaarSignature signature = random_signature(rng);
+  CHECK(db.addImage(10, signature) == first);
+
+  const auto image = db.getImage(10);
+  REQUIRE(image);
+  CHECK(image->id == static_cast<iqdbId>(first));
+  CHECK(image->haar().to_string() == signature.to_string());
+
+  db.removeImage(10);
+  CHECK(!db.getImage(10));
+  CHECK(db.addImage(10, signature) > second);
+}
+
+TEST_CASE("Renumbering gives every image its new id", "[sqlite]") {
+  std::mt19937 rng(47);
+  SqliteDB db;
+
+  for (postId post_id = 1; post_id <= 5; post_id++) {
+    CHECK(static_cast<postId>(db.addImage(post_id, random_signature(rng))) == post_id);
+  }
+
+  // Reverse the order, which swaps ids that are both in use.
+  db.renumber({ { 1, 5 }, { 2, 4 }, { 3, 3 }, { 4, 2 }, { 5, 1 } });
+
+  const std::vector<Image> images = db.getImages(0, 10);
+  REQUIRE(images.size() == 5);
+  for (size_t i = 0; i < images.size(); i++) {
+    CHECK(images[i].id == static_cast<iqdbId>(i + 1));
+    CHECK(images[i].post_id == static_cast<postId>(5 - i));
+  }
+}
+
+TEST_CASE("Renumbering changes nothing if an image isn't given an id", "[sqlite]") {
+  std::mt19937 rng(47);
+  SqliteDB db;
+
+  for (postId post_id = 1; post_id <= 3; post_id++) {
+    db.addImage(post_id, random_signature(rng));
+  }
+
+  CHECK_THROWS_AS(db.renumber({ { 1, 3 }, { 3, 1 } }), std::runtime_error);
+
+  const std::vector<Image> images = db.getImages(0, 10);
+  REQUIRE(images.size() == 3);
+  for (size_t i = 0; i < images.size(); i++) {
+    CHECK(images[i].id == static_cast<iqdbId>(i + 1));
+    CHECK(images[i].post_id == static_cast<postId>(i + 1));
+  }
+
+  // The table isn't left locked by the failed transaction.
+  CHECK(db.addImage(4, random_signature(rng)) == 4);
+}
+
+TEST_CASE("A replaced image is swapped out of the index", "[sqlite]") {
+  std::mt19937 rng(47);
+  std::vector<HaarSignature> signatures;
+  for (postId post_id = 1; post_id <= 100; post_id++) {
+    signatures.push_back(random_signature(rng, post_id % 4 == 0));
+  }
+
+  // `replaced` sees each post's old signature and then a new one; `fresh`
+  // only ever sees the new ones, in the same order, so both give the same
+  // slots to the same posts.
+  IQDB replaced, fresh;
+  replaced.enableLshIndex(4);
+  fresh.enableLshIndex(4);
+  for (postId post_id = 1; post_id <= 100; post_id++) {
+    replaced.addImage(post_id, signatures[post_id - 1]);
+  }
+
+  const size_t slots = replaced.imageSlots();
+  std::vector<HaarSignature> old_signatures;
+  for (postId post_id = 1; post_id <= 100; post_id++) {
+    if (post_id % 3 == 0) {
+      old_signatures.push_back(signatures[post_id - 1]);
+      signatures[post_id - 1] = random_signature(rng, post_id % 2 == 0);
+      replaced.addImage(post_id, signatures[post_id - 1]);
+    }
+
+    fresh.addImage(post_id, signatures[post_id - 1]);
+  }
+
+  CHECK(replaced.imageSlots() == slots);
+
+  QueryOptions approximate;
+  approximate.probes = 4;
+  for (size_t q = 0; q < signatures.size(); q += 7) {
+    CHECK(same_results(replaced.queryFromSignature(signatures[q], 10), fresh.queryFromSignature(signatures[q], 10)));
+    CHECK(same_results(replaced.queryFromSignature(signatures[q], 10, approximate), fresh.queryFromSignature(signatures[q], 10, approximate)));
+  }
+
+  // Old signatures are no longer found, but the new ones are.
+  for (const HaarSignature& signature : old_signatures) {
+    CHECK(replaced.findExact(signature).empty());
+    CHECK(same_results(replaced.queryFromSignature(signature, 10), fresh.queryFromSignature(signature, 10)));
+  }
+
+  const sim_vector exact = replaced.findExact(signatures[2]);
+  REQUIRE(exact.size() == 1);
+  CHECK(exact[0].id == 3);
+}
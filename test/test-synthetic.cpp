@@ -0,0 +1,98 @@
+// Tests that the benchmarks' synthetic corpora are deterministic and made of
+// valid signatures that look like real ones.
+
+#include <algorithm>
+#include <cstdlib>
+#include <set>
+#include <vector>
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <iqdb/imgdb.h>
+
+#include "../bench/synthetic.h"
+#include "test-helpers.h"
+
+using namespace iqdb;
+using namespace iqdb::bench;
+
+// Whether each channel holds NUM_COEFS sorted coefficients, none of them the
+// DC coefficient and no index twice.
+static bool valid(const HaarSignature& signature) {
+  for (int c = 0; c < 3; c++) {
+    std::set<int> indexes;
+    for (int16_t coef : signature.sig[c]) {
+      if (coef == 0 || std::abs(coef) >= NUM_PIXELS_SQUARED || !indexes.insert(std::abs(coef)).second)
+        return false;
+    }
+
+    if (!std::is_sorted(&signature.sig[c][0], &signature.sig[c][NUM_COEFS]))
+      return false;
+  }
+
+  return true;
+}
+
+TEST_CASE("Synthetic images depend only on the seed and their number", "[synthetic]") {
+  SyntheticCorpus corpus(31), same(31), other(32);
+
+  CHECK(corpus.image(0).to_string() == same.image(0).to_string());
+  CHECK(corpus.image(12345).to_string() == same.image(12345).to_string());
+  CHECK(corpus.image(1).to_string() != corpus.image(2).to_string());
+  CHECK(corpus.image(1).to_string() != other.image(1).to_string());
+}
+
+TEST_CASE("Synthetic images are valid and look like real ones", "[synthetic]") {
+  SyntheticCorpus corpus(31);
+  const size_t images = 2000;
+
+  size_t grayscale = 0, coarse = 0;
+  for (uint64_t n = 0; n < images; n++) {
+    const HaarSignature signature = corpus.image(n);
+    REQUIRE(valid(signature));
+    grayscale += signature.is_grayscale();
+
+    // Large coefficients are mostly in the coarse levels of the transform.
+    for (int16_t coef : signature.sig[0]) {
+      coarse += std::abs(coef) / NUM_PIXELS < 16 && std::abs(coef) % NUM_PIXELS < 16;
+    }
+  }
+
+  CHECK(grayscale > images / 10);
+  CHECK(grayscale < images / 5);
+  CHECK(coarse > images * NUM_COEFS / 2);
+}
+
+TEST_CASE("Synthetic corpora have near-duplicates to find", "[synthetic]") {
+  SyntheticCorpus corpus(31, 0.2);
+  IQDB db;
+  for (uint64_t n = 0; n < 500; n++) {
+    db.addImage(static_cast<postId>(n + 1), corpus.image(n));
+  }
+
+  // Each image finds itself, and a fair share also find a near-duplicate.
+  size_t duplicates = 0;
+  for (uint64_t n = 0; n < 500; n += 5) {
+    const sim_vector matches = db.queryFromSignature(corpus.image(n), 2);
+    REQUIRE(matches.size() == 2);
+    CHECK(matches[0].id == n + 1);
+    duplicates += matches[1].score > 80;
+  }
+
+  CHECK(duplicates > 10);
+}
+
+TEST_CASE("Corpora fitted to a sample use the sample's coefficients", "[synthetic]") {
+  std::mt19937 rng(31);
+  std::vector<HaarSignature> sample;
+  for (int i = 0; i < 50; i++) {
+    sample.push_back(random_signature(rng, false, 100));
+  }
+
+  SyntheticCorpus corpus(31, sample);
+  for (uint64_t n = 0; n < 200; n++) {
+    const HaarSignature signature = corpus.image(n);
+    REQUIRE(valid(signature));
+    CHECK(std::all_of(&signature.sig[0][0], &signature.sig[2][NUM_COEFS], [](int16_t coef) { return std::abs(coef) <= 100; }));
+  }
+}
@@ -0,0 +1,134 @@
+// Tests that worker pools run their tasks and turn work away when their queue
+// is full, and that queries are abandoned once their deadline has passed.
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <httplib.h>
+#include <iqdb/imgdb.h>
+#include <iqdb/server.h>
+#include <iqdb/thread_pool.h>
+#include <nlohmann/json.hpp>
+
+#include "test-helpers.h"
+
+using namespace iqdb;
+using nlohmann::json;
+using namespace std::chrono_literals;
+
+TEST_CASE("A worker pool runs every queued task before it shuts down", "[pool]") {
+  std::atomic<int> runs = 0;
+  WorkerPool pool("test", 2, 100);
+
+  for (int i = 0; i < 100; i++) {
+    CHECK(pool.submit([&] { runs++; }));
+  }
+
+  pool.shutdown();
+  CHECK(runs == 100);
+  CHECK(!pool.submit([&] { runs++; }));
+  CHECK(runs == 100);
+}
+
+TEST_CASE("A worker pool rejects tasks when its queue is full", "[pool]") {
+  std::promise<void> release;
+  std::shared_future<void> released = release.get_future().share();
+  std::promise<void> started;
+
+  WorkerPool pool("test", 1, 2);
+  CHECK(pool.submit([&] { started.set_value(); released.wait(); }));
+  started.get_future().wait();
+
+  CHECK(pool.submit([] {}));
+  CHECK(pool.submit([] {}));
+  CHECK(!pool.submit([] {}));
+
+  CHECK(pool.activeCount() == 1);
+  CHECK(pool.queueDepth() == 2);
+  CHECK(pool.rejectedCount() == 1);
+
+  release.set_value();
+  pool.shutdown();
+  CHECK(pool.queueDepth() == 0);
+  CHECK(pool.activeCount() == 0);
+}
+
+TEST_CASE("CPU lists are parsed into CPU numbers", "[pool]") {
+  CHECK(parse_cpu_list("0-3,8,10-11") == std::vector<int> { 0, 1, 2, 3, 8, 10, 11 });
+  CHECK(parse_cpu_list("5") == std::vector<int> { 5 });
+  CHECK(parse_cpu_list("").empty());
+
+  CHECK_THROWS_AS(parse_cpu_list("3-1"), param_error);
+  CHECK_THROWS_AS(parse_cpu_list("-1"), param_error);
+  CHECK_THROWS_AS(parse_cpu_list("a"), param_error);
+  CHECK_THROWS_AS(parse_cpu_list("0-100000"), param_error);
+}
+
+TEST_CASE("Queries past their deadline are abandoned", "[pool]") {
+  std::mt19937 rng(26);
+  IQDB db;
+  for (postId post_id = 1; post_id <= 100; post_id++) {
+    db.addImage(post_id, random_signature(rng));
+  }
+
+  QueryOptions options;
+  options.deadline = Clock::now() - 1ms;
+  CHECK_THROWS_AS(db.queryFromSignature(random_signature(rng), 10, options), timeout_error);
+
+  options.deadline = Clock::now() + 1h;
+  CHECK(db.queryFromSignature(random_signature(rng), 10, options).size() == 10);
+}
+
+TEST_CASE("The server turns queries away when the query queue is full", "[pool]") {
+  std::mt19937 rng(26);
+  const int port = free_port();
+
+  // With no room in the queue, every query is turned away, but requests that
+  // don't need a query thread are still answered.
+  ServerOptions options;
+  options.query_queue = 0;
+  options.overload_status = 429;
+  BackgroundServer server([&](StartedCallback started) { http_server("127.0.0.1", port, ":memory:", options, started); });
+
+  httplib::Client client("127.0.0.1", port);
+  const auto added = client.Post("/images/1", random_image(rng).dump(), "application/json");
+  REQUIRE(added);
+  CHECK(added->status == 200);
+
+  const auto result = client.Post("/query", json({ { "hash", json::parse(added->body)["hash"] } }).dump(), "application/json");
+  REQUIRE(result);
+  CHECK(result->status == 429);
+  CHECK(result->get_header_value("Retry-After") == "1");
+
+  const auto status = client.Get("/status");
+  REQUIRE(status);
+  CHECK(status->status == 200);
+}
+
+TEST_CASE("The server limits how many matches a query returns", "[pool]") {
+  std::mt19937 rng(26);
+  const int port = free_port();
+
+  ServerOptions options;
+  options.max_limit = 3;
+  BackgroundServer server([&](StartedCallback started) { http_server("127.0.0.1", port, ":memory:", options, started); });
+
+  httplib::Client client("127.0.0.1", port);
+  std::string hash;
+  for (postId post_id = 1; post_id <= 10; post_id++) {
+    const auto added = client.Post("/images/" + std::to_string(post_id), random_image(rng).dump(), "application/json");
+    REQUIRE(added);
+    hash = json::parse(added->body)["hash"];
+  }
+
+  const auto result = client.Post("/query", json({ { "hash", hash }, { "limit", 100 } }).dump(), "application/json");
+  REQUIRE(result);
+  REQUIRE(result->status == 200);
+  CHECK(json::parse(result->body).size() == 3);
+}